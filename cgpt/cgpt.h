@@ -48,6 +48,8 @@ struct drive {
   GptData gpt;
   struct pmbr pmbr;
   int fd;       /* file descriptor */
+  uint8_t *map;       /* private mapping of a regular file, or NULL */
+  uint64_t map_size;  /* size of the mapping (in bytes) */
 };
 
 // Opens a block device or file, loads raw GPT data from it.
@@ -56,6 +58,8 @@ struct drive {
 // 'drive_path'.
 // Otherwise, 'drive_size' is taken as the size of the device that all
 // partitions will reside on, and 'drive_path' is where we store GPT structs.
+// Regular files are mapped, and the GPT buffers in 'drive->gpt' may point
+// straight into that mapping; they stay valid until DriveClose().
 //
 // Returns CGPT_FAILED if any error happens.
 // Returns CGPT_OK if success and information are stored in 'drive'. */
@@ -158,6 +162,11 @@ void SetRaw(struct drive *drive, int secondary, uint32_t entry_index,
            uint32_t raw);
 
 void UpdateAllEntries(struct drive *drive);
+// Same as UpdateAllEntries(), for when only the primary entry at 'entry_index'
+// has changed since GptValidityCheck(); 'old_entry' is its previous contents.
+// The entries CRCs are patched rather than recomputed when possible.
+void UpdateEntry(struct drive *drive, uint32_t entry_index,
+                 const GptEntry *old_entry);
 
 uint8_t RepairHeader(GptData *gpt, const uint32_t valid_headers);
 uint8_t RepairEntries(GptData *gpt, const uint32_t valid_entries);
@@ -158,6 +158,7 @@ static int CgptGetUnusedPartition(struct drive *drive, uint32_t *index,
 
 int CgptSetAttributes(CgptAddParams *params) {
   struct drive drive;
+  GptEntry backup;
 
   if (params == NULL)
     return CGPT_FAILED;
@@ -176,9 +177,11 @@ int CgptSetAttributes(CgptAddParams *params) {
     goto bad;
   }
 
+  memcpy(&backup, GetEntry(&drive.gpt, PRIMARY, params->partition - 1),
+         sizeof(backup));
   SetEntryAttributes(&drive, params->partition - 1, params);
 
-  UpdateAllEntries(&drive);
+  UpdateEntry(&drive, params->partition - 1, &backup);
 
   // Write it all out.
   return DriveClose(&drive, 1);
@@ -265,7 +268,7 @@ static int GptAdd(struct drive *drive, CgptAddParams *params, uint32_t index) {
     return -1;
   }
 
-  UpdateAllEntries(drive);
+  UpdateEntry(drive, index, &backup);
 
   rv = CheckEntries((GptEntry*)drive->gpt.primary_entries,
                     (GptHeader*)drive->gpt.primary_header);
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -76,6 +77,101 @@ int CheckValid(const struct drive *drive) {
   return CGPT_OK;
 }
 
+static int RangesOverlap(uint64_t a, uint64_t a_size,
+                         uint64_t b, uint64_t b_size) {
+  return a < b + b_size && b < a + a_size;
+}
+
+/* Returns non-zero if 'buf' points into the private mapping of the drive. */
+static int IsAliased(const struct drive *drive, const uint8_t *buf) {
+  return drive->map && buf >= drive->map && buf < drive->map + drive->map_size;
+}
+
+/*
+ * Returns the address of the i-th GPT buffer (primary/secondary header,
+ * primary/secondary entries) and stores its allocation size in 'size'.
+ */
+static uint8_t **GptBuffer(struct drive *drive, int i, uint64_t *size) {
+  switch (i) {
+  case 0:
+    *size = drive->gpt.sector_bytes * GPT_HEADER_SECTORS;
+    return &drive->gpt.primary_header;
+  case 1:
+    *size = drive->gpt.sector_bytes * GPT_HEADER_SECTORS;
+    return &drive->gpt.secondary_header;
+  case 2:
+    *size = GPT_ENTRIES_ALLOC_SIZE;
+    return &drive->gpt.primary_entries;
+  default:
+    *size = GPT_ENTRIES_ALLOC_SIZE;
+    return &drive->gpt.secondary_entries;
+  }
+}
+
+#define GPT_BUFFER_COUNT 4
+
+/*
+ * Returns a pointer to 'size' bytes of the mapping at 'offset', or NULL if
+ * the range is not backed by the file or overlaps another aliased buffer.
+ */
+static uint8_t *MapAlias(struct drive *drive, uint64_t offset, uint64_t size) {
+  int i;
+
+  if (!drive->map || offset > drive->map_size ||
+      size > drive->map_size - offset)
+    return NULL;
+
+  for (i = 0; i < GPT_BUFFER_COUNT; i++) {
+    uint64_t buf_size;
+    uint8_t *buf = *GptBuffer(drive, i, &buf_size);
+    if (IsAliased(drive, buf) &&
+        RangesOverlap(buf - drive->map, buf_size, offset, size))
+      return NULL;
+  }
+  return drive->map + offset;
+}
+
+/*
+ * Before writing 'size' bytes at 'offset' of the file, move every aliased GPT
+ * buffer whose backing pages overlap that range into its own heap copy, so
+ * the write cannot change what the buffers read through the mapping. The
+ * buffer being written in place from '*buf' is left alone; if it has to move,
+ * '*buf' is updated to point at the copy.
+ *
+ * Returns CGPT_OK on success, CGPT_FAILED if a copy cannot be allocated.
+ */
+static int UnaliasRange(struct drive *drive, uint64_t offset, uint64_t size,
+                        const uint8_t **buf) {
+  const uint8_t *src = buf ? *buf : NULL;
+  int i;
+
+  if (!drive->map)
+    return CGPT_OK;
+
+  for (i = 0; i < GPT_BUFFER_COUNT; i++) {
+    uint64_t buf_size;
+    uint8_t **ptr = GptBuffer(drive, i, &buf_size);
+    uint8_t *copy;
+
+    if (!IsAliased(drive, *ptr) ||
+        !RangesOverlap(*ptr - drive->map, buf_size, offset, size))
+      continue;
+    if (src == *ptr && (uint64_t)(*ptr - drive->map) == offset)
+      continue;
+
+    copy = malloc(buf_size);
+    if (!copy) {
+      Error("Cannot allocate %" PRIu64 " bytes.\n", buf_size);
+      return CGPT_FAILED;
+    }
+    memcpy(copy, *ptr, buf_size);
+    if (src >= *ptr && src < *ptr + buf_size)
+      *buf = copy + (src - *ptr);
+    *ptr = copy;
+  }
+  return CGPT_OK;
+}
+
 int Load(struct drive *drive, uint8_t *buf,
                 const uint64_t sector,
                 const uint64_t sector_bytes,
@@ -97,6 +193,12 @@ int Load(struct drive *drive, uint8_t *buf,
   }
   count = sector_bytes * sector_count;
 
+  if (drive->map && sector < drive->map_size / sector_bytes &&
+      count <= drive->map_size - sector * sector_bytes) {
+    memcpy(buf, drive->map + sector * sector_bytes, count);
+    return CGPT_OK;
+  }
+
   if (-1 == lseek(drive->fd, sector * sector_bytes, SEEK_SET)) {
     Error("Can't seek: %s\n", strerror(errno));
     return CGPT_FAILED;
@@ -113,6 +215,11 @@ int Load(struct drive *drive, uint8_t *buf,
 
 
 int ReadPMBR(struct drive *drive) {
+  if (drive->map && drive->map_size >= sizeof(struct pmbr)) {
+    memcpy(&drive->pmbr, drive->map, sizeof(struct pmbr));
+    return CGPT_OK;
+  }
+
   if (-1 == lseek(drive->fd, 0, SEEK_SET))
     return CGPT_FAILED;
 
@@ -124,6 +231,9 @@ int ReadPMBR(struct drive *drive) {
 }
 
 int WritePMBR(struct drive *drive) {
+  if (CGPT_OK != UnaliasRange(drive, 0, sizeof(struct pmbr), NULL))
+    return CGPT_FAILED;
+
   if (-1 == lseek(drive->fd, 0, SEEK_SET))
     return CGPT_FAILED;
 
@@ -144,6 +254,9 @@ int Save(struct drive *drive, const uint8_t *buf,
   require(buf);
   count = sector_bytes * sector_count;
 
+  if (CGPT_OK != UnaliasRange(drive, sector * sector_bytes, count, &buf))
+    return CGPT_FAILED;
+
   if (-1 == lseek(drive->fd, sector * sector_bytes, SEEK_SET))
     return CGPT_FAILED;
 
@@ -154,6 +267,30 @@ int Save(struct drive *drive, const uint8_t *buf,
   return CGPT_OK;
 }
 
+/*
+ * Points '*buf' at 'sector_count' sectors starting at 'sector'. For mapped
+ * drives the buffer aliases the mapping directly when the whole 'alloc_size'
+ * range is backed by the file; otherwise it is allocated and read.
+ */
+static int LoadBuffer(struct drive *drive, uint8_t **buf, uint64_t sector,
+                      uint64_t sector_count, uint64_t alloc_size) {
+  uint64_t sector_bytes = drive->gpt.sector_bytes;
+
+  if (sector_count && sector_count <= alloc_size / sector_bytes &&
+      sector < drive->map_size / sector_bytes) {
+    uint8_t *alias = MapAlias(drive, sector * sector_bytes, alloc_size);
+    if (alias) {
+      *buf = alias;
+      return CGPT_OK;
+    }
+  }
+
+  *buf = malloc(alloc_size);
+  if (!*buf)
+    return CGPT_FAILED;
+  return Load(drive, *buf, sector, sector_bytes, sector_count);
+}
+
 static int GptLoad(struct drive *drive, uint32_t sector_bytes) {
   drive->gpt.sector_bytes = sector_bytes;
   if (drive->size % drive->gpt.sector_bytes) {
@@ -163,29 +300,21 @@ static int GptLoad(struct drive *drive, uint32_t sector_bytes) {
   }
   drive->gpt.streaming_drive_sectors = drive->size / drive->gpt.sector_bytes;
 
-  drive->gpt.primary_header = malloc(drive->gpt.sector_bytes);
-  drive->gpt.secondary_header = malloc(drive->gpt.sector_bytes);
-  drive->gpt.primary_entries = malloc(GPT_ENTRIES_ALLOC_SIZE);
-  drive->gpt.secondary_entries = malloc(GPT_ENTRIES_ALLOC_SIZE);
-  if (!drive->gpt.primary_header || !drive->gpt.secondary_header ||
-      !drive->gpt.primary_entries || !drive->gpt.secondary_entries)
-    return -1;
-
   /* TODO(namnguyen): Remove this and totally trust gpt_drive_sectors. */
   if (!(drive->gpt.flags & GPT_FLAG_EXTERNAL)) {
     drive->gpt.gpt_drive_sectors = drive->gpt.streaming_drive_sectors;
   } /* Else, we trust gpt.gpt_drive_sectors. */
 
   // Read the data.
-  if (CGPT_OK != Load(drive, drive->gpt.primary_header,
-                      GPT_PMBR_SECTORS,
-                      drive->gpt.sector_bytes, GPT_HEADER_SECTORS)) {
+  if (CGPT_OK != LoadBuffer(drive, &drive->gpt.primary_header,
+                            GPT_PMBR_SECTORS, GPT_HEADER_SECTORS,
+                            drive->gpt.sector_bytes)) {
     Error("Cannot read primary GPT header\n");
     return -1;
   }
-  if (CGPT_OK != Load(drive, drive->gpt.secondary_header,
-                      drive->gpt.gpt_drive_sectors - GPT_PMBR_SECTORS,
-                      drive->gpt.sector_bytes, GPT_HEADER_SECTORS)) {
+  if (CGPT_OK != LoadBuffer(drive, &drive->gpt.secondary_header,
+                            drive->gpt.gpt_drive_sectors - GPT_PMBR_SECTORS,
+                            GPT_HEADER_SECTORS, drive->gpt.sector_bytes)) {
     Error("Cannot read secondary GPT header\n");
     return -1;
   }
@@ -194,11 +323,11 @@ static int GptLoad(struct drive *drive, uint32_t sector_bytes) {
                   drive->gpt.gpt_drive_sectors,
                   drive->gpt.flags,
                   drive->gpt.sector_bytes) == 0) {
-    if (CGPT_OK != Load(drive, drive->gpt.primary_entries,
-                        primary_header->entries_lba,
-                        drive->gpt.sector_bytes,
-                        CalculateEntriesSectors(primary_header,
-                          drive->gpt.sector_bytes))) {
+    if (CGPT_OK != LoadBuffer(drive, &drive->gpt.primary_entries,
+                              primary_header->entries_lba,
+                              CalculateEntriesSectors(primary_header,
+                                drive->gpt.sector_bytes),
+                              GPT_ENTRIES_ALLOC_SIZE)) {
       Error("Cannot read primary partition entry array\n");
       return -1;
     }
@@ -206,17 +335,20 @@ static int GptLoad(struct drive *drive, uint32_t sector_bytes) {
     Warning("Primary GPT header is %s\n",
       memcmp(primary_header->signature, GPT_HEADER_SIGNATURE_IGNORED,
              GPT_HEADER_SIGNATURE_SIZE) ? "invalid" : "being ignored");
+    drive->gpt.primary_entries = malloc(GPT_ENTRIES_ALLOC_SIZE);
+    if (!drive->gpt.primary_entries)
+      return -1;
   }
   GptHeader* secondary_header = (GptHeader*)drive->gpt.secondary_header;
   if (CheckHeader(secondary_header, 1, drive->gpt.streaming_drive_sectors,
                   drive->gpt.gpt_drive_sectors,
                   drive->gpt.flags,
                   drive->gpt.sector_bytes) == 0) {
-    if (CGPT_OK != Load(drive, drive->gpt.secondary_entries,
-                        secondary_header->entries_lba,
-                        drive->gpt.sector_bytes,
-                        CalculateEntriesSectors(secondary_header,
-                          drive->gpt.sector_bytes))) {
+    if (CGPT_OK != LoadBuffer(drive, &drive->gpt.secondary_entries,
+                              secondary_header->entries_lba,
+                              CalculateEntriesSectors(secondary_header,
+                                drive->gpt.sector_bytes),
+                              GPT_ENTRIES_ALLOC_SIZE)) {
       Error("Cannot read secondary partition entry array\n");
       return -1;
     }
@@ -224,6 +356,9 @@ static int GptLoad(struct drive *drive, uint32_t sector_bytes) {
     Warning("Secondary GPT header is %s\n",
       memcmp(primary_header->signature, GPT_HEADER_SIGNATURE_IGNORED,
              GPT_HEADER_SIGNATURE_SIZE) ? "invalid" : "being ignored");
+    drive->gpt.secondary_entries = malloc(GPT_ENTRIES_ALLOC_SIZE);
+    if (!drive->gpt.secondary_entries)
+      return -1;
   }
   return 0;
 }
@@ -314,6 +449,29 @@ static int ObtainDriveSize(int fd, uint64_t* size, uint32_t* sector_bytes) {
   return 0;
 }
 
+/*
+ * Maps a regular file privately so GptLoad() can alias the GPT buffers to the
+ * page cache instead of reading them. The mapping is copy-on-write: changes
+ * only reach the file through Save(), exactly as with the read/write path.
+ * Block devices, and files that cannot be mapped, keep using read/write.
+ */
+static void MapDrive(struct drive *drive) {
+  struct stat stat;
+  void *map;
+
+  if (fstat(drive->fd, &stat) == -1 || !S_ISREG(stat.st_mode) ||
+      stat.st_size <= 0 || (uint64_t)stat.st_size > SIZE_MAX)
+    return;
+
+  map = mmap(NULL, stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+             drive->fd, 0);
+  if (map == MAP_FAILED)
+    return;
+
+  drive->map = map;
+  drive->map_size = stat.st_size;
+}
+
 int DriveOpen(const char *drive_path, struct drive *drive, int mode,
               uint64_t drive_size) {
   uint32_t sector_bytes;
@@ -350,6 +508,7 @@ int DriveOpen(const char *drive_path, struct drive *drive, int mode,
     drive->gpt.flags = GPT_FLAG_EXTERNAL;
   }
 
+  MapDrive(drive);
 
   if (GptLoad(drive, sector_bytes)) {
     goto error_close;
@@ -366,6 +525,7 @@ error_close:
 
 int DriveClose(struct drive *drive, int update_as_needed) {
   int errors = 0;
+  int i;
 
   if (update_as_needed) {
     if (GptSave(drive)) {
@@ -373,14 +533,19 @@ int DriveClose(struct drive *drive, int update_as_needed) {
     }
   }
 
-  free(drive->gpt.primary_header);
-  drive->gpt.primary_header = NULL;
-  free(drive->gpt.primary_entries);
-  drive->gpt.primary_entries = NULL;
-  free(drive->gpt.secondary_header);
-  drive->gpt.secondary_header = NULL;
-  free(drive->gpt.secondary_entries);
-  drive->gpt.secondary_entries = NULL;
+  for (i = 0; i < GPT_BUFFER_COUNT; i++) {
+    uint64_t size;
+    uint8_t **buf = GptBuffer(drive, i, &size);
+    if (!IsAliased(drive, *buf))
+      free(*buf);
+    *buf = NULL;
+  }
+
+  if (drive->map) {
+    munmap(drive->map, drive->map_size);
+    drive->map = NULL;
+    drive->map_size = 0;
+  }
 
   // Sync early! Only sync file descriptor here, and leave the whole system sync
   // outside cgpt because whole system sync would trigger tons of disk accesses
@@ -860,6 +1025,11 @@ void SetRaw(struct drive *drive, int secondary, uint32_t entry_index,
   entry->attrs.fields.gpt_att = (uint16_t)raw;
 }
 
+static void UpdateHeaderCrc(GptHeader *header) {
+  header->header_crc32 = 0;
+  header->header_crc32 = Crc32((const uint8_t *)header, sizeof(GptHeader));
+}
+
 void UpdateAllEntries(struct drive *drive) {
   RepairEntries(&drive->gpt, MASK_PRIMARY);
   RepairHeader(&drive->gpt, MASK_PRIMARY);
@@ -869,6 +1039,48 @@ void UpdateAllEntries(struct drive *drive) {
   UpdateCrc(&drive->gpt);
 }
 
+void UpdateEntry(struct drive *drive, uint32_t index,
+                 const GptEntry *old_entry) {
+  GptData *gpt = &drive->gpt;
+  GptHeader *primary_header = (GptHeader *)gpt->primary_header;
+  GptHeader *secondary_header = (GptHeader *)gpt->secondary_header;
+  uint32_t entries_size, offset, entries_crc32;
+
+  /*
+   * The entries CRC can only be patched when it is known to match the primary
+   * entries (as established by GptValidityCheck()) and nothing else has been
+   * changed since. Alternate-signature GPTs don't sync their entries, so
+   * UpdateCrc() has to handle them.
+   */
+  if (gpt->modified ||
+      !(gpt->valid_headers & MASK_PRIMARY) ||
+      !(gpt->valid_entries & MASK_PRIMARY) ||
+      index >= primary_header->number_of_entries ||
+      !memcmp(primary_header->signature, GPT_HEADER_SIGNATURE2,
+              GPT_HEADER_SIGNATURE_SIZE)) {
+    UpdateAllEntries(drive);
+    return;
+  }
+
+  entries_size = primary_header->size_of_entry *
+      primary_header->number_of_entries;
+  offset = index * primary_header->size_of_entry;
+  entries_crc32 = Crc32Patch(primary_header->entries_crc32, old_entry,
+                             GetEntry(gpt, PRIMARY, index), sizeof(GptEntry),
+                             entries_size - offset - sizeof(GptEntry));
+
+  RepairEntries(gpt, MASK_PRIMARY);
+  RepairHeader(gpt, MASK_PRIMARY);
+  gpt->modified |= (GPT_MODIFIED_HEADER1 | GPT_MODIFIED_ENTRIES1 |
+                    GPT_MODIFIED_HEADER2 | GPT_MODIFIED_ENTRIES2);
+
+  // Both entry arrays are identical now, so they share the patched CRC.
+  primary_header->entries_crc32 = entries_crc32;
+  secondary_header->entries_crc32 = entries_crc32;
+  UpdateHeaderCrc(primary_header);
+  UpdateHeaderCrc(secondary_header);
+}
+
 int IsUnused(struct drive *drive, int secondary, uint32_t index) {
   GptEntry *entry;
   entry = GetEntry(&drive->gpt, secondary, index);
@@ -919,16 +1131,10 @@ void UpdateCrc(GptData *gpt) {
     secondary_header->entries_crc32 =
         Crc32(gpt->secondary_entries, entries_size);
   }
-  if (gpt->modified & GPT_MODIFIED_HEADER1) {
-    primary_header->header_crc32 = 0;
-    primary_header->header_crc32 = Crc32(
-        (const uint8_t *)primary_header, sizeof(GptHeader));
-  }
-  if (gpt->modified & GPT_MODIFIED_HEADER2) {
-    secondary_header->header_crc32 = 0;
-    secondary_header->header_crc32 = Crc32(
-        (const uint8_t *)secondary_header, sizeof(GptHeader));
-  }
+  if (gpt->modified & GPT_MODIFIED_HEADER1)
+    UpdateHeaderCrc(primary_header);
+  if (gpt->modified & GPT_MODIFIED_HEADER2)
+    UpdateHeaderCrc(secondary_header);
 }
 /* Two headers are NOT bitwise identical. For example, my_lba pointers to header
  * itself so that my_lba in primary and secondary is definitely different.
@@ -12,6 +12,7 @@
 #include "cgpt.h"
 #include "cgptlib_internal.h"
 #include "cgpt_nor.h"
+#include "host_misc.h"
 #include "vboot_host.h"
 
 #define BUFSIZE 1024
@@ -248,19 +249,23 @@ static int scan_spi_gpt(CgptFindParams *params) {
         perror("Cannot create a temporary directory.\n");
         goto cleanup;
       }
-      if (ReadNorFlash(temp_dir) != 0) {
+      struct nor_gpt nor;
+      if (ReadNorFlash(&nor) != 0) {
         perror("ReadNorFlash");
         RemoveDir(temp_dir);
         goto cleanup;
       }
       char nor_file[64];
-      if (snprintf(nor_file, sizeof(nor_file), "%s/rw_gpt", temp_dir) > 0) {
+      if (snprintf(nor_file, sizeof(nor_file), "%s/rw_gpt", temp_dir) > 0 &&
+          vb2_write_file(nor_file, nor.image.data + nor.offset,
+                         nor.size) == VB2_SUCCESS) {
         params->show_fn = chromeos_mtd_show;
         if (do_search(params, nor_file)) {
           found++;
         }
         params->show_fn = NULL;
       }
+      FreeNorFlash(&nor);
       RemoveDir(temp_dir);
       break;
     }
@@ -2,13 +2,18 @@
  * Use of this source code is governed by a BSD-style license that can be
  * found in the LICENSE file.
  *
- * This module provides some utility functions to use "flashrom" to read from
+ * This module provides some utility functions to use libflashrom to read from
  * and write to NOR flash.
  */
 
 #ifndef VBOOT_REFERENCE_CGPT_NOR_H_
 #define VBOOT_REFERENCE_CGPT_NOR_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "flashrom.h"
+
 // Obtain the MTD size from its sysfs node. |mtd_device| should point to
 // a dev node such as /dev/mtd0. This function returns 0 on success.
 int GetMtdSize(const char *mtd_device, uint64_t *size);
@@ -17,16 +22,26 @@ int GetMtdSize(const char *mtd_device, uint64_t *size);
 // must be terminated with a NULL element as is required by execv().
 int ForkExecV(const char *cwd, const char *const argv[]);
 
-// Similar to ForkExecV but with a vararg instead of an array of pointers.
-int ForkExecL(const char *cwd, const char *cmd, ...);
-
 // Exec "rm" to remove |dir|.
 int RemoveDir(const char *dir);
 
-// Read RW_GPT from NOR flash to "rw_gpt" in dir.
-int ReadNorFlash(const char *dir);
+// The RW_GPT section read from NOR flash.
+struct nor_gpt {
+  struct firmware_image image;  // whole-flash buffer, only RW_GPT is read
+  uint32_t offset;              // offset of RW_GPT in |image|
+  uint32_t size;                // size of RW_GPT
+};
+
+// Read RW_GPT from NOR flash into |gpt|. Returns 0 on success, in which case
+// the caller must release |gpt| with FreeNorFlash().
+int ReadNorFlash(struct nor_gpt *gpt);
+
+// Write |rw_gpt| (the new contents of the |gpt->size| bytes of RW_GPT) back
+// to NOR flash. We write it in two parts for safety, and only the blocks that
+// differ from |gpt| are rewritten. Returns 0 on success.
+int WriteNorFlash(const struct nor_gpt *gpt, const uint8_t *rw_gpt);
 
-// Write "rw_gpt" back to NOR flash. We write the file in two parts for safety.
-int WriteNorFlash(const char *dir);
+// Release the buffers held by |gpt|.
+void FreeNorFlash(struct nor_gpt *gpt);
 
 #endif  /* VBOOT_REFERENCE_CGPT_NOR_H_ */
@@ -27,11 +27,10 @@
 #include <unistd.h>
 
 #include "2common.h"
-#include "2sha.h"
 #include "2sysincludes.h"
 #include "cgpt.h"
 #include "cgpt_nor.h"
-#include "file_keys.h"
+#include "host_misc.h"
 
 // Check if cmdline |argv| has "-D". "-D" signifies that GPT structs are stored
 // off device, and hence we should not wrap around cgpt.
@@ -75,27 +74,28 @@ static const char *find_mtd_device(int argc, const char *const argv[]) {
 static int wrap_cgpt(int argc,
                      const char *const argv[],
                      const char *mtd_device) {
-  uint8_t original_hash[VB2_SHA1_DIGEST_SIZE];
-  uint8_t modified_hash[VB2_SHA1_DIGEST_SIZE];
+  struct nor_gpt nor;
+  uint8_t *rw_gpt = NULL;
+  uint32_t rw_gpt_size = 0;
   int ret = 0;
 
   // Create a temp dir to work in.
   ret++;
   char temp_dir[] = "/tmp/cgpt_wrapper.XXXXXX";
-  if (mkdtemp(temp_dir_template) == NULL) {
+  if (mkdtemp(temp_dir) == NULL) {
     Error("Cannot create a temporary directory.\n");
     return ret;
   }
-  if (ReadNorFlash(temp_dir) != 0) {
-    goto cleanup;
+  if (ReadNorFlash(&nor) != 0) {
+    goto cleanup_dir;
   }
   char rw_gpt_path[PATH_MAX];
   if (snprintf(rw_gpt_path, sizeof(rw_gpt_path), "%s/rw_gpt", temp_dir) < 0) {
     goto cleanup;
   }
-  if (VB2_SUCCESS != DigestFile(rw_gpt_path, VB2_HASH_SHA1,
-				original_hash, sizeof(original_hash))) {
-    Error("Cannot compute original GPT digest.\n");
+  if (VB2_SUCCESS != vb2_write_file(rw_gpt_path, nor.image.data + nor.offset,
+                                    nor.size)) {
+    Error("Cannot write %s.\n", rw_gpt_path);
     goto cleanup;
   }
 
@@ -140,18 +140,23 @@ static int wrap_cgpt(int argc,
     goto cleanup;
   }
 
-  // Write back "rw_gpt" to NOR flash in two chunks.
+  // Write back "rw_gpt" to NOR flash in two chunks, if it was modified.
   ret++;
-  if (VB2_SUCCESS == DigestFile(rw_gpt_path, VB2_HASH_SHA1,
-				modified_hash, sizeof(modified_hash))) {
-    if (memcmp(original_hash, modified_hash, VB2_SHA1_DIGEST_SIZE) != 0) {
-      ret = WriteNorFlash(temp_dir);
-    } else {
-      ret = 0;
-    }
+  if (VB2_SUCCESS != vb2_read_file(rw_gpt_path, &rw_gpt, &rw_gpt_size) ||
+      rw_gpt_size != nor.size) {
+    Error("Cannot read back %s.\n", rw_gpt_path);
+    goto cleanup;
+  }
+  if (memcmp(nor.image.data + nor.offset, rw_gpt, nor.size) != 0) {
+    ret = WriteNorFlash(&nor, rw_gpt);
+  } else {
+    ret = 0;
   }
 
 cleanup:
+  free(rw_gpt);
+  FreeNorFlash(&nor);
+cleanup_dir:
   RemoveDir(temp_dir);
   return ret;
 }
@@ -635,6 +635,8 @@ vb2_error_t vb2api_load_kernel(struct vb2_context *ctx,
 	gpt.gpt_drive_sectors = disk_info->lba_count;
 	gpt.flags = disk_info->flags & VB2_DISK_FLAG_EXTERNAL_GPT
 			? GPT_FLAG_EXTERNAL : 0;
+	if (disk_info->flags & VB2_DISK_FLAG_DEFER_SECONDARY_GPT)
+		gpt.flags |= GPT_FLAG_DEFER_SECONDARY;
 	if (AllocAndReadGptData(disk_info->handle, &gpt)) {
 		VB2_DEBUG("Unable to read GPT data\n");
 		goto gpt_done;
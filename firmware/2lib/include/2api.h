@@ -632,6 +632,13 @@ struct vb2_kernel_params {
  */
 #define VB2_DISK_FLAG_EXTERNAL_GPT (1 << 16)
 
+/*
+ * Only validate the secondary GPT if the primary one is invalid.  The
+ * secondary GPT is then not repaired until the primary fails or the GPT is
+ * modified, but it saves checking it on every boot.
+ */
+#define VB2_DISK_FLAG_DEFER_SECONDARY_GPT (1 << 17)
+
 /* Information on a single disk. */
 struct vb2_disk_info {
 	/* Disk handle. */
@@ -849,6 +849,9 @@ enum vb2_return_code {
 	/* cbfstool exited with failure status */
 	VB2_ERROR_CBFSTOOL,
 
+	/* File not found in a well-formed CBFS by cbfs_find_file() */
+	VB2_ERROR_CBFS_FILE_NOT_FOUND,
+
 	/**********************************************************************
 	 * Errors generated by host library key functions
 	 */
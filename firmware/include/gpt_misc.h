@@ -68,6 +68,12 @@ enum {
 
 /* If this bit is 1, the GPT is stored in another from the streaming data */
 #define GPT_FLAG_EXTERNAL	0x1
+/*
+ * If this bit is 1, only validate the secondary GPT when the primary one is
+ * invalid.  A good primary GPT is copied over the secondary whenever the GPT
+ * is modified, so this saves the secondary checks on every boot.
+ */
+#define GPT_FLAG_DEFER_SECONDARY	0x2
 
 /*
  * A note about stored_on_device and gpt_drive_sectors:
@@ -118,11 +118,14 @@ int GptNextKernelEntry(GptData *gpt, uint64_t *start_sector, uint64_t *size)
  */
 int GptUpdateKernelWithEntry(GptData *gpt, GptEntry *e, uint32_t update_type)
 {
+	GptEntry old;
 	int modified = 0;
 
 	if (!IsKernelEntry(e))
 		return GPT_ERROR_INVALID_UPDATE_TYPE;
 
+	memcpy(&old, e, sizeof(old));
+
 	switch (update_type) {
 	case GPT_UPDATE_ENTRY_TRY: {
 		/* Used up a try */
@@ -184,7 +187,7 @@ int GptUpdateKernelWithEntry(GptData *gpt, GptEntry *e, uint32_t update_type)
 	}
 
 	if (modified) {
-		GptModified(gpt);
+		GptEntryModified(gpt, e, &old);
 	}
 
 	return GPT_SUCCESS;
@@ -245,6 +245,7 @@ int GptValidityCheck(GptData *gpt)
 	GptEntry *entries1 = (GptEntry *)(gpt->primary_entries);
 	GptEntry *entries2 = (GptEntry *)(gpt->secondary_entries);
 	GptHeader *goodhdr = NULL;
+	int entries_same;
 
 	gpt->valid_headers = 0;
 	gpt->valid_entries = 0;
@@ -266,15 +267,44 @@ int GptValidityCheck(GptData *gpt)
 		   GPT_HEADER_SIGNATURE_IGNORED, GPT_HEADER_SIGNATURE_SIZE)) {
 		gpt->ignored |= MASK_PRIMARY;
 	}
+
+	/*
+	 * If the caller asked for it, don't look any further at the secondary
+	 * GPT as long as the primary one is good; it gets rewritten from the
+	 * primary the next time the GPT is modified.  It is only examined
+	 * when the primary fails.
+	 */
+	if ((gpt->flags & GPT_FLAG_DEFER_SECONDARY) &&
+	    MASK_PRIMARY == gpt->valid_headers &&
+	    MASK_PRIMARY == gpt->valid_entries &&
+	    header2 && entries2 && memcmp(header2->signature,
+		GPT_HEADER_SIGNATURE_IGNORED, GPT_HEADER_SIGNATURE_SIZE)) {
+		gpt->valid_headers = MASK_BOTH;
+		gpt->valid_entries = MASK_BOTH;
+		return GPT_SUCCESS;
+	}
+
 	if (0 == CheckHeader(header2, 1, gpt->streaming_drive_sectors,
 			     gpt->gpt_drive_sectors, gpt->flags,
 			     gpt->sector_bytes)) {
 		gpt->valid_headers |= MASK_SECONDARY;
 		if (!goodhdr)
 			goodhdr = header2;
-		/* Check header1+entries2 if it was good, to catch mismatch. */
-		if (0 == CheckEntries(entries2, goodhdr))
+		/*
+		 * Check header1+entries2 if it was good, to catch mismatch.
+		 * Usually the entries are identical to the ones checked
+		 * above, so just reuse that result.
+		 */
+		entries_same = goodhdr == header1 && entries1 && entries2 &&
+			!memcmp(entries1, entries2,
+				goodhdr->size_of_entry *
+				goodhdr->number_of_entries);
+		if (entries_same) {
+			if (gpt->valid_entries & MASK_PRIMARY)
+				gpt->valid_entries |= MASK_SECONDARY;
+		} else if (0 == CheckEntries(entries2, goodhdr)) {
 			gpt->valid_entries |= MASK_SECONDARY;
+		}
 	} else if (header2 && !memcmp(header2->signature,
 		   GPT_HEADER_SIGNATURE_IGNORED, GPT_HEADER_SIGNATURE_SIZE)) {
 		gpt->ignored |= MASK_SECONDARY;
@@ -459,13 +489,11 @@ void GetCurrentKernelUniqueGuid(GptData *gpt, void *dest)
 	memcpy(dest, &e->unique, sizeof(Guid));
 }
 
-void GptModified(GptData *gpt) {
+/* Propagate a modified primary header to the secondary copy of the GPT. */
+static void GptPropagate(GptData *gpt)
+{
 	GptHeader *header = (GptHeader *)gpt->primary_header;
 
-	/* Update the CRCs */
-	header->entries_crc32 = Crc32(gpt->primary_entries,
-				      header->size_of_entry *
-				      header->number_of_entries);
 	header->header_crc32 = HeaderCrc(header);
 	gpt->modified |= GPT_MODIFIED_HEADER1 | GPT_MODIFIED_ENTRIES1;
 
@@ -479,6 +507,43 @@ void GptModified(GptData *gpt) {
 	GptRepair(gpt);
 }
 
+void GptModified(GptData *gpt) {
+	GptHeader *header = (GptHeader *)gpt->primary_header;
+
+	/* Update the CRCs */
+	header->entries_crc32 = Crc32(gpt->primary_entries,
+				      header->size_of_entry *
+				      header->number_of_entries);
+	GptPropagate(gpt);
+}
+
+void GptEntryModified(GptData *gpt, const GptEntry *e, const GptEntry *old)
+{
+	GptHeader *header = (GptHeader *)gpt->primary_header;
+	const uint8_t *entry = (const uint8_t *)e;
+	uint32_t entries_size = header->size_of_entry *
+				header->number_of_entries;
+	uint32_t offset = entry - gpt->primary_entries;
+
+	/*
+	 * The entries CRC can only be patched if it currently matches the
+	 * primary entries, which GptValidityCheck() established.
+	 */
+	if (!(gpt->valid_headers & MASK_PRIMARY) ||
+	    !(gpt->valid_entries & MASK_PRIMARY) ||
+	    entry < gpt->primary_entries ||
+	    entry + sizeof(GptEntry) > gpt->primary_entries + entries_size ||
+	    offset % header->size_of_entry) {
+		GptModified(gpt);
+		return;
+	}
+
+	header->entries_crc32 = Crc32Patch(header->entries_crc32, old, e,
+					   sizeof(GptEntry), entries_size -
+					   offset - sizeof(GptEntry));
+	GptPropagate(gpt);
+}
+
 
 const char *GptErrorText(int error_code)
 {
@@ -109,3 +109,62 @@ uint32_t Crc32(const void *buffer, uint32_t len)
 		value = crc32_tab[(value ^ byte[i]) & 0xff] ^ (value >> 8);
 	return value ^ ~0U;
 }
+
+/* x^(2^n) modulo the CRC polynomial, in the same bit-reversed notation. */
+static const uint32_t x2n_tab[32] = {
+	0x40000000U, 0x20000000U, 0x08000000U, 0x00800000U, 0x00008000U,
+	0xedb88320U, 0xb1e6b092U, 0xa06a2517U, 0xed627daeU, 0x88d14467U,
+	0xd7bbfe6aU, 0xec447f11U, 0x8e7ea170U, 0x6427800eU, 0x4d47bae0U,
+	0x09fe548fU, 0x83852d0fU, 0x30362f1aU, 0x7b5a9cc3U, 0x31fec169U,
+	0x9fec022aU, 0x6c8dedc4U, 0x15d6874dU, 0x5fde7a4eU, 0xbad90e37U,
+	0x2e4e5eefU, 0x4eaba214U, 0xa8a472c0U, 0x429a969eU, 0x148d302aU,
+	0xc40ba6d0U, 0xc4e22c3cU
+};
+
+/* Return a * b modulo the CRC polynomial. */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = 1U << 31;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ 0xedb88320U : b >> 1;
+	}
+	return p;
+}
+
+/*
+ * CRC32 is linear: for two messages of the same length,
+ * Crc32(A) ^ Crc32(B) is the CRC (with zero initial value and no final
+ * inversion) of A ^ B. The difference is zero outside the changed bytes, so
+ * only those bytes need to be fed through the table, and the trailing
+ * unchanged bytes are accounted for by multiplying with x^(8 * trailing_len),
+ * which takes O(log(trailing_len)) steps.
+ */
+uint32_t Crc32Patch(uint32_t crc, const void *old_data, const void *new_data,
+		    uint32_t len, uint32_t trailing_len)
+{
+	const uint8_t *old_byte = (const uint8_t *)old_data;
+	const uint8_t *new_byte = (const uint8_t *)new_data;
+	uint32_t delta = 0;
+	uint32_t shift = 1U << 31;
+	uint32_t i;
+
+	for (i = 0; i < len; ++i)
+		delta = crc32_tab[(delta ^ old_byte[i] ^ new_byte[i]) & 0xff] ^
+			(delta >> 8);
+
+	/* shift = x^(8 * trailing_len) */
+	for (i = 3; trailing_len; trailing_len >>= 1, i++) {
+		if (trailing_len & 1)
+			shift = multmodp(x2n_tab[i & 31], shift);
+	}
+
+	return crc ^ multmodp(shift, delta);
+}
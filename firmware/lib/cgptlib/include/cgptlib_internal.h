@@ -154,6 +154,13 @@ void GptRepair(GptData *gpt);
  */
 void GptModified(GptData *gpt);
 
+/**
+ * Like GptModified(), for when only the primary entry 'e' has changed and
+ * 'old' holds its previous contents. The entries CRC is updated incrementally
+ * instead of being recomputed over the whole table.
+ */
+void GptEntryModified(GptData *gpt, const GptEntry *e, const GptEntry *old);
+
 /**
  * Return 1 if the entry is a Chrome OS kernel partition, else 0.
  */
@@ -10,4 +10,13 @@
 
 uint32_t Crc32(const void *buffer, uint32_t len);
 
+/**
+ * Return the Crc32() of a buffer after 'len' bytes in it have changed from
+ * 'old_data' to 'new_data', given its previous 'crc' and the number of
+ * unchanged bytes following the change ('trailing_len'). Takes
+ * O(len + log(trailing_len)) time instead of a pass over the whole buffer.
+ */
+uint32_t Crc32Patch(uint32_t crc, const void *old_data, const void *new_data,
+		    uint32_t len, uint32_t trailing_len);
+
 #endif  /* VBOOT_REFERENCE_CRC32_H_ */
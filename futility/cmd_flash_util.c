@@ -240,7 +240,8 @@ static int do_flash(int argc, char *argv[])
 out_free:
 	prepare_servo_control(prepare_ctrl_name, 0);
 	free(servo_programmer);
-	updater_delete_config(cfg);
+	if (updater_delete_config(cfg))
+		ret = -1;
 
 	return ret;
 }
@@ -368,15 +368,20 @@ errdelete:
 #endif /* USE_FLASHROM */
 }
 
-/* Cleanup objects created in setup_flash and release servo from flash mode. */
-static void teardown_flash(struct updater_config *cfg,
-			   const char *prepare_ctrl_name,
-			   char *servo_programmer)
+/*
+ * Cleanup objects created in setup_flash and release servo from flash mode.
+ * Returns 0 on success, non-zero if the flash was not shut down cleanly.
+ */
+static int teardown_flash(struct updater_config *cfg,
+			  const char *prepare_ctrl_name,
+			  char *servo_programmer)
 {
 #ifdef USE_FLASHROM
 	prepare_servo_control(prepare_ctrl_name, 0);
 	free(servo_programmer);
-	updater_delete_config(cfg);
+	return updater_delete_config(cfg);
+#else
+	return 0;
 #endif /* USE_FLASHROM */
 }
 
@@ -812,8 +817,9 @@ static int do_gbb(int argc, char *argv[])
 		break;
 	}
 
-	if (args.use_flash)
-		teardown_flash(cfg, prepare_ctrl_name, servo_programmer);
+	if (args.use_flash &&
+	    teardown_flash(cfg, prepare_ctrl_name, servo_programmer))
+		errorcnt++;
 	if (inbuf)
 		free(inbuf);
 	if (outbuf)
@@ -10,6 +10,8 @@
 #include <openssl/pem.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "fmap.h"
@@ -55,11 +57,13 @@
 enum no_short_opts {
 	OPT_OUTFILE = 1000,
 	OPT_RO_GSCVD_FILE = 1001,
+	OPT_BATCH = 1002,
 };
 
 static const struct option long_opts[] = {
 	/* name       hasarg *flag  val */
 	{"add_gbb",       0, NULL, 'G'},
+	{"batch",         1, NULL, OPT_BATCH},
 	{"board_id",      1, NULL, 'b'},
 	{"help",          0, NULL, 'h'},
 	{"keyblock",      1, NULL, 'k'},
@@ -83,8 +87,12 @@ static const char usage[] =
 	"  "MYNAME" gscvd -R <ranges> PARAMS <firmware image>\n\n"
 	"Re-sign an existing GSCVD with new keys, preserving ranges:\n"
 	"  "MYNAME" gscvd PARAMS <firmware image>\n\n"
-	"Validate an existing GSCVD with given root key hash:\n"
-	"  "MYNAME" gscvd <firmware image> [<root key hash in hex>]\n\n"
+	"Validate an existing GSCVD with given root key hash(es), any of which\n"
+	"may match:\n"
+	"  "MYNAME" gscvd <firmware image> [<root key hash in hex>...]\n\n"
+	"Validate many images, one per line of LIST (\"-\" for stdin), each\n"
+	"optionally followed by root key hashes:\n"
+	"  "MYNAME" gscvd --batch LIST\n\n"
 	"Print the hash of a public root key:\n"
 	"  "MYNAME" gscvd -r <root key .vpubk file>\n\n"
 	"Required PARAMS:\n"
@@ -125,6 +133,7 @@ struct file_buf {
 	uint32_t len;
 	uint8_t *data;
 	int fd;
+	struct fmap_index *fmap;
 	FmapAreaHeader *ro_gscvd;
 	/* Cached GBB information. */
 	const FmapAreaHeader *gbb_area;
@@ -138,6 +147,9 @@ struct file_buf {
  */
 #define MAX_RANGES 32
 
+/* Max number of root key hashes an image can be validated against. */
+#define MAX_ROOT_KEY_HASHES 16
+
 /*
  * Container keeping track of the set of ranges to include in hash
  * calculation.
@@ -168,9 +180,11 @@ static int load_ap_firmware(const char *file_name, struct file_buf *file,
 				    &file->len))
 		return 1;
 
-	if (!fmap_find_by_name(file->data, file->len, NULL, "RO_GSCVD",
-			       &file->ro_gscvd)) {
+	file->fmap = fmap_index_create(file->data, file->len, NULL);
+	if (!fmap_index_find(file->fmap, "RO_GSCVD", &file->ro_gscvd)) {
 		ERROR("Could not find RO_GSCVD in the FMAP\n");
+		fmap_index_free(file->fmap);
+		file->fmap = NULL;
 		futil_unmap_and_close_file(file->fd, mode, file->data,
 					   file->len);
 		file->fd = -1;
@@ -184,7 +198,7 @@ static int load_ap_firmware(const char *file_name, struct file_buf *file,
 	 * failure if GBB is not found, it might not be required after all.
 	 */
 	FmapAreaHeader *area;
-	while (fmap_find_by_name(file->data, file->len, NULL, "GBB", &area)) {
+	while (fmap_index_find(file->fmap, "GBB", &area)) {
 		struct vb2_gbb_header *gbb;
 		uint32_t maxlen;
 
@@ -284,7 +298,7 @@ static int verify_ranges(const struct gscvd_ro_ranges *ranges,
 	FmapAreaHeader *si_all;
 	int errorcount;
 
-	if (!fmap_find_by_name(file->data, file->len, NULL, "WP_RO", &wp_ro)) {
+	if (!fmap_index_find(file->fmap, "WP_RO", &wp_ro)) {
 		ERROR("Could not find WP_RO in the FMAP\n");
 		return 1;
 	}
@@ -292,7 +306,7 @@ static int verify_ranges(const struct gscvd_ro_ranges *ranges,
 	/* Intel boards can have an SI_ALL region that's not in WP_RO but is
 	   protected by platform-specific mechanisms, and may still contain
 	   components that we want to protect from physical attack. */
-	if (!fmap_find_by_name(file->data, file->len, NULL, "SI_ALL", &si_all))
+	if (!fmap_index_find(file->fmap, "SI_ALL", &si_all))
 		si_all = NULL;
 
 	errorcount = 0;
@@ -611,7 +625,7 @@ struct gsc_verification_data *create_gvd(struct file_buf *ap_firmware_file,
 	gvd->rollback_counter = GSC_VD_ROLLBACK_COUNTER;
 
 	/* Guaranteed to succeed. */
-	fmh = fmap_find(ap_firmware_file->data, ap_firmware_file->len);
+	fmh = ap_firmware_file->fmap->fmap;
 
 	gvd->fmap_location = (uintptr_t)fmh - (uintptr_t)ap_firmware_file->data;
 
@@ -886,7 +900,7 @@ static int validate_gvd(const struct gsc_verification_data *gvd,
 	}
 
 	/* Guaranteed to succeed. */
-	fmh = fmap_find(ap_firmware_file->data, ap_firmware_file->len);
+	fmh = ap_firmware_file->fmap->fmap;
 
 	if (gvd->fmap_location !=
 	    ((uintptr_t)fmh - (uintptr_t)ap_firmware_file->data)) {
@@ -995,57 +1009,221 @@ static void try_retrieving_ranges_from_the_image(const char *file_name,
 }
 
 /*
- * Calculate ranges digest and compare it with the value stored in gvd, with
- * or without ignoring GBB flags, as requested by the caller.
+ * Calculate the ranges digest both as is and with GBB flags zeroed, in one
+ * pass. The two only differ from the GBB flags on, so the digest context is
+ * copied there and the rest of the ranges go into both. When the flags are
+ * zero already or not covered, only one digest is calculated.
+ *
+ * @return zero on success, nonzero on failure.
+ */
+static int calculate_both_digests(const struct file_buf *ap_firmware_file,
+				  const struct gscvd_ro_ranges *ranges,
+				  enum vb2_hash_algorithm hash_alg,
+				  uint8_t *digest, uint8_t *zeroed_digest,
+				  size_t digest_size)
+{
+	struct vb2_digest_context dc, zeroed_dc;
+	const struct gscvd_ro_range *range;
+	uint32_t flags_offset = 0;
+	vb2_gbb_flags_t flags;
+	bool forked = false;
+	size_t i;
+
+	if (ap_firmware_file->gbb_area) {
+		flags_offset = offsetof(struct vb2_gbb_header, flags) +
+			ap_firmware_file->gbb_area->area_offset;
+		memcpy(&flags, ap_firmware_file->data + flags_offset,
+		       sizeof(flags));
+		if (!flags)
+			flags_offset = 0;
+	}
+
+	if (!flags_offset) {
+		if (calculate_ranges_digest(ap_firmware_file, ranges, hash_alg,
+					    digest, digest_size, false))
+			return -1;
+		memcpy(zeroed_digest, digest, digest_size);
+		return 0;
+	}
+
+	if (vb2_digest_init(&dc, false, hash_alg, 0) != VB2_SUCCESS) {
+		ERROR("Failed to init digest!\n");
+		return -1;
+	}
+
+	for (i = 0; i < ranges->range_count; i++) {
+		uint32_t offset;
+		uint32_t size;
+
+		range = ranges->ranges + i;
+		offset = range->offset;
+		size = range->size;
+
+		if (!forked && flags_offset >= offset &&
+		    flags_offset < offset + size) {
+			/* Up to the flags, both digests are the same. */
+			if (extend_digest(ap_firmware_file, &dc, offset,
+					  flags_offset - offset, 0) !=
+			    VB2_SUCCESS)
+				goto extend_failed;
+			zeroed_dc = dc;
+			forked = true;
+			size -= flags_offset - offset;
+			offset = flags_offset;
+		}
+
+		if (extend_digest(ap_firmware_file, &dc, offset, size, 0) !=
+		    VB2_SUCCESS)
+			goto extend_failed;
+		if (forked &&
+		    extend_digest(ap_firmware_file, &zeroed_dc, offset, size,
+				  flags_offset) != VB2_SUCCESS)
+			goto extend_failed;
+	}
+
+	memset(digest, 0, digest_size);
+	memset(zeroed_digest, 0, digest_size);
+	if (vb2_digest_finalize(&dc, digest, digest_size) != VB2_SUCCESS ||
+	    (forked && vb2_digest_finalize(&zeroed_dc, zeroed_digest,
+					   digest_size) != VB2_SUCCESS)) {
+		ERROR("Failed to finalize digest!\n");
+		return -1;
+	}
+	if (!forked)
+		memcpy(zeroed_digest, digest, digest_size);
+
+	return 0;
+
+extend_failed:
+	ERROR("Failed to extend digest!\n");
+	return -1;
+}
+
+/*
+ * Ranges digests already calculated in this run, so validating the same
+ * file more than once (as --batch may) does not hash it again. Files are
+ * told apart by inode, size and modification time.
+ */
+struct digest_cache_entry {
+	struct digest_cache_entry *next;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	enum vb2_hash_algorithm hash_alg;
+	struct gscvd_ro_ranges ranges;
+	uint8_t digest[VB2_SHA512_DIGEST_SIZE];
+	uint8_t zeroed_digest[VB2_SHA512_DIGEST_SIZE];
+};
+
+static struct digest_cache_entry *digest_cache;
+
+static void free_digest_cache(void)
+{
+	struct digest_cache_entry *entry;
+
+	while (digest_cache) {
+		entry = digest_cache;
+		digest_cache = entry->next;
+		free(entry);
+	}
+}
+
+static bool same_ranges(const struct gscvd_ro_ranges *a,
+			const struct gscvd_ro_ranges *b)
+{
+	return a->range_count == b->range_count &&
+	       !memcmp(a->ranges, b->ranges,
+		       a->range_count * sizeof(a->ranges[0]));
+}
+
+/*
+ * Calculate ranges digest and compare it with the value stored in gvd, as
+ * is and then with GBB flags zeroed.
+ *
+ * @param zeroed_flags  set to true if only the digest with zeroed GBB flags
+ *			matches
  *
  * @return zero on success, nonzero on failure.
  */
 static int validate_digest(struct file_buf *ap_firmware_file,
 			   const struct gscvd_ro_ranges *ranges,
 			   const struct gsc_verification_data *gvd,
-			   bool override_gbb_flags)
+			   bool *zeroed_flags)
 {
-	uint8_t digest[sizeof(gvd->ranges_digest)];
+	struct digest_cache_entry *entry;
+	struct stat sb;
+
+	if (fstat(ap_firmware_file->fd, &sb))
+		memset(&sb, 0, sizeof(sb));
+
+	for (entry = digest_cache; entry; entry = entry->next) {
+		if (sb.st_ino && entry->dev == sb.st_dev &&
+		    entry->ino == sb.st_ino && entry->size == sb.st_size &&
+		    entry->mtime.tv_sec == sb.st_mtim.tv_sec &&
+		    entry->mtime.tv_nsec == sb.st_mtim.tv_nsec &&
+		    entry->hash_alg == gvd->hash_alg &&
+		    same_ranges(&entry->ranges, ranges)) {
+			VB2_DEBUG("Reusing ranges digest\n");
+			break;
+		}
+	}
 
-	if (calculate_ranges_digest(ap_firmware_file, ranges,
-				    gvd->hash_alg, digest,
-				    sizeof(digest),
-				    override_gbb_flags)) {
-		return 1;
+	if (!entry) {
+		entry = calloc(1, sizeof(*entry));
+		if (!entry)
+			return 1;
+		if (calculate_both_digests(ap_firmware_file, ranges,
+					   gvd->hash_alg, entry->digest,
+					   entry->zeroed_digest,
+					   sizeof(entry->digest))) {
+			free(entry);
+			return 1;
+		}
+		entry->dev = sb.st_dev;
+		entry->ino = sb.st_ino;
+		entry->size = sb.st_size;
+		entry->mtime = sb.st_mtim;
+		entry->hash_alg = gvd->hash_alg;
+		entry->ranges = *ranges;
+		entry->next = digest_cache;
+		digest_cache = entry;
 	}
 
-	return memcmp(digest, gvd->ranges_digest, sizeof(digest));
+	*zeroed_flags = false;
+	if (!memcmp(entry->digest, gvd->ranges_digest, sizeof(entry->digest)))
+		return 0;
+
+	*zeroed_flags = true;
+	return memcmp(entry->zeroed_digest, gvd->ranges_digest,
+		      sizeof(entry->zeroed_digest));
 }
 
 /*
- * Validate GVD of the passed in AP firmware file and possibly the root key hash
+ * Validate GVD of the passed in AP firmware file and possibly the root key
+ * hash.
  *
- * The input parameters are the subset of the command line, the first argv
- * string is the AP firmware file name, the second string, if present, is the
- * hash of the root public key included in the RO_GSCVD area of the AP
- * firmware file.
+ * @param file_name  the AP firmware file name
+ * @param root_key_digests  hashes of root public keys, one of which must be
+ *			    the root key included in the RO_GSCVD area of the
+ *			    AP firmware file
+ * @param digest_count  number of root_key_digests, can be zero
  *
  * @return zero on success, nonzero on failure.
  */
-static int validate_gscvd(int argc, char *argv[])
+static int validate_gscvd(const char *file_name,
+			  const struct vb2_hash *root_key_digests,
+			  int digest_count)
 {
 	struct file_buf ap_firmware_file;
 	int rv;
 	struct gscvd_ro_ranges ranges;
 	struct gsc_verification_data *gvd;
-	const char *file_name;
-	struct vb2_hash root_key_digest = { .algo = VB2_HASH_SHA256 };
-
-	/* Guaranteed to be available. */
-	file_name = argv[0];
-
-	if (argc > 1)
-		parse_digest_or_die(root_key_digest.sha256,
-				    sizeof(root_key_digest.sha256),
-				    argv[1]);
 
 	do {
 		struct vb2_keyblock *kblock;
+		bool zeroed_flags;
+		int i;
 
 		rv = -1; /* Speculative, will be cleared on success. */
 
@@ -1063,24 +1241,25 @@ static int validate_gscvd(int argc, char *argv[])
 		if (copy_ranges(&ap_firmware_file, gvd, &ranges))
 			break;
 
-		/* First try validating without ignoring GBB flags. */
-		if (validate_digest(&ap_firmware_file, &ranges, gvd, false)) {
-			/* It failed, maybe GBB flags are not cleared yet. */
-			if (validate_digest(&ap_firmware_file, &ranges,
-					    gvd, true)) {
-				ERROR("Ranges digest mismatch\n");
-				break;
-			}
-			WARN("Ranges digest matches with zeroed GBB flags\n");
+		/* Try validating without and then with ignoring GBB flags. */
+		if (validate_digest(&ap_firmware_file, &ranges, gvd,
+				    &zeroed_flags)) {
+			ERROR("Ranges digest mismatch\n");
+			break;
 		}
+		if (zeroed_flags)
+			WARN("Ranges digest matches with zeroed GBB flags\n");
 
 		/* Find the keyblock. */
 		kblock = (struct vb2_keyblock *)((uintptr_t)gvd + gvd->size);
 
-		if ((argc > 1) && (vb2_hash_verify(false,
+		for (i = 0; i < digest_count; i++)
+			if (vb2_hash_verify(false,
 				vb2_packed_key_data(&gvd->root_key_header),
 				gvd->root_key_header.key_size,
-				&root_key_digest) != VB2_SUCCESS)) {
+				root_key_digests + i) == VB2_SUCCESS)
+				break;
+		if (digest_count && i == digest_count) {
 			ERROR("Sha256 mismatch\n");
 			break;
 		}
@@ -1098,6 +1277,7 @@ static int validate_gscvd(int argc, char *argv[])
 		rv = 0;
 	} while (false);
 
+	fmap_index_free(ap_firmware_file.fmap);
 	if (ap_firmware_file.fd != -1)
 		futil_unmap_and_close_file(ap_firmware_file.fd, FILE_RO,
 					   ap_firmware_file.data,
@@ -1106,6 +1286,67 @@ static int validate_gscvd(int argc, char *argv[])
 	return rv;
 }
 
+/*
+ * Validate a list of AP firmware files, read from batch_file ("-" for stdin).
+ * Each line holds a file name, optionally followed by root key hashes, as on
+ * the command line. A line per file is printed with the result.
+ *
+ * @return zero if all files are valid, nonzero otherwise.
+ */
+static int validate_batch(const char *batch_file)
+{
+	struct vb2_hash root_key_digests[MAX_ROOT_KEY_HASHES];
+	char *line = NULL;
+	size_t line_size = 0;
+	int failures = 0;
+	FILE *fp;
+
+	fp = strcmp(batch_file, "-") ? fopen(batch_file, "r") : stdin;
+	if (!fp) {
+		ERROR("Cannot open %s: %s\n", batch_file, strerror(errno));
+		return 1;
+	}
+
+	while (getline(&line, &line_size, fp) != -1) {
+		char *file_name, *word, *saveptr;
+		int count = 0;
+		int rv = 0;
+
+		file_name = strtok_r(line, " \t\n", &saveptr);
+		if (!file_name || *file_name == '#')
+			continue;
+
+		while ((word = strtok_r(NULL, " \t\n", &saveptr))) {
+			if (count == ARRAY_SIZE(root_key_digests)) {
+				ERROR("Too many root key hashes\n");
+				rv = -1;
+				break;
+			}
+			root_key_digests[count].algo = VB2_HASH_SHA256;
+			if (!parse_hash(root_key_digests[count].sha256,
+					sizeof(root_key_digests[count].sha256),
+					word)) {
+				ERROR("Invalid DIGEST \"%s\"\n", word);
+				rv = -1;
+				break;
+			}
+			count++;
+		}
+
+		if (!rv)
+			rv = validate_gscvd(file_name, root_key_digests, count);
+		printf("%s: %s\n", file_name, rv ? "FAILED" : "OK");
+		if (rv)
+			failures++;
+	}
+
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+
+	return failures ? 1 : 0;
+}
+
 /**
  * Calculate and report sha256 hash of the public key body.
  *
@@ -1154,6 +1395,7 @@ static int do_gscvd(int argc, char *argv[])
 	struct file_buf ap_firmware_file = { .fd = -1 };
 	uint32_t board_id = UINT32_MAX;
 	char *ro_gscvd_file = NULL;
+	char *batch_file = NULL;
 	int rv = 0;
 
 	ranges.range_count = 0;
@@ -1167,6 +1409,9 @@ static int do_gscvd(int argc, char *argv[])
 		case OPT_RO_GSCVD_FILE:
 			ro_gscvd_file = optarg;
 			break;
+		case OPT_BATCH:
+			batch_file = optarg;
+			break;
 		case 'R':
 			if (parse_ranges(optarg, &ranges)) {
 				ERROR("Could not parse ranges\n");
@@ -1242,13 +1487,38 @@ static int do_gscvd(int argc, char *argv[])
 		}
 	}
 
+	if (batch_file) {
+		if (errorcount || optind != argc) {
+			ERROR("Unexpected arguments with --batch\n");
+			goto usage_out;
+		}
+		rv = validate_batch(batch_file);
+		free_digest_cache();
+		return rv;
+	}
+
 	if ((optind == 1) && (argc > 1)) {
+		struct vb2_hash root_key_digests[MAX_ROOT_KEY_HASHES];
+		int count = argc - 2;
+
 		if (ro_gscvd_file) {
 			ERROR("Unexpected --gscvd_out in command line\n");
 			goto usage_out;
 		}
+		if (count > ARRAY_SIZE(root_key_digests)) {
+			ERROR("Too many root key hashes\n");
+			goto usage_out;
+		}
+		for (i = 0; i < count; i++) {
+			root_key_digests[i].algo = VB2_HASH_SHA256;
+			parse_digest_or_die(root_key_digests[i].sha256,
+					    sizeof(root_key_digests[i].sha256),
+					    argv[i + 2]);
+		}
 		/* This must be a validation request. */
-		return validate_gscvd(argc - 1, argv + 1);
+		rv = validate_gscvd(argv[1], root_key_digests, count);
+		free_digest_cache();
+		return rv;
 	}
 
 	if (errorcount) /* Error message(s) should have been printed by now. */
@@ -1345,6 +1615,7 @@ static int do_gscvd(int argc, char *argv[])
 	free(kblock);
 	vb2_private_key_free(plat_privk);
 
+	fmap_index_free(ap_firmware_file.fmap);
 	if (ap_firmware_file.fd != -1)
 		futil_unmap_and_close_file(ap_firmware_file.fd, FILE_RW,
 					   ap_firmware_file.data,
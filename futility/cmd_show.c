@@ -5,6 +5,7 @@
 
 #include <openssl/rsa.h>
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
@@ -16,6 +17,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "2api.h"
@@ -493,6 +495,8 @@ enum no_short_opts {
 	OPT_PADDING = 1000,
 	OPT_TYPE,
 	OPT_PUBKEY,
+	OPT_JOBS,
+	OPT_RECURSIVE,
 	OPT_HELP,
 };
 
@@ -513,6 +517,8 @@ static const char usage[] = "\n"
 	"  -t                               Just show the type of each file\n"
 	"  --type           TYPE            Override the detected file type\n"
 	"                                     Use \"--type help\" for a list\n"
+	"  --jobs           NUM             Look at NUM files at a time\n"
+	"  --recursive                      Look at all files in directories\n"
 	"Type-specific options:\n"
 	"  -k|--publickey   FILE.vbpubk     Public key in vb1 format\n"
 	"  --pubkey         FILE.vpubk2     Public key in vb2 format\n"
@@ -541,6 +547,8 @@ static const struct option long_opts[] = {
 	{"type",        1, NULL, OPT_TYPE},
 	{"strict",      0, &show_option.strict, 1},
 	{"pubkey",      1, NULL, OPT_PUBKEY},
+	{"jobs",        1, NULL, OPT_JOBS},
+	{"recursive",   0, NULL, OPT_RECURSIVE},
 	{"help",        0, NULL, OPT_HELP},
 	{NULL, 0, NULL, 0},
 };
@@ -576,17 +584,223 @@ static int show_type(char *filename)
 	return 1;
 }
 
+/* A growable list of file names. */
+struct file_list {
+	char **names;
+	int count;
+	int size;
+};
+
+static int add_file(struct file_list *list, const char *name)
+{
+	if (list->count == list->size) {
+		int size = list->size ? list->size * 2 : 16;
+		char **names = realloc(list->names, size * sizeof(*names));
+		if (!names)
+			return 1;
+		list->names = names;
+		list->size = size;
+	}
+	list->names[list->count] = strdup(name);
+	if (!list->names[list->count])
+		return 1;
+	list->count++;
+	return 0;
+}
+
+/* Adds [path], or every file below it if it's a directory and [recursive]
+ * is set. Symlinks to directories are not followed. Returns zero on success.
+ */
+static int add_files(struct file_list *list, const char *path, int recursive)
+{
+	struct dirent **entries;
+	struct stat sb;
+	int n, i;
+	int rv = 0;
+
+	if (!recursive || lstat(path, &sb) || !S_ISDIR(sb.st_mode))
+		return add_file(list, path);
+
+	/* Sorted, so the output doesn't depend on the file system. */
+	n = scandir(path, &entries, NULL, alphasort);
+	if (n < 0) {
+		ERROR("Can't read directory %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	for (i = 0; i < n; i++) {
+		const char *name = entries[i]->d_name;
+		char *child;
+
+		if (strcmp(name, ".") && strcmp(name, "..")) {
+			if (asprintf(&child, "%s/%s", path, name) < 0) {
+				rv = 1;
+			} else {
+				rv |= add_files(list, child, recursive);
+				free(child);
+			}
+		}
+		free(entries[i]);
+	}
+	free(entries);
+
+	return rv;
+}
+
+/* Shows one file. Returns zero on success. */
+static int show_one(char *infile, int type_override)
+{
+	enum futil_file_type type;
+
+	if (show_option.t_flag)
+		return show_type(infile);
+
+	/* Allow the user to override the type */
+	if (type_override)
+		type = show_option.type;
+	else
+		futil_file_type(infile, &type);
+
+	return !!futil_file_type_show(type, infile);
+}
+
+/* A file being shown by a worker process for --jobs. */
+struct show_job {
+	pid_t pid;
+	FILE *out;		/* What the worker printed to stdout */
+	FILE *err;		/* and to stderr */
+	int done;
+	int failed;
+};
+
+/* Copies [from] to [to] from the start, and closes [from]. */
+static void copy_and_close(FILE *from, FILE *to)
+{
+	char buf[4096];
+	size_t n;
+
+	if (!from)
+		return;
+
+	rewind(from);
+	while ((n = fread(buf, 1, sizeof(buf), from)) > 0)
+		fwrite(buf, 1, n, to);
+	fflush(to);
+	fclose(from);
+}
+
+/* Prints the output of a finished job and cleans up after it. */
+static void finish_job(struct show_job *job)
+{
+	copy_and_close(job->err, stderr);
+	copy_and_close(job->out, stdout);
+	job->err = NULL;
+	job->out = NULL;
+}
+
+/* Forks a worker to show [infile], with its output going to [job]. */
+static int start_job(struct show_job *job, char *infile, int type_override)
+{
+	job->out = tmpfile();
+	job->err = tmpfile();
+	if (!job->out || !job->err) {
+		ERROR("Can't create a temporary file: %s\n", strerror(errno));
+		finish_job(job);
+		return 1;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	job->pid = fork();
+	if (job->pid < 0) {
+		ERROR("Can't fork: %s\n", strerror(errno));
+		finish_job(job);
+		return 1;
+	}
+	if (job->pid)
+		return 0;
+
+	/* The worker */
+	if (dup2(fileno(job->out), STDOUT_FILENO) < 0 ||
+	    dup2(fileno(job->err), STDERR_FILENO) < 0)
+		_exit(1);
+	int rv = show_one(infile, type_override);
+	fflush(stdout);
+	_exit(rv);
+}
+
+/*
+ * Shows all the files using up to [jobs] worker processes at once. The output
+ * of each file is printed in the order the files were given, as soon as it and
+ * all the files before it are done. Returns the number of files that failed.
+ */
+static int show_parallel(struct file_list *files, int jobs, int type_override)
+{
+	struct show_job *job = calloc(files->count, sizeof(*job));
+	int started = 0, printed = 0, running = 0;
+	int failed = 0;
+	int status, i;
+	pid_t pid;
+
+	if (!job) {
+		ERROR("Out of memory\n");
+		return files->count;
+	}
+
+	while (printed < files->count) {
+		/* Keep the workers busy */
+		while (running < jobs && started < files->count) {
+			struct show_job *j = &job[started];
+			if (start_job(j, files->names[started],
+				      type_override)) {
+				j->done = j->failed = 1;
+			} else {
+				running++;
+			}
+			started++;
+		}
+
+		/* Print everything that's ready, in order */
+		while (printed < started && job[printed].done) {
+			finish_job(&job[printed]);
+			failed += job[printed].failed;
+			printed++;
+		}
+		if (!running)
+			continue;
+
+		pid = wait(&status);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			FATAL("wait() failed: %s\n", strerror(errno));
+		}
+		for (i = printed; i < started; i++) {
+			if (job[i].pid == pid && !job[i].done) {
+				job[i].done = 1;
+				job[i].failed = !WIFEXITED(status) ||
+						WEXITSTATUS(status);
+				running--;
+				break;
+			}
+		}
+	}
+
+	free(job);
+	return failed;
+}
+
 static int do_show(int argc, char *argv[])
 {
 	uint8_t *pubkbuf = NULL;
 	struct vb2_public_key pubk2;
-	char *infile = 0;
 	int i;
 	int errorcnt = 0;
 	uint32_t len;
 	char *e = 0;
 	int type_override = 0;
-	enum futil_file_type type;
+	int jobs = 0;
+	int recursive = 0;
+	struct file_list files = {0};
 
 	vb2_workbuf_init(&wb, workbuf, sizeof(workbuf));
 
@@ -645,6 +859,16 @@ static int do_show(int argc, char *argv[])
 				errorcnt++;
 			}
 			break;
+		case OPT_JOBS:
+			jobs = strtol(optarg, &e, 0);
+			if (!*optarg || (e && *e) || jobs < 1) {
+				ERROR("Invalid --jobs \"%s\"\n", optarg);
+				errorcnt++;
+			}
+			break;
+		case OPT_RECURSIVE:
+			recursive = 1;
+			break;
 		case OPT_HELP:
 			print_help(argc, argv);
 			return !!errorcnt;
@@ -679,25 +903,29 @@ static int do_show(int argc, char *argv[])
 		return 1;
 	}
 
-	if (show_option.t_flag) {
-		for (i = optind; i < argc; i++)
-			errorcnt += show_type(argv[i]);
-		goto done;
-	}
-
 	for (i = optind; i < argc; i++) {
-		infile = argv[i];
-
-		/* Allow the user to override the type */
-		if (type_override)
-			type = show_option.type;
-		else
-			futil_file_type(infile, &type);
+		if (add_files(&files, argv[i], recursive)) {
+			errorcnt++;
+			goto done;
+		}
+	}
 
-		errorcnt += futil_file_type_show(type, infile);
+	if (jobs > 1) {
+		errorcnt += show_parallel(&files, jobs, type_override);
+	} else {
+		for (i = 0; i < files.count; i++)
+			errorcnt += show_one(files.names[i], type_override);
 	}
 
+	/* Only the new options get a summary, to keep the old output as is. */
+	if (jobs || recursive)
+		printf("%d file%s, %d failed\n", files.count,
+		       files.count == 1 ? "" : "s", errorcnt);
+
 done:
+	for (i = 0; i < files.count; i++)
+		free(files.names[i]);
+	free(files.names);
 	if (pubkbuf)
 		free(pubkbuf);
 	if (show_option.fv)
@@ -142,7 +142,7 @@ int ft_sign_raw_kernel(const char *name, void *data)
 				     sign_option.kloadaddr,
 				     sign_option.keyblock,
 				     sign_option.signprivate,
-				     sign_option.flags, &vblock_size);
+				     sign_option.flags, &vblock_size, NULL);
 	if (!vblock_data) {
 		ERROR("Unable to sign kernel blob\n");
 		goto done;
@@ -171,6 +171,46 @@ done:
 	return rv;
 }
 
+/*
+ * Writes the vblock to a new outfile, followed by len bytes of in_fd from
+ * in_offset, which are copied within the kernel where it can.
+ */
+static int write_vblock_and_copy(const char *outfile,
+				 const void *vblock, uint32_t vblock_size,
+				 int in_fd, off_t in_offset, uint32_t len)
+{
+	int out_fd;
+
+	VB2_DEBUG("writing %s with %#x, %#x copied\n", outfile, vblock_size,
+		  len);
+
+	out_fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out_fd < 0) {
+		ERROR("Can't open output file %s: %s\n", outfile,
+		      strerror(errno));
+		return 1;
+	}
+
+	if (pwrite(out_fd, vblock, vblock_size, 0) != vblock_size ||
+	    futil_copy_file_range(in_fd, in_offset, out_fd, vblock_size,
+				  len)) {
+		ERROR("Can't write output file %s: %s\n", outfile,
+		      strerror(errno));
+		close(out_fd);
+		unlink(outfile);
+		return 1;
+	}
+
+	if (close(out_fd)) {
+		ERROR("Can't write output file %s: %s\n", outfile,
+		      strerror(errno));
+		unlink(outfile);
+		return 1;
+	}
+
+	return 0;
+}
+
 int ft_sign_kern_preamble(const char *name, void *data)
 {
 	uint8_t *kpart_data = NULL, *kblob_data = NULL, *vblock_data = NULL;
@@ -233,7 +273,7 @@ int ft_sign_kern_preamble(const char *name, void *data)
 				     keyblock,
 				     sign_option.signprivate,
 				     sign_option.flags,
-				     &vblock_size);
+				     &vblock_size, NULL);
 	if (!vblock_data) {
 		ERROR("Unable to sign kernel blob\n");
 		goto done;
@@ -242,7 +282,14 @@ int ft_sign_kern_preamble(const char *name, void *data)
 
 	if (sign_option.create_new_outfile) {
 		/* Write out what we've been asked for */
-		if (sign_option.vblockonly)
+		if (!sign_option.vblockonly && !sign_option.config_data)
+			/* The blob is unchanged, so it needn't pass through
+			 * memory on its way to the output. */
+			rv = write_vblock_and_copy(sign_option.outfile,
+						   vblock_data, vblock_size,
+						   fd, kblob_data - kpart_data,
+						   kblob_size);
+		else if (sign_option.vblockonly)
 			rv = WriteSomeParts(sign_option.outfile,
 					    vblock_data, vblock_size,
 					    NULL, 0);
@@ -680,6 +727,16 @@ static const char usage_default[] = "\n"
 	"  usbpd1 firmware image               same, or signed in-place\n"
 	"  RW device image                     same, or signed in-place\n"
 	"\n"
+	"The sign_server command takes the same options, but reads requests\n"
+	"from stdin instead, one per line:\n"
+	"\n"
+	"  TYPE INFILE [OUTFILE]\n"
+	"\n"
+	"TYPE is one listed below, or \"auto\" to detect it from INFILE. Keys\n"
+	"are loaded once and reused, and an external signer given with\n"
+	"--pem_external is kept running between requests. Each request is\n"
+	"answered on stdout with a line saying \"OK\" or \"ERROR\".\n"
+	"\n"
 	"For more information, use \"" MYNAME " help %s TYPE\", where\n"
 	"TYPE is one of:\n\n";
 static void print_help_default(int argc, char *argv[])
@@ -783,11 +840,292 @@ static int parse_number_opt(const char *arg, const char *name, uint32_t *dest)
 	return 0;
 }
 
+/* Sets sign_option.type if it isn't known yet. Returns zero on success. */
+static int detect_type(const char *infile)
+{
+	/* What are we looking at? */
+	if (sign_option.type == FILE_TYPE_UNKNOWN &&
+	    futil_file_type(infile, &sign_option.type))
+		return 1;
+
+	/* We may be able to infer the type based on the other args */
+	if (sign_option.type == FILE_TYPE_UNKNOWN) {
+		if (sign_option.bootloader_data || sign_option.config_data
+		    || sign_option.arch != ARCH_UNSPECIFIED)
+			sign_option.type = FILE_TYPE_RAW_KERNEL;
+		else if (sign_option.kernel_subkey || sign_option.fv_specified)
+			sign_option.type = FILE_TYPE_RAW_FIRMWARE;
+	}
+
+	return 0;
+}
+
+/*
+ * Signs (or re-signs) a single file, using whatever is in sign_option. The
+ * [errorcnt] from parsing the options is passed in so that all the problems
+ * are reported before giving up. Returns the updated number of errors.
+ */
+static int sign_one(char *infile, int errorcnt)
+{
+	if (detect_type(infile))
+		return errorcnt + 1;
+
+	/* Load keys and keyblocks from keyset path, if they were not provided
+	   earlier. */
+	errorcnt += load_keyset();
+
+	VB2_DEBUG("type=%s\n", futil_file_type_name(sign_option.type));
+
+	/* Check the arguments for the type of thing we want to sign */
+	switch (sign_option.type) {
+	case FILE_TYPE_PUBKEY:
+		sign_option.create_new_outfile = 1;
+		if (sign_option.signprivate && sign_option.pem_signpriv) {
+			ERROR("Only one of --signprivate and --pem_signpriv"
+				" can be specified\n");
+			errorcnt++;
+		}
+		if ((sign_option.signprivate &&
+		     sign_option.pem_algo_specified) ||
+		    (sign_option.pem_signpriv &&
+		     !sign_option.pem_algo_specified)) {
+			ERROR("--pem_algo must be used with"
+				" --pem_signpriv\n");
+			errorcnt++;
+		}
+		if (sign_option.pem_external && !sign_option.pem_signpriv) {
+			ERROR("--pem_external must be used with"
+				" --pem_signpriv\n");
+			errorcnt++;
+		}
+		/* We'll wait to read the PEM file, since the external signer
+		 * may want to read it instead. */
+		break;
+	case FILE_TYPE_BIOS_IMAGE:
+		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
+		errorcnt += no_opt_if(!sign_option.keyblock, "keyblock");
+		errorcnt += no_opt_if(!sign_option.kernel_subkey, "kernelkey");
+		break;
+	case FILE_TYPE_KERN_PREAMBLE:
+		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
+		if (sign_option.vblockonly || sign_option.inout_file_count > 1)
+			sign_option.create_new_outfile = 1;
+		break;
+	case FILE_TYPE_RAW_FIRMWARE:
+		sign_option.create_new_outfile = 1;
+		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
+		errorcnt += no_opt_if(!sign_option.keyblock, "keyblock");
+		errorcnt += no_opt_if(!sign_option.kernel_subkey, "kernelkey");
+		errorcnt += no_opt_if(!sign_option.version_specified,
+				      "version");
+		break;
+	case FILE_TYPE_RAW_KERNEL:
+		sign_option.create_new_outfile = 1;
+		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
+		errorcnt += no_opt_if(!sign_option.keyblock, "keyblock");
+		errorcnt += no_opt_if(!sign_option.version_specified,
+				      "version");
+		errorcnt += no_opt_if(!sign_option.bootloader_data,
+				      "bootloader");
+		errorcnt += no_opt_if(!sign_option.config_data, "config");
+		errorcnt += no_opt_if(sign_option.arch == ARCH_UNSPECIFIED,
+				      "arch");
+		break;
+	case FILE_TYPE_USBPD1:
+		errorcnt += no_opt_if(!sign_option.pem_signpriv, "pem");
+		errorcnt += no_opt_if(sign_option.hash_alg == VB2_HASH_INVALID,
+				      "hash_alg");
+		break;
+	case FILE_TYPE_RWSIG:
+		if (sign_option.inout_file_count > 1)
+			/* Signing raw data. No signature pre-exists. */
+			errorcnt += no_opt_if(!sign_option.prikey, "prikey");
+		break;
+	default:
+		/* Anything else we don't care */
+		break;
+	}
+
+	VB2_DEBUG("infile=%s\n", infile);
+	VB2_DEBUG("sign_option.inout_file_count=%d\n",
+		  sign_option.inout_file_count);
+	VB2_DEBUG("sign_option.create_new_outfile=%d\n",
+		  sign_option.create_new_outfile);
+
+	/* Make sure we have an output file if one is needed */
+	if (!sign_option.outfile) {
+		if (sign_option.create_new_outfile) {
+			errorcnt++;
+			ERROR("Missing output filename\n");
+			return errorcnt;
+		} else {
+			sign_option.outfile = infile;
+		}
+	}
+
+	VB2_DEBUG("sign_option.outfile=%s\n", sign_option.outfile);
+
+	if (errorcnt)
+		return errorcnt;
+
+	if (!sign_option.create_new_outfile) {
+		/* We'll read-modify-write the output file */
+		if (sign_option.inout_file_count > 1)
+			if (futil_copy_file(infile, sign_option.outfile) < 0)
+				return errorcnt;
+		infile = sign_option.outfile;
+	}
+
+	errorcnt += futil_file_type_sign(sign_option.type, infile);
+	return errorcnt;
+}
+
+/* Set by the sign_server command. */
+static int server_mode;
+
+/* Keys that sign_server loaded from the keyset, by file type. */
+static struct {
+	struct vb2_private_key *signprivate;
+	struct vb2_keyblock *keyblock;
+	struct vb2_packed_key *kernel_subkey;
+} server_keys[NUM_FILE_TYPES];
+
+/*
+ * Remember the keys that load_keyset() loaded for this request, so the next
+ * request of the same type doesn't have to load them again. Keys loaded by
+ * anything else are dropped.
+ */
+static void keep_server_keys(const struct sign_option_s *options)
+{
+	enum futil_file_type type = sign_option.type;
+	/* ft_sign_pubkey() always reads its PEM key itself. */
+	int keep = type != FILE_TYPE_PUBKEY;
+
+	if (sign_option.signprivate != options->signprivate &&
+	    sign_option.signprivate != server_keys[type].signprivate) {
+		if (keep && !server_keys[type].signprivate)
+			server_keys[type].signprivate = sign_option.signprivate;
+		else
+			vb2_free_private_key(sign_option.signprivate);
+	}
+	if (sign_option.keyblock != options->keyblock &&
+	    sign_option.keyblock != server_keys[type].keyblock) {
+		if (keep && !server_keys[type].keyblock)
+			server_keys[type].keyblock = sign_option.keyblock;
+		else
+			free(sign_option.keyblock);
+	}
+	if (sign_option.kernel_subkey != options->kernel_subkey &&
+	    sign_option.kernel_subkey != server_keys[type].kernel_subkey) {
+		if (keep && !server_keys[type].kernel_subkey)
+			server_keys[type].kernel_subkey =
+				sign_option.kernel_subkey;
+		else
+			free(sign_option.kernel_subkey);
+	}
+}
+
+/*
+ * Reads "TYPE INFILE [OUTFILE]" requests from stdin, one per line, and signs
+ * each one as "sign --type TYPE INFILE [OUTFILE]" would, using the options
+ * given on the command line. TYPE may be "auto" to detect it from INFILE.
+ * Each request is answered with a line saying "OK" or "ERROR" on stdout.
+ * Returns the number of requests that failed.
+ */
+static int serve_requests(void)
+{
+	const struct sign_option_s options = sign_option;
+	const char *delim = " \t\n";
+	char *line = NULL;
+	size_t size = 0;
+	int failures = 0;
+	enum futil_file_type type;
+	FILE *reply;
+	int fd;
+
+	/* Signing may print to stdout, so keep that out of the replies. */
+	fflush(stdout);
+	fd = dup(STDOUT_FILENO);
+	if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 ||
+	    !(reply = fdopen(fd, "w"))) {
+		ERROR("Can't set up replies: %s\n", strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return 1;
+	}
+
+	/* Keep the external signer running for all the requests. */
+	if (options.pem_external)
+		vb2_external_signer_persist(1);
+
+	while (getline(&line, &size, stdin) > 0) {
+		char *type_name = strtok(line, delim);
+		char *infile = strtok(NULL, delim);
+		char *outfile = strtok(NULL, delim);
+		int errorcnt = 0;
+
+		/* Skip blank lines */
+		if (!type_name)
+			continue;
+
+		sign_option = options;
+		if (!infile || strtok(NULL, delim)) {
+			ERROR("Expected \"TYPE INFILE [OUTFILE]\"\n");
+			errorcnt++;
+		} else if (strcasecmp(type_name, "auto") &&
+			   !futil_str_to_file_type(type_name,
+						   &sign_option.type)) {
+			ERROR("Invalid type \"%s\"\n", type_name);
+			errorcnt++;
+		} else if (detect_type(infile)) {
+			errorcnt++;
+		} else {
+			type = sign_option.type;
+			if (!sign_option.signprivate)
+				sign_option.signprivate =
+					server_keys[type].signprivate;
+			if (!sign_option.keyblock)
+				sign_option.keyblock =
+					server_keys[type].keyblock;
+			if (!sign_option.kernel_subkey)
+				sign_option.kernel_subkey =
+					server_keys[type].kernel_subkey;
+
+			sign_option.inout_file_count++;
+			if (outfile) {
+				sign_option.inout_file_count++;
+				sign_option.outfile = outfile;
+			}
+			errorcnt = sign_one(infile, 0);
+			keep_server_keys(&options);
+		}
+
+		fflush(stdout);
+		fprintf(reply, "%s\n", errorcnt ? "ERROR" : "OK");
+		fflush(reply);
+		if (errorcnt)
+			failures++;
+	}
+
+	free(line);
+	fclose(reply);
+	vb2_external_signer_persist(0);
+	sign_option = options;
+	for (type = 0; type < NUM_FILE_TYPES; type++) {
+		vb2_free_private_key(server_keys[type].signprivate);
+		free(server_keys[type].keyblock);
+		free(server_keys[type].kernel_subkey);
+	}
+
+	return failures;
+}
+
 static int do_sign(int argc, char *argv[])
 {
 	char *infile = 0;
 	int i;
 	int errorcnt = 0;
+	int failures = 0;
 	char *e = 0;
 	int helpind = 0;
 	int longindex;
@@ -991,6 +1329,18 @@ static int do_sign(int argc, char *argv[])
 		return !!errorcnt;
 	}
 
+	if (server_mode) {
+		if (infile || sign_option.outfile || argc - optind > 0) {
+			errorcnt++;
+			ERROR("Files are given with each request\n");
+			goto done;
+		}
+		if (errorcnt)
+			goto done;
+		failures = serve_requests();
+		goto done;
+	}
+
 	/* If we don't have an input file already, we need one */
 	if (!infile) {
 		if (argc - optind <= 0) {
@@ -1009,134 +1359,12 @@ static int do_sign(int argc, char *argv[])
 		sign_option.outfile = argv[optind++];
 	}
 
-	/* What are we looking at? */
-	if (sign_option.type == FILE_TYPE_UNKNOWN &&
-	    futil_file_type(infile, &sign_option.type)) {
-		errorcnt++;
-		goto done;
-	}
-
-	/* We may be able to infer the type based on the other args */
-	if (sign_option.type == FILE_TYPE_UNKNOWN) {
-		if (sign_option.bootloader_data || sign_option.config_data
-		    || sign_option.arch != ARCH_UNSPECIFIED)
-			sign_option.type = FILE_TYPE_RAW_KERNEL;
-		else if (sign_option.kernel_subkey || sign_option.fv_specified)
-			sign_option.type = FILE_TYPE_RAW_FIRMWARE;
-	}
-
-	/* Load keys and keyblocks from keyset path, if they were not provided
-	   earlier. */
-	errorcnt += load_keyset();
-
-	VB2_DEBUG("type=%s\n", futil_file_type_name(sign_option.type));
-
-	/* Check the arguments for the type of thing we want to sign */
-	switch (sign_option.type) {
-	case FILE_TYPE_PUBKEY:
-		sign_option.create_new_outfile = 1;
-		if (sign_option.signprivate && sign_option.pem_signpriv) {
-			ERROR("Only one of --signprivate and --pem_signpriv"
-				" can be specified\n");
-			errorcnt++;
-		}
-		if ((sign_option.signprivate &&
-		     sign_option.pem_algo_specified) ||
-		    (sign_option.pem_signpriv &&
-		     !sign_option.pem_algo_specified)) {
-			ERROR("--pem_algo must be used with"
-				" --pem_signpriv\n");
-			errorcnt++;
-		}
-		if (sign_option.pem_external && !sign_option.pem_signpriv) {
-			ERROR("--pem_external must be used with"
-				" --pem_signpriv\n");
-			errorcnt++;
-		}
-		/* We'll wait to read the PEM file, since the external signer
-		 * may want to read it instead. */
-		break;
-	case FILE_TYPE_BIOS_IMAGE:
-		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
-		errorcnt += no_opt_if(!sign_option.keyblock, "keyblock");
-		errorcnt += no_opt_if(!sign_option.kernel_subkey, "kernelkey");
-		break;
-	case FILE_TYPE_KERN_PREAMBLE:
-		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
-		if (sign_option.vblockonly || sign_option.inout_file_count > 1)
-			sign_option.create_new_outfile = 1;
-		break;
-	case FILE_TYPE_RAW_FIRMWARE:
-		sign_option.create_new_outfile = 1;
-		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
-		errorcnt += no_opt_if(!sign_option.keyblock, "keyblock");
-		errorcnt += no_opt_if(!sign_option.kernel_subkey, "kernelkey");
-		errorcnt += no_opt_if(!sign_option.version_specified,
-				      "version");
-		break;
-	case FILE_TYPE_RAW_KERNEL:
-		sign_option.create_new_outfile = 1;
-		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
-		errorcnt += no_opt_if(!sign_option.keyblock, "keyblock");
-		errorcnt += no_opt_if(!sign_option.version_specified,
-				      "version");
-		errorcnt += no_opt_if(!sign_option.bootloader_data,
-				      "bootloader");
-		errorcnt += no_opt_if(!sign_option.config_data, "config");
-		errorcnt += no_opt_if(sign_option.arch == ARCH_UNSPECIFIED,
-				      "arch");
-		break;
-	case FILE_TYPE_USBPD1:
-		errorcnt += no_opt_if(!sign_option.pem_signpriv, "pem");
-		errorcnt += no_opt_if(sign_option.hash_alg == VB2_HASH_INVALID,
-				      "hash_alg");
-		break;
-	case FILE_TYPE_RWSIG:
-		if (sign_option.inout_file_count > 1)
-			/* Signing raw data. No signature pre-exists. */
-			errorcnt += no_opt_if(!sign_option.prikey, "prikey");
-		break;
-	default:
-		/* Anything else we don't care */
-		break;
-	}
-
-	VB2_DEBUG("infile=%s\n", infile);
-	VB2_DEBUG("sign_option.inout_file_count=%d\n",
-		  sign_option.inout_file_count);
-	VB2_DEBUG("sign_option.create_new_outfile=%d\n",
-		  sign_option.create_new_outfile);
-
-	/* Make sure we have an output file if one is needed */
-	if (!sign_option.outfile) {
-		if (sign_option.create_new_outfile) {
-			errorcnt++;
-			ERROR("Missing output filename\n");
-			goto done;
-		} else {
-			sign_option.outfile = infile;
-		}
-	}
-
-	VB2_DEBUG("sign_option.outfile=%s\n", sign_option.outfile);
-
 	if (argc - optind > 0) {
 		errorcnt++;
 		ERROR("Too many arguments left over\n");
 	}
 
-	if (errorcnt)
-		goto done;
-
-	if (!sign_option.create_new_outfile) {
-		/* We'll read-modify-write the output file */
-		if (sign_option.inout_file_count > 1)
-			if (futil_copy_file(infile, sign_option.outfile) < 0)
-				goto done;
-		infile = sign_option.outfile;
-	}
-
-	errorcnt += futil_file_type_sign(sign_option.type, infile);
+	errorcnt = sign_one(infile, errorcnt);
 done:
 	free(sign_option.signprivate);
 	free(sign_option.keyblock);
@@ -1147,8 +1375,17 @@ done:
 	if (errorcnt)
 		ERROR("Use --help for usage instructions\n");
 
-	return !!errorcnt;
+	return errorcnt || failures;
 }
 
 DECLARE_FUTIL_COMMAND(sign, do_sign, VBOOT_VERSION_ALL,
 		      "Sign / resign various binary components");
+
+static int do_sign_server(int argc, char *argv[])
+{
+	server_mode = 1;
+	return do_sign(argc, argv);
+}
+
+DECLARE_FUTIL_COMMAND(sign_server, do_sign_server, VBOOT_VERSION_ALL,
+		      "Sign files listed on stdin, loading keys only once");
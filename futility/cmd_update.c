@@ -8,6 +8,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
 
 #include "futility.h"
@@ -18,6 +19,7 @@
 enum {
 	OPT_DUMMY = 0x1000,
 	OPT_DETECT_MODEL_ONLY,
+	OPT_EMULATE_EC,
 	OPT_FACTORY,
 	OPT_FAST,
 	OPT_FORCE,
@@ -33,8 +35,10 @@ enum {
 	OPT_SERVO_NORESET,
 	OPT_SIGNATURE,
 	OPT_SYS_PROPS,
+	OPT_TIMING,
 	OPT_UNLOCK_ME,
 	OPT_UNPACK,
+	OPT_WRITE_INDEX,
 	OPT_WRITE_PROTECTION,
 };
 
@@ -53,6 +57,7 @@ static struct option const long_opts[] = {
 	{"mode", 1, NULL, 'm'},
 
 	{"detect-model-only", 0, NULL, OPT_DETECT_MODEL_ONLY},
+	{"emulate_ec", 1, NULL, OPT_EMULATE_EC},
 	{"factory", 0, NULL, OPT_FACTORY},
 	{"fast", 0, NULL, OPT_FAST},
 	{"force", 0, NULL, OPT_FORCE},
@@ -67,9 +72,11 @@ static struct option const long_opts[] = {
 	{"repack", 1, NULL, OPT_REPACK},
 	{"signature_id", 1, NULL, OPT_SIGNATURE},
 	{"sys_props", 1, NULL, OPT_SYS_PROPS},
+	{"timing", 2, NULL, OPT_TIMING},
 	{"unlock_me", 0, NULL, OPT_UNLOCK_ME},
 	{"unpack", 1, NULL, OPT_UNPACK},
 	{"wp", 1, NULL, OPT_WRITE_PROTECTION},
+	{"write-index", 0, NULL, OPT_WRITE_INDEX},
 
 	/* TODO(hungte) Remove following deprecated options. */
 	{"noupdate_ec", 0, NULL, OPT_HOST_ONLY},
@@ -113,7 +120,10 @@ static void print_help(int argc, char *argv[])
 		"    --list-quirks   \tPrint all available quirks\n"
 		"-m, --mode=MODE     \tRun updater in the specified mode\n"
 		"    --manifest      \tScan the archive to print a manifest in JSON\n"
+		"    --write-index   \tWith --manifest, also save an index of the\n"
+		"                    \tmanifest in the archive for faster loading\n"
 		"    --unlock_me     \tUnlock the Intel ME before flashing\n"
+		"    --timing[=json] \tReport time and bytes of each stage\n"
 		SHARED_FLASH_ARGS_HELP
 		"\n"
 		" * Option --manifest requires either -a,--archive or -i,--image\n"
@@ -123,12 +133,17 @@ static void print_help(int argc, char *argv[])
 		"   will not scan the archive and simply dump the previously\n"
 		"   cached manifest (may be out-dated) from the archive.\n"
 		"   Works only with -a,--archive option.\n"
+		" * The manifest index saved by --write-index is used instead\n"
+		"   of scanning the archive, and must be written again when\n"
+		"   the archive contents change.\n"
+		" * The --timing report is printed to stderr when the updater\n"
+		"   exits, as text or (with --timing=json) in JSON.\n"
 		" * Use of -p,--programmer with option other than '%s',\n"
 		"   or with --ccd effectively disables ability to update EC and PD\n"
 		"   firmware images.\n"
 		" * Emulation works only with AP (host) firmware image, and does\n"
-		"   not accept EC or PD firmware image, and does not work\n"
-		"   with --mode=output\n"
+		"   not accept EC (unless --emulate_ec is also given) or PD\n"
+		"   firmware image, and does not work with --mode=output\n"
 		" * Model detection with option --detect-model-only requires\n"
 		"   archive path -a,--archive\n"
 		"\n"
@@ -145,6 +160,7 @@ static void print_help(int argc, char *argv[])
 		"    --gbb_flags=FLAG\tOverride new GBB flags\n"
 		"    --signature_id=S\tOverride signature ID for key files\n"
 		"    --sys_props=LIST\tList of system properties to override\n"
+		"    --emulate_ec=FILE\tWith --emulate, emulate EC firmware using file\n"
 		"-d, --debug         \tPrint debugging messages\n"
 		"-v, --verbose       \tPrint verbose messages\n"
 		"",
@@ -224,6 +240,9 @@ static int do_update(int argc, char *argv[])
 		case OPT_DETECT_MODEL_ONLY:
 			args.detect_model_only = true;
 			break;
+		case OPT_EMULATE_EC:
+			args.ec_emulation = optarg;
+			break;
 		case OPT_SIGNATURE:
 			args.signature_id = optarg;
 			break;
@@ -233,9 +252,22 @@ static int do_update(int argc, char *argv[])
 		case OPT_SYS_PROPS:
 			args.sys_props = optarg;
 			break;
+		case OPT_TIMING:
+			if (!optarg || !strcmp(optarg, "text")) {
+				args.timing = TIMING_TEXT;
+			} else if (!strcmp(optarg, "json")) {
+				args.timing = TIMING_JSON;
+			} else {
+				ERROR("Invalid timing format: %s\n", optarg);
+				errorcnt++;
+			}
+			break;
 		case OPT_MANIFEST:
 			args.do_manifest = 1;
 			break;
+		case OPT_WRITE_INDEX:
+			args.write_index = true;
+			break;
 		case OPT_FACTORY:
 			args.is_factory = 1;
 			break;
@@ -315,7 +347,9 @@ static int do_update(int argc, char *argv[])
 	prepare_servo_control(prepare_ctrl_name, 0);
 	free(servo_programmer);
 
-	updater_delete_config(cfg);
+	print_update_timing(cfg);
+	if (updater_delete_config(cfg))
+		errorcnt++;
 	return !!errorcnt;
 }
 #define CMD_HELP_STR "Update system firmware"
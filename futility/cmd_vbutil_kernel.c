@@ -30,6 +30,7 @@
 /* Global opts */
 static int opt_verbose;
 static int opt_vblockonly;
+static int opt_sign_and_verify;
 static uint64_t opt_pad = 65536;
 
 /* Command line options */
@@ -74,6 +75,7 @@ static const struct option long_opts[] = {
 	{"bootloader", 1, 0, OPT_BOOTLOADER},
 	{"config", 1, 0, OPT_CONFIG},
 	{"vblockonly", 0, 0, OPT_VBLOCKONLY},
+	{"sign-and-verify", 0, &opt_sign_and_verify, 1},
 	{"pad", 1, 0, OPT_PAD},
 	{"verbose", 0, &opt_verbose, 1},
 	{"vmlinuz-out", 1, 0, OPT_VMLINUZ_OUT},
@@ -103,6 +105,8 @@ static const char usage[] =
 	"    --pad <number>            Verification padding size in bytes\n"
 	"    --vblockonly              Emit just the verification blob\n"
 	"    --flags NUM               Flags to be passed in the header\n"
+	"    --sign-and-verify         Also verify the result, as --verify\n"
+	"                                does (accepts its options)\n"
 	"\nOR\n\n"
 	"Usage:  " MYNAME " %s --repack <file> [PARAMETERS]\n"
 	"\n"
@@ -119,6 +123,8 @@ static const char usage[] =
 	"    --kloadaddr <address>     Assign kernel body load address\n"
 	"    --pad <number>            Verification blob size in bytes\n"
 	"    --vblockonly              Emit just the verification blob\n"
+	"    --sign-and-verify         Also verify the result, as --verify\n"
+	"                                does (accepts its options)\n"
 	"\nOR\n\n"
 	"Usage:  " MYNAME " %s --verify <file> [PARAMETERS]\n"
 	"\n"
@@ -204,6 +210,26 @@ static uint8_t *ReadOldKPartFromFileOrDie(const char *filename,
 	return buf;
 }
 
+/* Verifies what --pack or --repack just signed, for --sign-and-verify */
+static int verify_signed(uint8_t *vblock_data, uint8_t *kblob_data,
+			 uint32_t kblob_size, const struct vb2_hash *kblob_digest,
+			 const char *signpubkey_file, uint32_t min_version)
+{
+	struct vb2_packed_key *signpub_key = NULL;
+	int rv;
+
+	if (signpubkey_file) {
+		signpub_key = vb2_read_packed_key(signpubkey_file);
+		if (!signpub_key)
+			FATAL("Error reading public key.\n");
+	}
+
+	rv = VerifySignedKernelBlob(vblock_data, kblob_data, kblob_size,
+				    kblob_digest, signpub_key, min_version);
+	free(signpub_key);
+	return rv;
+}
+
 /****************************************************************************/
 
 static int do_vbutil_kernel(int argc, char *argv[])
@@ -246,6 +272,7 @@ static int do_vbutil_kernel(int argc, char *argv[])
 	struct vb2_kernel_preamble *preamble = NULL;
 	uint8_t *kblob_data = NULL;
 	uint32_t kblob_size = 0;
+	struct vb2_hash kblob_digest;
 	uint8_t *vblock_data = NULL;
 	uint32_t vblock_size = 0;
 	uint32_t flags = 0;
@@ -408,6 +435,24 @@ static int do_vbutil_kernel(int argc, char *argv[])
 		if (!bootloader_file)
 			FATAL("Missing required bootloader file.\n");
 
+		if (!vmlinuz_file)
+			FATAL("Missing required vmlinuz file.\n");
+
+		/* Unless it's to be verified too, the blob needn't be kept in
+		 * memory, so stream it straight to the output. */
+		if (!opt_sign_and_verify) {
+			rv = PackKernelPartition(filename, opt_vblockonly,
+						 vmlinuz_file, arch,
+						 kernel_body_load_address,
+						 t_config_data, t_config_size,
+						 bootloader_file, opt_pad,
+						 version, t_keyblock,
+						 signpriv_key, flags);
+			free(t_config_data);
+			vb2_free_private_key(signpriv_key);
+			return rv;
+		}
+
 		VB2_DEBUG("Reading %s\n", bootloader_file);
 
 		if (VB2_SUCCESS != vb2_read_file(bootloader_file,
@@ -416,9 +461,6 @@ static int do_vbutil_kernel(int argc, char *argv[])
 			FATAL("Error reading bootloader file.\n");
 		VB2_DEBUG(" bootloader file size=%#x\n", t_bootloader_size);
 
-		if (!vmlinuz_file)
-			FATAL("Missing required vmlinuz file.\n");
-
 		VB2_DEBUG("Reading %s\n", vmlinuz_file);
 		if (VB2_SUCCESS !=
 		    vb2_read_file(vmlinuz_file, &vmlinuz_buf, &vmlinuz_size))
@@ -442,7 +484,7 @@ static int do_vbutil_kernel(int argc, char *argv[])
 		vblock_data = SignKernelBlob(kblob_data, kblob_size, opt_pad,
 					     version, kernel_body_load_address,
 					     t_keyblock, signpriv_key, flags,
-					     &vblock_size);
+					     &vblock_size, &kblob_digest);
 		if (!vblock_data)
 			FATAL("Unable to sign kernel blob\n");
 
@@ -457,6 +499,11 @@ static int do_vbutil_kernel(int argc, char *argv[])
 					    vblock_data, vblock_size,
 					    kblob_data, kblob_size);
 
+		if (!rv && opt_sign_and_verify)
+			rv = verify_signed(vblock_data, kblob_data, kblob_size,
+					   &kblob_digest, signpubkey_file,
+					   min_version);
+
 		free(vmlinuz_buf);
 		free(t_config_data);
 		free(t_bootloader_data);
@@ -525,7 +572,8 @@ static int do_vbutil_kernel(int argc, char *argv[])
 		vblock_data = SignKernelBlob(kblob_data, kblob_size, opt_pad,
 					     version, kernel_body_load_address,
 					     t_keyblock ? t_keyblock : keyblock,
-					     signpriv_key, flags, &vblock_size);
+					     signpriv_key, flags, &vblock_size,
+					     &kblob_digest);
 		if (!vblock_data)
 			FATAL("Unable to sign kernel blob\n");
 
@@ -537,6 +585,11 @@ static int do_vbutil_kernel(int argc, char *argv[])
 			rv = WriteSomeParts(filename,
 					    vblock_data, vblock_size,
 					    kblob_data, kblob_size);
+
+		if (!rv && opt_sign_and_verify)
+			rv = verify_signed(vblock_data, kblob_data, kblob_size,
+					   &kblob_digest, signpubkey_file,
+					   min_version);
 		return rv;
 
 	case OPT_MODE_VERIFY:
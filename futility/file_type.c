@@ -13,8 +13,11 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "2struct.h"
 #include "file_type.h"
 #include "futility.h"
+#include "gpt.h"
+#include "host_struct21.h"
 
 /* Description and functions to handle each file type */
 struct futil_file_type_s {
@@ -78,20 +81,94 @@ void print_file_types_and_exit(int retval)
 	exit(retval);
 }
 
-/* Try to figure out what we're looking at */
-enum futil_file_type futil_file_type_buf(uint8_t *buf, uint32_t len)
+static int starts_with(const uint8_t *buf, uint32_t len, uint32_t offset,
+		       const void *magic, uint32_t magic_size)
 {
-	for (enum futil_file_type i = 0; i < NUM_FILE_TYPES; i++) {
-		if (futil_file_types[i].recognize) {
-			enum futil_file_type type = futil_file_types[i].recognize(buf, len);
-			if (type != FILE_TYPE_UNKNOWN)
-				return type;
-		}
-	}
+	return offset <= len && magic_size <= len - offset &&
+		!memcmp(buf + offset, magic, magic_size);
+}
+
+/*
+ * Guess the file type from the magic at the start of the buffer, without
+ * parsing anything. The guess still has to be confirmed by its recognizer.
+ */
+static enum futil_file_type guess_file_type(const uint8_t *buf, uint32_t len)
+{
+	const uint32_t vb21_magic[] = {
+		VB21_MAGIC_PACKED_KEY,
+		VB21_MAGIC_PACKED_PRIVATE_KEY,
+	};
+	const uint32_t vb21_sig_magic = VB21_MAGIC_SIGNATURE;
+
+	/* This also identifies the firmware and kernel preambles. */
+	if (starts_with(buf, len, 0, VB2_KEYBLOCK_MAGIC,
+			VB2_KEYBLOCK_MAGIC_SIZE))
+		return FILE_TYPE_KEYBLOCK;
+	if (starts_with(buf, len, 0, VB2_GBB_SIGNATURE,
+			VB2_GBB_SIGNATURE_SIZE))
+		return FILE_TYPE_GBB;
+	/* The GPT header is in the second 512-byte sector. */
+	if (starts_with(buf, len, 512, GPT_HEADER_SIGNATURE,
+			GPT_HEADER_SIGNATURE_SIZE) ||
+	    starts_with(buf, len, 512, GPT_HEADER_SIGNATURE2,
+			GPT_HEADER_SIGNATURE_SIZE))
+		return FILE_TYPE_CHROMIUMOS_DISK;
+	for (int i = 0; i < ARRAY_SIZE(vb21_magic); i++)
+		if (starts_with(buf, len, 0, &vb21_magic[i],
+				sizeof(vb21_magic[i])))
+			return FILE_TYPE_VB2_PUBKEY;
+	if (starts_with(buf, len, 0, &vb21_sig_magic, sizeof(vb21_sig_magic)))
+		return FILE_TYPE_RWSIG;
+	if (starts_with(buf, len, 0, "-----BEGIN ", 11))
+		return FILE_TYPE_PEM;
 
 	return FILE_TYPE_UNKNOWN;
 }
 
+typedef enum futil_file_type (*recognizer_t)(uint8_t *buf, uint32_t len);
+
+/*
+ * Run the recognizer for type t, unless it is already in tried[] (types can
+ * share a recognizer, which tells them apart).
+ */
+static enum futil_file_type recognize_once(enum futil_file_type t,
+					   uint8_t *buf, uint32_t len,
+					   recognizer_t *tried, int *num_tried)
+{
+	recognizer_t recognize = futil_file_types[t].recognize;
+
+	if (!recognize)
+		return FILE_TYPE_UNKNOWN;
+	for (int i = 0; i < *num_tried; i++)
+		if (tried[i] == recognize)
+			return FILE_TYPE_UNKNOWN;
+	tried[(*num_tried)++] = recognize;
+
+	return recognize(buf, len);
+}
+
+/*
+ * Try to figure out what we're looking at.
+ *
+ * Some recognizers scan the whole buffer, which is slow for large images. So
+ * we first try the type suggested by the magic at the start of the buffer,
+ * then fall back to the others in the order of file_type.inc.
+ */
+enum futil_file_type futil_file_type_buf(uint8_t *buf, uint32_t len)
+{
+	recognizer_t tried[NUM_FILE_TYPES];
+	int num_tried = 0;
+	enum futil_file_type type;
+
+	type = recognize_once(guess_file_type(buf, len), buf, len,
+			      tried, &num_tried);
+	for (enum futil_file_type i = 0;
+	     type == FILE_TYPE_UNKNOWN && i < NUM_FILE_TYPES; i++)
+		type = recognize_once(i, buf, len, tried, &num_tried);
+
+	return type;
+}
+
 enum futil_file_err futil_file_type(const char *filename,
 				    enum futil_file_type *type)
 {
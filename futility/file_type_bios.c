@@ -5,9 +5,11 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "cbfstool.h"
@@ -186,11 +188,11 @@ int ft_show_bios(const char *name, void *data)
 	printf("BIOS:                    %s\n", name);
 
 	/* We've already checked, so we know this will work. */
-	FmapHeader *fmap = fmap_find(buf, len);
+	struct fmap_index *fmap = fmap_index_create(buf, len, NULL);
 	for (enum bios_component c = 0; c < NUM_BIOS_COMPONENTS; c++) {
 		FmapAreaHeader *ah = NULL;
 		/* We know one of these will work, too */
-		if (fmap_find_by_name(buf, len, fmap, fmap_name[c], &ah)) {
+		if (fmap_index_find(fmap, fmap_name[c], &ah)) {
 			/* But the file might be truncated */
 			fmap_limit_area(ah, len);
 			/* The name is not necessarily null-terminated */
@@ -216,20 +218,18 @@ int ft_show_bios(const char *name, void *data)
 		}
 	}
 
+	fmap_index_free(fmap);
 	futil_unmap_and_close_file(fd, FILE_RO, buf, len);
 	return retval;
 }
 
 /** Sign functions **/
 
-static int write_new_preamble(struct bios_area_s *vblock,
-			      struct bios_area_s *fw_body,
-			      struct vb2_private_key *signkey,
-			      struct vb2_keyblock *keyblock)
+static struct vb2_signature *create_body_signature(
+	struct bios_area_s *fw_body, struct vb2_private_key *signkey)
 {
-	int retval = 1;
-
 	struct vb2_signature *body_sig;
+
 	if (fw_body->metadata_hash.algo != VB2_HASH_INVALID)
 		body_sig =
 			vb2_create_signature_from_hash(&fw_body->metadata_hash);
@@ -237,10 +237,18 @@ static int write_new_preamble(struct bios_area_s *vblock,
 		body_sig = vb2_calculate_signature(fw_body->buf, fw_body->len,
 						   signkey);
 
-	if (!body_sig) {
+	if (!body_sig)
 		ERROR("Cannot calculate or creating body signature\n");
-		return 1;
-	}
+
+	return body_sig;
+}
+
+static int write_new_preamble(struct bios_area_s *vblock,
+			      const struct vb2_signature *body_sig,
+			      struct vb2_private_key *signkey,
+			      struct vb2_keyblock *keyblock)
+{
+	int retval = 1;
 
 	struct vb2_fw_preamble *preamble = vb2_create_fw_preamble(vblock->version,
 			(struct vb2_packed_key *)sign_option.kernel_subkey,
@@ -266,7 +274,6 @@ static int write_new_preamble(struct bios_area_s *vblock,
 
 end:
 	free(preamble);
-	free(body_sig);
 
 	return retval;
 }
@@ -302,6 +309,41 @@ static int write_loem(const char *ab, struct bios_area_s *vblock)
 	return 0;
 }
 
+/* Everything needed to sign one firmware slot. */
+struct sign_slot_s {
+	const char *ab;
+	struct bios_area_s *vblock;
+	struct bios_area_s *fw_body;
+	/* Body signature shared with the other slot, or NULL. */
+	const struct vb2_signature *body_sig;
+	int retval;
+};
+
+static void *sign_slot(void *arg)
+{
+	struct sign_slot_s *slot = arg;
+	struct vb2_signature *body_sig = NULL;
+
+	slot->retval = 1;
+	if (!slot->body_sig) {
+		body_sig = create_body_signature(slot->fw_body,
+						 sign_option.signprivate);
+		if (!body_sig)
+			return NULL;
+	}
+
+	slot->retval = write_new_preamble(slot->vblock,
+					  body_sig ? body_sig : slot->body_sig,
+					  sign_option.signprivate,
+					  sign_option.keyblock);
+	free(body_sig);
+
+	if (!slot->retval && sign_option.loemid)
+		slot->retval = write_loem(slot->ab, slot->vblock);
+
+	return NULL;
+}
+
 /* This signs a full BIOS image after it's been traversed. */
 static int sign_bios_at_end(struct bios_state_s *state)
 {
@@ -309,6 +351,11 @@ static int sign_bios_at_end(struct bios_state_s *state)
 	struct bios_area_s *vblock_b = &state->area[BIOS_FMAP_VBLOCK_B];
 	struct bios_area_s *fw_a = &state->area[BIOS_FMAP_FW_MAIN_A];
 	struct bios_area_s *fw_b = &state->area[BIOS_FMAP_FW_MAIN_B];
+	struct sign_slot_s slot_a = {"A", vblock_a, fw_a};
+	struct sign_slot_s slot_b = {"B", vblock_b, fw_b};
+	struct vb2_signature *body_sig = NULL;
+	pthread_t thread;
+	int threaded = 0;
 	int retval = 0;
 
 	if (!vblock_a->is_valid || !fw_a->is_valid) {
@@ -316,32 +363,55 @@ static int sign_bios_at_end(struct bios_state_s *state)
 		return 1;
 	}
 
-	retval |= write_new_preamble(vblock_a, fw_a, sign_option.signprivate,
-				     sign_option.keyblock);
-
-	if (vblock_b->is_valid && fw_b->is_valid)
-		retval |= write_new_preamble(vblock_b, fw_b,
-					     sign_option.signprivate,
-					     sign_option.keyblock);
-	else
+	if (!vblock_b->is_valid || !fw_b->is_valid) {
 		INFO("BIOS image does not have %s. Signing only %s\n",
 		     fmap_name[BIOS_FMAP_FW_MAIN_B],
 		     fmap_name[BIOS_FMAP_FW_MAIN_A]);
-
-	if (sign_option.loemid) {
-		retval |= write_loem("A", vblock_a);
-		if (vblock_b->is_valid)
+		sign_slot(&slot_a);
+		retval = slot_a.retval;
+		/* The old LOEM vblock for B is still written, if there is one. */
+		if (sign_option.loemid && vblock_b->is_valid)
 			retval |= write_loem("B", vblock_b);
+		return retval;
 	}
 
-	return retval;
+	/* Identical bodies (the common case) only need one signature. */
+	if (fw_a->metadata_hash.algo == VB2_HASH_INVALID &&
+	    fw_b->metadata_hash.algo == VB2_HASH_INVALID &&
+	    fw_a->len == fw_b->len && !memcmp(fw_a->buf, fw_b->buf, fw_a->len)) {
+		VB2_DEBUG("%s and %s are identical\n",
+			  fmap_name[BIOS_FMAP_FW_MAIN_A],
+			  fmap_name[BIOS_FMAP_FW_MAIN_B]);
+		body_sig = create_body_signature(fw_a, sign_option.signprivate);
+		if (!body_sig)
+			return 1;
+		slot_a.body_sig = body_sig;
+		slot_b.body_sig = body_sig;
+	}
+
+	/* The slots don't overlap, so sign B on another thread if we can. */
+	if (!pthread_create(&thread, NULL, sign_slot, &slot_b))
+		threaded = 1;
+	else
+		VB2_DEBUG("Can't create a thread, signing the slots in turn\n");
+
+	sign_slot(&slot_a);
+	if (threaded)
+		pthread_join(thread, NULL);
+	else
+		sign_slot(&slot_b);
+
+	free(body_sig);
+
+	return slot_a.retval | slot_b.retval;
 }
 
 /* Prepare firmware slot for signing.
    If fw_size is not zero, then it will be used as new length of signed area,
    for zero the length will be taken form FlashMap or preamble. */
-static int prepare_slot(uint8_t *buf, uint32_t len, enum bios_component fw_c,
-			enum bios_component vblock_c,
+static int prepare_slot(uint8_t *buf, uint32_t len,
+			const struct fmap_index *fmap,
+			enum bios_component fw_c, enum bios_component vblock_c,
 			struct bios_state_s *state)
 {
 	const char *fw_main_name = fmap_name[fw_c];
@@ -350,14 +420,13 @@ static int prepare_slot(uint8_t *buf, uint32_t len, enum bios_component fw_c,
 		__attribute__((aligned(VB2_WORKBUF_ALIGN)));
 	static struct vb2_workbuf wb;
 
-	FmapHeader *fmap = fmap_find(buf, len);
 	vb2_workbuf_init(&wb, workbuf, sizeof(workbuf));
 
 	VB2_DEBUG("Preparing areas: %s and %s\n", fw_main_name, vblock_name);
 
 	/* FW_MAIN */
 	FmapAreaHeader *ah;
-	if (!fmap_find_by_name(buf, len, fmap, fw_main_name, &ah)) {
+	if (!fmap_index_find(fmap, fw_main_name, &ah)) {
 		ERROR("%s area not found in FMAP\n", fw_main_name);
 		return 1;
 	}
@@ -378,7 +447,7 @@ static int prepare_slot(uint8_t *buf, uint32_t len, enum bios_component fw_c,
 	}
 
 	/* Corresponding VBLOCK */
-	if (!fmap_find_by_name(buf, len, fmap, vblock_name, &ah)) {
+	if (!fmap_index_find(fmap, vblock_name, &ah)) {
 		ERROR("%s area not found in FMAP\n", vblock_name);
 		return 1;
 	}
@@ -535,13 +604,14 @@ int ft_sign_bios(const char *name, void *data)
 				    &buf, &len))
 		return 1;
 
-	int retval = prepare_slot(buf, len, BIOS_FMAP_FW_MAIN_A, BIOS_FMAP_VBLOCK_A,
-			      &state);
+	struct fmap_index *fmap = fmap_index_create(buf, len, NULL);
+	int retval = prepare_slot(buf, len, fmap, BIOS_FMAP_FW_MAIN_A,
+				  BIOS_FMAP_VBLOCK_A, &state);
 	if (retval)
 		goto done;
 
-	retval = prepare_slot(buf, len, BIOS_FMAP_FW_MAIN_B, BIOS_FMAP_VBLOCK_B,
-			      &state);
+	retval = prepare_slot(buf, len, fmap, BIOS_FMAP_FW_MAIN_B,
+			      BIOS_FMAP_VBLOCK_B, &state);
 	if (retval && state.area[BIOS_FMAP_FW_MAIN_B].is_valid)
 		goto done;
 
@@ -552,6 +622,7 @@ int ft_sign_bios(const char *name, void *data)
 
 	retval = sign_bios_at_end(&state);
 done:
+	fmap_index_free(fmap);
 	futil_unmap_and_close_file(fd, FILE_MODE_SIGN(sign_option), buf, len);
 	return retval;
 }
@@ -388,6 +388,43 @@ static vb2_error_t try_our_own(enum vb2_signature_algorithm sig_alg,
 	return rv;
 }
 
+/*
+ * Returns VB2_SUCCESS if the signature decrypts to a valid padding for the
+ * algorithms. This only costs one modexp, so it's a cheap way to rule out
+ * combinations before hashing the whole RW image.
+ */
+static vb2_error_t check_sig_padding(enum vb2_signature_algorithm sig_alg,
+				     enum vb2_hash_algorithm hash_alg,
+				     const uint8_t *o_pubkey,
+				     uint32_t o_pubkey_size,
+				     const uint8_t *o_sig, uint32_t o_sig_size)
+{
+	struct vb2_public_key pubkey;
+	uint8_t digest[VB2_MAX_DIGEST_SIZE] = {0};
+	uint8_t sig[8192 / 8];		/* Big enough for RSA8192 */
+	uint8_t buf[VB2_FIRMWARE_WORKBUF_RECOMMENDED_SIZE]
+		__attribute__((aligned(VB2_WORKBUF_ALIGN)));
+	struct vb2_workbuf wb = {
+		.buf = buf,
+		.size = sizeof(buf),
+	};
+	vb2_error_t rv;
+
+	if (o_sig_size > sizeof(sig))
+		return VB2_ERROR_UNKNOWN;
+
+	vb2_pubkey_from_usbpd1(&pubkey, sig_alg, hash_alg,
+			       o_pubkey, o_pubkey_size);
+
+	/* The digest is bogus, so the best we can hope for is a mismatch. */
+	memcpy(sig, o_sig, o_sig_size);
+	rv = vb2_rsa_verify_digest(&pubkey, sig, digest, &wb);
+	if (rv == VB2_SUCCESS || rv == VB2_ERROR_RSA_VERIFY_DIGEST)
+		return VB2_SUCCESS;
+
+	return rv;
+}
+
 /* Returns VB2_SUCCESS if the image validates itself */
 static vb2_error_t check_self_consistency(const uint8_t *buf, const char *name,
 					  uint32_t ro_size, uint32_t rw_size,
@@ -406,7 +443,13 @@ static vb2_error_t check_self_consistency(const uint8_t *buf, const char *name,
 	if (sig_size > rw_size || pubkey_size > ro_size)
 		return VB2_ERROR_UNKNOWN;
 
-	vb2_error_t rv = try_our_own(sig_alg, hash_alg,		/* algs */
+	vb2_error_t rv = check_sig_padding(sig_alg, hash_alg,
+					   buf + pubkey_offset, pubkey_size,
+					   buf + sig_offset, sig_size);
+	if (rv)
+		return rv;
+
+	rv = try_our_own(sig_alg, hash_alg,		/* algs */
 			 buf + pubkey_offset, pubkey_size,     /* pubkey blob */
 			 buf + sig_offset, sig_size,	       /* sig blob */
 			 buf + rw_offset, rw_size - sig_size); /* RW image */
@@ -7,6 +7,7 @@
 #define VBOOT_REFERENCE_FUTILITY_H_
 
 #include <stdint.h>
+#include <sys/types.h>
 
 #include "2common.h"
 #include "host_key.h"
@@ -113,9 +114,16 @@ void update_hwid_digest(struct vb2_gbb_header *gbb);
 int print_hwid_digest(struct vb2_gbb_header *gbb,
 		      const char *banner, const char *footer);
 
-/* Copies a file. */
+/* Copies a file, sharing the data with a reflink where possible. */
 int futil_copy_file(const char *infile, const char *outfile);
 
+/*
+ * Copies len bytes from in_fd to out_fd at the given offsets, within the
+ * kernel when it can. Returns 0 on success, -1 and errno on failure.
+ */
+int futil_copy_file_range(int in_fd, off_t in_offset, int out_fd,
+			  off_t out_offset, size_t len);
+
 /* Possible file operation errors */
 enum futil_file_err {
 	FILE_ERR_NONE,
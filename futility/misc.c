@@ -8,7 +8,6 @@
 #include <fcntl.h>
 #if !defined(HAVE_MACOS) && !defined(__FreeBSD__) && !defined(__OpenBSD__)
 #include <linux/fs.h>		/* For BLKGETSIZE64 */
-#include <sys/sendfile.h>
 #else
 #include <copyfile.h>
 #endif
@@ -213,6 +212,49 @@ int futil_set_gbb_hwid(struct vb2_gbb_header *gbb, const char *hwid)
 	return VB2_SUCCESS;
 }
 
+int futil_copy_file_range(int in_fd, off_t in_offset, int out_fd,
+			  off_t out_offset, size_t len)
+{
+	uint8_t buf[64 * 1024];
+	ssize_t n;
+
+#if !defined(HAVE_MACOS) && !defined(__FreeBSD__) && !defined(__OpenBSD__)
+	/* Let the kernel copy (or share) the data where it can. */
+	while (len) {
+		n = copy_file_range(in_fd, &in_offset, out_fd, &out_offset,
+				    len, 0);
+		if (n <= 0)
+			break;
+		len -= n;
+	}
+	if (!len)
+		return 0;
+	if (n == 0) {
+		errno = EIO;
+		return -1;
+	}
+	if (errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+	    errno != EOPNOTSUPP)
+		return -1;
+	VB2_DEBUG("copy_file_range: %s, copying by hand\n", strerror(errno));
+#endif
+
+	while (len) {
+		n = pread(in_fd, buf, VB2_MIN(len, sizeof(buf)), in_offset);
+		if (n <= 0) {
+			if (n == 0)
+				errno = EIO;
+			return -1;
+		}
+		if (pwrite(out_fd, buf, n, out_offset) != n)
+			return -1;
+		in_offset += n;
+		out_offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
 int futil_copy_file(const char *infile, const char *outfile)
 {
 	VB2_DEBUG("%s -> %s\n", infile, outfile);
@@ -235,7 +277,10 @@ int futil_copy_file(const char *infile, const char *outfile)
 		return -1;
 	}
 #if !defined(HAVE_MACOS) && !defined(__FreeBSD__) && !defined(__OpenBSD__)
-	ssize_t ret = sendfile(ofd, ifd, NULL, finfo.st_size);
+	/* A reflink shares the data until either file is written to. */
+	ssize_t ret = ioctl(ofd, FICLONE, ifd);
+	if (ret)
+		ret = futil_copy_file_range(ifd, 0, ofd, 0, finfo.st_size);
 #else
 	ssize_t ret = fcopyfile(ifd, ofd, 0, COPYFILE_ALL);
 #endif
@@ -7,7 +7,10 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "2rsa.h"
 #include "futility.h"
@@ -293,7 +296,7 @@ static int set_try_cookies(struct updater_config *cfg, const char *target,
 }
 
 int write_firmware(struct updater_config *cfg,
-		   const struct firmware_image *image, const char *section_name)
+		   struct firmware_image *image, const char *section_name)
 {
 	const char *sections[2] = {0};
 
@@ -306,7 +309,7 @@ int write_firmware(struct updater_config *cfg,
  * Returns True if we should start the update process for given image.
  */
 static int has_valid_update(struct updater_config *cfg,
-			const struct firmware_image *image,
+			struct firmware_image *image,
 			const char *section_name,
 			int is_host)
 {
@@ -319,8 +322,9 @@ static int has_valid_update(struct updater_config *cfg,
 			  image->file_name, image->programmer, section_name);
 		return 0;
 	}
-	/* Currently only host emulation is supported. */
-	if (cfg->emulation && !is_host) {
+	/* Only host emulation is supported, and EC with --emulate_ec. */
+	if (cfg->emulation && !is_host &&
+	    !(image == &cfg->ec_image && cfg->ec_emulation_programmer)) {
 		INFO("(emulation) Update %s from %s to %s (%d bytes), "
 		     "skipped for non-host targets in emulation.\n",
 		     section_name ? section_name : "whole image",
@@ -337,7 +341,7 @@ static int has_valid_update(struct updater_config *cfg,
  * Returns 0 if success, non-zero if error.
  */
 static int write_optional_firmware(struct updater_config *cfg,
-				   const struct firmware_image *image,
+				   struct firmware_image *image,
 				   const char *section_name,
 				   int check_programmer_wp,
 				   int is_host)
@@ -360,16 +364,22 @@ static int write_optional_firmware(struct updater_config *cfg,
 /*
  * Preserve the GBB contents from image_from to image_to.
  * HWID is always preserved, and flags are preserved only if preserve_flags set.
- * Returns 0 if success, otherwise -1 if GBB header can't be found or if HWID is
+ * Returns 0 if success, SECTION_READ_FAILURE if the GBB of image_from can't be
+ * read from flash, otherwise -1 if GBB header can't be found or if HWID is
  * too large.
  */
-static int preserve_gbb(const struct firmware_image *image_from,
+static int preserve_gbb(struct firmware_image *image_from,
 			struct firmware_image *image_to,
 			int preserve_flags, int override_flags,
 			uint64_t override_value)
 {
 	const struct vb2_gbb_header *gbb_from;
 	struct vb2_gbb_header *gbb_to;
+	struct firmware_section section;
+
+	if (find_firmware_section(&section, image_from, FMAP_RO_GBB) ==
+	    SECTION_READ_FAILURE)
+		return SECTION_READ_FAILURE;
 
 	/* Cast to non-const because we do want to change GBB contents later. */
 	gbb_to = (struct vb2_gbb_header *)find_gbb(image_to);
@@ -399,14 +409,18 @@ static int preserve_gbb(const struct firmware_image *image_from,
 
 /*
  * Preserves the regions locked by Intel management engine.
+ * Returns 0 if success, SECTION_READ_FAILURE if a section can't be read from
+ * flash, otherwise error.
  */
 static int preserve_management_engine(struct updater_config *cfg,
-				      const struct firmware_image *image_from,
+				      struct firmware_image *image_from,
 				      struct firmware_image *image_to)
 {
 	struct firmware_section section;
 
-	find_firmware_section(&section, image_from, FMAP_SI_ME);
+	if (find_firmware_section(&section, image_from, FMAP_SI_ME) ==
+	    SECTION_READ_FAILURE)
+		return SECTION_READ_FAILURE;
 	if (!section.data) {
 		VB2_DEBUG("Skipped because no section %s.\n", FMAP_SI_ME);
 		return 0;
@@ -433,12 +447,16 @@ static int preserve_management_engine(struct updater_config *cfg,
 	return try_apply_quirk(QUIRK_UNLOCK_ME_FOR_UPDATE, cfg);
 }
 
-/* Preserve firmware sections by FMAP area flags. */
+/*
+ * Preserve firmware sections by FMAP area flags.
+ * Returns the number of errors, or SECTION_READ_FAILURE if a section can't be
+ * read from flash.
+ */
 static int preserve_fmap_sections(struct firmware_image *from,
 				  struct firmware_image *to,
 				  int *count)
 {
-	int i, errcnt = 0;
+	int i, r, errcnt = 0;
 	FmapHeader *fmap = to->fmap_header;
 	FmapAreaHeader *ah = (FmapAreaHeader*)(
 			(uint8_t *)fmap + sizeof(FmapHeader));
@@ -455,7 +473,11 @@ static int preserve_fmap_sections(struct firmware_image *from,
 		}
 		VB2_DEBUG("Preserve FMAP area: %.*s\n", FMAP_NAMELEN,
 			  ah->area_name);
-		errcnt += preserve_firmware_section(from, to, ah->area_name);
+		r = preserve_firmware_section(from, to, ah->area_name);
+		if (r == SECTION_READ_FAILURE)
+			return r;
+		if (r)
+			errcnt++;
 		(*count)++;
 	}
 
@@ -465,11 +487,13 @@ static int preserve_fmap_sections(struct firmware_image *from,
 /*
  * Preserve old images without "preserve" information in FMAP.
  * We have to use the legacy hard-coded list of names.
+ * Returns the number of errors, or SECTION_READ_FAILURE if a section can't be
+ * read from flash.
  */
 static int preserve_known_sections(struct firmware_image *from,
 				   struct firmware_image *to)
 {
-	int errcnt = 0, i;
+	int errcnt = 0, i, r;
 	const char * const names[] = {
 		"RW_PRESERVE",  /* Only octopus fw branch is using this. */
 		"RO_VPD",
@@ -483,7 +507,11 @@ static int preserve_known_sections(struct firmware_image *from,
 		if (!firmware_section_exists(from, names[i]))
 			continue;
 		VB2_DEBUG("Preserve firmware section: %s\n", names[i]);
-		errcnt += preserve_firmware_section(from, to, names[i]);
+		r = preserve_firmware_section(from, to, names[i]);
+		if (r == SECTION_READ_FAILURE)
+			return r;
+		if (r)
+			errcnt++;
 	}
 	return errcnt;
 }
@@ -492,22 +520,41 @@ static int preserve_known_sections(struct firmware_image *from,
  * Preserves the critical sections from the current (active) firmware.
  * Currently preserved sections: GBB (HWID and flags), x86 ME, and any firmware
  * sections with FMAP_AREA_PRESERVE flag set (or a list of known names).
- * Returns 0 if success, non-zero if error.
+ * Returns 0 if success, SECTION_READ_FAILURE if a section of the current
+ * firmware can't be read from flash, or the number of other errors.
  */
 static int preserve_images(struct updater_config *cfg)
 {
-	int errcnt = 0, found;
+	int errcnt = 0, found = 1, r;
 	struct firmware_image *from = &cfg->image_current, *to = &cfg->image;
-
-	errcnt += preserve_gbb(from, to, !cfg->factory_update,
-			       cfg->override_gbb_flags, cfg->gbb_flags);
-	errcnt += preserve_management_engine(cfg, from, to);
-	errcnt += preserve_fmap_sections(from, to, &found);
-
-	if (!found)
-		errcnt += preserve_known_sections(from, to);
-
-	return errcnt;
+	int stage = begin_update_stage(cfg, "preserve sections");
+
+	r = preserve_gbb(from, to, !cfg->factory_update,
+			 cfg->override_gbb_flags, cfg->gbb_flags);
+	if (r == SECTION_READ_FAILURE)
+		goto done;
+	errcnt += !!r;
+
+	r = preserve_management_engine(cfg, from, to);
+	if (r == SECTION_READ_FAILURE)
+		goto done;
+	errcnt += !!r;
+
+	r = preserve_fmap_sections(from, to, &found);
+	if (r == SECTION_READ_FAILURE)
+		goto done;
+	errcnt += r;
+
+	if (!found) {
+		r = preserve_known_sections(from, to);
+		if (r == SECTION_READ_FAILURE)
+			goto done;
+		errcnt += r;
+	}
+	r = errcnt;
+done:
+	end_update_stage(cfg, stage, 0);
+	return r;
 }
 
 /*
@@ -526,25 +573,32 @@ static int compare_section(const struct firmware_section *a,
  * Returns if the images are different (should be updated) in given section.
  * If the section contents are the same or if the section does not exist on both
  * images, return value is 0 (no need to update). Otherwise the return value is
- * non-zero, indicating an update should be performed.
+ * 1, indicating an update should be performed, or SECTION_READ_FAILURE if the
+ * section can't be read from flash.
  * If section_name is NULL, compare whole images.
  */
-static int section_needs_update(const struct firmware_image *image_from,
-				const struct firmware_image *image_to,
+static int section_needs_update(struct firmware_image *image_from,
+				struct firmware_image *image_to,
 				const char *section_name)
 {
 	struct firmware_section from, to;
 
 	if (!section_name) {
 		if (image_from->size != image_to->size)
-			return -1;
-		return memcmp(image_from->data, image_to->data, image_to->size);
+			return 1;
+		if (complete_firmware_image(image_from))
+			return SECTION_READ_FAILURE;
+		return memcmp(image_from->data, image_to->data,
+			      image_to->size) != 0;
 	}
 
-	find_firmware_section(&from, image_from, section_name);
-	find_firmware_section(&to, image_to, section_name);
+	if (find_firmware_section(&from, image_from, section_name) ==
+	    SECTION_READ_FAILURE ||
+	    find_firmware_section(&to, image_to, section_name) ==
+	    SECTION_READ_FAILURE)
+		return SECTION_READ_FAILURE;
 
-	return compare_section(&from, &to);
+	return compare_section(&from, &to) != 0;
 }
 
 /*
@@ -590,7 +644,7 @@ const struct vb2_packed_key *get_rootkey(
  * Returns a keyblock key from given image section, or NULL on failure.
  */
 static const struct vb2_keyblock *get_keyblock(
-		const struct firmware_image *image,
+		struct firmware_image *image,
 		const char *section_name)
 {
 	struct firmware_section section;
@@ -664,7 +718,7 @@ static int verify_keyblock(const struct vb2_keyblock *block,
  * into argument `data_key_version` and `firmware_version`.
  * Returns 0 for success, otherwise failure.
  */
-static int get_key_versions(const struct firmware_image *image,
+static int get_key_versions(struct firmware_image *image,
 			    const char *section_name,
 			    unsigned int *data_key_version,
 			    unsigned int *firmware_version)
@@ -687,9 +741,9 @@ static int get_key_versions(const struct firmware_image *image,
  * Checks if the root key in ro_image can verify vblocks in rw_image.
  * Returns 0 for success, otherwise failure.
  */
-static enum rootkey_compat_result check_compatible_root_key(
-		const struct firmware_image *ro_image,
-		const struct firmware_image *rw_image)
+static enum rootkey_compat_result do_check_compatible_root_key(
+		struct firmware_image *ro_image,
+		struct firmware_image *rw_image)
 {
 	const struct vb2_gbb_header *gbb = find_gbb(ro_image);
 	const struct vb2_packed_key *rootkey;
@@ -744,6 +798,23 @@ static enum rootkey_compat_result check_compatible_root_key(
 	return ROOTKEY_COMPAT_OK;
 }
 
+/*
+ * Wrapper for do_check_compatible_root_key, timed as a stage of the update.
+ * Returns 0 for success, otherwise failure.
+ */
+static enum rootkey_compat_result check_compatible_root_key(
+		struct updater_config *cfg,
+		struct firmware_image *ro_image,
+		struct firmware_image *rw_image)
+{
+	int stage = begin_update_stage(cfg, "check root key");
+	enum rootkey_compat_result r = do_check_compatible_root_key(
+			ro_image, rw_image);
+
+	end_update_stage(cfg, stage, 0);
+	return r;
+}
+
 /*
  * Returns non-zero if the RW_LEGACY needs to be updated, otherwise 0.
  */
@@ -752,18 +823,23 @@ static int legacy_needs_update(struct updater_config *cfg)
 	int has_from, has_to;
 	const char * const tag = "cros_allow_auto_update";
 	const char *section = FMAP_RW_LEGACY;
-	const char *tmp_to, *tmp_from;
 
 	VB2_DEBUG("Checking %s contents...\n", FMAP_RW_LEGACY);
 
-	tmp_to = get_firmware_image_temp_file(&cfg->image, &cfg->tempfiles);
-	tmp_from = get_firmware_image_temp_file(&cfg->image_current,
-						&cfg->tempfiles);
-	if (!tmp_from || !tmp_to)
+	/* Compare first, so unchanged system firmware is not read in whole. */
+	switch (section_needs_update(&cfg->image_current, &cfg->image,
+				     section)) {
+	case 0:
+		return 0;
+	case SECTION_READ_FAILURE:
+		WARN("Cannot read %s from flash, won't update.\n", section);
 		return 0;
+	}
 
-	has_to = cbfs_file_exists(tmp_to, section, tag);
-	has_from = cbfs_file_exists(tmp_from, section, tag);
+	has_to = cbfs_file_exists(&cfg->image, section, tag,
+				  &cfg->tempfiles);
+	has_from = cbfs_file_exists(&cfg->image_current, section, tag,
+				    &cfg->tempfiles);
 
 	if (!has_from || !has_to) {
 		VB2_DEBUG("Current legacy firmware has%s updater tag (%s) and "
@@ -772,8 +848,7 @@ static int legacy_needs_update(struct updater_config *cfg)
 		return 0;
 	}
 
-	return section_needs_update(
-			&cfg->image_current, &cfg->image, FMAP_RW_LEGACY);
+	return 1;
 }
 
 /*
@@ -782,7 +857,7 @@ static int legacy_needs_update(struct updater_config *cfg)
  * Returns 0 for success, otherwise failure.
  */
 static int do_check_compatible_tpm_keys(struct updater_config *cfg,
-					const struct firmware_image *rw_image)
+					struct firmware_image *rw_image)
 {
 	unsigned int data_key_version = 0, firmware_version = 0,
 		     tpm_data_key_version = 0, tpm_firmware_version = 0;
@@ -824,14 +899,17 @@ static int do_check_compatible_tpm_keys(struct updater_config *cfg,
 }
 
 /*
- * Wrapper for do_check_compatible_tpm_keys.
+ * Wrapper for do_check_compatible_tpm_keys, timed as a stage of the update.
  * Will return 0 if do_check_compatible_tpm_keys success or if cfg.force_update
  * is set; otherwise non-zero.
  */
 static int check_compatible_tpm_keys(struct updater_config *cfg,
-				     const struct firmware_image *rw_image)
+				     struct firmware_image *rw_image)
 {
+	int stage = begin_update_stage(cfg, "check TPM keys");
 	int r = do_check_compatible_tpm_keys(cfg, rw_image);
+
+	end_update_stage(cfg, stage, 0);
 	if (!r)
 		return r;
 	if (!cfg->force_update) {
@@ -868,6 +946,70 @@ static int update_ec_firmware(struct updater_config *cfg)
 	return r;
 }
 
+/*
+ * Writes the whole AP (host) firmware and then updates the EC firmware.
+ * With QUIRK_PARALLEL_EC_WRITE (for boards where the AP and EC flash are on
+ * independent buses) the EC is updated by a child process while the AP is
+ * written. Both writes always finish; a failed flash write cannot be rolled
+ * back, so either one failing fails the update and the PD is not written.
+ * Returns 0 if success, non-zero if error.
+ */
+static int write_host_and_ec_firmware(struct updater_config *cfg,
+				      struct firmware_image *image_to)
+{
+	int r, status, stage;
+	pid_t pid = -1;
+
+	if (get_config_quirk(QUIRK_PARALLEL_EC_WRITE, cfg) &&
+	    cfg->ec_image.data &&
+	    (!cfg->emulation || cfg->ec_emulation_programmer)) {
+		/*
+		 * The EC write would close the AP flash session, so close it
+		 * now instead of from the child while the AP is written.
+		 */
+		if (close_flash_session(cfg))
+			return -1;
+		fflush(stdout);
+		fflush(stderr);
+		pid = fork();
+		if (pid < 0)
+			WARN("Cannot fork, updating EC after AP.\n");
+	}
+	if (pid == 0) {
+		/*
+		 * The inherited temp files belong to the parent; only remove
+		 * the ones created here, as _exit skips the usual cleanup.
+		 */
+		cfg->tempfiles.next = NULL;
+		r = update_ec_firmware(cfg);
+		remove_all_temp_files(&cfg->tempfiles);
+		fflush(stdout);
+		fflush(stderr);
+		_exit(r ? 1 : 0);
+	}
+	if (pid < 0)
+		return write_firmware(cfg, image_to, NULL) ||
+			update_ec_firmware(cfg);
+
+	INFO("Updating EC firmware in process %d.\n", (int)pid);
+	/*
+	 * The EC finishes in the child, so this stage covers the whole window
+	 * of the AP write and the EC update running side by side.
+	 */
+	stage = begin_update_stage(cfg, "update ap and ec (parallel)");
+	r = write_firmware(cfg, image_to, NULL);
+	if (r)
+		ERROR("Failed to write AP firmware.\n");
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status)) {
+		ERROR("Failed to update EC firmware.\n");
+		r = -1;
+	}
+	end_update_stage(cfg, stage,
+			 r ? 0 : (uint64_t)image_to->size + cfg->ec_image.size);
+	return r;
+}
+
 const char * const updater_error_messages[] = {
 	[UPDATE_ERR_DONE] = "Done (no error)",
 	[UPDATE_ERR_NEED_RO_UPDATE] = "RO changed and no WP. Need full update.",
@@ -900,13 +1042,23 @@ static enum updater_error_codes update_try_rw_firmware(
 	const char *target, *self_target;
 	int has_update = 1;
 
-	preserve_gbb(image_from, image_to, 1, 0, 0);
-	if (!wp_enabled && section_needs_update(
-			image_from, image_to, FMAP_RO_SECTION))
-		return UPDATE_ERR_NEED_RO_UPDATE;
+	if (preserve_gbb(image_from, image_to, 1, 0, 0) ==
+	    SECTION_READ_FAILURE)
+		return UPDATE_ERR_SYSTEM_IMAGE;
+	if (!wp_enabled) {
+		switch (section_needs_update(image_from, image_to,
+					     FMAP_RO_SECTION)) {
+		case 0:
+			break;
+		case SECTION_READ_FAILURE:
+			return UPDATE_ERR_SYSTEM_IMAGE;
+		default:
+			return UPDATE_ERR_NEED_RO_UPDATE;
+		}
+	}
 
 	INFO("Checking compatibility...\n");
-	if (check_compatible_root_key(image_from, image_to))
+	if (check_compatible_root_key(cfg, image_from, image_to))
 		return UPDATE_ERR_ROOT_KEY;
 	if (check_compatible_tpm_keys(cfg, image_to))
 		return UPDATE_ERR_TPM_ROLLBACK;
@@ -925,6 +1077,8 @@ static enum updater_error_codes update_try_rw_firmware(
 	}
 	if (!(cfg->force_update || cfg->try_update == TRY_UPDATE_DEFERRED_HOLD))
 		has_update = section_needs_update(image_from, image_to, target);
+	if (has_update == SECTION_READ_FAILURE)
+		return UPDATE_ERR_SYSTEM_IMAGE;
 
 	if (has_update) {
 		target = decide_rw_target(cfg, TARGET_UPDATE);
@@ -994,7 +1148,7 @@ static enum updater_error_codes update_rw_firmware(
 	       FMAP_RW_LEGACY);
 
 	INFO("Checking compatibility...\n");
-	if (check_compatible_root_key(image_from, image_to))
+	if (check_compatible_root_key(cfg, image_from, image_to))
 		return UPDATE_ERR_ROOT_KEY;
 	if (check_compatible_tpm_keys(cfg, image_to))
 		return UPDATE_ERR_TPM_ROLLBACK;
@@ -1056,8 +1210,15 @@ static enum updater_error_codes update_whole_firmware(
 {
 	STATUS("FULL UPDATE: Updating whole firmware image(s), RO+RW.\n");
 
-	if (preserve_images(cfg))
+	switch (preserve_images(cfg)) {
+	case 0:
+		break;
+	case SECTION_READ_FAILURE:
+		ERROR("Cannot read the sections to preserve from flash.\n");
+		return UPDATE_ERR_SYSTEM_IMAGE;
+	default:
 		VB2_DEBUG("Failed to preserve some sections - ignore.\n");
+	}
 
 	if (cfg->unlock_me && unlock_me(image_to)) {
 		ERROR("Failed unlocking Intel ME.\n");
@@ -1068,7 +1229,7 @@ static enum updater_error_codes update_whole_firmware(
 	if (!cfg->force_update) {
 		/* Check if the image_to itself is broken */
 		enum rootkey_compat_result r = check_compatible_root_key(
-				image_to, image_to);
+				cfg, image_to, image_to);
 		if (r != ROOTKEY_COMPAT_OK) {
 			ERROR("Target image does not look valid. \n"
 			      "Add --force if you really want to use it.");
@@ -1076,7 +1237,8 @@ static enum updater_error_codes update_whole_firmware(
 		}
 
 		/* Check if the system is going to re-key. */
-		r = check_compatible_root_key(&cfg->image_current, image_to);
+		r = check_compatible_root_key(cfg, &cfg->image_current,
+					      image_to);
 		/* We only allow re-key to non-dev keys. */
 		switch (r) {
 		case ROOTKEY_COMPAT_OK:
@@ -1096,8 +1258,7 @@ static enum updater_error_codes update_whole_firmware(
 		return UPDATE_ERR_TPM_ROLLBACK;
 
 	/* FMAP may be different so we should just update all. */
-	if (write_firmware(cfg, image_to, NULL) ||
-	    update_ec_firmware(cfg) ||
+	if (write_host_and_ec_firmware(cfg, image_to) ||
 	    write_optional_firmware(cfg, &cfg->pd_image, NULL, 1, 0))
 		return UPDATE_ERR_WRITE_FIRMWARE;
 
@@ -1108,7 +1269,7 @@ static enum updater_error_codes update_whole_firmware(
  * The main updater to update system firmware using the configuration parameter.
  * Returns UPDATE_ERR_DONE if success, otherwise failure.
  */
-enum updater_error_codes update_firmware(struct updater_config *cfg)
+static enum updater_error_codes do_update_firmware(struct updater_config *cfg)
 {
 	int wp_enabled, done = 0;
 	enum updater_error_codes r = UPDATE_ERR_UNKNOWN;
@@ -1146,7 +1307,7 @@ enum updater_error_codes update_firmware(struct updater_config *cfg)
 		int ret;
 
 		INFO("Loading current system firmware...\n");
-		ret = load_system_firmware(cfg, image_from);
+		ret = load_system_firmware_lazily(cfg, image_from);
 		if (ret == IMAGE_PARSE_FAILURE && cfg->force_update) {
 			WARN("No compatible firmware in system.\n");
 			cfg->check_platform = 0;
@@ -1208,6 +1369,16 @@ enum updater_error_codes update_firmware(struct updater_config *cfg)
 	return r;
 }
 
+enum updater_error_codes update_firmware(struct updater_config *cfg)
+{
+	enum updater_error_codes r = do_update_firmware(cfg);
+
+	/* An emulated flash is only saved when its session is closed. */
+	if (close_flash_session(cfg) && r == UPDATE_ERR_DONE)
+		r = UPDATE_ERR_WRITE_FIRMWARE;
+	return r;
+}
+
 /*
  * Allocates and initializes a updater_config object with default values.
  * Returns the newly allocated object, or NULL on error.
@@ -1226,6 +1397,7 @@ struct updater_config *updater_new_config(void)
 
 	cfg->check_platform = 1;
 	cfg->do_verify = 1;
+	cfg->timing_start = get_monotonic_time();
 
 	dut_init_properties(&cfg->dut_properties[0],
 			    ARRAY_SIZE(cfg->dut_properties));
@@ -1260,8 +1432,55 @@ static int updater_setup_quirks(struct updater_config *cfg,
 	return errorcnt;
 }
 
+/* A firmware image loaded on its own thread by updater_load_images. */
+struct image_load_job {
+	struct firmware_image *image;
+	const char *file_name;
+	struct u_archive *archive;
+	pthread_t thread;
+	int threaded;
+	int errorcnt;
+};
+
+/* Thread entry to load (read and parse) the image of an image_load_job. */
+static void *load_image_job(void *arg)
+{
+	struct image_load_job *job = (struct image_load_job *)arg;
+
+	job->errorcnt = !!load_firmware_image(job->image, job->file_name,
+					      job->archive);
+	return NULL;
+}
+
+/*
+ * Starts loading the image of a job on another thread, or loads it now if
+ * no thread can be created.
+ */
+static void start_image_load_job(struct image_load_job *job)
+{
+	if (!pthread_create(&job->thread, NULL, load_image_job, job)) {
+		job->threaded = 1;
+		return;
+	}
+	VB2_DEBUG("Can't create a thread, loading %s now\n", job->file_name);
+	load_image_job(job);
+}
+
+/*
+ * Waits for an image_load_job to finish.
+ * Returns 0 on success, otherwise number of failures.
+ */
+static int finish_image_load_job(struct image_load_job *job)
+{
+	if (job->threaded)
+		pthread_join(job->thread, NULL);
+	return job->errorcnt;
+}
+
 /*
  * Loads images into updater configuration.
+ * The EC and PD images are loaded on their own threads while the AP image
+ * and its quirks are set up.
  * Returns 0 on success, otherwise number of failures.
  */
 static int updater_load_images(struct updater_config *cfg,
@@ -1272,8 +1491,24 @@ static int updater_load_images(struct updater_config *cfg,
 {
 	int errorcnt = 0;
 	struct u_archive *ar = cfg->archive;
-
-	if (!cfg->image.data && image) {
+	struct image_load_job ec_job = {&cfg->ec_image, ec_image, ar};
+	struct image_load_job pd_job = {&cfg->pd_image, pd_image, ar};
+	const int load_ec = !arg->host_only &&
+			    (!arg->emulation || arg->ec_emulation) &&
+			    !cfg->ec_image.data && ec_image;
+	const int load_pd = !arg->host_only && !arg->emulation &&
+			    !cfg->pd_image.data && pd_image;
+	const int load_ap = !cfg->image.data && image;
+	int stage = -1;
+
+	if (load_ap || load_ec || load_pd)
+		stage = begin_update_stage(cfg, "load images");
+	if (load_ec)
+		start_image_load_job(&ec_job);
+	if (load_pd)
+		start_image_load_job(&pd_job);
+
+	if (load_ap) {
 		if (image && strcmp(image, "-") == 0) {
 			INFO("Reading image from stdin...\n");
 			image = create_temp_file(&cfg->tempfiles);
@@ -1284,13 +1519,14 @@ static int updater_load_images(struct updater_config *cfg,
 		if (!errorcnt)
 			errorcnt += updater_setup_quirks(cfg, arg);
 	}
-	if (arg->host_only || arg->emulation)
-		return errorcnt;
 
-	if (!cfg->ec_image.data && ec_image)
-		errorcnt += !!load_firmware_image(&cfg->ec_image, ec_image, ar);
-	if (!cfg->pd_image.data && pd_image)
-		errorcnt += !!load_firmware_image(&cfg->pd_image, pd_image, ar);
+	if (load_ec)
+		errorcnt += finish_image_load_job(&ec_job);
+	if (load_pd)
+		errorcnt += finish_image_load_job(&pd_job);
+	end_update_stage(cfg, stage, (load_ap ? cfg->image.size : 0) +
+			 (load_ec ? cfg->ec_image.size : 0) +
+			 (load_pd ? cfg->pd_image.size : 0));
 	return errorcnt;
 }
 
@@ -1366,7 +1602,8 @@ static int updater_setup_archive(
 	if (arg->do_manifest) {
 		assert(!arg->image);
 		print_json_manifest(manifest);
-		/* No additional error. */
+		if (arg->write_index)
+			errorcnt += !!manifest_write_index(manifest);
 		return errorcnt;
 	}
 
@@ -1388,6 +1625,9 @@ static int updater_setup_archive(
 	errorcnt += updater_load_images(
 			cfg, arg, model->image, model->ec_image,
 			model->pd_image);
+	errorcnt += !!model_check_image_hash(model, &cfg->image);
+	errorcnt += !!model_check_image_hash(model, &cfg->ec_image);
+	errorcnt += !!model_check_image_hash(model, &cfg->pd_image);
 
 	if (model->is_custom_label && !manifest->has_keyset) {
 		/*
@@ -1438,6 +1678,7 @@ int updater_setup_config(struct updater_config *cfg,
 	cfg->use_diff_image = arg->fast_update;
 	cfg->do_verify = !arg->fast_update;
 	cfg->factory_update = arg->is_factory;
+	cfg->timing = arg->timing;
 	if (arg->force_update)
 		cfg->force_update = 1;
 
@@ -1455,6 +1696,11 @@ int updater_setup_config(struct updater_config *cfg,
 		}
 		*do_update = 0;
 	}
+	if (arg->write_index && (!arg->do_manifest || !arg->archive ||
+				 arg->fast_update)) {
+		ERROR("--write-index needs --manifest and -a, without --fast.\n");
+		return ++errorcnt;
+	}
 	if (arg->repack || arg->unpack) {
 		if (!arg->archive) {
 			ERROR("--{re,un}pack needs --archive.\n");
@@ -1539,6 +1785,25 @@ int updater_setup_config(struct updater_config *cfg,
 		cfg->image.programmer = cfg->emulation_programmer;
 		cfg->image_current.programmer = cfg->emulation_programmer;
 	}
+	if (arg->ec_emulation) {
+		struct stat statbuf;
+
+		if (!arg->emulation) {
+			ERROR("--emulate_ec needs --emulate.\n");
+			return ++errorcnt;
+		}
+		if (stat(arg->ec_emulation, &statbuf)) {
+			ERROR("Failed to stat EC emulation file %s\n",
+			      arg->ec_emulation);
+			return ++errorcnt;
+		}
+		VB2_DEBUG("Using file %s for EC emulation.\n",
+			  arg->ec_emulation);
+		ASPRINTF(&cfg->ec_emulation_programmer,
+			 "dummy:emulate=VARIABLE_SIZE,size=%d,image=%s,bus=prog",
+			 (int)statbuf.st_size, arg->ec_emulation);
+		cfg->ec_image.programmer = cfg->ec_emulation_programmer;
+	}
 
 	if (arg->sys_props)
 		override_properties_from_list(arg->sys_props, cfg);
@@ -1606,7 +1871,11 @@ int updater_setup_config(struct updater_config *cfg,
 			errorcnt++;
 		}
 	} else if (arg->archive) {
-		struct manifest *m = new_manifest_from_archive(cfg->archive);
+		int stage = begin_update_stage(cfg, "load manifest");
+		struct manifest *m = new_manifest_from_archive(
+				cfg->archive, !arg->write_index);
+
+		end_update_stage(cfg, stage, 0);
 		if (m) {
 			errorcnt += updater_setup_archive(
 					cfg, arg, m, cfg->factory_update);
@@ -1639,7 +1908,9 @@ int updater_setup_config(struct updater_config *cfg,
 		errorcnt += !!setup_config_quirks(arg->quirks, cfg);
 
 	/* Additional checks. */
-	if (check_single_image && !do_output && (cfg->ec_image.data || cfg->pd_image.data)) {
+	if (check_single_image && !do_output &&
+	    ((cfg->ec_image.data && !cfg->ec_emulation_programmer) ||
+	     cfg->pd_image.data)) {
 		errorcnt++;
 		ERROR("EC/PD images are not supported in current mode.\n");
 	}
@@ -1706,10 +1977,15 @@ int handle_flash_argument(struct updater_config_arguments *args, int opt,
 
 /*
  * Releases all resources in an updater configuration object.
+ * Returns 0 if success, or non-zero if the flash session (which also saves
+ * the contents of an emulated flash to its file) failed to close.
  */
-void updater_delete_config(struct updater_config *cfg)
+int updater_delete_config(struct updater_config *cfg)
 {
+	int r;
+
 	assert(cfg);
+	r = close_flash_session(cfg);
 	free_firmware_image(&cfg->image);
 	free_firmware_image(&cfg->image_current);
 	free_firmware_image(&cfg->ec_image);
@@ -1717,8 +1993,14 @@ void updater_delete_config(struct updater_config *cfg)
 	cfg->image.programmer = cfg->original_programmer;
 	cfg->image_current.programmer = cfg->original_programmer;
 	free(cfg->emulation_programmer);
+	cfg->ec_image.programmer = PROG_EC;
+	free(cfg->ec_emulation_programmer);
 	remove_all_temp_files(&cfg->tempfiles);
 	if (cfg->archive)
 		archive_close(cfg->archive);
+	for (int i = 0; i < cfg->num_stages; i++)
+		free(cfg->stages[i].name);
+	free(cfg->stages);
 	free(cfg);
+	return r;
 }
@@ -53,6 +53,7 @@ enum quirk_types {
 	QUIRK_NO_VERIFY,
 	QUIRK_EXTRA_RETRIES,
 	QUIRK_CLEAR_MRC_DATA,
+	QUIRK_PARALLEL_EC_WRITE,
 	QUIRK_MAX,
 };
 
@@ -63,6 +64,21 @@ enum {
 	EC_RECOVERY_DONE
 };
 
+/* Formats of the --timing report. */
+enum updater_timing_format {
+	TIMING_OFF = 0,
+	TIMING_TEXT,
+	TIMING_JSON,
+};
+
+/* Wall time and bytes moved by one stage of an update. */
+struct updater_stage {
+	char *name;
+	double start;
+	double seconds;
+	uint64_t bytes;
+};
+
 enum try_update_type {
 	TRY_UPDATE_OFF = 0,
 	TRY_UPDATE_AUTO,
@@ -87,12 +103,18 @@ struct updater_config {
 	int verbosity;
 	const char *emulation;
 	char *emulation_programmer;
+	char *ec_emulation_programmer;
 	const char *original_programmer;
+	struct flashrom_session *flash_session;
 	int override_gbb_flags;
 	uint32_t gbb_flags;
 	bool detect_model;
 	bool dut_is_remote;
 	bool unlock_me;
+	enum updater_timing_format timing;
+	double timing_start;
+	struct updater_stage *stages;
+	int num_stages;
 };
 
 struct updater_config_arguments {
@@ -100,11 +122,12 @@ struct updater_config_arguments {
 	char *archive, *quirks, *mode;
 	const char *programmer, *write_protection;
 	char *model, *signature_id;
-	char *emulation, *sys_props;
+	char *emulation, *ec_emulation, *sys_props;
 	char *output_dir;
 	char *repack, *unpack;
 	int is_factory, try_update, force_update, do_manifest, host_only;
 	int fast_update;
+	bool write_index;
 	int verbosity;
 	int override_gbb_flags;
 	int detect_servo;
@@ -112,6 +135,7 @@ struct updater_config_arguments {
 	uint32_t gbb_flags;
 	bool detect_model_only;
 	bool unlock_me;
+	enum updater_timing_format timing;
 };
 
 /*
@@ -160,6 +184,8 @@ struct model_config {
 	struct patch_config patches;
 	char *signature_id;
 	int is_custom_label;
+	/* Image contents recorded in a manifest index (or VB2_HASH_INVALID). */
+	struct vb2_hash image_hash, ec_image_hash, pd_image_hash;
 };
 
 struct manifest {
@@ -209,8 +235,10 @@ struct updater_config *updater_new_config(void);
 
 /*
  * Releases all resources in an updater configuration object.
+ * Returns 0 if success, or non-zero if the flash session (which also saves
+ * the contents of an emulated flash to its file) failed to close.
  */
-void updater_delete_config(struct updater_config *cfg);
+int updater_delete_config(struct updater_config *cfg);
 
 /*
  * Handle an argument if it is a shared updater option.
@@ -264,7 +292,7 @@ int quirk_override_signature_id(struct updater_config *cfg,
  * Returns 0 if success, non-zero if error.
  */
 int write_firmware(struct updater_config *cfg,
-		   const struct firmware_image *image,
+		   struct firmware_image *image,
 		   const char *section_name);
 
 /* Functions from updater_archive.c */
@@ -323,10 +351,28 @@ int archive_walk(struct u_archive *ar, void *arg,
 int archive_copy(struct u_archive *from, struct u_archive *to);
 
 /*
- * Creates a new manifest object by scanning files in archive.
+ * Creates a new manifest object from the manifest index in archive if
+ * use_index is true and the index is valid, otherwise by scanning files in
+ * archive.
  * Returns the manifest on success, otherwise NULL for failure.
  */
-struct manifest *new_manifest_from_archive(struct u_archive *archive);
+struct manifest *new_manifest_from_archive(struct u_archive *archive,
+					   bool use_index);
+
+/*
+ * Writes a manifest index into the archive of given manifest, so later runs
+ * can load the manifest without scanning the archive.
+ * Returns 0 on success, otherwise failure.
+ */
+int manifest_write_index(const struct manifest *manifest);
+
+/*
+ * Checks if a loaded image is the one recorded for the model in the manifest
+ * index. Images not from the model or without a recorded hash always pass.
+ * Returns 0 on success, otherwise failure.
+ */
+int model_check_image_hash(const struct model_config *model,
+			   const struct firmware_image *image);
 
 /* Releases all resources allocated by given manifest object. */
 void delete_manifest(struct manifest *manifest);
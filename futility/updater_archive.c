@@ -11,6 +11,7 @@
 #include <sys/types.h>
 #endif
 #include <fts.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -42,6 +43,8 @@
 
 struct u_archive {
 	void *handle;
+	/* Serializes access to the handle, which drivers don't share. */
+	pthread_mutex_t lock;
 
 	void * (*open)(const char *name);
 	int (*close)(void *handle);
@@ -198,23 +201,88 @@ static int archive_fallback_write_file(void *handle, const char *fname,
 
 /*
  * For stream-based archives (e.g., tar+gz) we want to create a cache for
- * storing the names and contents for later processing.
+ * storing the names of entries, and the contents once they are read.
  */
 struct archive_cache {
 	char *name;
 	uint8_t *data;
 	int64_t mtime;
 	size_t size;
+	size_t position;  /* Index of the entry header in the archive. */
 	int has_data;
-	struct archive_cache *next;
+	struct archive_cache *next;  /* In archive order. */
+	struct archive_cache *hash_next;
 };
 
-/* Add a new cache node to an existing cache list and return the new head. */
-static struct archive_cache *archive_cache_new(struct archive_cache *cache,
-					       const char *name)
+/* Entries passed while seeking to another one are kept if this small. */
+#define ARCHIVE_CACHE_READAHEAD_MAX (64 * 1024)
+/* Contents read on demand are only kept in memory up to this size. */
+#define ARCHIVE_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+struct archive_cache_index {
+	char *path;
+	/* The archive being read on demand, and its next header index. */
+	struct archive *reader;
+	size_t position;
+	struct archive_cache *head, *tail;
+	struct archive_cache **buckets;
+	size_t num_buckets;  /* Always a power of 2. */
+	size_t num_entries;
+	size_t cached_bytes;
+	size_t read_bytes;
+	int reopens;
+};
+
+/* FNV-1a over an entry name. */
+static uint32_t archive_cache_hash(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	for (; *name; name++) {
+		hash ^= (uint8_t)*name;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Inserts an entry into its hash bucket, ahead of earlier entries. */
+static void archive_cache_link(struct archive_cache_index *index,
+			       struct archive_cache *c)
+{
+	struct archive_cache **bucket = &index->buckets[
+			archive_cache_hash(c->name) & (index->num_buckets - 1)];
+
+	c->hash_next = *bucket;
+	*bucket = c;
+}
+
+/* Doubles the hash buckets once there are more entries than buckets. */
+static int archive_cache_grow(struct archive_cache_index *index)
+{
+	size_t num_buckets = index->num_buckets ? index->num_buckets * 2 : 64;
+	struct archive_cache *c;
+
+	free(index->buckets);
+	index->buckets = calloc(num_buckets, sizeof(*index->buckets));
+	if (!index->buckets)
+		return -1;
+	index->num_buckets = num_buckets;
+	/* Relinking in archive order keeps the latest duplicate first. */
+	for (c = index->head; c; c = c->next)
+		archive_cache_link(index, c);
+	return 0;
+}
+
+/* Add a new cache node to the end of the cache and return it. */
+static struct archive_cache *archive_cache_new(
+		struct archive_cache_index *index, const char *name)
 {
 	struct archive_cache *c;
 
+	if (index->num_entries >= index->num_buckets &&
+	    archive_cache_grow(index))
+		return NULL;
+
 	c = (struct archive_cache *)calloc(sizeof(*c), 1);
 	if (!c)
 		return NULL;
@@ -225,15 +293,28 @@ static struct archive_cache *archive_cache_new(struct archive_cache *cache,
 		return NULL;
 	}
 
-	c->next = cache;
+	if (index->tail)
+		index->tail->next = c;
+	else
+		index->head = c;
+	index->tail = c;
+	index->num_entries++;
+	archive_cache_link(index, c);
 	return c;
 }
 
 /* Find and return an entry (by name) from the cache. */
-static struct archive_cache *archive_cache_find(struct archive_cache *c,
-						const char *name)
+static struct archive_cache *archive_cache_find(
+		struct archive_cache_index *index, const char *name)
 {
-	for (; c; c = c->next) {
+	struct archive_cache *c;
+
+	if (!index->num_buckets)
+		return NULL;
+
+	c = index->buckets[archive_cache_hash(name) &
+			   (index->num_buckets - 1)];
+	for (; c; c = c->hash_next) {
 		assert(c->name);
 		if (!strcmp(c->name, name))
 			return c;
@@ -243,10 +324,12 @@ static struct archive_cache *archive_cache_find(struct archive_cache *c,
 
 /* Callback for archive_walk to process all entries in the cache. */
 static int archive_cache_walk(
-		struct archive_cache *c, void *arg,
+		struct archive_cache_index *index, void *arg,
 		int (*callback)(const char *name, void *arg))
 {
-	for (; c; c = c->next) {
+	struct archive_cache *c;
+
+	for (c = index->head; c; c = c->next) {
 		assert(c->name);
 		if (callback(c->name, arg))
 			break;
@@ -255,17 +338,21 @@ static int archive_cache_walk(
 }
 
 /* Delete all entries in the cache. */
-static void *archive_cache_free(struct archive_cache *c)
+static void *archive_cache_free(struct archive_cache_index *index)
 {
-	struct archive_cache *next;
+	struct archive_cache *c, *next;
 
-	while (c) {
+	for (c = index->head; c; c = next) {
 		next = c->next;
 		free(c->name);
 		free(c->data);
 		free(c);
-		c = next;
 	}
+	if (index->reader)
+		archive_read_free(index->reader);
+	free(index->buckets);
+	free(index->path);
+	free(index);
 	return NULL;
 }
 
@@ -273,94 +360,172 @@ static void *archive_cache_free(struct archive_cache *c)
  * -- The libarchive driver (multiple formats but very slow). --
  */
 
-enum {
-	FILTER_IGNORE,
-	FILTER_ABORT,
-	FILTER_NAME_ONLY,
-	FILTER_READ_ALL,
-};
-
-static struct archive_cache *libarchive_read_file_entries(
-		const char *fpath, int (*filter)(struct archive_entry *entry))
+static struct archive *libarchive_open_reader(const char *fpath)
 {
 	struct archive *a = archive_read_new();
-	struct archive_entry *entry;
-	struct archive_cache *c, *cache = NULL;
-	int r;
 
 	assert(a);
 	archive_read_support_filter_all(a);
 	archive_read_support_format_all(a);
-	r = archive_read_open_filename(a, fpath, 10240);
-	if (r != ARCHIVE_OK) {
+	if (archive_read_open_filename(a, fpath, 10240) != ARCHIVE_OK) {
 		ERROR("Failed parsing archive using libarchive: %s\n", fpath);
 		archive_read_free(a);
 		return NULL;
 	}
+	return a;
+}
+
+/*
+ * Reads the contents of the current entry of the reader.
+ * Returns an allocated buffer with one extra '\0', or NULL on failure.
+ */
+static uint8_t *libarchive_read_data(struct archive_cache_index *index,
+				     struct archive_cache *c)
+{
+	uint8_t *data = (uint8_t *)malloc(c->size + 1);
+
+	if (!data) {
+		ERROR("Out of memory when loading: %s\n", c->name);
+		return NULL;
+	}
+	if (archive_read_data(index->reader, data, c->size) != c->size) {
+		ERROR("Failed reading from archive: %s\n", c->name);
+		free(data);
+		return NULL;
+	}
+	data[c->size] = '\0';
+	index->read_bytes += c->size;
+	return data;
+}
+
+/* Keeps the contents of an entry in the cache if the budget allows. */
+static int archive_cache_keep(struct archive_cache_index *index,
+			      struct archive_cache *c, uint8_t *data)
+{
+	if (index->cached_bytes + c->size > ARCHIVE_CACHE_MAX_BYTES)
+		return 0;
+	c->data = data;
+	c->has_data = 1;
+	index->cached_bytes += c->size;
+	return 1;
+}
+
+/*
+ * Decompresses the contents of an entry, by reading forward from the last
+ * entry read or from the start of the archive. Small entries passed on the
+ * way are kept, since entries are usually read in the order of the archive.
+ * Returns an allocated buffer with one extra '\0', or NULL on failure.
+ */
+static uint8_t *libarchive_load_entry(struct archive_cache_index *index,
+				      struct archive_cache *c)
+{
+	struct archive_entry *entry;
+	struct archive_cache *passed;
+	uint8_t *data;
+
+	if (index->reader && index->position > c->position) {
+		archive_read_free(index->reader);
+		index->reader = NULL;
+		index->reopens++;
+	}
+	if (!index->reader) {
+		index->reader = libarchive_open_reader(index->path);
+		if (!index->reader)
+			return NULL;
+		index->position = 0;
+	}
+
+	while (archive_read_next_header(index->reader, &entry) == ARCHIVE_OK) {
+		size_t position = index->position++;
+
+		if (position == c->position)
+			return libarchive_read_data(index, c);
 
-	WARN("Loading data from archive: %s ", fpath);
-	while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
-		fputc('.', stderr);
 		if (archive_entry_filetype(entry) != AE_IFREG)
 			continue;
-		if (filter)
-			r = filter(entry);
-		else
-			r = FILTER_READ_ALL;
+		passed = archive_cache_find(index,
+					    archive_entry_pathname(entry));
+		if (!passed || passed->position != position ||
+		    passed->has_data ||
+		    passed->size > ARCHIVE_CACHE_READAHEAD_MAX)
+			continue;
+		data = libarchive_read_data(index, passed);
+		if (data && !archive_cache_keep(index, passed, data))
+			free(data);
+	}
 
-		if (r == FILTER_ABORT)
-			break;
-		if (r == FILTER_IGNORE)
+	ERROR("Failed to find in archive: %s\n", c->name);
+	archive_read_free(index->reader);
+	index->reader = NULL;
+	return NULL;
+}
+
+/*
+ * Indexes the names of all files in an archive. The contents are only
+ * decompressed when they are read.
+ */
+static struct archive_cache_index *libarchive_read_file_entries(
+		const char *fpath)
+{
+	struct archive_cache_index *index;
+	struct archive *a = libarchive_open_reader(fpath);
+	struct archive_entry *entry;
+	struct archive_cache *c;
+	size_t position = 0;
+
+	if (!a)
+		return NULL;
+
+	index = (struct archive_cache_index *)calloc(sizeof(*index), 1);
+	if (!index || !(index->path = strdup(fpath))) {
+		ERROR("Internal error: out of memory.\n");
+		free(index);
+		archive_read_free(a);
+		return NULL;
+	}
+
+	WARN("Loading data from archive: %s ", fpath);
+	while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
+		fputc('.', stderr);
+		if (archive_entry_filetype(entry) != AE_IFREG) {
+			position++;
 			continue;
+		}
 
-		c = archive_cache_new(cache, archive_entry_pathname(entry));
+		c = archive_cache_new(index, archive_entry_pathname(entry));
 		if (!c) {
 			ERROR("Internal error: out of memory.\n");
-			archive_cache_free(cache);
+			archive_cache_free(index);
 			archive_read_free(a);
 			return NULL;
 		}
-		cache = c;
-
-		if (r == FILTER_NAME_ONLY)
-			continue;
-
-		assert(r == FILTER_READ_ALL);
 		c->size = archive_entry_size(entry);
 		c->mtime = archive_entry_mtime(entry);
-		c->data = (uint8_t *)calloc(1, c->size + 1);
-		if (!c->data) {
-			WARN("Out of memory when loading: %s\n", c->name);
-			continue;
-		}
-		if (archive_read_data(a, c->data, c->size) != c->size) {
-			WARN("Failed reading from archive: %s\n", c->name);
-			continue;
-		}
-		c->has_data = 1;
+		c->position = position++;
 	}
 	fputs("\r\n", stderr);  /* Flush the '.' */
-	VB2_DEBUG("Finished loading from archive: %s.\n", fpath);
+	VB2_DEBUG("Finished loading from archive: %s (%zu entries).\n", fpath,
+		  index->num_entries);
 
 	archive_read_free(a);
-	return cache;
+	return index;
 }
 
 /* Callback for archive_open on an ARCHIVE file. */
 static void *archive_libarchive_open(const char *name)
 {
-	/*
-	 * The firmware archives today can usually all load into memory
-	 * so we are using a NULL filter. Change that to a specific list in
-	 * future if the /build/$BOARD/firmware archive becomes too large.
-	 */
-	return libarchive_read_file_entries(name, NULL);
+	return libarchive_read_file_entries(name);
 }
 
 /* Callback for archive_close on an ARCHIVE file. */
 static int archive_libarchive_close(void *handle)
 {
-	archive_cache_free(handle);
+	struct archive_cache_index *index = handle;
+
+	VB2_DEBUG("Archive cache: %zu entries, %zu bytes decompressed on "
+		  "demand (%d rewinds), %zu bytes kept.\n", index->num_entries,
+		  index->read_bytes, index->reopens, index->cached_bytes);
+	archive_cache_free(index);
 	return 0;
 }
 
@@ -383,21 +548,29 @@ static int archive_libarchive_read_file(
 		void *handle, const char *fname, uint8_t **data,
 		uint32_t *size, int64_t *mtime)
 {
-	struct archive_cache *c = archive_cache_find(handle, fname);
+	struct archive_cache_index *index = handle;
+	struct archive_cache *c = archive_cache_find(index, fname);
+	uint8_t *loaded;
 
 	if (!c)
 		return 1;
 
-	if (!c->has_data) {
-		/* TODO(hungte) Re-read. */
-		ERROR("Not in the cache: %s\n", fname);
-		return 1;
-	}
-
 	if (mtime)
 		*mtime = c->mtime;
 	if (size)
 		*size = c->size;
+
+	if (!c->has_data) {
+		loaded = libarchive_load_entry(index, c);
+		if (!loaded)
+			return 1;
+		/* Contents that do not fit in the cache are handed over. */
+		if (!archive_cache_keep(index, c, loaded)) {
+			*data = loaded;
+			return 0;
+		}
+	}
+
 	*data = (uint8_t *)malloc(c->size + 1);
 	if (!*data) {
 		ERROR("Out of memory when reading: %s\n", c->name);
@@ -477,16 +650,19 @@ static int archive_zip_read_file(void *handle, const char *fname,
 	struct zip *zip = (struct zip *)handle;
 	struct zip_file *fp;
 	struct zip_stat stat;
+	zip_int64_t index;
 
 	assert(zip);
 	*data = NULL;
 	*size = 0;
+	/* Look up the name once; entries are then read directly by index. */
+	index = zip_name_locate(zip, fname, 0);
 	zip_stat_init(&stat);
-	if (zip_stat(zip, fname, 0, &stat)) {
+	if (index < 0 || zip_stat_index(zip, index, 0, &stat)) {
 		ERROR("Fail to stat entry in ZIP: %s\n", fname);
 		return 1;
 	}
-	fp = zip_fopen(zip, fname, 0);
+	fp = zip_fopen_index(zip, index, 0);
 	if (!fp) {
 		ERROR("Failed to open entry in ZIP: %s\n", fname);
 		return 1;
@@ -514,11 +690,20 @@ static int archive_zip_write_file(void *handle, const char *fname,
 {
 	struct zip *zip = (struct zip *)handle;
 	struct zip_source *src;
+	uint8_t *copy;
 
 	VB2_DEBUG("Writing %s\n", fname);
 	assert(zip);
-	src = zip_source_buffer(zip, data, size, 0);
+	/* The data is only read when the archive is closed. */
+	copy = (uint8_t *)malloc(size ? size : 1);
+	if (!copy) {
+		ERROR("Internal error: cannot allocate buffer: %s\n", fname);
+		return 1;
+	}
+	memcpy(copy, data, size);
+	src = zip_source_buffer(zip, copy, size, 1);
 	if (!src) {
+		free(copy);
 		ERROR("Internal error: cannot allocate buffer: %s\n", fname);
 		return 1;
 	}
@@ -619,6 +804,7 @@ struct u_archive *archive_open(const char *path)
 		free(ar);
 		return NULL;
 	}
+	pthread_mutex_init(&ar->lock, NULL);
 	return ar;
 }
 
@@ -629,6 +815,7 @@ struct u_archive *archive_open(const char *path)
 int archive_close(struct u_archive *ar)
 {
 	int r = ar->close(ar->handle);
+	pthread_mutex_destroy(&ar->lock);
 	free(ar);
 	return r;
 }
@@ -641,9 +828,14 @@ int archive_close(struct u_archive *ar)
  */
 int archive_has_entry(struct u_archive *ar, const char *name)
 {
+	int r;
+
 	if (!ar || *name == '/')
 		return archive_fallback_has_entry(NULL, name);
-	return ar->has_entry(ar->handle, name);
+	pthread_mutex_lock(&ar->lock);
+	r = ar->has_entry(ar->handle, name);
+	pthread_mutex_unlock(&ar->lock);
+	return r;
 }
 
 /*
@@ -667,15 +859,21 @@ int archive_walk(struct u_archive *ar, void *arg,
  * from real file system.
  * The returned data must always have one extra (not included by size) '\0' in
  * the end of the allocated buffer for C string processing.
+ * This may be called from several threads at once.
  * Returns 0 on success (data and size reflects the file content),
  * otherwise non-zero as failure.
  */
 int archive_read_file(struct u_archive *ar, const char *fname,
 		      uint8_t **data, uint32_t *size, int64_t *mtime)
 {
+	int r;
+
 	if (!ar || *fname == '/')
 		return archive_fallback_read_file(NULL, fname, data, size, mtime);
-	return ar->read_file(ar->handle, fname, data, size, mtime);
+	pthread_mutex_lock(&ar->lock);
+	r = ar->read_file(ar->handle, fname, data, size, mtime);
+	pthread_mutex_unlock(&ar->lock);
+	return r;
 }
 
 /*
@@ -687,9 +885,14 @@ int archive_read_file(struct u_archive *ar, const char *fname,
 int archive_write_file(struct u_archive *ar, const char *fname,
 		       uint8_t *data, uint32_t size, int64_t mtime)
 {
+	int r;
+
 	if (!ar || *fname == '/')
 		return archive_fallback_write_file(NULL, fname, data, size, mtime);
-	return ar->write_file(ar->handle, fname, data, size, mtime);
+	pthread_mutex_lock(&ar->lock);
+	r = ar->write_file(ar->handle, fname, data, size, mtime);
+	pthread_mutex_unlock(&ar->lock);
+	return r;
 }
 
 struct _copy_arg {
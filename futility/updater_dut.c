@@ -49,6 +49,9 @@ int dut_set_property_string(const char *key, const char *value,
 		WARN("Ignored setting property %s on a remote DUT.\n", key);
 		return -1;
 	}
+	/* crossystem may read or write the flash (e.g. NVRAM) on its own. */
+	if (close_flash_session(cfg))
+		return -1;
 	return VbSetSystemPropertyString(key, value);
 }
 
@@ -59,6 +62,8 @@ const char *dut_get_property_string(const char *key, char *dest, size_t size,
 		WARN("Ignored getting property %s on a remote DUT.\n", key);
 		return NULL;
 	}
+	if (close_flash_session(cfg))
+		return NULL;
 	return VbGetSystemPropertyString(key, dest, size);
 }
 
@@ -69,6 +74,8 @@ int dut_set_property_int(const char *key, const int value,
 		WARN("Ignored setting property %s on a remote DUT.\n", key);
 		return -1;
 	}
+	if (close_flash_session(cfg))
+		return -1;
 	return VbSetSystemPropertyInt(key, value);
 }
 
@@ -78,6 +85,8 @@ int dut_get_property_int(const char *key, struct updater_config *cfg)
 		WARN("Ignored getting property %s on a remote DUT.\n", key);
 		return -1;
 	}
+	if (close_flash_session(cfg))
+		return -1;
 	return VbGetSystemPropertyInt(key);
 }
 
@@ -127,6 +136,7 @@ static int dut_get_wp_sw(struct updater_config *cfg)
 	assert(cfg->image.programmer);
 	bool mode;
 
+	prepare_flash_session(cfg, cfg->image.programmer);
 	if (flashrom_get_wp(cfg->image.programmer, &mode, NULL, NULL, -1)) {
 		/* Read WP status error */
 		return -1;
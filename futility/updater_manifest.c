@@ -9,6 +9,7 @@
 #if defined(__OpenBSD__)
 #include <sys/types.h>
 #endif
+#include <time.h>
 
 #include "updater.h"
 #include "util_misc.h"
@@ -56,6 +57,10 @@
  *
  * The current implementation is to first look at `setvars.sh` first, and then
  * fallback to `signer_config.csv` if needed.
+ *
+ * Scanning a large archive takes time, so the manifest may also be stored in
+ * a binary 'manifest.index' file (see manifest_write_index), which is used
+ * instead of scanning if available.
  */
 
 static const char * const SETVARS_IMAGE_MAIN = "IMAGE_MAIN",
@@ -72,6 +77,7 @@ static const char * const SETVARS_IMAGE_MAIN = "IMAGE_MAIN",
 		  * const ENV_VAR_MODEL_DIR = "${MODEL_DIR}",
 		  * const PATH_STARTSWITH_KEYSET = "keyset/",
 		  * const PATH_SIGNER_CONFIG = "signer_config.csv",
+		  * const PATH_MANIFEST_INDEX = "manifest.index",
 		  * const PATH_ENDSWITH_SETVARS = "/setvars.sh";
 
 /* Utility function to convert a string. */
@@ -454,6 +460,18 @@ static void clear_patch_config(struct patch_config *patch)
 	memset(patch, 0, sizeof(*patch));
 }
 
+/* Releases (and zeros) the data inside a model config. */
+static void clear_model_config(struct model_config *model)
+{
+	free(model->name);
+	free(model->signature_id);
+	free(model->image);
+	free(model->ec_image);
+	free(model->pd_image);
+	clear_patch_config(&model->patches);
+	memset(model, 0, sizeof(*model));
+}
+
 /*
  * Creates the manifest from the 'signer_config.csv' file.
  * Returns 0 on success (loaded), otherwise failure.
@@ -686,6 +704,7 @@ manifest_detect_model_from_frid(struct updater_config *cfg,
 	const struct model_config *result = NULL;
 	struct firmware_image current_ro_frid = {0};
 	current_ro_frid.programmer = cfg->image_current.programmer;
+	prepare_flash_session(cfg, current_ro_frid.programmer);
 	int error = flashrom_read_region(&current_ro_frid, FMAP_RO_FRID,
 					 cfg->verbosity + 1);
 	const char *from_dot;
@@ -815,18 +834,275 @@ int model_apply_custom_label(
 }
 
 /*
- * Creates a new manifest object by scanning files in archive.
- * Returns the manifest on success, otherwise NULL for failure.
+ * The manifest index is a compact binary form of a manifest, written into the
+ * archive by "--manifest --write-index". It has a header, the models, and a
+ * string table with all paths and names in the models.
+ */
+#define MANIFEST_INDEX_MAGIC "VBMFIDX"
+#define MANIFEST_INDEX_VERSION 1
+
+enum manifest_index_field {
+	INDEX_NAME,
+	INDEX_IMAGE,
+	INDEX_EC_IMAGE,
+	INDEX_PD_IMAGE,
+	INDEX_SIGNATURE_ID,
+	INDEX_ROOTKEY,
+	INDEX_VBLOCK_A,
+	INDEX_VBLOCK_B,
+	INDEX_GSCVD,
+	INDEX_NUM_FIELDS,
+};
+
+struct manifest_index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_models;
+	int32_t default_model;
+	uint32_t has_keyset;
+	uint32_t strings_size;
+	/* Of the models and the string table. */
+	struct vb2_hash hash;
+} __attribute__((packed));
+
+struct manifest_index_model {
+	/* Offset in the string table plus one, or 0 for NULL. */
+	uint32_t fields[INDEX_NUM_FIELDS];
+	uint32_t is_custom_label;
+	struct vb2_hash image_hash, ec_image_hash, pd_image_hash;
+} __attribute__((packed));
+
+/* Collects pointers to the string fields of a model config. */
+static void model_index_fields(struct model_config *model,
+			       char **fields[INDEX_NUM_FIELDS])
+{
+	fields[INDEX_NAME] = &model->name;
+	fields[INDEX_IMAGE] = &model->image;
+	fields[INDEX_EC_IMAGE] = &model->ec_image;
+	fields[INDEX_PD_IMAGE] = &model->pd_image;
+	fields[INDEX_SIGNATURE_ID] = &model->signature_id;
+	fields[INDEX_ROOTKEY] = &model->patches.rootkey;
+	fields[INDEX_VBLOCK_A] = &model->patches.vblock_a;
+	fields[INDEX_VBLOCK_B] = &model->patches.vblock_b;
+	fields[INDEX_GSCVD] = &model->patches.gscvd;
+}
+
+/*
+ * Calculates the hash of an image file in archive, or leaves it invalid if
+ * there is no such image.
+ * Returns 0 on success, otherwise failure.
+ */
+static int hash_archive_file(struct u_archive *archive, const char *fpath,
+			     struct vb2_hash *hash)
+{
+	uint8_t *data;
+	uint32_t size;
+	int r;
+
+	hash->algo = VB2_HASH_INVALID;
+	if (!fpath)
+		return 0;
+	if (archive_read_file(archive, fpath, &data, &size, NULL)) {
+		ERROR("Failed reading: %s\n", fpath);
+		return -1;
+	}
+	r = vb2_hash_calculate(false, data, size, VB2_HASH_SHA256, hash);
+	free(data);
+	return r;
+}
+
+int manifest_write_index(const struct manifest *manifest)
+{
+	struct manifest_index_header *header;
+	struct manifest_index_model *models;
+	char **fields[INDEX_NUM_FIELDS];
+	size_t models_size, strings_size = 0, offset = 0, size;
+	char *strings;
+	int i, j, r = 0;
+
+	for (i = 0; i < manifest->num; i++) {
+		model_index_fields(&manifest->models[i], fields);
+		for (j = 0; j < INDEX_NUM_FIELDS; j++)
+			if (*fields[j])
+				strings_size += strlen(*fields[j]) + 1;
+	}
+
+	models_size = manifest->num * sizeof(*models);
+	size = sizeof(*header) + models_size + strings_size;
+	header = (struct manifest_index_header *)calloc(1, size);
+	if (!header) {
+		ERROR("Internal error: memory allocation error.\n");
+		return -1;
+	}
+	models = (struct manifest_index_model *)(header + 1);
+	strings = (char *)models + models_size;
+
+	memcpy(header->magic, MANIFEST_INDEX_MAGIC, sizeof(header->magic));
+	header->version = MANIFEST_INDEX_VERSION;
+	header->num_models = manifest->num;
+	header->default_model = manifest->default_model;
+	header->has_keyset = manifest->has_keyset;
+	header->strings_size = strings_size;
+
+	for (i = 0; i < manifest->num && !r; i++) {
+		struct model_config *model = &manifest->models[i];
+		struct manifest_index_model *m = &models[i];
+
+		model_index_fields(model, fields);
+		for (j = 0; j < INDEX_NUM_FIELDS; j++) {
+			if (!*fields[j])
+				continue;
+			m->fields[j] = offset + 1;
+			strcpy(strings + offset, *fields[j]);
+			offset += strlen(*fields[j]) + 1;
+		}
+		m->is_custom_label = model->is_custom_label;
+		r = hash_archive_file(manifest->archive, model->image,
+				      &m->image_hash) ||
+		    hash_archive_file(manifest->archive, model->ec_image,
+				      &m->ec_image_hash) ||
+		    hash_archive_file(manifest->archive, model->pd_image,
+				      &m->pd_image_hash);
+	}
+
+	if (!r)
+		r = vb2_hash_calculate(false, models, models_size + strings_size,
+				       VB2_HASH_SHA256, &header->hash);
+	if (!r)
+		r = archive_write_file(manifest->archive, PATH_MANIFEST_INDEX,
+				       (uint8_t *)header, size, time(NULL));
+	if (r)
+		ERROR("Failed to write the manifest index: %s\n",
+		      PATH_MANIFEST_INDEX);
+	else
+		INFO("Wrote the manifest index of %d model(s): %s\n",
+		     manifest->num, PATH_MANIFEST_INDEX);
+	free(header);
+	return r;
+}
+
+/*
+ * Creates the manifest from the manifest index in archive.
+ * Returns 0 on success (loaded), otherwise failure.
  */
-struct manifest *new_manifest_from_archive(struct u_archive *archive)
+static int manifest_from_index(struct manifest *manifest)
+{
+	struct u_archive *archive = manifest->archive;
+	const struct manifest_index_header *header;
+	const struct manifest_index_model *models;
+	char **fields[INDEX_NUM_FIELDS];
+	const char *strings;
+	uint8_t *data;
+	uint32_t size, i, j;
+
+	if (!archive_has_entry(archive, PATH_MANIFEST_INDEX))
+		return -1;
+	if (archive_read_file(archive, PATH_MANIFEST_INDEX, &data, &size,
+			      NULL)) {
+		ERROR("Failed reading: %s\n", PATH_MANIFEST_INDEX);
+		return -1;
+	}
+
+	header = (const struct manifest_index_header *)data;
+	models = (const struct manifest_index_model *)(header + 1);
+	strings = (const char *)(models + header->num_models);
+	if (size < sizeof(*header) ||
+	    memcmp(header->magic, MANIFEST_INDEX_MAGIC, sizeof(header->magic)) ||
+	    header->version != MANIFEST_INDEX_VERSION ||
+	    header->num_models > (size - sizeof(*header)) / sizeof(*models) ||
+	    header->strings_size != size - sizeof(*header) -
+				    header->num_models * sizeof(*models) ||
+	    (header->strings_size && strings[header->strings_size - 1]) ||
+	    header->default_model >= (int32_t)header->num_models ||
+	    vb2_hash_verify(false, models, size - sizeof(*header),
+			    &header->hash)) {
+		WARN("Ignored invalid or outdated manifest index: %s\n",
+		     PATH_MANIFEST_INDEX);
+		free(data);
+		return -1;
+	}
+
+	for (i = 0; i < header->num_models; i++) {
+		const struct manifest_index_model *m = &models[i];
+		struct model_config model = {0};
+
+		model_index_fields(&model, fields);
+		for (j = 0; j < INDEX_NUM_FIELDS; j++) {
+			if (!m->fields[j])
+				continue;
+			if (m->fields[j] > header->strings_size)
+				break;
+			*fields[j] = strdup(strings + m->fields[j] - 1);
+		}
+		model.is_custom_label = m->is_custom_label;
+		model.image_hash = m->image_hash;
+		model.ec_image_hash = m->ec_image_hash;
+		model.pd_image_hash = m->pd_image_hash;
+		if (j < INDEX_NUM_FIELDS || !model.name ||
+		    !manifest_add_model(manifest, &model)) {
+			ERROR("Invalid model %u in %s.\n", i,
+			      PATH_MANIFEST_INDEX);
+			clear_model_config(&model);
+			while (manifest->num > 0)
+				clear_model_config(
+					&manifest->models[--manifest->num]);
+			free(manifest->models);
+			manifest->models = NULL;
+			free(data);
+			return -1;
+		}
+	}
+	manifest->default_model = header->default_model;
+	manifest->has_keyset = header->has_keyset;
+	VB2_DEBUG("Loaded %d model(s) from %s.\n", manifest->num,
+		  PATH_MANIFEST_INDEX);
+	free(data);
+	return 0;
+}
+
+int model_check_image_hash(const struct model_config *model,
+			   const struct firmware_image *image)
+{
+	const struct vb2_hash *hash = NULL;
+
+	if (!image->data || !image->file_name)
+		return 0;
+	if (model->image && !strcmp(image->file_name, model->image))
+		hash = &model->image_hash;
+	else if (model->ec_image && !strcmp(image->file_name, model->ec_image))
+		hash = &model->ec_image_hash;
+	else if (model->pd_image && !strcmp(image->file_name, model->pd_image))
+		hash = &model->pd_image_hash;
+	if (!hash || hash->algo == VB2_HASH_INVALID)
+		return 0;
+
+	if (vb2_hash_verify(false, image->data, image->size, hash)) {
+		ERROR("%s does not match the manifest index (%s). "
+		      "Regenerate it with --manifest --write-index.\n",
+		      image->file_name, PATH_MANIFEST_INDEX);
+		return -1;
+	}
+	return 0;
+}
+
+struct manifest *new_manifest_from_archive(struct u_archive *archive,
+					   bool use_index)
 {
 	struct manifest manifest = {0}, *new_manifest;
 
 	manifest.archive = archive;
 	manifest.default_model = -1;
 
-	VB2_DEBUG("Try to build a manifest from *%s\n", PATH_ENDSWITH_SETVARS);
-	archive_walk(archive, &manifest, manifest_scan_entries);
+	if (use_index) {
+		VB2_DEBUG("Try to load the manifest from %s\n",
+			  PATH_MANIFEST_INDEX);
+		manifest_from_index(&manifest);
+	}
+	if (manifest.num == 0) {
+		VB2_DEBUG("Try to build a manifest from *%s\n",
+			  PATH_ENDSWITH_SETVARS);
+		archive_walk(archive, &manifest, manifest_scan_entries);
+	}
 
 	if (manifest.num == 0) {
 		VB2_DEBUG("Try to build a manifest from %s\n",
@@ -862,15 +1138,8 @@ void delete_manifest(struct manifest *manifest)
 {
 	int i;
 	assert(manifest);
-	for (i = 0; i < manifest->num; i++) {
-		struct model_config *model = &manifest->models[i];
-		free(model->name);
-		free(model->signature_id);
-		free(model->image);
-		free(model->ec_image);
-		free(model->pd_image);
-		clear_patch_config(&model->patches);
-	}
+	for (i = 0; i < manifest->num; i++)
+		clear_model_config(&manifest->models[i]);
 	free(manifest->models);
 	free(manifest);
 }
@@ -106,29 +106,26 @@ static int is_ec_software_sync_enabled(struct updater_config *cfg)
  */
 static int ec_ro_software_sync(struct updater_config *cfg)
 {
-	const char *ec_ro_path;
 	uint8_t *ec_ro_data;
 	uint32_t ec_ro_len;
 	int is_same_ec_ro;
 	struct firmware_section ec_ro_sec;
-	const char *tmp_path = get_firmware_image_temp_file(
-			&cfg->image, &cfg->tempfiles);
 
-	if (!tmp_path)
-		return 1;
 	find_firmware_section(&ec_ro_sec, &cfg->ec_image, "EC_RO");
 	if (!ec_ro_sec.data || !ec_ro_sec.size) {
 		ERROR("EC image has invalid section '%s'.\n", "EC_RO");
 		return 1;
 	}
-	ec_ro_path = cbfs_extract_file(tmp_path, FMAP_RO_CBFS, "ecro",
-				       &cfg->tempfiles);
-	if (!ec_ro_path ||
-	    !cbfs_file_exists(tmp_path, FMAP_RO_CBFS, "ecro.hash")) {
+	if (!cbfs_file_exists(&cfg->image, FMAP_RO_CBFS, "ecro",
+			      &cfg->tempfiles) ||
+	    !cbfs_file_exists(&cfg->image, FMAP_RO_CBFS, "ecro.hash",
+			      &cfg->tempfiles)) {
 		INFO("No valid EC RO for software sync in AP firmware.\n");
 		return 1;
 	}
-	if (vb2_read_file(ec_ro_path, &ec_ro_data, &ec_ro_len) != VB2_SUCCESS) {
+	ec_ro_data = cbfs_read_file(&cfg->image, FMAP_RO_CBFS, "ecro",
+				    &ec_ro_len, &cfg->tempfiles);
+	if (!ec_ro_data) {
 		ERROR("Failed to read EC RO.\n");
 		return 1;
 	}
@@ -274,15 +271,10 @@ static int quirk_min_platform_version(struct updater_config *cfg)
 static int quirk_eve_smm_store(struct updater_config *cfg)
 {
 	const char *smm_store_name = "smm_store";
-	const char *old_store;
+	const char *old_store, *temp_image;
 	char *command;
-	const char *temp_image = get_firmware_image_temp_file(
-			&cfg->image_current, &cfg->tempfiles);
 
-	if (!temp_image)
-		return -1;
-
-	old_store = cbfs_extract_file(temp_image, FMAP_RW_LEGACY,
+	old_store = cbfs_extract_file(&cfg->image_current, FMAP_RW_LEGACY,
 				      smm_store_name, &cfg->tempfiles);
 	if (!old_store) {
 		VB2_DEBUG("cbfstool failure or SMM store not available. "
@@ -290,7 +282,6 @@ static int quirk_eve_smm_store(struct updater_config *cfg)
 		return 0;
 	}
 
-	/* Reuse temp_image */
 	temp_image = get_firmware_image_temp_file(&cfg->image, &cfg->tempfiles);
 	if (!temp_image)
 		return -1;
@@ -541,6 +532,11 @@ void updater_register_quirks(struct updater_config *cfg)
 	quirks->name = "clear_mrc_data";
 	quirks->help = "b/255617349: Clear memory training data (MRC).";
 	quirks->apply = quirk_clear_mrc_data;
+
+	quirks = &cfg->quirks[QUIRK_PARALLEL_EC_WRITE];
+	quirks->name = "parallel_ec_write";
+	quirks->help = "Write EC and AP firmware at once (independent buses).";
+	quirks->apply = NULL;  /* Simple config. */
 }
 
 /*
@@ -577,33 +573,25 @@ char *updater_get_cbfs_quirks(struct updater_config *cfg)
 	const char *cbfs_region = "FW_MAIN_A";
 	struct firmware_section cbfs_section;
 
-	/* Before invoking cbfstool, try to search for CBFS file name. */
 	find_firmware_section(&cbfs_section, &cfg->image, cbfs_region);
-	if (!cbfs_section.size || !memmem(cbfs_section.data, cbfs_section.size,
-					  entry_name, strlen(entry_name))) {
-		if (!cbfs_section.size)
-			VB2_DEBUG("Missing region: %s\n", cbfs_region);
-		else
-			VB2_DEBUG("Cannot find entry: %s\n", entry_name);
+	if (!cbfs_section.size) {
+		VB2_DEBUG("Missing region: %s\n", cbfs_region);
 		return NULL;
 	}
 
-	const char *tmp_path = get_firmware_image_temp_file(
-			&cfg->image, &cfg->tempfiles);
 	uint8_t *data = NULL;
 	uint32_t size = 0;
 
-	/* Although the name exists, it may not be a real file. */
-	if (!cbfs_file_exists(tmp_path, cbfs_region, entry_name)) {
-		VB2_DEBUG("Found string '%s' but not a file.\n", entry_name);
+	if (!cbfs_file_exists(&cfg->image, cbfs_region, entry_name,
+			      &cfg->tempfiles)) {
+		VB2_DEBUG("Cannot find entry: %s\n", entry_name);
 		return NULL;
 	}
 
 	VB2_DEBUG("Found %s from CBFS %s\n", entry_name, cbfs_region);
-	tmp_path = cbfs_extract_file(tmp_path, cbfs_region, entry_name,
-				     &cfg->tempfiles);
-	if (!tmp_path ||
-	    vb2_read_file(tmp_path, &data, &size) != VB2_SUCCESS) {
+	data = cbfs_read_file(&cfg->image, cbfs_region, entry_name, &size,
+			      &cfg->tempfiles);
+	if (!data) {
 		ERROR("Failed to read [%s] from CBFS [%s].\n",
 		      entry_name, cbfs_region);
 		return NULL;
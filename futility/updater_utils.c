@@ -6,22 +6,33 @@
  */
 
 #include <assert.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #if defined (__FreeBSD__) || defined(__OpenBSD__)
 #include <sys/wait.h>
 #endif
 
 #include "2common.h"
+#include "cbfstool.h"
 #include "host_misc.h"
 #include "util_misc.h"
 #include "updater.h"
 
 #define COMMAND_BUFFER_SIZE 256
 
+/* The ranges of a lazily loaded system firmware image read so far. */
+struct partial_read {
+	struct updater_config *cfg;
+	int verbosity;
+	struct flash_range *loaded; /* Sorted by offset and never adjacent. */
+	size_t count;
+};
+
 /*
  * Strips a string (usually from shell execution output) by removing all the
  * trailing characters in pattern. If pattern is NULL, match by space type
@@ -70,17 +81,62 @@ int save_file_from_stdin(const char *output)
 	return 0;
 }
 
+/*
+ * Finds a file (cbfs_entry_name) in a CBFS section of a firmware image.
+ * Returns 0 and the file in *file if found, -1 if the section or the file
+ * does not exist, or 1 if the CBFS is malformed and only cbfstool can tell.
+ */
+static int find_cbfs_file(struct firmware_image *image,
+			  const char *section_name,
+			  const char *cbfs_entry_name,
+			  struct cbfs_file_info *file)
+{
+	struct firmware_section section;
+	vb2_error_t rv;
+
+	if (find_firmware_section(&section, image, section_name))
+		return -1;
+	rv = cbfs_find_file(section.data, section.size, cbfs_entry_name, file);
+	if (rv == VB2_SUCCESS)
+		return 0;
+	if (rv == VB2_ERROR_CBFS_FILE_NOT_FOUND)
+		return -1;
+	VB2_DEBUG("Malformed CBFS in %s, using cbfstool.\n", section_name);
+	return 1;
+}
+
+/*
+ * Returns true if the contents of a CBFS file can be used as stored, which
+ * is what cbfstool extracts for uncompressed raw files.
+ */
+static bool is_plain_cbfs_file(const struct cbfs_file_info *file)
+{
+	return file->type == CBFS_TYPE_RAW &&
+		file->compression == CBFS_COMPRESS_NONE;
+}
+
 /*
  * Returns 1 if a given file (cbfs_entry_name) exists inside a particular CBFS
- * section of an image file, otherwise 0.
+ * section of a firmware image, otherwise 0.
  */
-int cbfs_file_exists(const char *image_file,
+int cbfs_file_exists(struct firmware_image *image,
 		     const char *section_name,
-		     const char *cbfs_entry_name)
+		     const char *cbfs_entry_name,
+		     struct tempfile *tempfiles)
 {
+	struct cbfs_file_info file;
+	const char *image_file;
 	char *cmd;
 	int r;
 
+	r = find_cbfs_file(image, section_name, cbfs_entry_name, &file);
+	if (r <= 0)
+		return !r;
+
+	image_file = get_firmware_image_temp_file(image, tempfiles);
+	if (!image_file)
+		return 0;
+
 	ASPRINTF(&cmd,
 		 "cbfstool '%s' print -r %s 2>/dev/null | grep -q '^%s '",
 		 image_file, section_name, cbfs_entry_name);
@@ -90,20 +146,36 @@ int cbfs_file_exists(const char *image_file,
 }
 
 /*
- * Extracts files from a CBFS on given region (section) of image_file.
+ * Extracts files from a CBFS on given region (section) of a firmware image.
  * Returns the path to a temporary file on success, otherwise NULL.
  */
-const char *cbfs_extract_file(const char *image_file,
+const char *cbfs_extract_file(struct firmware_image *image,
 			      const char *cbfs_region,
 			      const char *cbfs_name,
 			      struct tempfile *tempfiles)
 {
-	const char *output = create_temp_file(tempfiles);
+	struct cbfs_file_info file;
+	const char *output, *image_file;
 	char *command, *result;
 
+	int found = find_cbfs_file(image, cbfs_region, cbfs_name, &file);
+
+	if (found < 0)
+		return NULL;
+
+	output = create_temp_file(tempfiles);
 	if (!output)
 		return NULL;
 
+	if (found == 0 && is_plain_cbfs_file(&file))
+		return vb2_write_file(output, file.data, file.size) ==
+			VB2_SUCCESS ? output : NULL;
+
+	/* Let cbfstool decompress or convert the file. */
+	image_file = get_firmware_image_temp_file(image, tempfiles);
+	if (!image_file)
+		return NULL;
+
 	ASPRINTF(&command, "cbfstool \"%s\" extract -r %s -n \"%s\" "
 		 "-f \"%s\" 2>&1", image_file, cbfs_region,
 		 cbfs_name, output);
@@ -118,6 +190,42 @@ const char *cbfs_extract_file(const char *image_file,
 	return output;
 }
 
+uint8_t *cbfs_read_file(struct firmware_image *image,
+			const char *cbfs_region,
+			const char *cbfs_name,
+			uint32_t *size,
+			struct tempfile *tempfiles)
+{
+	struct cbfs_file_info file;
+	const char *path;
+	uint8_t *data = NULL, *new_data;
+	int found = find_cbfs_file(image, cbfs_region, cbfs_name, &file);
+
+	if (found < 0)
+		return NULL;
+
+	if (found == 0 && is_plain_cbfs_file(&file)) {
+		data = (uint8_t *)malloc(file.size + 1);
+		if (!data)
+			return NULL;
+		memcpy(data, file.data, file.size);
+		*size = file.size;
+	} else {
+		path = cbfs_extract_file(image, cbfs_region, cbfs_name,
+					 tempfiles);
+		if (!path || vb2_read_file(path, &data, size) != VB2_SUCCESS)
+			return NULL;
+		new_data = (uint8_t *)realloc(data, *size + 1);
+		if (!new_data) {
+			free(data);
+			return NULL;
+		}
+		data = new_data;
+	}
+	data[*size] = '\0';
+	return data;
+}
+
 /*
  * Loads the firmware information from an FMAP section in loaded firmware image.
  * The section should only contain ASCIIZ string as firmware version.
@@ -175,6 +283,10 @@ static int parse_firmware_image(struct firmware_image *image)
 	if (!image->fmap_header) {
 		ERROR("Invalid image file (missing FMAP): %s\n", image->file_name);
 		ret = IMAGE_PARSE_FAILURE;
+	} else {
+		fmap_index_free(image->fmap_index);
+		image->fmap_index = fmap_index_create(
+				image->data, image->size, image->fmap_header);
 	}
 
 	if (load_firmware_version(image, FMAP_RO_FRID, &image->ro_version))
@@ -238,10 +350,15 @@ int load_firmware_image(struct firmware_image *image, const char *file_name,
  *
  * Returns a file path if success, otherwise NULL.
  */
-const char *get_firmware_image_temp_file(const struct firmware_image *image,
+const char *get_firmware_image_temp_file(struct firmware_image *image,
 					 struct tempfile *tempfiles)
 {
-	const char *tmp_path = create_temp_file(tempfiles);
+	const char *tmp_path;
+
+	if (complete_firmware_image(image))
+		return NULL;
+
+	tmp_path = create_temp_file(tempfiles);
 	if (!tmp_path)
 		return NULL;
 
@@ -267,6 +384,10 @@ void free_firmware_image(struct firmware_image *image)
 
 	free(image->data);
 	free(image->file_name);
+	fmap_index_free(image->fmap_index);
+	if (image->partial)
+		free(image->partial->loaded);
+	free(image->partial);
 	free(image->ro_version);
 	free(image->rw_version_a);
 	free(image->rw_version_b);
@@ -274,13 +395,295 @@ void free_firmware_image(struct firmware_image *image)
 	image->programmer = programmer;
 }
 
+/* Returns true if [start, end) of a lazily loaded image was read. */
+static bool is_range_loaded(const struct partial_read *partial,
+			    uint32_t start, uint32_t end)
+{
+	size_t i;
+
+	for (i = 0; i < partial->count; i++) {
+		const struct flash_range *r = &partial->loaded[i];
+
+		if (r->offset <= start && end <= r->offset + r->size)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Copies the parts of [start, end) that were already read (and may have been
+ * changed since) from saved, which holds the image contents of [start, end)
+ * before the range was read again, back to the image in dest.
+ */
+static void restore_loaded_ranges(const struct partial_read *partial,
+				  uint8_t *dest, const uint8_t *saved,
+				  uint32_t start, uint32_t end)
+{
+	size_t i;
+
+	for (i = 0; i < partial->count; i++) {
+		const struct flash_range *r = &partial->loaded[i];
+		uint32_t from = VB2_MAX(start, r->offset);
+		uint32_t to = VB2_MIN(end, r->offset + r->size);
+
+		if (from < to)
+			memcpy(dest + from, saved + (from - start), to - from);
+	}
+}
+
+/*
+ * Records [start, end) of a lazily loaded image as read.
+ * Returns 0 if success, non-zero if error.
+ */
+static int add_loaded_range(struct partial_read *partial, uint32_t start,
+			    uint32_t end)
+{
+	struct flash_range *loaded;
+	size_t i, count = 0;
+
+	/* Merge the new range into the sorted list. */
+	loaded = (struct flash_range *)malloc(
+			(partial->count + 1) * sizeof(*loaded));
+	if (!loaded)
+		return -1;
+	for (i = 0; i < partial->count; i++) {
+		const struct flash_range *r = &partial->loaded[i];
+
+		if (r->offset + r->size < start) {
+			loaded[count++] = *r;
+		} else if (r->offset > end) {
+			break;
+		} else {
+			start = VB2_MIN(start, r->offset);
+			end = VB2_MAX(end, r->offset + r->size);
+		}
+	}
+	loaded[count].offset = start;
+	loaded[count++].size = end - start;
+	for (; i < partial->count; i++)
+		loaded[count++] = partial->loaded[i];
+
+	free(partial->loaded);
+	partial->loaded = loaded;
+	partial->count = count;
+	return 0;
+}
+
+double get_monotonic_time(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int begin_update_stage(struct updater_config *cfg, const char *name)
+{
+	struct updater_stage *stages, *stage;
+
+	if (!cfg || !cfg->timing)
+		return -1;
+
+	stages = (struct updater_stage *)realloc(
+			cfg->stages, (cfg->num_stages + 1) * sizeof(*stages));
+	if (!stages)
+		return -1;
+	cfg->stages = stages;
+	stage = &stages[cfg->num_stages];
+	stage->name = strdup(name);
+	stage->seconds = 0;
+	stage->bytes = 0;
+	stage->start = get_monotonic_time();
+	return cfg->num_stages++;
+}
+
+void end_update_stage(struct updater_config *cfg, int stage, uint64_t bytes)
+{
+	if (!cfg || stage < 0 || stage >= cfg->num_stages)
+		return;
+	cfg->stages[stage].seconds =
+		get_monotonic_time() - cfg->stages[stage].start;
+	cfg->stages[stage].bytes = bytes;
+}
+
+/*
+ * Prints a string as a quoted JSON string. Stage names include programmer
+ * and section names, which may contain quotes, backslashes or control
+ * characters.
+ */
+static void print_json_string(FILE *fp, const char *str)
+{
+	const unsigned char *c;
+
+	fputc('"', fp);
+	for (c = (const unsigned char *)str; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(fp, "\\%c", *c);
+		else if (*c < 0x20)
+			fprintf(fp, "\\u%04x", *c);
+		else
+			fputc(*c, fp);
+	}
+	fputc('"', fp);
+}
+
+void print_update_timing(const struct updater_config *cfg)
+{
+	/* Keep the report out of stdout, which may carry --manifest JSON. */
+	FILE *fp = stderr;
+	double total = 0;
+	int i;
+
+	if (!cfg->timing || !cfg->num_stages)
+		return;
+	total = get_monotonic_time() - cfg->timing_start;
+
+	if (cfg->timing == TIMING_JSON) {
+		fprintf(fp, "{\n  \"stages\": [");
+		for (i = 0; i < cfg->num_stages; i++) {
+			const struct updater_stage *s = &cfg->stages[i];
+
+			fprintf(fp, "%s\n    { \"name\": ", i ? "," : "");
+			print_json_string(fp, s->name ? s->name : "");
+			fprintf(fp, ", \"seconds\": %.6f, \"bytes\": %" PRIu64
+				" }", s->seconds, s->bytes);
+		}
+		fprintf(fp, "\n  ],\n  \"total_seconds\": %.6f\n}\n", total);
+		return;
+	}
+
+	fprintf(fp, "Update timing:\n");
+	for (i = 0; i < cfg->num_stages; i++) {
+		const struct updater_stage *s = &cfg->stages[i];
+
+		fprintf(fp, "  %-40s %9.3fs %10" PRIu64 " bytes\n",
+			s->name ? s->name : "", s->seconds, s->bytes);
+	}
+	fprintf(fp, "  %-40s %9.3fs\n", "total", total);
+}
+
+/*
+ * Starts timing a flash operation (op) on the sections of an image, or on the
+ * whole image if sections is NULL.
+ * Returns the stage to pass to end_update_stage, or -1.
+ */
+static int begin_flash_stage(struct updater_config *cfg, const char *op,
+			     const struct firmware_image *image,
+			     const char * const sections[])
+{
+	char *name;
+	size_t len;
+	int i, stage;
+
+	if (!cfg || !cfg->timing)
+		return -1;
+
+	len = strlen(op) + strlen(image->programmer) + strlen("whole image") + 3;
+	for (i = 0; sections && sections[i]; i++)
+		len += strlen(sections[i]) + 1;
+	name = (char *)malloc(len);
+	if (!name)
+		return -1;
+
+	snprintf(name, len, "%s %s ", op, image->programmer);
+	for (i = 0; sections && sections[i]; i++) {
+		if (i)
+			strcat(name, ",");
+		strcat(name, sections[i]);
+	}
+	if (!sections)
+		strcat(name, "whole image");
+
+	stage = begin_update_stage(cfg, name);
+	free(name);
+	return stage;
+}
+
+/*
+ * Reads [offset, offset + size), which is the FMAP area name (or the whole
+ * image if name is NULL), of a lazily loaded image from flash.
+ * The range is read into the image itself, and only the parts of it that
+ * were read before are kept aside, so they can be put back.
+ * Returns 0 if success, non-zero if error.
+ */
+static int load_partial_range(struct firmware_image *image,
+			      const char *name, uint32_t offset, uint32_t size)
+{
+	const char * const regions[] = {name, NULL};
+	uint8_t *saved;
+	int r, stage;
+
+	if (is_range_loaded(image->partial, offset, offset + size))
+		return 0;
+
+	saved = (uint8_t *)malloc(size);
+	if (!saved) {
+		ERROR("Cannot allocate %u bytes to read %s.\n", size,
+		      name ? name : "whole image");
+		return -1;
+	}
+	memcpy(saved, image->data + offset, size);
+
+	VB2_DEBUG("Reading %s from flash.\n", name ? name : "whole image");
+	prepare_flash_session(image->partial->cfg, image->programmer);
+	stage = begin_flash_stage(image->partial->cfg, "read", image,
+				  name ? regions : NULL);
+	r = flashrom_read_image_in_place(image, name ? regions : NULL,
+					 image->partial->verbosity);
+	end_update_stage(image->partial->cfg, stage, r ? 0 : size);
+	if (r) {
+		ERROR("Failed to read %s from flash.\n",
+		      name ? name : "whole image");
+		memcpy(image->data + offset, saved, size);
+	} else {
+		restore_loaded_ranges(image->partial, image->data, saved,
+				      offset, offset + size);
+		r = add_loaded_range(image->partial, offset, offset + size);
+	}
+	free(saved);
+	return r;
+}
+
+int complete_firmware_image(struct firmware_image *image)
+{
+	if (!image->partial)
+		return 0;
+	return load_partial_range(image, NULL, 0, image->size);
+}
+
+/*
+ * Finds the FMAP area by given name in the firmware image, and stores its
+ * header in *fah. Areas outside of a lazily loaded image are not found.
+ * Returns a pointer to the area data, or NULL if not found.
+ */
+static uint8_t *find_fmap_area(struct firmware_image *image,
+			       const char *section_name, FmapAreaHeader **fah)
+{
+	uint8_t *ptr;
+
+	/* Images that were not parsed (e.g. built by tests) have no index. */
+	if (image->fmap_index && image->fmap_index->base == image->data &&
+	    image->fmap_index->fmap == image->fmap_header)
+		ptr = fmap_index_find(image->fmap_index, section_name, fah);
+	else
+		ptr = fmap_find_by_name(
+				image->data, image->size, image->fmap_header,
+				section_name, fah);
+	if (ptr && image->partial &&
+	    ((*fah)->area_offset > image->size ||
+	     (*fah)->area_size > image->size - (*fah)->area_offset))
+		return NULL;
+	return ptr;
+}
+
 /*
  * Finds a firmware section by given name in the firmware image.
- * If successful, return zero and *section argument contains the address and
- * size of the section; otherwise failure.
+ * If successful, return SECTION_FOUND and *section argument contains the
+ * address and size of the section; otherwise SECTION_NOT_FOUND, or
+ * SECTION_READ_FAILURE if the section could not be read from flash.
  */
 int find_firmware_section(struct firmware_section *section,
-			  const struct firmware_image *image,
+			  struct firmware_image *image,
 			  const char *section_name)
 {
 	FmapAreaHeader *fah = NULL;
@@ -288,25 +691,27 @@ int find_firmware_section(struct firmware_section *section,
 
 	section->data = NULL;
 	section->size = 0;
-	ptr = fmap_find_by_name(
-			image->data, image->size, image->fmap_header,
-			section_name, &fah);
+	ptr = find_fmap_area(image, section_name, &fah);
 	if (!ptr)
-		return -1;
-	section->data = (uint8_t *)ptr;
+		return SECTION_NOT_FOUND;
+	if (image->partial &&
+	    load_partial_range(image, section_name, fah->area_offset,
+			       fah->area_size))
+		return SECTION_READ_FAILURE;
+	section->data = ptr;
 	section->size = fah->area_size;
-	return 0;
+	return SECTION_FOUND;
 }
 
 /*
  * Returns true if the given FMAP section exists in the firmware image.
  */
-int firmware_section_exists(const struct firmware_image *image,
+int firmware_section_exists(struct firmware_image *image,
 			    const char *section_name)
 {
-	struct firmware_section section;
-	find_firmware_section(&section, image, section_name);
-	return section.data != NULL;
+	FmapAreaHeader *fah;
+
+	return find_fmap_area(image, section_name, &fah) != NULL;
 }
 
 /*
@@ -317,14 +722,17 @@ int firmware_section_exists(const struct firmware_image *image,
  * If the source section is smaller, the remaining area is not modified.
  * Returns 0 if success, non-zero if error.
  */
-int preserve_firmware_section(const struct firmware_image *image_from,
+int preserve_firmware_section(struct firmware_image *image_from,
 			      struct firmware_image *image_to,
 			      const char *section_name)
 {
 	struct firmware_section from, to;
 
-	find_firmware_section(&from, image_from, section_name);
-	find_firmware_section(&to, image_to, section_name);
+	if (find_firmware_section(&from, image_from, section_name) ==
+	    SECTION_READ_FAILURE ||
+	    find_firmware_section(&to, image_to, section_name) ==
+	    SECTION_READ_FAILURE)
+		return SECTION_READ_FAILURE;
 	if (!from.data || !to.data) {
 		VB2_DEBUG("Cannot find section %.*s: from=%p, to=%p\n",
 			  FMAP_NAMELEN, section_name, from.data, to.data);
@@ -343,12 +751,14 @@ int preserve_firmware_section(const struct firmware_image *image_from,
  * Finds the GBB (Google Binary Block) header on a given firmware image.
  * Returns a pointer to valid GBB header, or NULL on not found.
  */
-const struct vb2_gbb_header *find_gbb(const struct firmware_image *image)
+const struct vb2_gbb_header *find_gbb(struct firmware_image *image)
 {
 	struct firmware_section section;
 	struct vb2_gbb_header *gbb_header;
 
-	find_firmware_section(&section, image, FMAP_RO_GBB);
+	if (find_firmware_section(&section, image, FMAP_RO_GBB) ==
+	    SECTION_READ_FAILURE)
+		return NULL;
 	gbb_header = (struct vb2_gbb_header *)section.data;
 	if (!futil_valid_gbb_header(gbb_header, section.size, NULL)) {
 		ERROR("Cannot find GBB in image: %s.\n", image->file_name);
@@ -583,15 +993,48 @@ static char *get_flashrom_command(enum flash_command flash_cmd,
 	return cmd;
 }
 
+int close_flash_session(struct updater_config *cfg)
+{
+	if (!flashrom_session_close(&cfg->flash_session))
+		return 0;
+	ERROR("Failed to shut down the flash programmer; an emulated flash "
+	      "may not be saved.\n");
+	return -1;
+}
+
+void prepare_flash_session(struct updater_config *cfg,
+			   const char *programmer)
+{
+	/*
+	 * The EC programmers may sysjump the EC when they start and stop, and
+	 * the EC steps (e.g. software sync) expect that to be done after each
+	 * write, so only the AP flash is kept open.
+	 */
+	if ((cfg->ec_image.programmer &&
+	     !strcmp(programmer, cfg->ec_image.programmer)) ||
+	    (cfg->pd_image.programmer &&
+	     !strcmp(programmer, cfg->pd_image.programmer))) {
+		close_flash_session(cfg);
+		return;
+	}
+	if (flashrom_session_open(&cfg->flash_session, programmer,
+				  cfg->verbosity + 1))
+		VB2_DEBUG("No flashrom session for %s.\n", programmer);
+}
+
 static int read_flash(struct flashrom_params *params,
 		      struct updater_config *cfg)
 {
-	return flashrom_read_image(params->image, NULL, params->verbose);
+	prepare_flash_session(cfg, params->image->programmer);
+	return flashrom_read_image(params->image, params->regions,
+				   params->verbose);
 }
 
 static int write_flash(struct flashrom_params *params,
 		       struct updater_config *cfg)
 {
+	prepare_flash_session(cfg, params->image->programmer);
+
 	int r = flashrom_write_image(params->image,
 				 params->regions,
 				 params->flash_contents,
@@ -608,7 +1051,7 @@ static int write_flash(struct flashrom_params *params,
 int load_system_firmware(struct updater_config *cfg,
 			 struct firmware_image *image)
 {
-	int r, i;
+	int r, i, stage;
 	char *cmd;
 	const int tries = 1 + get_config_quirk(QUIRK_EXTRA_RETRIES, cfg);
 	struct flashrom_params params = {0};
@@ -620,16 +1063,213 @@ int load_system_firmware(struct updater_config *cfg,
 	INFO("%s\n", cmd);
 	free(cmd);
 
+	stage = begin_flash_stage(cfg, "read", image, NULL);
 	for (i = 1, r = -1; i <= tries && r != 0; i++, params.verbose++) {
 		if (i > 1)
 			WARN("Retry reading firmware (%d/%d)...\n", i, tries);
 		r = read_flash(&params, cfg);
 	}
+	end_update_stage(cfg, stage, r ? 0 : image->size);
 	if (!r)
 		r = parse_firmware_image(image);
 	return r;
 }
 
+int load_system_firmware_lazily(struct updater_config *cfg,
+				struct firmware_image *image)
+{
+	int r, i, stage;
+	char *cmd;
+	const int tries = 1 + get_config_quirk(QUIRK_EXTRA_RETRIES, cfg);
+	const char * const regions[] = {FMAP_RO_FMAP, NULL};
+	struct flashrom_params params = {0};
+	FmapAreaHeader *ah = NULL;
+	struct partial_read *partial;
+
+	params.image = image;
+	params.regions = regions;
+	params.verbose = cfg->verbosity + 1; /* libflashrom verbose 1 = WARN. */
+
+	cmd = get_flashrom_command(FLASH_READ, &params, NULL, NULL);
+	INFO("%s\n", cmd);
+	free(cmd);
+
+	stage = begin_flash_stage(cfg, "read", image, regions);
+	for (i = 1, r = -1; i <= tries && r != 0; i++, params.verbose++) {
+		if (i > 1)
+			WARN("Retry reading firmware (%d/%d)...\n", i, tries);
+		r = read_flash(&params, cfg);
+	}
+	if (!r && !fmap_find_by_name(image->data, image->size, NULL,
+				     FMAP_RO_FMAP, &ah))
+		r = -1;
+	if (!r && (ah->area_offset > image->size ||
+		   ah->area_size > image->size - ah->area_offset))
+		r = -1;
+	end_update_stage(cfg, stage, r ? 0 : ah->area_size);
+
+	partial = (struct partial_read *)calloc(1, sizeof(*partial));
+	if (!r && partial)
+		partial->loaded = (struct flash_range *)malloc(
+				sizeof(*partial->loaded));
+	if (r || !partial || !partial->loaded) {
+		free(partial);
+		free_firmware_image(image);
+		VB2_DEBUG("Cannot read the FMAP alone, read whole flash.\n");
+		return load_system_firmware(cfg, image);
+	}
+
+	partial->cfg = cfg;
+	partial->verbosity = cfg->verbosity + 1;
+	partial->loaded[0].offset = ah->area_offset;
+	partial->loaded[0].size = ah->area_size;
+	partial->count = 1;
+	image->partial = partial;
+
+	if (parse_firmware_image(image) != IMAGE_LOAD_SUCCESS) {
+		free_firmware_image(image);
+		VB2_DEBUG("Cannot parse the partial image, read whole flash.\n");
+		return load_system_firmware(cfg, image);
+	}
+	return 0;
+}
+
+/*
+ * Marks the erase blocks where [offset, offset + size) differs between the
+ * image and the current flash contents.
+ */
+static void mark_changed_blocks(uint8_t *changed,
+				const struct firmware_image *image,
+				const struct firmware_image *current,
+				uint32_t offset, uint32_t size,
+				uint32_t block_size)
+{
+	uint32_t end = offset + size;
+
+	while (offset < end) {
+		uint32_t block = offset / block_size;
+		uint32_t next = offset + (block_size - offset % block_size);
+
+		if (next > end || next < offset)
+			next = end;
+		if (!changed[block] &&
+		    memcmp(image->data + offset, current->data + offset,
+			   next - offset))
+			changed[block] = 1;
+		offset = next;
+	}
+}
+
+int plan_firmware_write(struct write_plan *plan,
+			struct firmware_image *image,
+			const struct firmware_image *current,
+			const char * const sections[],
+			uint32_t block_size)
+{
+	uint8_t *changed;
+	uint32_t blocks, i;
+	size_t count = 0;
+
+	memset(plan, 0, sizeof(*plan));
+	if (!block_size || image->size != current->size)
+		return -1;
+	if (!image->size)
+		return 0;
+
+	blocks = image->size / block_size + !!(image->size % block_size);
+	changed = (uint8_t *)calloc(blocks, 1);
+	if (!changed)
+		return -1;
+
+	if (!sections)
+		mark_changed_blocks(changed, image, current, 0, image->size,
+				    block_size);
+	for (i = 0; sections && sections[i]; i++) {
+		struct firmware_section section;
+		uint32_t offset;
+
+		if (find_firmware_section(&section, image, sections[i]) ||
+		    section.data + section.size > image->data + image->size) {
+			VB2_DEBUG("Cannot plan for section %s.\n", sections[i]);
+			free(changed);
+			return -1;
+		}
+		offset = section.data - image->data;
+		mark_changed_blocks(changed, image, current, offset,
+				    section.size, block_size);
+	}
+
+	for (i = 0; i < blocks; i++) {
+		if (changed[i] && (i == 0 || !changed[i - 1]))
+			count++;
+	}
+	if (count) {
+		plan->ranges = (struct flash_range *)calloc(
+				count, sizeof(*plan->ranges));
+		if (!plan->ranges) {
+			free(changed);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < blocks; i++) {
+		uint32_t offset = i * block_size;
+		uint32_t size = VB2_MIN(block_size, image->size - offset);
+		struct flash_range *range;
+
+		if (!changed[i])
+			continue;
+		if (i == 0 || !changed[i - 1]) {
+			range = &plan->ranges[plan->count++];
+			range->offset = offset;
+		} else {
+			range = &plan->ranges[plan->count - 1];
+		}
+		range->size += size;
+		plan->bytes += size;
+	}
+	free(changed);
+	return 0;
+}
+
+void free_write_plan(struct write_plan *plan)
+{
+	free(plan->ranges);
+	plan->ranges = NULL;
+	plan->count = 0;
+	plan->bytes = 0;
+}
+
+/*
+ * Makes sure the sections to write from image are read in flash_contents, if
+ * that is loaded lazily, at the same offsets. Otherwise reads the whole flash.
+ * Returns 0 if success, non-zero if error.
+ */
+static int read_flash_contents(struct firmware_image *flash_contents,
+			       struct firmware_image *image,
+			       const char * const sections[])
+{
+	int i;
+
+	if (!flash_contents->partial)
+		return 0;
+
+	for (i = 0; sections && sections[i]; i++) {
+		struct firmware_section from, to;
+
+		if (find_firmware_section(&from, flash_contents, sections[i]) ==
+		    SECTION_READ_FAILURE)
+			return -1;
+		find_firmware_section(&to, image, sections[i]);
+		if (!from.data || !to.data || from.size != to.size ||
+		    from.data - flash_contents->data != to.data - image->data)
+			break;
+	}
+	if (sections && !sections[i])
+		return 0;
+	return complete_firmware_image(flash_contents);
+}
+
 /*
  * Writes sections from a given firmware image to the system firmware.
  * Regions should be NULL for writing the whole image, or a list of
@@ -637,20 +1277,54 @@ int load_system_firmware(struct updater_config *cfg,
  * Returns 0 if success, non-zero if error.
  */
 int write_system_firmware(struct updater_config *cfg,
-			  const struct firmware_image *image,
+			  struct firmware_image *image,
 			  const char * const sections[])
 {
-	int r = 0, i;
+	int r = 0, i, stage;
 	char *cmd;
 	const int tries = 1 + get_config_quirk(QUIRK_EXTRA_RETRIES, cfg);
 	struct flashrom_params params = {0};
 	struct firmware_image *flash_contents = NULL;
+	struct write_plan plan;
+	bool planned = false;
+	uint64_t bytes = 0;
 
 	if (cfg->use_diff_image && cfg->image_current.data &&
 	    is_the_same_programmer(&cfg->image_current, image))
 		flash_contents = &cfg->image_current;
 
-	params.image = (struct firmware_image *)image;
+	if (flash_contents && read_flash_contents(flash_contents, image,
+						  sections)) {
+		WARN("Failed reading current flash contents, not using them.\n");
+		flash_contents = NULL;
+	}
+
+	/*
+	 * flashrom only erases the blocks that differ from flash_contents, so
+	 * find those first: report how much will be written, and skip
+	 * probing the flash at all if nothing changed.
+	 */
+	if (flash_contents &&
+	    !plan_firmware_write(&plan, image, flash_contents, sections,
+				 FLASH_ERASE_BLOCK_SIZE)) {
+		size_t n;
+
+		planned = true;
+		bytes = plan.bytes;
+		for (n = 0; n < plan.count; n++)
+			VB2_DEBUG("Erase and write %#x-%#x.\n",
+				  plan.ranges[n].offset,
+				  plan.ranges[n].offset + plan.ranges[n].size);
+		INFO("Changes to write: %u bytes in %zu range(s).\n",
+		     plan.bytes, plan.count);
+		free_write_plan(&plan);
+		if (!bytes) {
+			INFO("Flash contents are already up to date.\n");
+			return 0;
+		}
+	}
+
+	params.image = image;
 	params.flash_contents = flash_contents;
 	params.regions = sections;
 	params.noverify = !cfg->do_verify;
@@ -661,16 +1335,39 @@ int write_system_firmware(struct updater_config *cfg,
 	INFO("%s\n", cmd);
 	free(cmd);
 
+	/* Without a plan, count all the sections to write (and verify). */
+	for (i = 0; !planned && sections && sections[i]; i++) {
+		struct firmware_section section;
+
+		find_firmware_section(&section, image, sections[i]);
+		bytes += section.size;
+	}
+	if (!planned && !sections)
+		bytes = image->size;
+
+	stage = begin_flash_stage(cfg, "write", image, sections);
 	for (i = 1, r = -1; i <= tries && r != 0; i++, params.verbose++) {
 		if (i > 1)
 			WARN("Retry writing firmware (%d/%d)...\n", i, tries);
 		r = write_flash(&params, cfg);
 	}
+	end_update_stage(cfg, stage, r ? 0 : bytes);
 	return r;
 }
 
+/* Deletes a file created by create_temp_file(). */
+static void remove_temp_file(const char *path, int memfd)
+{
+	if (memfd >= 0)
+		close(memfd);
+	else
+		remove(path);
+}
+
 /*
  * Helper function to create a new temporary file.
+ * The file is kept in memory if possible, because the images passed to
+ * subprocesses are large and the disk may be slow.
  * All files created will be removed remove_all_temp_files().
  * Returns the path of new file, or NULL on failure.
  */
@@ -678,28 +1375,37 @@ const char *create_temp_file(struct tempfile *head)
 {
 	struct tempfile *new_temp;
 	char new_path[] = P_tmpdir "/fwupdater.XXXXXX";
-	int fd;
+	char memfd_path[32];
+	const char *path = new_path;
+	int fd, memfd;
 	mode_t umask_save;
 
-	/* Set the umask before mkstemp for security considerations. */
-	umask_save = umask(077);
-	fd = mkstemp(new_path);
-	umask(umask_save);
-	if (fd < 0) {
-		ERROR("Failed to create new temp file in %s\n", new_path);
-		return NULL;
+	memfd = vb2_create_memfd("fwupdater", memfd_path, sizeof(memfd_path));
+	if (memfd >= 0) {
+		path = memfd_path;
+	} else {
+		/* Set the umask before mkstemp for security considerations. */
+		umask_save = umask(077);
+		fd = mkstemp(new_path);
+		umask(umask_save);
+		if (fd < 0) {
+			ERROR("Failed to create new temp file in %s\n",
+			      new_path);
+			return NULL;
+		}
+		close(fd);
 	}
-	close(fd);
 	new_temp = (struct tempfile *)malloc(sizeof(*new_temp));
 	if (new_temp)
-		new_temp->filepath = strdup(new_path);
+		new_temp->filepath = strdup(path);
 	if (!new_temp || !new_temp->filepath) {
-		remove(new_path);
+		remove_temp_file(path, memfd);
 		free(new_temp);
 		ERROR("Failed to allocate buffer for new temp file.\n");
 		return NULL;
 	}
-	VB2_DEBUG("Created new temporary file: %s.\n", new_path);
+	VB2_DEBUG("Created new temporary file: %s.\n", path);
+	new_temp->memfd = memfd;
 	new_temp->next = NULL;
 	while (head->next)
 		head = head->next;
@@ -722,7 +1428,7 @@ void remove_all_temp_files(struct tempfile *head)
 		next = head->next;
 		assert(head->filepath);
 		VB2_DEBUG("Remove temporary file: %s.\n", head->filepath);
-		remove(head->filepath);
+		remove_temp_file(head->filepath, head->memfd);
 		free(head->filepath);
 		free(head);
 	}
@@ -731,7 +1437,7 @@ void remove_all_temp_files(struct tempfile *head)
 /*
  * Returns rootkey hash of firmware image, or NULL on failure.
  */
-const char *get_firmware_rootkey_hash(const struct firmware_image *image)
+const char *get_firmware_rootkey_hash(struct firmware_image *image)
 {
 	const struct vb2_gbb_header *gbb = NULL;
 	const struct vb2_packed_key *rootkey = NULL;
@@ -36,11 +36,12 @@ enum active_slot {
 /* Utilities for managing temporary files. */
 struct tempfile {
 	char *filepath;
+	int memfd;  /* An in-memory file if >= 0, otherwise on disk. */
 	struct tempfile *next;
 };
 
 /*
- * Create a new temporary file.
+ * Create a new temporary file, in memory if possible.
  *
  * The parameter head refers to a linked list dummy head.
  * Returns the path of new file, or NULL on failure.
@@ -102,6 +103,24 @@ struct updater_config;
 int load_system_firmware(struct updater_config *cfg,
 			 struct firmware_image *image);
 
+/*
+ * Loads the active system firmware image like load_system_firmware, but only
+ * reads the FMAP at first: each section is read from flash when it is first
+ * looked up by find_firmware_section, and complete_firmware_image reads the
+ * rest. Falls back to reading the whole flash if the FMAP cannot be read.
+ * Returns 0 if success. Returns IMAGE_PARSE_FAILURE for non-vboot images.
+ * Returns other values for error.
+ */
+int load_system_firmware_lazily(struct updater_config *cfg,
+				struct firmware_image *image);
+
+/*
+ * Reads the parts of a lazily loaded image that were not read yet, for
+ * users of the whole image data. Does nothing for other images.
+ * Returns 0 if success, non-zero if error.
+ */
+int complete_firmware_image(struct firmware_image *image);
+
 /* Frees the allocated resource from a firmware image object. */
 void free_firmware_image(struct firmware_image *image);
 
@@ -110,9 +129,26 @@ void free_firmware_image(struct firmware_image *image);
  *
  * Returns a file path if success, otherwise NULL.
  */
-const char *get_firmware_image_temp_file(const struct firmware_image *image,
+const char *get_firmware_image_temp_file(struct firmware_image *image,
 					 struct tempfile *tempfiles);
 
+/*
+ * Keeps the flash chip of the given programmer probed for the following
+ * flashrom operations, until another programmer is used or the config is
+ * deleted. If probing fails here, each operation probes (and reports) again.
+ * EC and PD programmers are not kept open.
+ */
+void prepare_flash_session(struct updater_config *cfg,
+			   const char *programmer);
+
+/*
+ * Closes the flash session kept by prepare_flash_session, which is also when
+ * an emulated flash is saved to its file. Must be called before anything that
+ * may access the flash outside of the session, like crossystem.
+ * Returns 0 if success, non-zero if error.
+ */
+int close_flash_session(struct updater_config *cfg);
+
 /*
  * Writes sections from a given firmware image to the system firmware.
  * Regions should be NULL for writing the whole image, or a list of
@@ -120,27 +156,87 @@ const char *get_firmware_image_temp_file(const struct firmware_image *image,
  * Returns 0 if success, non-zero if error.
  */
 int write_system_firmware(struct updater_config *cfg,
-			  const struct firmware_image *image,
+			  struct firmware_image *image,
 			  const char * const sections[]);
 
+/* Returns the time from a monotonic clock, in seconds. */
+double get_monotonic_time(void);
+
+/*
+ * Starts timing a stage of the update for the --timing report.
+ * Does nothing unless timing is enabled in cfg.
+ * Returns the stage to pass to end_update_stage, or -1.
+ */
+int begin_update_stage(struct updater_config *cfg, const char *name);
+
+/* Ends a stage from begin_update_stage, which moved the given bytes. */
+void end_update_stage(struct updater_config *cfg, int stage, uint64_t bytes);
+
+/*
+ * Prints the --timing report of all stages to stderr, if timing is enabled in
+ * cfg. The total is counted from when cfg was created.
+ */
+void print_update_timing(const struct updater_config *cfg);
+
+/* The smallest erase block of the SPI flash chips we update. */
+#define FLASH_ERASE_BLOCK_SIZE 4096
+
+/* A range of flash to be erased and written. */
+struct flash_range {
+	uint32_t offset;
+	uint32_t size;
+};
+
+/* The erase blocks that have to change to write an image to flash. */
+struct write_plan {
+	struct flash_range *ranges; /* Sorted by offset and never adjacent. */
+	size_t count;
+	uint32_t bytes; /* Total size of all ranges. */
+};
+
+/*
+ * Compares the image against the current flash contents one erase block at a
+ * time and fills *plan with the blocks that differ, merged into ranges.
+ * Sections should be NULL for the whole image, or a list of FMAP section
+ * names (and ended with a NULL); only the bytes in those sections count.
+ * Returns 0 if success, non-zero if error.
+ */
+int plan_firmware_write(struct write_plan *plan,
+			struct firmware_image *image,
+			const struct firmware_image *current,
+			const char * const sections[],
+			uint32_t block_size);
+
+/* Frees the ranges allocated by plan_firmware_write. */
+void free_write_plan(struct write_plan *plan);
+
 struct firmware_section {
 	uint8_t *data;
 	size_t size;
 };
 
+enum {
+	SECTION_FOUND = 0,
+	SECTION_NOT_FOUND = -1,
+	SECTION_READ_FAILURE = -2,
+};
+
 /*
  * Returns true if the given FMAP section exists in the firmware image.
+ * The section of a lazily loaded image is not read from flash.
  */
-int firmware_section_exists(const struct firmware_image *image,
+int firmware_section_exists(struct firmware_image *image,
 			    const char *section_name);
 
 /*
  * Finds a firmware section by given name in the firmware image.
- * If successful, return zero and *section argument contains the address and
- * size of the section; otherwise failure.
+ * If successful, return SECTION_FOUND and *section argument contains the
+ * address and size of the section. Returns SECTION_NOT_FOUND if there is no
+ * such section, or SECTION_READ_FAILURE if the section of a lazily loaded
+ * image could not be read from flash.
  */
 int find_firmware_section(struct firmware_section *section,
-			  const struct firmware_image *image,
+			  struct firmware_image *image,
 			  const char *section_name);
 
 /*
@@ -149,9 +245,10 @@ int find_firmware_section(struct firmware_section *section,
  * If the section does not exist on either images, return as failure.
  * If the source section is larger, contents on destination be truncated.
  * If the source section is smaller, the remaining area is not modified.
- * Returns 0 if success, non-zero if error.
+ * Returns 0 if success, SECTION_READ_FAILURE if a section could not be read
+ * from flash, or other non-zero values if error.
  */
-int preserve_firmware_section(const struct firmware_image *image_from,
+int preserve_firmware_section(struct firmware_image *image_from,
 			      struct firmware_image *image_to,
 			      const char *section_name);
 
@@ -171,14 +268,14 @@ int unlock_me(struct firmware_image *image);
 /*
  * Returns rootkey hash of firmware image, or NULL on failure.
  */
-const char *get_firmware_rootkey_hash(const struct firmware_image *image);
+const char *get_firmware_rootkey_hash(struct firmware_image *image);
 
 /*
  * Finds the GBB (Google Binary Block) header on a given firmware image.
  * Returns a pointer to valid GBB header, or NULL on not found.
  */
 struct vb2_gbb_header;
-const struct vb2_gbb_header *find_gbb(const struct firmware_image *image);
+const struct vb2_gbb_header *find_gbb(struct firmware_image *image);
 
 /*
  * Strips a string (usually from shell execution output) by removing all the
@@ -226,21 +323,33 @@ void prepare_servo_control(const char *control_name, int on);
 
 /*
  * Returns 1 if a given file (cbfs_entry_name) exists inside a particular CBFS
- * section of an image file, otherwise 0.
+ * section of a firmware image, otherwise 0.
  */
-int cbfs_file_exists(const char *image_file,
+int cbfs_file_exists(struct firmware_image *image,
 		     const char *section_name,
-		     const char *cbfs_entry_name);
+		     const char *cbfs_entry_name,
+		     struct tempfile *tempfiles);
 
 /*
- * Extracts files from a CBFS on given region (section) of image_file.
+ * Extracts files from a CBFS on given region (section) of a firmware image.
  * Returns the path to a temporary file on success, otherwise NULL.
  */
-const char *cbfs_extract_file(const char *image_file,
+const char *cbfs_extract_file(struct firmware_image *image,
 			      const char *cbfs_region,
 			      const char *cbfs_name,
 			      struct tempfile *tempfiles);
 
+/*
+ * Reads a file from a CBFS on given region (section) of a firmware image.
+ * Returns an allocated buffer with the contents followed by a NUL (not
+ * counted in *size) on success, otherwise NULL.
+ */
+uint8_t *cbfs_read_file(struct firmware_image *image,
+			const char *cbfs_region,
+			const char *cbfs_name,
+			uint32_t *size,
+			struct tempfile *tempfiles);
+
 /* DUT related functions (implementations in updater_dut.c) */
 
 struct dut_property {
@@ -4,9 +4,11 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>		/* For PRIu64 */
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <openssl/rsa.h>
 
@@ -168,6 +170,46 @@ static int KernelSize(uint8_t *kernel_buf,
 	return kernel_size - kernel32_start;
 }
 
+/* Fills in g_param_data from the zeropage of an x86 vmlinuz, whose 32-bit
+ * kernel is kernel32_size bytes. Both callers run this before copying the
+ * config into the still zeroed g_config_data, so the command line pointer
+ * is the start of the config; keep that order so their params match. */
+static void FillKernelParams(const struct linux_kernel_params *lh,
+			     uint32_t kernel32_size,
+			     uint64_t kernel_body_load_address)
+{
+	struct linux_kernel_params *params;
+
+	/* Copy the original zeropage data from the vmlinuz into
+	 * g_param_data, then tweak a few fields for our purposes */
+	params = (struct linux_kernel_params *)(g_param_data);
+	memcpy(&(params->setup_sects), &(lh->setup_sects),
+	       offsetof(struct linux_kernel_params, e820_entries)
+	       - offsetof(struct linux_kernel_params, setup_sects));
+	params->boot_flag = 0;
+	params->ramdisk_image = 0;	/* we don't support initrd */
+	params->ramdisk_size = 0;
+	params->type_of_loader = 0xff;
+	/* We need to point to the kernel commandline arg. On disk, it
+	 * will come right after the 32-bit part of the kernel. */
+	params->cmd_line_ptr = kernel_body_load_address +
+		roundup(kernel32_size, CROS_ALIGN) +
+		find_cmdline_start(g_config_data, g_config_size);
+	VB2_DEBUG(" cmdline_addr=%#x\n", params->cmd_line_ptr);
+	VB2_DEBUG(" version=%#x\n", params->version);
+	VB2_DEBUG(" kernel_alignment=%#x\n", params->kernel_alignment);
+	VB2_DEBUG(" relocatable_kernel=%#x\n",
+		  params->relocatable_kernel);
+	/* Add a fake e820 memory map with 2 entries. */
+	params->n_e820_entry = 2;
+	params->e820_entries[0].start_addr = 0x00000000;
+	params->e820_entries[0].segment_size = 0x00001000;
+	params->e820_entries[0].segment_type = E820_TYPE_RAM;
+	params->e820_entries[1].start_addr = 0xfffff000;
+	params->e820_entries[1].segment_size = 0x00001000;
+	params->e820_entries[1].segment_type = E820_TYPE_RESERVED;
+}
+
 /* This extracts g_kernel_* and g_param_* from a standard vmlinuz file.
  * It returns nonzero on error. */
 static int PickApartVmlinuz(uint8_t *kernel_buf,
@@ -177,7 +219,7 @@ static int PickApartVmlinuz(uint8_t *kernel_buf,
 {
 	uint32_t kernel32_start = 0;
 	uint32_t kernel32_size = kernel_size;
-	struct linux_kernel_params *lh, *params;
+	struct linux_kernel_params *lh;
 
 	/* Except for x86, the kernel is the kernel. */
 	switch (arch) {
@@ -206,34 +248,7 @@ static int PickApartVmlinuz(uint8_t *kernel_buf,
 		VB2_DEBUG(" kernel16_start=%#x\n", 0);
 		VB2_DEBUG(" kernel16_size=%#x\n", kernel32_start);
 
-		/* Copy the original zeropage data from kernel_buf into
-		 * g_param_data, then tweak a few fields for our purposes */
-		params = (struct linux_kernel_params *)(g_param_data);
-		memcpy(&(params->setup_sects), &(lh->setup_sects),
-		       offsetof(struct linux_kernel_params, e820_entries)
-		       - offsetof(struct linux_kernel_params, setup_sects));
-		params->boot_flag = 0;
-		params->ramdisk_image = 0;	/* we don't support initrd */
-		params->ramdisk_size = 0;
-		params->type_of_loader = 0xff;
-		/* We need to point to the kernel commandline arg. On disk, it
-		 * will come right after the 32-bit part of the kernel. */
-		params->cmd_line_ptr = kernel_body_load_address +
-			roundup(kernel32_size, CROS_ALIGN) +
-			find_cmdline_start(g_config_data, g_config_size);
-		VB2_DEBUG(" cmdline_addr=%#x\n", params->cmd_line_ptr);
-		VB2_DEBUG(" version=%#x\n", params->version);
-		VB2_DEBUG(" kernel_alignment=%#x\n", params->kernel_alignment);
-		VB2_DEBUG(" relocatable_kernel=%#x\n",
-			  params->relocatable_kernel);
-		/* Add a fake e820 memory map with 2 entries. */
-		params->n_e820_entry = 2;
-		params->e820_entries[0].start_addr = 0x00000000;
-		params->e820_entries[0].segment_size = 0x00001000;
-		params->e820_entries[0].segment_type = E820_TYPE_RAM;
-		params->e820_entries[1].start_addr = 0xfffff000;
-		params->e820_entries[1].segment_size = 0x00001000;
-		params->e820_entries[1].segment_type = E820_TYPE_RESERVED;
+		FillKernelParams(lh, kernel32_size, kernel_body_load_address);
 		break;
 	default:
 		break;
@@ -430,20 +445,25 @@ uint8_t *SignKernelBlob(uint8_t *kernel_blob,
 			struct vb2_keyblock *keyblock,
 			struct vb2_private_key *signpriv_key,
 			uint32_t flags,
-			uint32_t *vblock_size_ptr)
+			uint32_t *vblock_size_ptr,
+			struct vb2_hash *body_digest_ptr)
 {
 	/* Make sure the preamble fills up the rest of the required padding */
 	uint32_t min_size = padding > keyblock->keyblock_size
 		? padding - keyblock->keyblock_size : 0;
 
 	/* Sign the kernel data */
-	struct vb2_signature *body_sig = vb2_calculate_signature(kernel_blob,
-								 kernel_size,
-								 signpriv_key);
+	struct vb2_signature *body_sig = NULL;
+	struct vb2_hash hash;
+	if (VB2_SUCCESS == vb2_hash_calculate(false, kernel_blob, kernel_size,
+					      signpriv_key->hash_alg, &hash))
+		body_sig = vb2_sign_digest(&hash, kernel_size, signpriv_key);
 	if (!body_sig) {
 		fprintf(stderr, "Error calculating body signature\n");
 		return NULL;
 	}
+	if (body_digest_ptr)
+		*body_digest_ptr = hash;
 
 	/* Create preamble */
 	struct vb2_kernel_preamble *preamble =
@@ -517,12 +537,17 @@ int WriteSomeParts(const char *outfile,
 	return 0;
 }
 
-/* Returns 0 on success */
-int VerifyKernelBlob(uint8_t *kernel_blob,
-		     uint32_t kernel_size,
-		     struct vb2_packed_key *signpub_key,
-		     const char *keyblock_outfile,
-		     uint32_t min_version)
+/*
+ * Verifies g_keyblock, g_preamble and the kernel blob. If body_digest is not
+ * NULL, it is the digest of all kernel_size bytes of the blob, which is then
+ * not hashed again. Returns 0 on success.
+ */
+static int verify_kernel_blob(uint8_t *kernel_blob,
+			      uint32_t kernel_size,
+			      const struct vb2_hash *body_digest,
+			      struct vb2_packed_key *signpub_key,
+			      const char *keyblock_outfile,
+			      uint32_t min_version)
 {
 	int rv = -1;
 	uint32_t vmlinuz_header_size = 0;
@@ -650,10 +675,21 @@ int VerifyKernelBlob(uint8_t *kernel_blob,
 	}
 
 	/* Verify body */
-	if (VB2_SUCCESS !=
-	    vb2_verify_data(kernel_blob, kernel_size,
-			    &g_preamble->body_signature,
-			    &pubkey, &wb)) {
+	struct vb2_signature *body_sig = &g_preamble->body_signature;
+	struct vb2_hash hash;
+	if (body_digest && body_digest->algo == pubkey.hash_alg &&
+	    body_sig->data_size == kernel_size) {
+		VB2_DEBUG("Reusing the digest of the kernel blob\n");
+		hash = *body_digest;
+	} else if (body_sig->data_size > kernel_size ||
+		   VB2_SUCCESS != vb2_hash_calculate(false, kernel_blob,
+						     body_sig->data_size,
+						     pubkey.hash_alg, &hash)) {
+		fprintf(stderr, "Error verifying kernel body.\n");
+		goto done;
+	}
+	if (VB2_SUCCESS != vb2_verify_digest(&pubkey, body_sig, hash.raw,
+					     &wb)) {
 		fprintf(stderr, "Error verifying kernel body.\n");
 		goto done;
 	}
@@ -668,19 +704,46 @@ done:
 }
 
 
-uint8_t *CreateKernelBlob(uint8_t *vmlinuz_buf, uint32_t vmlinuz_size,
-			  enum arch_t arch, uint64_t kernel_body_load_address,
-			  uint8_t *config_data, uint32_t config_size,
-			  uint8_t *bootloader_data, uint32_t bootloader_size,
-			  uint32_t *blob_size_ptr)
+/* Returns 0 on success */
+int VerifyKernelBlob(uint8_t *kernel_blob,
+		     uint32_t kernel_size,
+		     struct vb2_packed_key *signpub_key,
+		     const char *keyblock_outfile,
+		     uint32_t min_version)
 {
-	uint32_t now = 0;
+	return verify_kernel_blob(kernel_blob, kernel_size, NULL, signpub_key,
+				  keyblock_outfile, min_version);
+}
+
+int VerifySignedKernelBlob(uint8_t *vblock_data,
+			   uint8_t *kernel_blob,
+			   uint32_t kernel_size,
+			   const struct vb2_hash *body_digest,
+			   struct vb2_packed_key *signpub_key,
+			   uint32_t min_version)
+{
+	g_keyblock = (struct vb2_keyblock *)vblock_data;
+	g_preamble = (struct vb2_kernel_preamble *)
+		(vblock_data + g_keyblock->keyblock_size);
+
+	return verify_kernel_blob(kernel_blob, kernel_size, body_digest,
+				  signpub_key, NULL, min_version);
+}
+
+/* Works out the sizes of all the parts of a new kernel blob, and where the
+ * bootloader and vmlinuz header will end up once it's loaded. Only the
+ * header of the vmlinuz is needed. Returns nonzero on error. */
+static int LayoutKernelBlob(uint8_t *vmlinuz_buf, uint32_t vmlinuz_size,
+			    enum arch_t arch, uint64_t kernel_body_load_address,
+			    uint32_t bootloader_size)
+{
+	uint32_t now;
 	int tmp;
 
 	/* We have all the parts. How much room do we need? */
 	tmp = KernelSize(vmlinuz_buf, vmlinuz_size, arch);
 	if (tmp < 0)
-		return NULL;
+		return -1;
 	g_kernel_size = tmp;
 	g_config_size = CROS_CONFIG_SIZE;
 	g_param_size = CROS_PARAMS_SIZE;
@@ -700,6 +763,34 @@ uint8_t *CreateKernelBlob(uint8_t *vmlinuz_buf, uint32_t vmlinuz_size,
 	g_kernel_blob_size = roundup(g_kernel_blob_size, CROS_ALIGN);
 	VB2_DEBUG("g_kernel_blob_size  %#x\n", g_kernel_blob_size);
 
+	now = roundup(g_kernel_size, CROS_ALIGN) + g_config_size +
+		g_param_size;
+	g_ondisk_bootloader_addr = kernel_body_load_address + now;
+	VB2_DEBUG("g_ondisk_bootloader_addr   0x%" PRIx64 "\n",
+		  g_ondisk_bootloader_addr);
+
+	if (g_vmlinuz_header_size) {
+		now += g_bootloader_size;
+		g_ondisk_vmlinuz_header_addr = kernel_body_load_address + now;
+		VB2_DEBUG("g_ondisk_vmlinuz_header_addr   0x%" PRIx64 "\n",
+			  g_ondisk_vmlinuz_header_addr);
+	}
+
+	return 0;
+}
+
+uint8_t *CreateKernelBlob(uint8_t *vmlinuz_buf, uint32_t vmlinuz_size,
+			  enum arch_t arch, uint64_t kernel_body_load_address,
+			  uint8_t *config_data, uint32_t config_size,
+			  uint8_t *bootloader_data, uint32_t bootloader_size,
+			  uint32_t *blob_size_ptr)
+{
+	uint32_t now = 0;
+
+	if (LayoutKernelBlob(vmlinuz_buf, vmlinuz_size, arch,
+			     kernel_body_load_address, bootloader_size))
+		return NULL;
+
 	/* Allocate space for the blob. */
 	g_kernel_blob_data = malloc(g_kernel_blob_size);
 	memset(g_kernel_blob_data, 0, g_kernel_blob_size);
@@ -723,18 +814,12 @@ uint8_t *CreateKernelBlob(uint8_t *vmlinuz_buf, uint32_t vmlinuz_size,
 	g_bootloader_data = g_kernel_blob_data + now;
 	VB2_DEBUG("g_bootloader_size   %#x ofs %#x\n",
 		  g_bootloader_size, now);
-	g_ondisk_bootloader_addr = kernel_body_load_address + now;
-	VB2_DEBUG("g_ondisk_bootloader_addr   0x%" PRIx64 "\n",
-		  g_ondisk_bootloader_addr);
 	now += g_bootloader_size;
 
 	if (g_vmlinuz_header_size) {
 		g_vmlinuz_header_data = g_kernel_blob_data + now;
 		VB2_DEBUG("g_vmlinuz_header_size %#x ofs %#x\n",
 			  g_vmlinuz_header_size, now);
-		g_ondisk_vmlinuz_header_addr = kernel_body_load_address + now;
-		VB2_DEBUG("g_ondisk_vmlinuz_header_addr   0x%" PRIx64 "\n",
-			  g_ondisk_vmlinuz_header_addr);
 	}
 
 	VB2_DEBUG("end of kern_blob at kern_blob+%#x\n", now);
@@ -763,6 +848,326 @@ uint8_t *CreateKernelBlob(uint8_t *vmlinuz_buf, uint32_t vmlinuz_size,
 	return g_kernel_blob_data;
 }
 
+/* How much of an input file the streaming packer holds at once. */
+#define PACK_CHUNK_SIZE (1024 * 1024)
+
+/* State for streaming a kernel blob out, a section at a time. */
+struct blob_stream {
+	const char *outfile;
+	int fd;				/* -1 when only hashing */
+	off_t offset;			/* where the next section goes */
+	struct vb2_digest_context dc;
+	uint8_t *chunk;
+};
+
+/* Writes to the output, if there is one. Returns nonzero on error. */
+static int write_out(struct blob_stream *bs, const uint8_t *buf, uint32_t len)
+{
+	ssize_t n;
+
+	if (bs->fd < 0) {
+		bs->offset += len;
+		return 0;
+	}
+
+	while (len) {
+		n = pwrite(bs->fd, buf, len, bs->offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			fprintf(stderr, "Can't write output file %s: %s\n",
+				bs->outfile, strerror(errno));
+			return -1;
+		}
+		buf += n;
+		len -= n;
+		bs->offset += n;
+	}
+	return 0;
+}
+
+/* Hashes one chunk of the blob and writes it out. Returns nonzero on error. */
+static int stream_chunk(struct blob_stream *bs, const uint8_t *buf,
+			uint32_t len)
+{
+	if (VB2_SUCCESS != vb2_digest_extend(&bs->dc, buf, len)) {
+		fprintf(stderr, "Error hashing kernel blob\n");
+		return -1;
+	}
+	return write_out(bs, buf, len);
+}
+
+/* Streams one section of the kernel blob, zero-padded to section_size. The
+ * contents come from data, or else from size bytes of in_fd starting at
+ * in_offset. Returns nonzero on error. */
+static int stream_section(struct blob_stream *bs, const uint8_t *data,
+			  int in_fd, const char *infile, off_t in_offset,
+			  uint32_t size, uint32_t section_size)
+{
+	uint32_t len;
+	ssize_t n;
+
+	if (data && size && stream_chunk(bs, data, size))
+		return -1;
+
+	while (!data && size) {
+		len = size < PACK_CHUNK_SIZE ? size : PACK_CHUNK_SIZE;
+		n = pread(in_fd, bs->chunk, len, in_offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			fprintf(stderr, "Unable to read %s: %s\n", infile,
+				n ? strerror(errno) : "file got shorter");
+			return -1;
+		}
+		if (stream_chunk(bs, bs->chunk, n))
+			return -1;
+		in_offset += n;
+		size -= n;
+		section_size -= n;
+	}
+	if (data)
+		section_size -= size;
+
+	memset(bs->chunk, 0, PACK_CHUNK_SIZE);
+	while (section_size) {
+		len = section_size < PACK_CHUNK_SIZE ?
+			section_size : PACK_CHUNK_SIZE;
+		if (stream_chunk(bs, bs->chunk, len))
+			return -1;
+		section_size -= len;
+	}
+	return 0;
+}
+
+/* Opens an input file for streaming and gets its size. Returns -1 on
+ * error. */
+static int open_input(const char *filename, uint32_t *size_ptr)
+{
+	struct stat sb;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Unable to open file %s: %s\n", filename,
+			strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &sb) || sb.st_size > UINT32_MAX) {
+		fprintf(stderr, "Unable to use %s: %s\n", filename,
+			errno ? strerror(errno) : "too big");
+		close(fd);
+		return -1;
+	}
+	*size_ptr = sb.st_size;
+	return fd;
+}
+
+int PackKernelPartition(const char *outfile, int vblock_only,
+			const char *vmlinuz_file, enum arch_t arch,
+			uint64_t kernel_body_load_address,
+			uint8_t *config_data, uint32_t config_size,
+			const char *bootloader_file,
+			uint32_t padding,
+			int version,
+			struct vb2_keyblock *keyblock,
+			struct vb2_private_key *signpriv_key,
+			uint32_t flags)
+{
+	struct blob_stream bs = { .outfile = outfile, .fd = -1 };
+	uint32_t vmlinuz_size, bootloader_size, hdr_size;
+	uint32_t preamble_size, vblock_size = 0;
+	int vmlinuz_fd, bootloader_fd = -1;
+	uint8_t *hdr = NULL, *vblock = NULL;
+	struct vb2_signature *body_sig = NULL;
+	struct vb2_kernel_preamble *preamble;
+	struct vb2_hash hash;
+	ssize_t n;
+	int rv = -1;
+
+	g_kernel_blob_data = NULL;
+
+	vmlinuz_fd = open_input(vmlinuz_file, &vmlinuz_size);
+	if (vmlinuz_fd < 0)
+		return -1;
+	VB2_DEBUG(" vmlinuz file size=%#x\n", vmlinuz_size);
+	if (!vmlinuz_size) {
+		fprintf(stderr, "Empty vmlinuz file\n");
+		goto done;
+	}
+
+	bootloader_fd = open_input(bootloader_file, &bootloader_size);
+	if (bootloader_fd < 0)
+		goto done;
+	VB2_DEBUG(" bootloader file size=%#x\n", bootloader_size);
+
+	/* Only the vmlinuz header is needed to lay out the blob. */
+	hdr_size = sizeof(struct linux_kernel_params);
+	hdr = calloc(hdr_size, 1);
+	bs.chunk = malloc(PACK_CHUNK_SIZE);
+	g_config_data = calloc(CROS_CONFIG_SIZE, 1);
+	g_param_data = calloc(CROS_PARAMS_SIZE, 1);
+	if (!hdr || !bs.chunk || !g_config_data || !g_param_data) {
+		fprintf(stderr, "Out of memory\n");
+		goto done;
+	}
+	n = pread(vmlinuz_fd, hdr, hdr_size < vmlinuz_size ?
+		  hdr_size : vmlinuz_size, 0);
+	if (n < 0) {
+		fprintf(stderr, "Unable to read %s: %s\n", vmlinuz_file,
+			strerror(errno));
+		goto done;
+	}
+
+	if (LayoutKernelBlob(hdr, vmlinuz_size, arch,
+			     kernel_body_load_address, bootloader_size))
+		goto done;
+
+	/* The real-mode part of an x86 kernel is kept whole, to go at the
+	 * end of the blob. */
+	if (g_vmlinuz_header_size > hdr_size) {
+		uint8_t *more = realloc(hdr, g_vmlinuz_header_size);
+		if (!more) {
+			fprintf(stderr, "Out of memory\n");
+			goto done;
+		}
+		hdr = more;
+		n = pread(vmlinuz_fd, hdr + hdr_size,
+			  g_vmlinuz_header_size - hdr_size, hdr_size);
+		if (n != g_vmlinuz_header_size - hdr_size) {
+			fprintf(stderr, "Unable to read %s\n", vmlinuz_file);
+			goto done;
+		}
+	}
+
+	/* Same order as CreateKernelBlob(), so the params match it. */
+	if (g_vmlinuz_header_size)
+		FillKernelParams((struct linux_kernel_params *)hdr,
+				 g_kernel_size, kernel_body_load_address);
+	memcpy(g_config_data, config_data, config_size);
+
+	/* The vblock size doesn't depend on the blob, so leave room for it
+	 * at the front and fill it in once the blob has been hashed. */
+	preamble_size = sizeof(struct vb2_kernel_preamble) +
+		2 * vb2_rsa_sig_size(signpriv_key->sig_alg);
+	if (padding > keyblock->keyblock_size &&
+	    preamble_size < padding - keyblock->keyblock_size)
+		preamble_size = padding - keyblock->keyblock_size;
+	bs.offset = keyblock->keyblock_size + preamble_size;
+
+	if (!vblock_only) {
+		bs.fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (bs.fd < 0) {
+			fprintf(stderr, "Can't open output file %s: %s\n",
+				outfile, strerror(errno));
+			goto done;
+		}
+	}
+
+	if (VB2_SUCCESS != vb2_digest_init(&bs.dc, false,
+					   signpriv_key->hash_alg,
+					   g_kernel_blob_size)) {
+		fprintf(stderr, "Error calculating body signature\n");
+		goto done;
+	}
+
+	VB2_DEBUG("streaming %#x byte blob to %s\n", g_kernel_blob_size,
+		  outfile);
+	if (stream_section(&bs, NULL, vmlinuz_fd, vmlinuz_file,
+			   g_vmlinuz_header_size, g_kernel_size,
+			   roundup(g_kernel_size, CROS_ALIGN)) ||
+	    stream_section(&bs, g_config_data, -1, NULL, 0,
+			   g_config_size, g_config_size) ||
+	    stream_section(&bs, g_param_data, -1, NULL, 0,
+			   g_param_size, g_param_size) ||
+	    stream_section(&bs, NULL, bootloader_fd, bootloader_file, 0,
+			   bootloader_size, g_bootloader_size) ||
+	    stream_section(&bs, hdr, -1, NULL, 0, g_vmlinuz_header_size,
+			   g_kernel_blob_size - (roundup(g_kernel_size,
+							 CROS_ALIGN) +
+						 g_config_size +
+						 g_param_size +
+						 g_bootloader_size)))
+		goto done;
+
+	hash.algo = signpriv_key->hash_alg;
+	if (VB2_SUCCESS == vb2_digest_finalize(&bs.dc, hash.raw,
+					       vb2_digest_size(hash.algo)))
+		body_sig = vb2_sign_digest(&hash, g_kernel_blob_size,
+					   signpriv_key);
+	if (!body_sig) {
+		fprintf(stderr, "Error calculating body signature\n");
+		goto done;
+	}
+
+	preamble = vb2_create_kernel_preamble(version,
+					      kernel_body_load_address,
+					      g_ondisk_bootloader_addr,
+					      g_bootloader_size,
+					      body_sig,
+					      g_ondisk_vmlinuz_header_addr,
+					      g_vmlinuz_header_size,
+					      flags,
+					      preamble_size,
+					      signpriv_key);
+	if (!preamble) {
+		fprintf(stderr, "Error creating preamble.\n");
+		goto done;
+	}
+	if (preamble->preamble_size != preamble_size) {
+		fprintf(stderr, "Unexpected preamble size %#x\n",
+			preamble->preamble_size);
+		free(preamble);
+		goto done;
+	}
+
+	vblock_size = keyblock->keyblock_size + preamble_size;
+	vblock = malloc(vblock_size);
+	if (!vblock) {
+		free(preamble);
+		goto done;
+	}
+	memcpy(vblock, keyblock, keyblock->keyblock_size);
+	memcpy(vblock + keyblock->keyblock_size, preamble, preamble_size);
+	free(preamble);
+	VB2_DEBUG("vblock_size = %#x\n", vblock_size);
+
+	if (vblock_only) {
+		rv = WriteSomeParts(outfile, vblock, vblock_size, NULL, 0);
+		goto done;
+	}
+
+	bs.offset = 0;
+	if (write_out(&bs, vblock, vblock_size))
+		goto done;
+	if (close(bs.fd)) {
+		bs.fd = -1;
+		fprintf(stderr, "Can't write output file %s: %s\n",
+			outfile, strerror(errno));
+		goto done;
+	}
+	bs.fd = -1;
+	rv = 0;
+
+done:
+	if (bs.fd >= 0) {
+		close(bs.fd);
+		unlink(outfile);
+	}
+	if (bootloader_fd >= 0)
+		close(bootloader_fd);
+	close(vmlinuz_fd);
+	free(vblock);
+	free(body_sig);
+	free(bs.chunk);
+	free(hdr);
+	free(g_config_data);
+	free(g_param_data);
+	g_config_data = NULL;
+	g_param_data = NULL;
+	return rv;
+}
+
 enum futil_file_type ft_recognize_vblock1(uint8_t *buf, uint32_t len)
 {
 	uint8_t workbuf[VB2_KERNEL_WORKBUF_RECOMMENDED_SIZE]
@@ -770,6 +1175,11 @@ enum futil_file_type ft_recognize_vblock1(uint8_t *buf, uint32_t len)
 	struct vb2_workbuf wb;
 	vb2_workbuf_init(&wb, workbuf, sizeof(workbuf));
 
+	/* Don't bother copying large files that aren't keyblocks at all */
+	if (len < sizeof(struct vb2_keyblock) ||
+	    memcmp(buf, VB2_KEYBLOCK_MAGIC, VB2_KEYBLOCK_MAGIC_SIZE))
+		return FILE_TYPE_UNKNOWN;
+
 	/* Vboot 2.0 signature checks destroy the buffer, so make a copy */
 	uint8_t *buf2 = malloc(len);
 	memcpy(buf2, buf, len);
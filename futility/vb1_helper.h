@@ -8,6 +8,7 @@
 struct vb2_kernel_preamble;
 struct vb2_keyblock;
 struct vb2_packed_key;
+struct vb2_hash;
 
 /* Display a public key with variable indentation */
 void show_pubkey(const struct vb2_packed_key *pubkey, const char *sp);
@@ -22,6 +23,28 @@ uint8_t *CreateKernelBlob(uint8_t *vmlinuz_buf, uint32_t vmlinuz_size,
 			  uint8_t *bootloader_data, uint32_t bootloader_size,
 			  uint32_t *blob_size_ptr);
 
+/*
+ * Packs and signs a new kernel partition straight from the vmlinuz and
+ * bootloader files, as CreateKernelBlob() and SignKernelBlob() would, but
+ * without holding the kernel in memory. The blob is hashed as it's written,
+ * and the vblock is filled in at the front afterwards. With vblock_only,
+ * only the vblock is written. Returns nonzero on error.
+ */
+int PackKernelPartition(const char *outfile, int vblock_only,
+			const char *vmlinuz_file, enum arch_t arch,
+			uint64_t kernel_body_load_address,
+			uint8_t *config_data, uint32_t config_size,
+			const char *bootloader_file,
+			uint32_t padding,
+			int version,
+			struct vb2_keyblock *keyblock,
+			struct vb2_private_key *signpriv_key,
+			uint32_t flags);
+
+/*
+ * Signs a kernel blob and returns the new vblock. If body_digest_ptr is not
+ * NULL, the digest of the blob is stored there, for VerifySignedKernelBlob().
+ */
 uint8_t *SignKernelBlob(uint8_t *kernel_blob,
 			uint32_t kernel_size,
 			uint32_t padding,
@@ -30,7 +53,8 @@ uint8_t *SignKernelBlob(uint8_t *kernel_blob,
 			struct vb2_keyblock *keyblock,
 			struct vb2_private_key *signpriv_key,
 			uint32_t flags,
-			uint32_t *vblock_size_ptr);
+			uint32_t *vblock_size_ptr,
+			struct vb2_hash *body_digest_ptr);
 
 int WriteSomeParts(const char *outfile,
 		   void *part1_data, uint32_t part1_size,
@@ -64,6 +88,18 @@ int VerifyKernelBlob(uint8_t *kernel_blob,
 		     const char *keyblock_outfile,
 		     uint32_t min_version);
 
+/*
+ * Like VerifyKernelBlob(), but for a kernel blob and the vblock that
+ * SignKernelBlob() just created for it. The blob isn't hashed again: its
+ * body_digest is the one SignKernelBlob() returned.
+ */
+int VerifySignedKernelBlob(uint8_t *vblock_data,
+			   uint8_t *kernel_blob,
+			   uint32_t kernel_size,
+			   const struct vb2_hash *body_digest,
+			   struct vb2_packed_key *signpub_key,
+			   uint32_t min_version);
+
 uint64_t kernel_cmd_line_offset(const struct vb2_kernel_preamble *preamble);
 
 #endif  /* VBOOT_REFERENCE_VB1_HELPER_H_ */
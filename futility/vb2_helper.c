@@ -181,7 +181,13 @@ static RSA *rsa_from_buffer(uint8_t *buf, uint32_t len)
 
 enum futil_file_type ft_recognize_pem(uint8_t *buf, uint32_t len)
 {
-	RSA *rsa_key = rsa_from_buffer(buf, len);
+	RSA *rsa_key;
+
+	/* Much faster than letting the PEM parser look for it, twice. */
+	if (!memmem(buf, len, "-----BEGIN ", 11))
+		return FILE_TYPE_UNKNOWN;
+
+	rsa_key = rsa_from_buffer(buf, len);
 
 	if (rsa_key) {
 		RSA_free(rsa_key);
@@ -7,6 +7,7 @@
 #include "2crypto.h"
 #include "2return_codes.h"
 #include "cbfstool.h"
+#include "fmap.h"
 #include "host_misc.h"
 #include "subprocess.h"
 #include "vboot_host.h"
@@ -28,6 +29,254 @@ static const char *get_cbfstool_path(void)
 	return cbfstool;
 }
 
+/* CBFS layout, as defined by coreboot (commonlib/bsd/cbfs_serialized.h). */
+#define CBFS_FILE_MAGIC "LARCHIVE"
+#define CBFS_ALIGNMENT 64
+#define CBFS_METADATA_MAX_SIZE 256
+#define CBFS_TYPE_DELETED 0x00000000
+#define CBFS_TYPE_NULL 0xffffffff
+#define CBFS_FILE_ATTR_TAG_COMPRESSION 0x42435a4c
+#define CBFS_FILE_ATTR_TAG_HASH 0x68736148
+#define CBFS_MHASH_ANCHOR_MAGIC "\xadMdtHsh\x15"
+#define CBFS_DEFAULT_REGION "COREBOOT"
+#define CBFS_BOOTBLOCK_REGION "BOOTBLOCK"
+
+/* All fields are big-endian. */
+struct cbfs_file_header {
+	char magic[8];
+	uint32_t len;
+	uint32_t type;
+	uint32_t attributes_offset;
+	uint32_t offset;
+	char filename[];
+} __attribute__((packed));
+
+struct cbfs_file_attribute {
+	uint32_t tag;
+	uint32_t len; /* Including the tag and len. */
+	uint8_t data[];
+} __attribute__((packed));
+
+static uint32_t read_be32(const uint32_t *ptr)
+{
+	const uint8_t *bytes = (const uint8_t *)ptr;
+
+	return (uint32_t)bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 |
+		bytes[3];
+}
+
+/*
+ * Finds an attribute with the given tag in the metadata (header, name and
+ * attributes) of a file, and checks it has at least size bytes of data.
+ */
+static const struct cbfs_file_attribute *cbfs_find_attr(
+		const struct cbfs_file_header *header, uint32_t tag,
+		uint32_t size)
+{
+	uint32_t offset = read_be32(&header->attributes_offset);
+	uint32_t end = read_be32(&header->offset);
+
+	if (!offset)
+		return NULL;
+
+	while (offset + sizeof(struct cbfs_file_attribute) <= end) {
+		const struct cbfs_file_attribute *attr =
+			(const void *)((const uint8_t *)header + offset);
+		uint32_t len = read_be32(&attr->len);
+
+		if (len < sizeof(*attr) || len > end - offset)
+			return NULL;
+		if (read_be32(&attr->tag) == tag)
+			return len - sizeof(*attr) < size ? NULL : attr;
+		offset += len;
+	}
+	return NULL;
+}
+
+/*
+ * Walks the files of a CBFS in the same way as coreboot's cbfs_walk(): the
+ * walk ends at the first aligned offset without a file header, and empty
+ * (deleted) files are skipped. If dc is not NULL, the metadata of each file
+ * is added to it. The walk stops early when the walker returns true.
+ * Returns VB2_ERROR_CBFSTOOL on a truncated or malformed file header, so
+ * callers never decide anything from a CBFS that coreboot would reject.
+ */
+static vb2_error_t cbfs_walk(const uint8_t *cbfs, size_t size,
+			     bool (*walker)(const struct cbfs_file_header *,
+					    const uint8_t *data, uint32_t len,
+					    void *arg),
+			     void *arg, struct vb2_digest_context *dc)
+{
+	size_t offset = 0;
+
+	while (offset < size) {
+		const struct cbfs_file_header *header =
+			(const void *)(cbfs + offset);
+		uint32_t data_offset, len, type;
+
+		if (size - offset < sizeof(*header))
+			return VB2_ERROR_CBFSTOOL;
+		if (memcmp(header->magic, CBFS_FILE_MAGIC,
+			   sizeof(header->magic)))
+			break;
+
+		data_offset = read_be32(&header->offset);
+		len = read_be32(&header->len);
+		type = read_be32(&header->type);
+		if (data_offset < sizeof(*header) ||
+		    data_offset > CBFS_METADATA_MAX_SIZE || len > size ||
+		    data_offset + len > size - offset)
+			return VB2_ERROR_CBFSTOOL;
+
+		if (type != CBFS_TYPE_DELETED && type != CBFS_TYPE_NULL) {
+			if (dc && vb2_digest_extend(dc, (const uint8_t *)header,
+						    data_offset))
+				return VB2_ERROR_CBFSTOOL;
+			if (walker && walker(header, cbfs + offset + data_offset,
+					     len, arg))
+				return VB2_SUCCESS;
+		}
+
+		offset += data_offset + len;
+		offset = (offset + CBFS_ALIGNMENT - 1) & ~(CBFS_ALIGNMENT - 1);
+	}
+	return VB2_SUCCESS;
+}
+
+struct cbfs_find_arg {
+	const char *name;
+	struct cbfs_file_info *file;
+	bool found;
+};
+
+static bool cbfs_find_walker(const struct cbfs_file_header *header,
+			     const uint8_t *data, uint32_t len, void *arg)
+{
+	struct cbfs_find_arg *find = arg;
+	const struct cbfs_file_attribute *attr;
+	uint32_t name_end = read_be32(&header->attributes_offset);
+	size_t name_len = strlen(find->name);
+
+	if (!name_end)
+		name_end = read_be32(&header->offset);
+	if (name_end <= sizeof(*header) + name_len ||
+	    memcmp(header->filename, find->name, name_len + 1))
+		return false;
+
+	find->found = true;
+	find->file->type = read_be32(&header->type);
+	find->file->data = data;
+	find->file->size = len;
+	find->file->compression = CBFS_COMPRESS_NONE;
+	attr = cbfs_find_attr(header, CBFS_FILE_ATTR_TAG_COMPRESSION,
+			      sizeof(uint32_t));
+	if (attr)
+		find->file->compression = read_be32((const void *)attr->data);
+	return true;
+}
+
+vb2_error_t cbfs_find_file(const uint8_t *cbfs, size_t size, const char *name,
+			   struct cbfs_file_info *file)
+{
+	struct cbfs_find_arg find = {
+		.name = name,
+		.file = file,
+	};
+	vb2_error_t rv = cbfs_walk(cbfs, size, cbfs_find_walker, &find, NULL);
+
+	if (rv)
+		return rv;
+	return find.found ? VB2_SUCCESS : VB2_ERROR_CBFS_FILE_NOT_FOUND;
+}
+
+static bool cbfs_verify_walker(const struct cbfs_file_header *header,
+			       const uint8_t *data, uint32_t len, void *arg)
+{
+	bool *valid = arg;
+	const struct cbfs_file_attribute *attr = cbfs_find_attr(
+			header, CBFS_FILE_ATTR_TAG_HASH,
+			offsetof(struct vb2_hash, raw));
+	const struct vb2_hash *hash;
+
+	if (!attr)
+		return false;
+	hash = (const void *)attr->data;
+	if (read_be32(&attr->len) - sizeof(*attr) <
+	    offsetof(struct vb2_hash, raw) + vb2_digest_size(hash->algo) ||
+	    vb2_hash_verify(false, data, len, hash)) {
+		*valid = false;
+		return true;
+	}
+	return false;
+}
+
+vb2_error_t cbfs_get_metadata_hash(const uint8_t *cbfs, size_t size,
+				   struct vb2_hash *hash)
+{
+	struct vb2_digest_context dc;
+	bool valid = true;
+
+	if (vb2_digest_init(&dc, false, hash->algo, 0) ||
+	    cbfs_walk(cbfs, size, cbfs_verify_walker, &valid, &dc) ||
+	    vb2_digest_finalize(&dc, hash->raw, vb2_digest_size(hash->algo)))
+		return VB2_ERROR_CBFSTOOL;
+	return valid ? VB2_SUCCESS : VB2_ERROR_CBFSTOOL;
+}
+
+/* Finds an FMAP area of a firmware image, or the default CBFS region. */
+static const uint8_t *find_cbfs_region(uint8_t *buf, uint32_t size,
+				       const char *region,
+				       uint32_t *region_size)
+{
+	FmapAreaHeader *ah;
+	uint8_t *ptr = fmap_find_by_name(buf, size, NULL,
+					 region ? region : CBFS_DEFAULT_REGION,
+					 &ah);
+
+	if (!ptr || ah->area_offset > size ||
+	    ah->area_size > size - ah->area_offset)
+		return NULL;
+	*region_size = ah->area_size;
+	return ptr;
+}
+
+/*
+ * Finds the hash algorithm of the CBFS metadata, from the metadata hash
+ * anchor in the bootblock (which cbfstool also uses for RW regions).
+ */
+static enum vb2_hash_algorithm find_metadata_hash_algo(uint8_t *buf,
+						       uint32_t size)
+{
+	const size_t magic_size = sizeof(CBFS_MHASH_ANCHOR_MAGIC) - 1;
+	const uint8_t *bootblock, *anchor;
+	uint32_t bootblock_size;
+	struct cbfs_file_info file;
+	const struct vb2_hash *hash;
+
+	bootblock = find_cbfs_region(buf, size, CBFS_BOOTBLOCK_REGION,
+				     &bootblock_size);
+	if (!bootblock) {
+		bootblock = find_cbfs_region(buf, size, NULL, &bootblock_size);
+		if (!bootblock ||
+		    cbfs_find_file(bootblock, bootblock_size, "bootblock",
+				   &file) ||
+		    file.compression != CBFS_COMPRESS_NONE)
+			return VB2_HASH_INVALID;
+		bootblock = file.data;
+		bootblock_size = file.size;
+	}
+
+	anchor = memmem(bootblock, bootblock_size, CBFS_MHASH_ANCHOR_MAGIC,
+			magic_size);
+	if (!anchor || bootblock + bootblock_size - anchor <
+	    magic_size + offsetof(struct vb2_hash, raw))
+		return VB2_HASH_INVALID;
+	hash = (const void *)(anchor + magic_size);
+	if (!vb2_digest_size(hash->algo))
+		return VB2_HASH_INVALID;
+	return hash->algo;
+}
+
 vb2_error_t cbfstool_truncate(const char *file, const char *region,
 			      size_t *new_size)
 {
@@ -118,15 +367,45 @@ done:
 	return rv;
 }
 
+/* Gets the metadata hash without cbfstool, if the image is simple enough. */
+static vb2_error_t get_metadata_hash_in_process(const char *file,
+						const char *region,
+						struct vb2_hash *hash)
+{
+	uint8_t *buf;
+	uint32_t size, cbfs_size;
+	const uint8_t *cbfs;
+	vb2_error_t rv = VB2_ERROR_CBFSTOOL;
+
+	if (vb2_read_file(file, &buf, &size))
+		return rv;
+
+	memset(hash, 0, sizeof(*hash));
+	hash->algo = find_metadata_hash_algo(buf, size);
+	cbfs = find_cbfs_region(buf, size, region, &cbfs_size);
+	if (hash->algo != VB2_HASH_INVALID && cbfs)
+		rv = cbfs_get_metadata_hash(cbfs, cbfs_size, hash);
+	if (rv)
+		hash->algo = VB2_HASH_INVALID;
+
+	free(buf);
+	return rv;
+}
+
 vb2_error_t cbfstool_get_metadata_hash(const char *file, const char *region,
 				       struct vb2_hash *hash)
 {
 	int status;
 	const char *cbfstool = get_cbfstool_path();
 	const size_t data_buffer_sz = 1024 * 1024;
-	char *data_buffer = malloc(data_buffer_sz);
+	char *data_buffer;
 	vb2_error_t rv = VB2_ERROR_CBFSTOOL;
 
+	/* Anything unusual (e.g. no anchor or a bad file) is left to cbfstool. */
+	if (get_metadata_hash_in_process(file, region, hash) == VB2_SUCCESS)
+		return VB2_SUCCESS;
+
+	data_buffer = malloc(data_buffer_sz);
 	if (!data_buffer)
 		goto done;
 
@@ -189,17 +468,48 @@ static char *extract_config_value(const char *buf, const char *config_field)
 	return NULL;
 }
 
+/*
+ * Reads the "config" file without cbfstool, if it is not compressed.
+ * Returns it as an allocated null-terminated string, or NULL.
+ */
+static char *read_config_in_process(const char *file, const char *region)
+{
+	uint8_t *buf;
+	uint32_t size, cbfs_size;
+	const uint8_t *cbfs;
+	struct cbfs_file_info config;
+	char *data = NULL;
+
+	if (vb2_read_file(file, &buf, &size))
+		return NULL;
+
+	cbfs = find_cbfs_region(buf, size, region, &cbfs_size);
+	if (cbfs && !cbfs_find_file(cbfs, cbfs_size, "config", &config) &&
+	    config.compression == CBFS_COMPRESS_NONE)
+		data = strndup((const char *)config.data, config.size);
+
+	free(buf);
+	return data;
+}
+
 vb2_error_t cbfstool_get_config_value(const char *file, const char *region,
 				      const char *config_field, char **value)
 {
 	int status;
 	const char *cbfstool = get_cbfstool_path();
 	const size_t data_buffer_sz = 1024 * 1024;
-	char *data_buffer = malloc(data_buffer_sz);
+	char *data_buffer = read_config_in_process(file, region);
 	vb2_error_t rv = VB2_ERROR_CBFSTOOL;
 
 	*value = NULL;
 
+	if (data_buffer) {
+		*value = extract_config_value(data_buffer, config_field);
+		free(data_buffer);
+		return VB2_SUCCESS;
+	}
+
+	data_buffer = malloc(data_buffer_sz);
 	if (!data_buffer)
 		goto done;
 
@@ -34,17 +34,20 @@
  *			create an empty temporary file.
  * @param data_size	The size of the buffer to write, if applicable.
  * @param path_out	An output pointer for the filename.  Caller
- *			should free.
+ *			should release it with remove_temp_file().
+ * @param memfd_out	An output pointer for the descriptor of an
+ *			in-memory file, or -1 for a file on disk.
  *
  * @return VB2_SUCCESS on success, or a relevant error.
  */
 static vb2_error_t write_temp_file(const uint8_t *data, uint32_t data_size,
-				   char **path_out)
+				   char **path_out, int *memfd_out)
 {
 	int fd;
 	ssize_t write_rv;
 	vb2_error_t rv;
 	char *path;
+	char memfd_path[32];
 	mode_t umask_save;
 
 #if defined(__FreeBSD__)
@@ -52,12 +55,19 @@ static vb2_error_t write_temp_file(const uint8_t *data, uint32_t data_size,
 #endif
 
 	*path_out = NULL;
-	path = strdup(P_tmpdir "/vb2_flashrom.XXXXXX");
-
-	/* Set the umask before mkstemp for security considerations. */
-	umask_save = umask(077);
-	fd = mkstemp(path);
-	umask(umask_save);
+	*memfd_out = vb2_create_memfd("vb2_flashrom", memfd_path,
+				      sizeof(memfd_path));
+	if (*memfd_out >= 0) {
+		fd = *memfd_out;
+		path = strdup(memfd_path);
+	} else {
+		path = strdup(P_tmpdir "/vb2_flashrom.XXXXXX");
+
+		/* Set the umask before mkstemp for security considerations. */
+		umask_save = umask(077);
+		fd = mkstemp(path);
+		umask(umask_save);
+	}
 	if (fd < 0) {
 		rv = VB2_ERROR_WRITE_FILE_OPEN;
 		goto fail;
@@ -66,8 +76,6 @@ static vb2_error_t write_temp_file(const uint8_t *data, uint32_t data_size,
 	while (data && data_size > 0) {
 		write_rv = write(fd, data, data_size);
 		if (write_rv < 0) {
-			close(fd);
-			unlink(path);
 			rv = VB2_ERROR_WRITE_FILE_DATA;
 			goto fail;
 		}
@@ -76,15 +84,33 @@ static vb2_error_t write_temp_file(const uint8_t *data, uint32_t data_size,
 		data += write_rv;
 	}
 
-	close(fd);
+	/* The in-memory file is deleted when closed. */
+	if (*memfd_out < 0)
+		close(fd);
 	*path_out = path;
 	return VB2_SUCCESS;
 
  fail:
+	if (fd >= 0) {
+		close(fd);
+		if (*memfd_out < 0)
+			unlink(path);
+	}
+	*memfd_out = -1;
 	free(path);
 	return rv;
 }
 
+/* Deletes a file created by write_temp_file(). */
+static void remove_temp_file(char *path, int memfd)
+{
+	if (memfd >= 0)
+		close(memfd);
+	else
+		unlink(path);
+	free(path);
+}
+
 static vb2_error_t run_flashrom(const char *const argv[])
 {
 	int status = subprocess_run(argv, &subprocess_null, &subprocess_null,
@@ -108,11 +134,12 @@ vb2_error_t flashrom_read(struct firmware_image *image, const char *region)
 	char *tmpfile;
 	char region_param[PATH_MAX];
 	vb2_error_t rv;
+	int memfd;
 
 	image->data = NULL;
 	image->size = 0;
 
-	VB2_TRY(write_temp_file(NULL, 0, &tmpfile));
+	VB2_TRY(write_temp_file(NULL, 0, &tmpfile, &memfd));
 
 	if (region)
 		snprintf(region_param, sizeof(region_param), "%s:%s", region,
@@ -132,8 +159,7 @@ vb2_error_t flashrom_read(struct firmware_image *image, const char *region)
 	if (rv == VB2_SUCCESS)
 		rv = vb2_read_file(tmpfile, &image->data, &image->size);
 
-	unlink(tmpfile);
-	free(tmpfile);
+	remove_temp_file(tmpfile, memfd);
 	return rv;
 }
 
@@ -142,8 +168,9 @@ vb2_error_t flashrom_write(struct firmware_image *image, const char *region)
 	char *tmpfile;
 	char region_param[PATH_MAX];
 	vb2_error_t rv;
+	int memfd;
 
-	VB2_TRY(write_temp_file(image->data, image->size, &tmpfile));
+	VB2_TRY(write_temp_file(image->data, image->size, &tmpfile, &memfd));
 
 	if (region)
 		snprintf(region_param, sizeof(region_param), "%s:%s", region,
@@ -161,7 +188,6 @@ vb2_error_t flashrom_write(struct firmware_image *image, const char *region)
 	};
 
 	rv = run_flashrom(argv);
-	unlink(tmpfile);
-	free(tmpfile);
+	remove_temp_file(tmpfile, memfd);
 	return rv;
 }
@@ -6,6 +6,7 @@
  */
 
 #include <libflashrom.h>
+#include <time.h>
 
 #include "2common.h"
 #include "crossystem.h"
@@ -46,6 +47,163 @@ static char *flashrom_extract_params(const char *str, char **prog, char **params
 	return tmp;
 }
 
+struct flashrom_session {
+	char *prog_with_params;
+	struct flashrom_programmer *prog;
+	struct flashrom_flashctx *flashctx;
+	int verbosity;
+	int operations;
+	struct timespec opened;
+};
+
+/* libflashrom drives one programmer at a time, so there is one session. */
+static struct flashrom_session *g_session;
+
+/* The programmer and probed flash chip used by one operation. */
+struct flashrom_op {
+	struct flashrom_programmer *prog;
+	struct flashrom_flashctx *flashctx;
+	struct flashrom_session *session;
+	struct timespec start;
+};
+
+static double flashrom_elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int flashrom_probe(const char *prog_with_params,
+			  struct flashrom_programmer **prog,
+			  struct flashrom_flashctx **flashctx)
+{
+	char *programmer, *params;
+	char *tmp = flashrom_extract_params(prog_with_params, &programmer,
+					    &params);
+	int r = 0;
+
+	flashrom_set_log_callback((flashrom_log_callback *)&flashrom_print_cb);
+
+	*prog = NULL;
+	*flashctx = NULL;
+	if (flashrom_init(1) ||
+	    flashrom_programmer_init(prog, programmer, params)) {
+		r = -1;
+	} else if (flashrom_flash_probe(flashctx, *prog, NULL)) {
+		flashrom_programmer_shutdown(*prog);
+		r = -1;
+	}
+	free(tmp);
+	return r;
+}
+
+/*
+ * Gets the flash chip for an operation: from the open session if it is for
+ * the same programmer, otherwise initialized and probed for this operation.
+ * Another programmer cannot be started while a session is open, since
+ * libflashrom drives a single programmer.
+ */
+static int flashrom_op_begin(struct flashrom_op *op,
+			     const char *prog_with_params)
+{
+	memset(op, 0, sizeof(*op));
+	if (!g_session)
+		return flashrom_probe(prog_with_params, &op->prog,
+				      &op->flashctx);
+	if (strcmp(g_session->prog_with_params, prog_with_params)) {
+		ERROR("Cannot use %s while the flashrom session for %s is "
+		      "open.\n", prog_with_params, g_session->prog_with_params);
+		return -1;
+	}
+	op->session = g_session;
+	op->prog = g_session->prog;
+	op->flashctx = g_session->flashctx;
+	clock_gettime(CLOCK_MONOTONIC, &op->start);
+	return 0;
+}
+
+/*
+ * Finishes an operation: the flash chip is released, unless it belongs to
+ * the open session.
+ */
+static int flashrom_op_end(struct flashrom_op *op, const char *name)
+{
+	struct flashrom_session *session = op->session;
+
+	if (session) {
+		flashrom_layout_set(op->flashctx, NULL);
+		session->operations++;
+		if (session->verbosity >= FLASHROM_MSG_INFO)
+			INFO("%s took %.3fs.\n", name,
+			     flashrom_elapsed(&op->start));
+		return 0;
+	}
+	flashrom_flash_release(op->flashctx);
+	return flashrom_programmer_shutdown(op->prog);
+}
+
+int flashrom_session_open(struct flashrom_session **session,
+			  const char *prog_with_params, int verbosity)
+{
+	struct flashrom_session *new_session;
+
+	if (*session && !strcmp((*session)->prog_with_params,
+				prog_with_params))
+		return 0;
+	flashrom_session_close(session);
+	if (g_session) {
+		ERROR("Another flashrom session is already open.\n");
+		return -1;
+	}
+
+	new_session = calloc(1, sizeof(*new_session));
+	if (!new_session)
+		return -1;
+	new_session->verbosity = verbosity;
+	new_session->prog_with_params = strdup(prog_with_params);
+	g_verbose_screen = (verbosity == -1) ? FLASHROM_MSG_INFO : verbosity;
+	clock_gettime(CLOCK_MONOTONIC, &new_session->opened);
+	if (!new_session->prog_with_params ||
+	    flashrom_probe(prog_with_params, &new_session->prog,
+			   &new_session->flashctx)) {
+		free(new_session->prog_with_params);
+		free(new_session);
+		return -1;
+	}
+	if (verbosity >= FLASHROM_MSG_INFO)
+		INFO("Probed %s in %.3fs.\n", prog_with_params,
+		     flashrom_elapsed(&new_session->opened));
+
+	*session = g_session = new_session;
+	return 0;
+}
+
+int flashrom_session_close(struct flashrom_session **session)
+{
+	struct flashrom_session *old_session = *session;
+	int r;
+
+	if (!old_session)
+		return 0;
+
+	flashrom_flash_release(old_session->flashctx);
+	r = flashrom_programmer_shutdown(old_session->prog);
+	if (old_session->verbosity >= FLASHROM_MSG_INFO)
+		INFO("Closed %s after %d operation(s) in %.3fs.\n",
+		     old_session->prog_with_params, old_session->operations,
+		     flashrom_elapsed(&old_session->opened));
+
+	if (g_session == old_session)
+		g_session = NULL;
+	free(old_session->prog_with_params);
+	free(old_session);
+	*session = NULL;
+	return r;
+}
+
 /*
  * NOTE: When `regions` contains multiple regions, `region_start` and
  * `region_len` will be filled with the data of the first region.
@@ -53,7 +211,8 @@ static char *flashrom_extract_params(const char *str, char **prog, char **params
 static int flashrom_read_image_impl(struct firmware_image *image,
 				    const char * const regions[],
 				    unsigned int *region_start,
-				    unsigned int *region_len, int verbosity)
+				    unsigned int *region_len, bool in_place,
+				    int verbosity)
 {
 	int r = 0;
 	size_t len = 0;
@@ -62,24 +221,13 @@ static int flashrom_read_image_impl(struct firmware_image *image,
 
 	g_verbose_screen = (verbosity == -1) ? FLASHROM_MSG_INFO : verbosity;
 
-	char *programmer, *params;
-	char *tmp = flashrom_extract_params(image->programmer, &programmer, &params);
-
-	struct flashrom_programmer *prog = NULL;
-	struct flashrom_flashctx *flashctx = NULL;
+	struct flashrom_op op;
+	struct flashrom_flashctx *flashctx;
 	struct flashrom_layout *layout = NULL;
 
-	flashrom_set_log_callback((flashrom_log_callback *)&flashrom_print_cb);
-
-	if (flashrom_init(1)
-		|| flashrom_programmer_init(&prog, programmer, params)) {
-		r = -1;
-		goto err_init;
-	}
-	if (flashrom_flash_probe(&flashctx, prog, NULL)) {
-		r = -1;
-		goto err_probe;
-	}
+	if (flashrom_op_begin(&op, image->programmer))
+		return -1;
+	flashctx = op.flashctx;
 
 	len = flashrom_flash_getsize(flashctx);
 
@@ -107,9 +255,18 @@ static int flashrom_read_image_impl(struct firmware_image *image,
 		flashrom_layout_set(flashctx, layout);
 	}
 
-	image->data = calloc(1, len);
-	image->size = len;
-	image->file_name = strdup("<sys-flash>");
+	if (in_place) {
+		if (!image->data || image->size != len) {
+			ERROR("Buffer size %u does not match flash size %zu\n",
+			      image->size, len);
+			r = -1;
+			goto err_cleanup;
+		}
+	} else {
+		image->data = calloc(1, len);
+		image->size = len;
+		image->file_name = strdup("<sys-flash>");
+	}
 
 	r |= flashrom_image_read(flashctx, image->data, len);
 
@@ -118,14 +275,8 @@ static int flashrom_read_image_impl(struct firmware_image *image,
 						      region_start, region_len);
 
 err_cleanup:
+	r |= flashrom_op_end(&op, "flashrom_read_image");
 	flashrom_layout_release(layout);
-	flashrom_flash_release(flashctx);
-
-err_probe:
-	r |= flashrom_programmer_shutdown(prog);
-
-err_init:
-	free(tmp);
 	return r;
 }
 
@@ -134,16 +285,33 @@ int flashrom_read_image(struct firmware_image *image,
 			int verbosity)
 {
 	unsigned int start, len;
-	return flashrom_read_image_impl(image, regions, &start, &len,
+	return flashrom_read_image_impl(image, regions, &start, &len, false,
 					verbosity);
 }
 
+int flashrom_read_image_in_place(struct firmware_image *image,
+				 const char * const regions[], int verbosity)
+{
+	unsigned int start, len;
+	return flashrom_read_image_impl(image, regions, &start, &len, true,
+					verbosity);
+}
+
+int flashrom_read_image_range(struct firmware_image *image,
+			      const char * const regions[],
+			      unsigned int *region_start,
+			      unsigned int *region_len, int verbosity)
+{
+	return flashrom_read_image_impl(image, regions, region_start,
+					region_len, false, verbosity);
+}
+
 int flashrom_read_region(struct firmware_image *image, const char *region,
 			 int verbosity)
 {
 	const char * const regions[] = {region, NULL};
 	unsigned int start, len;
-	int r = flashrom_read_image_impl(image, regions, &start, &len,
+	int r = flashrom_read_image_impl(image, regions, &start, &len, false,
 					 verbosity);
 	if (r != 0)
 		return r;
@@ -163,24 +331,13 @@ int flashrom_write_image(const struct firmware_image *image,
 
 	g_verbose_screen = (verbosity == -1) ? FLASHROM_MSG_INFO : verbosity;
 
-	char *programmer, *params;
-	char *tmp = flashrom_extract_params(image->programmer, &programmer, &params);
-
-	struct flashrom_programmer *prog = NULL;
-	struct flashrom_flashctx *flashctx = NULL;
+	struct flashrom_op op;
+	struct flashrom_flashctx *flashctx;
 	struct flashrom_layout *layout = NULL;
 
-	flashrom_set_log_callback((flashrom_log_callback *)&flashrom_print_cb);
-
-	if (flashrom_init(1)
-		|| flashrom_programmer_init(&prog, programmer, params)) {
-		r = -1;
-		goto err_init;
-	}
-	if (flashrom_flash_probe(&flashctx, prog, NULL)) {
-		r = -1;
-		goto err_probe;
-	}
+	if (flashrom_op_begin(&op, image->programmer))
+		return -1;
+	flashctx = op.flashctx;
 
 	len = flashrom_flash_getsize(flashctx);
 	if (len == 0) {
@@ -241,14 +398,8 @@ int flashrom_write_image(const struct firmware_image *image,
 				  diff_image ? diff_image->data : NULL);
 
 err_cleanup:
+	r |= flashrom_op_end(&op, "flashrom_write_image");
 	flashrom_layout_release(layout);
-	flashrom_flash_release(flashctx);
-
-err_probe:
-	r |= flashrom_programmer_shutdown(prog);
-
-err_init:
-	free(tmp);
 	return r;
 }
 
@@ -259,23 +410,14 @@ int flashrom_get_wp(const char *prog_with_params, bool *wp_mode,
 
 	g_verbose_screen = (verbosity == -1) ? FLASHROM_MSG_INFO : verbosity;
 
-	struct flashrom_programmer *prog = NULL;
-	struct flashrom_flashctx *flashctx = NULL;
+	struct flashrom_op op;
+	struct flashrom_flashctx *flashctx;
 
 	struct flashrom_wp_cfg *cfg = NULL;
 
-	char *programmer, *params;
-	char *tmp = flashrom_extract_params(prog_with_params, &programmer,
-					    &params);
-
-	flashrom_set_log_callback((flashrom_log_callback *)&flashrom_print_cb);
-
-	if (flashrom_init(1)
-		|| flashrom_programmer_init(&prog, programmer, params))
-		goto err_init;
-
-	if (flashrom_flash_probe(&flashctx, prog, NULL))
-		goto err_probe;
+	if (flashrom_op_begin(&op, prog_with_params))
+		return ret;
+	flashctx = op.flashctx;
 
 	if (flashrom_wp_cfg_new(&cfg) != FLASHROM_WP_OK)
 		goto err_cleanup;
@@ -300,15 +442,9 @@ err_read_cfg:
 	flashrom_wp_cfg_release(cfg);
 
 err_cleanup:
-	flashrom_flash_release(flashctx);
-
-err_probe:
-	if (flashrom_programmer_shutdown(prog))
+	if (flashrom_op_end(&op, "flashrom_get_wp"))
 		ret = -1;
 
-err_init:
-	free(tmp);
-
 	return ret;
 }
 
@@ -319,23 +455,14 @@ int flashrom_set_wp(const char *prog_with_params, bool wp_mode,
 
 	g_verbose_screen = (verbosity == -1) ? FLASHROM_MSG_INFO : verbosity;
 
-	struct flashrom_programmer *prog = NULL;
-	struct flashrom_flashctx *flashctx = NULL;
+	struct flashrom_op op;
+	struct flashrom_flashctx *flashctx;
 
 	struct flashrom_wp_cfg *cfg = NULL;
 
-	char *programmer, *params;
-	char *tmp = flashrom_extract_params(prog_with_params, &programmer,
-					    &params);
-
-	flashrom_set_log_callback((flashrom_log_callback *)&flashrom_print_cb);
-
-	if (flashrom_init(1)
-		|| flashrom_programmer_init(&prog, programmer, params))
-		goto err_init;
-
-	if (flashrom_flash_probe(&flashctx, prog, NULL))
-		goto err_probe;
+	if (flashrom_op_begin(&op, prog_with_params))
+		return ret;
+	flashctx = op.flashctx;
 
 	if (flashrom_wp_cfg_new(&cfg) != FLASHROM_WP_OK)
 		goto err_cleanup;
@@ -354,15 +481,9 @@ err_write_cfg:
 	flashrom_wp_cfg_release(cfg);
 
 err_cleanup:
-	flashrom_flash_release(flashctx);
-
-err_probe:
-	if (flashrom_programmer_shutdown(prog))
+	if (flashrom_op_end(&op, "flashrom_set_wp"))
 		ret = 1;
 
-err_init:
-	free(tmp);
-
 	return ret;
 }
 
@@ -373,33 +494,13 @@ int flashrom_get_size(const char *prog_with_params,
 
 	g_verbose_screen = (verbosity == -1) ? FLASHROM_MSG_INFO : verbosity;
 
-	char *programmer, *params;
-	char *tmp = flashrom_extract_params(prog_with_params,
-					    &programmer, &params);
-
-	struct flashrom_programmer *prog = NULL;
-	struct flashrom_flashctx *flashctx = NULL;
-
-	flashrom_set_log_callback((flashrom_log_callback *)&flashrom_print_cb);
-
-	if (flashrom_init(1) ||
-	    flashrom_programmer_init(&prog, programmer, params)) {
-		r = -1;
-		goto err_init;
-	}
-	if (flashrom_flash_probe(&flashctx, prog, NULL)) {
-		r = -1;
-		goto err_probe;
-	}
-
-	*flash_len = flashrom_flash_getsize(flashctx);
+	struct flashrom_op op;
 
-	flashrom_flash_release(flashctx);
+	if (flashrom_op_begin(&op, prog_with_params))
+		return -1;
 
-err_probe:
-	r |= flashrom_programmer_shutdown(prog);
+	*flash_len = flashrom_flash_getsize(op.flashctx);
 
-err_init:
-	free(tmp);
+	r |= flashrom_op_end(&op, "flashrom_get_size");
 	return r;
 }
@@ -4,24 +4,34 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
 #include "fmap.h"
 
-static int is_fmap(uint8_t *ptr)
+static int is_fmap(uint8_t *ptr, size_t size)
 {
 	FmapHeader *fmap_header = (FmapHeader *)ptr;
 
 	if (0 != memcmp(ptr, FMAP_SIGNATURE, FMAP_SIGNATURE_SIZE))
 		return 0;
 
-	if (fmap_header->fmap_ver_major == FMAP_VER_MAJOR)
-		return 1;
+	if (fmap_header->fmap_ver_major != FMAP_VER_MAJOR) {
+		fprintf(stderr,
+			"Found FMAP, but major version is %u instead of %u\n",
+			fmap_header->fmap_ver_major, FMAP_VER_MAJOR);
+		return 0;
+	}
+
+	/* The area table must fit in the buffer. */
+	if (fmap_header->fmap_nareas >
+	    (size - sizeof(FmapHeader)) / sizeof(FmapAreaHeader)) {
+		fprintf(stderr, "Found FMAP, but it is truncated\n");
+		return 0;
+	}
 
-	fprintf(stderr, "Found FMAP, but major version is %u instead of %u\n",
-		fmap_header->fmap_ver_major, FMAP_VER_MAJOR);
-	return 0;
+	return 1;
 }
 
 /* Find and point to the FMAP header within the buffer */
@@ -30,14 +40,14 @@ FmapHeader *fmap_find(uint8_t *ptr, size_t size)
 	ssize_t offset, align;
 	ssize_t lim = size - sizeof(FmapHeader);
 
-	if (lim >= 0 && is_fmap(ptr))
+	if (lim >= 0 && is_fmap(ptr, size))
 		return (FmapHeader *)ptr;
 
 	/* Search large alignments before small ones to find "right" FMAP. */
 	for (align = FMAP_SEARCH_STRIDE; align <= lim; align *= 2);
 	for (; align >= FMAP_SEARCH_STRIDE; align /= 2)
 		for (offset = align; offset <= lim; offset += align * 2)
-			if (is_fmap(ptr + offset))
+			if (is_fmap(ptr + offset, size - offset))
 				return (FmapHeader *)(ptr + offset);
 
 	return NULL;
@@ -65,3 +75,84 @@ uint8_t *fmap_find_by_name(uint8_t *ptr, size_t size, FmapHeader *fmap,
 
 	return NULL;
 }
+
+/* FNV-1a over an area name, which need not be NUL-terminated. */
+static uint32_t fmap_name_hash(const char *name)
+{
+	uint32_t hash = 2166136261u;
+	int i;
+
+	for (i = 0; i < FMAP_NAMELEN && name[i]; i++) {
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+struct fmap_index *fmap_index_create(uint8_t *ptr, size_t size,
+				     FmapHeader *fmap)
+{
+	struct fmap_index *index;
+	FmapAreaHeader *ah;
+	uint32_t nslots = 8, slot;
+	int i;
+
+	if (!fmap)
+		fmap = fmap_find(ptr, size);
+	if (!fmap)
+		return NULL;
+
+	/* Keep the table at most half full. */
+	while (nslots < 2 * (uint32_t)fmap->fmap_nareas)
+		nslots *= 2;
+	index = calloc(1, sizeof(*index) + nslots * sizeof(index->slots[0]));
+	if (!index)
+		return NULL;
+	index->base = ptr;
+	index->fmap = fmap;
+	index->mask = nslots - 1;
+
+	ah = (FmapAreaHeader *)((void *)fmap + sizeof(FmapHeader));
+	for (i = 0; i < fmap->fmap_nareas; i++) {
+		slot = fmap_name_hash(ah[i].area_name) & index->mask;
+		while (index->slots[slot]) {
+			/* Like fmap_find_by_name(), the first one wins. */
+			if (!strncmp(ah[index->slots[slot] - 1].area_name,
+				     ah[i].area_name, FMAP_NAMELEN))
+				break;
+			slot = (slot + 1) & index->mask;
+		}
+		if (!index->slots[slot])
+			index->slots[slot] = i + 1;
+	}
+
+	return index;
+}
+
+uint8_t *fmap_index_find(const struct fmap_index *index, const char *name,
+			 FmapAreaHeader **ah_ptr)
+{
+	FmapAreaHeader *ah;
+	uint32_t slot;
+
+	if (!index)
+		return NULL;
+
+	ah = (FmapAreaHeader *)((void *)index->fmap + sizeof(FmapHeader));
+	slot = fmap_name_hash(name) & index->mask;
+	for (; index->slots[slot]; slot = (slot + 1) & index->mask) {
+		FmapAreaHeader *found = ah + index->slots[slot] - 1;
+		if (!strncmp(found->area_name, name, FMAP_NAMELEN)) {
+			if (ah_ptr)
+				*ah_ptr = found;
+			return index->base + found->area_offset;
+		}
+	}
+
+	return NULL;
+}
+
+void fmap_index_free(struct fmap_index *index)
+{
+	free(index);
+}
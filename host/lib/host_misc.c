@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include "host_common.h"
@@ -166,3 +167,22 @@ bool parse_hash(uint8_t *buf, size_t len, const char *str)
 		return false;
 	return true;
 }
+
+int vb2_create_memfd(const char *name, char *path, size_t path_size)
+{
+#ifdef SYS_memfd_create
+	/* Not close-on-exec, so subprocesses can open the same path. */
+	int fd = syscall(SYS_memfd_create, name, 0);
+
+	if (fd < 0)
+		return -1;
+	snprintf(path, path_size, "/proc/self/fd/%d", fd);
+	if (access(path, R_OK | W_OK)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+#else
+	return -1;
+#endif
+}
@@ -9,8 +9,12 @@
 
 #include <openssl/rsa.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -22,6 +26,114 @@
 #include "host_common.h"
 #include "host_signature21.h"
 
+/* Fork [external_signer] with [arg] (if not NULL) and [pem_file] as its
+ * arguments, and its stdin/stdout connected to pipes.  The parent's ends of
+ * the pipes are returned in [to_fd] and [from_fd].  Returns -1 on error, 0 on
+ * success.
+ */
+static int spawn_signer(const char *external_signer, const char *arg,
+			const char *pem_file, pid_t *pid, int *to_fd,
+			int *from_fd)
+{
+	int p_to_c[2], c_to_p[2];  /* pipe descriptors */
+
+	/* Need two pipes since we want to invoke the external_signer as
+	 * a co-process writing to its stdin and reading from its stdout.
+	 * Close-on-exec keeps them out of other children (e.g. a persistent
+	 * signer started later), which would otherwise hold them open. */
+	if (pipe2(p_to_c, O_CLOEXEC) < 0) {
+		VB2_DEBUG("pipe() error\n");
+		return -1;
+	}
+	if (pipe2(c_to_p, O_CLOEXEC) < 0) {
+		VB2_DEBUG("pipe() error\n");
+		close(p_to_c[0]);
+		close(p_to_c[1]);
+		return -1;
+	}
+	if ((*pid = fork()) < 0) {
+		VB2_DEBUG("fork() error\n");
+		close(p_to_c[0]);
+		close(p_to_c[1]);
+		close(c_to_p[0]);
+		close(c_to_p[1]);
+		return -1;
+	} else if (*pid > 0) {  /* Parent. */
+		close(p_to_c[STDIN_FILENO]);
+		close(c_to_p[STDOUT_FILENO]);
+		*to_fd = p_to_c[STDOUT_FILENO];
+		*from_fd = c_to_p[STDIN_FILENO];
+		return 0;
+	}
+
+	/* Child. */
+	close(p_to_c[STDOUT_FILENO]);
+	close(c_to_p[STDIN_FILENO]);
+	/* Map the stdin to the first pipe (this pipe gets input
+	 * from the parent).  dup2() clears close-on-exec on the copy. */
+	if (STDIN_FILENO != p_to_c[STDIN_FILENO]) {
+		if (dup2(p_to_c[STDIN_FILENO], STDIN_FILENO) != STDIN_FILENO) {
+			VB2_DEBUG("stdin dup2() failed\n");
+			_exit(1);
+		}
+		close(p_to_c[STDIN_FILENO]);
+	} else if (fcntl(STDIN_FILENO, F_SETFD, 0) < 0) {
+		VB2_DEBUG("stdin fcntl() failed\n");
+		_exit(1);
+	}
+	/* Map the stdout to the second pipe (this pipe sends back
+	 * signer output to the parent) */
+	if (STDOUT_FILENO != c_to_p[STDOUT_FILENO]) {
+		if (dup2(c_to_p[STDOUT_FILENO], STDOUT_FILENO) !=
+		    STDOUT_FILENO) {
+			VB2_DEBUG("stdout dup2() failed\n");
+			_exit(1);
+		}
+		close(c_to_p[STDOUT_FILENO]);
+	} else if (fcntl(STDOUT_FILENO, F_SETFD, 0) < 0) {
+		VB2_DEBUG("stdout fcntl() failed\n");
+		_exit(1);
+	}
+	/* External signer is invoked here. */
+	if (arg)
+		execl(external_signer, external_signer, arg, pem_file,
+		      (char *)0);
+	else
+		execl(external_signer, external_signer, pem_file, (char *)0);
+	VB2_DEBUG("execl() of external signer failed\n");
+	_exit(1);
+}
+
+/* Read exactly [size] bytes from [fd].  Returns -1 on error or EOF. */
+static int read_all(int fd, uint8_t *buf, uint32_t size)
+{
+	while (size) {
+		ssize_t n = read(fd, buf, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf += n;
+		size -= n;
+	}
+	return 0;
+}
+
+/* Write exactly [size] bytes to [fd].  Returns -1 on error. */
+static int write_all(int fd, const uint8_t *buf, uint32_t size)
+{
+	while (size) {
+		ssize_t n = write(fd, buf, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf += n;
+		size -= n;
+	}
+	return 0;
+}
+
 /* Invoke [external_signer] command with [pem_file] as an argument, contents of
  * [inbuf] passed redirected to stdin, and the stdout of the command is put
  * back into [outbuf].  Returns -1 on error, 0 on success.
@@ -31,7 +143,7 @@ static int sign_external(uint32_t size, const uint8_t *inbuf, uint8_t *outbuf,
 			 const char *external_signer)
 {
 	int rv = 0, n;
-	int p_to_c[2], c_to_p[2];  /* pipe descriptors */
+	int to_fd, from_fd;
 	pid_t pid;
 
 	VB2_DEBUG("Will invoke \"%s %s\" to perform signing.\n"
@@ -39,75 +151,178 @@ static int sign_external(uint32_t size, const uint8_t *inbuf, uint8_t *outbuf,
 		 "Output of the signer will be read from standard out.\n",
 		  external_signer, pem_file);
 
-	/* Need two pipes since we want to invoke the external_signer as
-	 * a co-process writing to its stdin and reading from its stdout. */
-	if (pipe(p_to_c) < 0 || pipe(c_to_p) < 0) {
-		VB2_DEBUG("pipe() error\n");
+	if (spawn_signer(external_signer, NULL, pem_file, &pid, &to_fd,
+			 &from_fd))
 		return -1;
-	}
-	if ((pid = fork()) < 0) {
-		VB2_DEBUG("fork() error\n");
-		return -1;
-	} else if (pid > 0) {  /* Parent. */
-		close(p_to_c[STDIN_FILENO]);
-		close(c_to_p[STDOUT_FILENO]);
 
-		/* We provide input to the child process (external signer). */
-		if (write(p_to_c[STDOUT_FILENO], inbuf, size) != size) {
-			VB2_DEBUG("write() error\n");
-			rv = -1;
-		} else {
-			/* Send EOF to child (signer process). */
-			close(p_to_c[STDOUT_FILENO]);
-
-			do {
-				n = read(c_to_p[STDIN_FILENO], outbuf,
-					 outbufsize);
-				outbuf += n;
-				outbufsize -= n;
-			} while (n > 0 && outbufsize);
-
-			if (n < 0) {
-				VB2_DEBUG("read() error\n");
-				rv = -1;
-			}
-		}
-		if (waitpid(pid, NULL, 0) < 0) {
-			VB2_DEBUG("waitpid() error\n");
+	/* We provide input to the child process (external signer). */
+	if (write_all(to_fd, inbuf, size)) {
+		VB2_DEBUG("write() error\n");
+		rv = -1;
+		close(to_fd);
+	} else {
+		/* Send EOF to child (signer process). */
+		close(to_fd);
+
+		do {
+			n = read(from_fd, outbuf, outbufsize);
+			outbuf += n;
+			outbufsize -= n;
+		} while (n > 0 && outbufsize);
+
+		if (n < 0) {
+			VB2_DEBUG("read() error\n");
 			rv = -1;
 		}
-	} else {  /* Child. */
-		close (p_to_c[STDOUT_FILENO]);
-		close (c_to_p[STDIN_FILENO]);
-		/* Map the stdin to the first pipe (this pipe gets input
-		 * from the parent) */
-		if (STDIN_FILENO != p_to_c[STDIN_FILENO]) {
-			if (dup2(p_to_c[STDIN_FILENO], STDIN_FILENO) !=
-			    STDIN_FILENO) {
-				VB2_DEBUG("stdin dup2() failed\n");
-				close(p_to_c[0]);
-				return -1;
-			}
-		}
-		/* Map the stdout to the second pipe (this pipe sends back
-		 * signer output to the parent) */
-		if (STDOUT_FILENO != c_to_p[STDOUT_FILENO]) {
-			if (dup2(c_to_p[STDOUT_FILENO], STDOUT_FILENO) !=
-			    STDOUT_FILENO) {
-				VB2_DEBUG("stdout dup2() failed\n");
-				close(c_to_p[STDOUT_FILENO]);
-				return -1;
-			}
-		}
-		/* External signer is invoked here. */
-		if (execl(external_signer, external_signer, pem_file,
-			  (char *) 0) < 0) {
-			VB2_DEBUG("execl() of external signer failed\n");
-		}
 	}
+	close(from_fd);
+	if (waitpid(pid, NULL, 0) < 0) {
+		VB2_DEBUG("waitpid() error\n");
+		rv = -1;
+	}
+	return rv;
+}
+
+/* The persistent external signer, see vb2_external_signer_persist(). */
+static struct {
+	int enabled;
+	pid_t pid;		/* 0 if not running */
+	int to_fd;
+	int from_fd;
+	char *external_signer;
+	char *pem_file;
+} persistent;
+
+void vb2_external_signer_persist(int enable)
+{
+	if (!enable)
+		vb2_external_signer_stop();
+	persistent.enabled = enable;
+}
+
+void vb2_external_signer_stop(void)
+{
+	if (!persistent.pid)
+		return;
+
+	/* EOF on its stdin tells the signer to exit. */
+	close(persistent.to_fd);
+	close(persistent.from_fd);
+	if (waitpid(persistent.pid, NULL, 0) < 0)
+		VB2_DEBUG("waitpid() error\n");
+
+	free(persistent.external_signer);
+	free(persistent.pem_file);
+	persistent.external_signer = NULL;
+	persistent.pem_file = NULL;
+	persistent.pid = 0;
+}
+
+/* Start the persistent signer for [pem_file] if it isn't already running.
+ * Returns -1 on error, 0 on success.
+ */
+static int start_persistent_signer(const char *pem_file,
+				   const char *external_signer)
+{
+	static int registered;
+
+	if (persistent.pid &&
+	    !strcmp(persistent.external_signer, external_signer) &&
+	    !strcmp(persistent.pem_file, pem_file))
+		return 0;
+
+	vb2_external_signer_stop();
+
+	VB2_DEBUG("Starting \"%s --persistent %s\" to perform signing.\n",
+		  external_signer, pem_file);
+
+	persistent.external_signer = strdup(external_signer);
+	persistent.pem_file = strdup(pem_file);
+	if (!persistent.external_signer || !persistent.pem_file ||
+	    spawn_signer(external_signer, "--persistent", pem_file,
+			 &persistent.pid, &persistent.to_fd,
+			 &persistent.from_fd)) {
+		free(persistent.external_signer);
+		free(persistent.pem_file);
+		persistent.external_signer = NULL;
+		persistent.pem_file = NULL;
+		persistent.pid = 0;
+		return -1;
+	}
+
+	if (!registered) {
+		atexit(vb2_external_signer_stop);
+		registered = 1;
+	}
+	return 0;
+}
+
+/* Write one frame to the persistent signer.  A signer that died fails the
+ * write instead of killing us with SIGPIPE; the caller's handler is restored
+ * afterwards.  Returns -1 on error, 0 on success.
+ */
+static int write_frame(const uint8_t *buf, uint32_t size)
+{
+	struct sigaction ignore = { .sa_handler = SIG_IGN }, saved;
+	uint8_t len[4];
+	int rv;
+
+	/* Frames are a 32-bit big-endian length followed by the payload. */
+	len[0] = size >> 24;
+	len[1] = size >> 16;
+	len[2] = size >> 8;
+	len[3] = size;
+
+	sigemptyset(&ignore.sa_mask);
+	if (sigaction(SIGPIPE, &ignore, &saved) < 0)
+		return -1;
+	rv = write_all(persistent.to_fd, len, sizeof(len)) ||
+	     write_all(persistent.to_fd, buf, size) ? -1 : 0;
+	sigaction(SIGPIPE, &saved, NULL);
 	return rv;
 }
 
+/* Like sign_external(), but exchange one frame with the persistent signer.
+ * The signature must fill [outbuf] exactly.
+ */
+static int sign_persistent(uint32_t size, const uint8_t *inbuf,
+			   uint8_t *outbuf, uint32_t outbufsize,
+			   const char *pem_file, const char *external_signer)
+{
+	uint8_t len[4];
+	uint32_t sig_size;
+
+	if (start_persistent_signer(pem_file, external_signer))
+		return -1;
+
+	if (write_frame(inbuf, size)) {
+		VB2_DEBUG("write() error\n");
+		goto fail;
+	}
+
+	if (read_all(persistent.from_fd, len, sizeof(len))) {
+		VB2_DEBUG("read() error\n");
+		goto fail;
+	}
+	sig_size = (uint32_t)len[0] << 24 | (uint32_t)len[1] << 16 |
+		   (uint32_t)len[2] << 8 | len[3];
+	if (sig_size != outbufsize) {
+		VB2_DEBUG("Signer returned %u bytes, expected %u\n",
+			  sig_size, outbufsize);
+		goto fail;
+	}
+	if (read_all(persistent.from_fd, outbuf, outbufsize)) {
+		VB2_DEBUG("read() error\n");
+		goto fail;
+	}
+	return 0;
+
+fail:
+	/* The stream is out of sync now; start over next time. */
+	vb2_external_signer_stop();
+	return -1;
+}
+
 struct vb2_signature *vb2_external_signature(const uint8_t *data, uint32_t size,
 					     const char *key_file,
 					     uint32_t key_algorithm,
@@ -151,12 +366,17 @@ struct vb2_signature *vb2_external_signature(const uint8_t *data, uint32_t size,
 	}
 
 	/* Sign the signature_digest into our output buffer */
-	rv = sign_external(signature_digest_len,    /* Input length */
-			   signature_digest,        /* Input data */
-			   vb2_signature_data_mutable(sig),  /* Output sig */
-			   sig_size,                /* Max Output sig size */
-			   key_file,                /* Key file to use */
-			   external_signer);        /* External cmd to invoke */
+	if (persistent.enabled)
+		rv = sign_persistent(signature_digest_len, signature_digest,
+				     vb2_signature_data_mutable(sig), sig_size,
+				     key_file, external_signer);
+	else
+		rv = sign_external(signature_digest_len,    /* Input length */
+				   signature_digest,        /* Input data */
+				   vb2_signature_data_mutable(sig),  /* Output sig */
+				   sig_size,                /* Max Output sig size */
+				   key_file,                /* Key file to use */
+				   external_signer);        /* External cmd to invoke */
 	free(signature_digest);
 
 	if (-1 == rv) {
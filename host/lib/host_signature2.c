@@ -80,24 +80,21 @@ struct vb2_signature *vb2_sha512_signature(const uint8_t *data, uint32_t size)
 	return sig;
 }
 
-struct vb2_signature *vb2_calculate_signature(
-		const uint8_t *data, uint32_t size,
-		const struct vb2_private_key *key)
+struct vb2_signature *vb2_sign_digest(const struct vb2_hash *hash,
+				     uint32_t size,
+				     const struct vb2_private_key *key)
 {
-	struct vb2_hash hash;
 	uint32_t digest_size = vb2_digest_size(key->hash_alg);
 
+	if (hash->algo != key->hash_alg)
+		return NULL;
+
 	uint32_t digest_info_size = 0;
 	const uint8_t *digest_info = NULL;
 	if (VB2_SUCCESS != vb2_digest_info(key->hash_alg,
 					   &digest_info, &digest_info_size))
 		return NULL;
 
-	/* Calculate the digest */
-	if (VB2_SUCCESS != vb2_hash_calculate(false, data, size, key->hash_alg,
-					      &hash))
-		return NULL;
-
 	/* Prepend the digest info to the digest */
 	int signature_digest_len = digest_size + digest_info_size;
 	uint8_t *signature_digest = malloc(signature_digest_len);
@@ -105,7 +102,7 @@ struct vb2_signature *vb2_calculate_signature(
 		return NULL;
 
 	memcpy(signature_digest, digest_info, digest_info_size);
-	memcpy(signature_digest + digest_info_size, hash.raw, digest_size);
+	memcpy(signature_digest + digest_info_size, hash->raw, digest_size);
 
 	/* Allocate output signature */
 	struct vb2_signature *sig = (struct vb2_signature *)
@@ -133,6 +130,20 @@ struct vb2_signature *vb2_calculate_signature(
 	return sig;
 }
 
+struct vb2_signature *vb2_calculate_signature(
+		const uint8_t *data, uint32_t size,
+		const struct vb2_private_key *key)
+{
+	struct vb2_hash hash;
+
+	/* Calculate the digest */
+	if (VB2_SUCCESS != vb2_hash_calculate(false, data, size, key->hash_alg,
+					      &hash))
+		return NULL;
+
+	return vb2_sign_digest(&hash, size, key);
+}
+
 struct vb2_signature *
 vb2_create_signature_from_hash(const struct vb2_hash *hash)
 {
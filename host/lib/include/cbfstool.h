@@ -9,6 +9,35 @@
 #define ENV_CBFSTOOL "CBFSTOOL"
 #define DEFAULT_CBFSTOOL "cbfstool"
 
+#define CBFS_COMPRESS_NONE 0
+#define CBFS_TYPE_RAW 0x50
+
+/* A file found in a CBFS by cbfs_find_file(). */
+struct cbfs_file_info {
+	uint32_t type;
+	uint32_t compression; /* CBFS_COMPRESS_NONE if stored as is. */
+	const uint8_t *data; /* As stored, so maybe compressed. */
+	uint32_t size;
+};
+
+/*
+ * Find a file by name in a CBFS (usually an FMAP area) in memory, without
+ * running cbfstool. Deleted and empty files are never found.
+ *
+ * Returns VB2_ERROR_CBFS_FILE_NOT_FOUND if the whole CBFS was walked without
+ * finding the file, or VB2_ERROR_CBFSTOOL if the CBFS is malformed before it.
+ */
+vb2_error_t cbfs_find_file(const uint8_t *cbfs, size_t size, const char *name,
+			   struct cbfs_file_info *file);
+
+/*
+ * Calculate the metadata hash of a CBFS in memory with hash->algo, like
+ * cbfstool does, into hash->raw. Fails if the data of any file does not match
+ * its hash attribute, as cbfstool then does not report it "fully valid".
+ */
+vb2_error_t cbfs_get_metadata_hash(const uint8_t *cbfs, size_t size,
+				   struct vb2_hash *hash);
+
 vb2_error_t cbfstool_truncate(const char *file, const char *region,
 			      size_t *new_size);
 
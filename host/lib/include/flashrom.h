@@ -27,6 +27,8 @@ struct firmware_image {
 	char *file_name;
 	char *ro_version, *rw_version_a, *rw_version_b;
 	FmapHeader *fmap_header;
+	struct fmap_index *fmap_index; /* Area lookup for fmap_header. */
+	struct partial_read *partial; /* Areas read so far, if read lazily. */
 };
 
 /**
@@ -40,6 +42,14 @@ struct firmware_image {
  *
  * flashrom_read_region returns the buffer truncated to the region.
  *
+ * flashrom_read_image_range is flashrom_read_image that also reports where
+ * the first of the regions is in the buffer, for callers that need to write
+ * the full sized buffer back with flashrom_write_image.
+ *
+ * flashrom_read_image_in_place reads the regions into the existing buffer of
+ * image, which must be as large as the flash, and leaves the rest of the
+ * buffer as it was.
+ *
  * @param image		The parameter that contains the programmer, buffer and
  *			size to use in the read operation.
  * @param regions	A list of the names of the fmap regions to read, or NULL
@@ -51,6 +61,12 @@ vb2_error_t flashrom_read(struct firmware_image *image, const char *region);
 int flashrom_read_image(struct firmware_image *image,
 			const char * const regions[],
 			int verbosity);
+int flashrom_read_image_in_place(struct firmware_image *image,
+				 const char * const regions[], int verbosity);
+int flashrom_read_image_range(struct firmware_image *image,
+			      const char * const regions[],
+			      unsigned int *region_start,
+			      unsigned int *region_len, int verbosity);
 int flashrom_read_region(struct firmware_image *image, const char *region,
 			 int verbosity);
 
@@ -113,3 +129,32 @@ int flashrom_set_wp(const char *programmer, bool wp_mode,
  */
 int flashrom_get_size(const char *programmer, uint32_t *flash_len,
 		      int verbosity);
+
+/**
+ * Keep a programmer initialized and its flash chip probed.
+ *
+ * While a session is open, the functions above reuse its probed chip for
+ * operations on the same programmer instead of probing for each one, and
+ * fail for other programmers. Only one session can be open at a time, since
+ * libflashrom drives a single programmer.
+ *
+ * @param session	The session to open. If it is already open for the
+ *			same programmer this does nothing, otherwise it is
+ *			closed and opened again for the new programmer.
+ * @param programmer	The name of the programmer, with its parameters.
+ * @param verbosity	The libflashrom verbosity; from the info level up,
+ *			the time taken by probing and by each operation is
+ *			reported.
+ *
+ * @return 0 on success, or a relevant error.
+ */
+struct flashrom_session;
+int flashrom_session_open(struct flashrom_session **session,
+			  const char *programmer, int verbosity);
+
+/**
+ * Shut down the programmer of a session, if it is open, and set it to NULL.
+ *
+ * @return 0 on success, or a relevant error.
+ */
+int flashrom_session_close(struct flashrom_session **session);
@@ -54,4 +54,27 @@ uint8_t *fmap_find_by_name(uint8_t *ptr, size_t size,
 			   /* optional, return pointer to entry if not NULL */
 			   FmapAreaHeader **ah);
 
+/*
+ * An FMAP located once, with a hash table of its area names, for callers
+ * that look up many areas in the same image.
+ */
+struct fmap_index {
+	uint8_t *base;		/* The image the FMAP was found in */
+	FmapHeader *fmap;
+	uint32_t mask;		/* Number of slots - 1 */
+	uint32_t slots[];	/* Area number + 1, or 0 if unused */
+};
+
+/* Build an index for the FMAP in the buffer. If fmap is NULL, it will call
+ * fmap_find(). Returns NULL if there is no FMAP or on allocation failure. */
+struct fmap_index *fmap_index_create(uint8_t *ptr, size_t size,
+				     FmapHeader *fmap);
+
+/* Like fmap_find_by_name(), using an index. index may be NULL. */
+uint8_t *fmap_index_find(const struct fmap_index *index, const char *name,
+			 /* optional, return pointer to entry if not NULL */
+			 FmapAreaHeader **ah);
+
+void fmap_index_free(struct fmap_index *index);
+
 #endif  /* VBOOT_REFERENCE_FMAP_H_ */
@@ -122,4 +122,16 @@ bool parse_hex(uint8_t *val, const char *str);
  */
 bool parse_hash(uint8_t *buf, size_t len, const char *str);
 
+/**
+ * Create an in-memory file that can be used as a temporary file, without
+ * writing to the disk. Its path stays valid for subprocesses started later.
+ *
+ * @param name		Name of the file, only used for debugging
+ * @param path		Output buffer for the path to the file
+ * @param path_size	Size of the path buffer
+ * @return The file descriptor, which deletes the file when closed, or -1 if
+ * in-memory files are not supported (and a file on disk should be used).
+ */
+int vb2_create_memfd(const char *name, char *path, size_t path_size);
+
 #endif  /* VBOOT_REFERENCE_HOST_MISC_H_ */
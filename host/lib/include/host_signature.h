@@ -57,6 +57,19 @@ vb2_error_t vb2_copy_signature(struct vb2_signature *dest,
  */
 struct vb2_signature *vb2_sha512_signature(const uint8_t *data, uint32_t size);
 
+/**
+ * Calculate a signature for data that has already been hashed.
+ *
+ * @param hash		Digest of the data, using the key's hash algorithm
+ * @param size		Length of the data in bytes
+ * @param key		Private key to use to sign data
+ *
+ * @return The signature, or NULL if error.  Caller must free() it.
+ */
+struct vb2_signature *vb2_sign_digest(const struct vb2_hash *hash,
+				     uint32_t size,
+				     const struct vb2_private_key *key);
+
 /**
  * Calculate a signature for the data using the specified key.
  *
@@ -85,6 +98,26 @@ struct vb2_signature *vb2_external_signature(const uint8_t *data, uint32_t size,
 					     uint32_t key_algorithm,
 					     const char *external_signer);
 
+/**
+ * Keep the external signer running between signatures.
+ *
+ * When enabled, vb2_external_signature() starts the signer once as
+ * "<external_signer> --persistent <key_file>" and reuses it for every
+ * signature with the same signer and key.  Each request and reply is a 32-bit
+ * big-endian length followed by that many bytes: the request carries the
+ * digest to sign, the reply carries the signature.  The signer should exit
+ * when its stdin is closed.
+ *
+ * @param enable	Non-zero to enable, zero to stop and disable
+ */
+void vb2_external_signer_persist(int enable);
+
+/**
+ * Stop the persistent external signer, if one is running.  This is also done
+ * automatically at exit.
+ */
+void vb2_external_signer_stop(void);
+
 /**
  * Create signature using the provided hash as its body. Created signature
  * contains vb2_hash trimmed to fit digest of its algorithm and nothing more.
@@ -1121,6 +1121,32 @@ static int ValidityCheckTest(void)
 	EXPECT(MASK_PRIMARY == gpt->ignored);
 	EXPECT(0 == gpt->modified);
 
+	/* Deferred secondary checks skip a corrupted secondary GPT... */
+	BuildTestGptData(gpt);
+	gpt->flags = GPT_FLAG_DEFER_SECONDARY;
+	gpt->secondary_header[0]++;
+	gpt->secondary_entries[0]++;
+	EXPECT(GPT_SUCCESS == GptValidityCheck(gpt));
+	EXPECT(MASK_BOTH == gpt->valid_headers);
+	EXPECT(MASK_BOTH == gpt->valid_entries);
+	EXPECT(0 == gpt->ignored);
+
+	/* ...but still check it when the primary is bad... */
+	BuildTestGptData(gpt);
+	gpt->primary_entries[0]++;
+	EXPECT(GPT_SUCCESS == GptValidityCheck(gpt));
+	EXPECT(MASK_BOTH == gpt->valid_headers);
+	EXPECT(MASK_SECONDARY == gpt->valid_entries);
+	EXPECT(0 == gpt->ignored);
+
+	/* ...and still recognize IGNOREME in the secondary. */
+	BuildTestGptData(gpt);
+	memcpy(h2->signature, GPT_HEADER_SIGNATURE_IGNORED,
+	       GPT_HEADER_SIGNATURE_SIZE);
+	EXPECT(GPT_SUCCESS == GptValidityCheck(gpt));
+	EXPECT(MASK_SECONDARY == gpt->ignored);
+	gpt->flags = 0;
+
 	return TEST_OK;
 }
 
@@ -1399,6 +1425,9 @@ static int GptUpdateTest(void)
 	EXPECT(0 == GetEntryTries(e2 + KERNEL_B));
 	/* And that's caused the GPT to need updating */
 	EXPECT(0x0F == gpt->modified);
+	/* With entries CRCs that match the updated entries */
+	EXPECT(0 == CheckEntries(e, (GptHeader *)gpt->primary_header));
+	EXPECT(0 == CheckEntries(e2, (GptHeader *)gpt->secondary_header));
 
 	/* Another kernel with tries */
 	EXPECT(GPT_SUCCESS == GptNextKernelEntry(gpt, &start, &size));
@@ -1414,6 +1443,8 @@ static int GptUpdateTest(void)
 	EXPECT(0 == GetEntrySuccessful(e2 + KERNEL_X));
 	EXPECT(2 == GetEntryPriority(e2 + KERNEL_X));
 	EXPECT(1 == GetEntryTries(e2 + KERNEL_X));
+	EXPECT(0 == CheckEntries(e, (GptHeader *)gpt->primary_header));
+	EXPECT(0 == CheckEntries(e2, (GptHeader *)gpt->secondary_header));
 	/* Trying it again marks it inactive */
 	EXPECT(GPT_SUCCESS == GptUpdateKernelEntry(gpt, GPT_UPDATE_ENTRY_TRY));
 	EXPECT(0 == GetEntrySuccessful(e + KERNEL_X));
@@ -1642,6 +1673,7 @@ int main(int argc, char *argv[])
 		{ TEST_CASE(UpdateInvalidKernelTypeTest), },
 		{ TEST_CASE(DuplicateUniqueGuidTest), },
 		{ TEST_CASE(TestCrc32TestVectors), },
+		{ TEST_CASE(TestCrc32Patch), },
 		{ TEST_CASE(GetKernelGuidTest), },
 		{ TEST_CASE(ErrorTextTest), },
 		{ TEST_CASE(CheckHeaderOffDevice), },
@@ -3,6 +3,8 @@
  * found in the LICENSE file.
  */
 
+#include <string.h>
+
 #include "cgptlib_test.h"
 #include "common/tests.h"
 #include "crc32.h"
@@ -45,3 +47,40 @@ int TestCrc32TestVectors(void) {
 	}
 	return TEST_OK;
 }
+
+int TestCrc32Patch(void) {
+	uint8_t buf[MAX_VECTOR_LEN];
+	uint8_t old[16];
+	struct {
+		int offset;
+		int len;
+	} cases[] = {
+		{0, 1},
+		{0, 16},
+		{7, 9},
+		{128, 8},
+		{MAX_VECTOR_LEN - 16, 16},
+		{MAX_VECTOR_LEN - 1, 1},
+	};
+	int i, j;
+
+	for (i = 0; i < MAX_VECTOR_LEN; ++i)
+		buf[i] = i * 7 + 3;
+
+	for (i = 0; i < ARRAY_SIZE(cases); ++i) {
+		uint32_t crc32 = Crc32(buf, sizeof(buf));
+		uint8_t *p = buf + cases[i].offset;
+
+		memcpy(old, p, cases[i].len);
+		for (j = 0; j < cases[i].len; ++j)
+			p[j] ^= 0x5a + i + j;
+		crc32 = Crc32Patch(crc32, old, p, cases[i].len,
+				   sizeof(buf) - cases[i].offset -
+				   cases[i].len);
+		EXPECT(crc32 == Crc32(buf, sizeof(buf)));
+
+		/* Unchanged bytes must not change the CRC. */
+		EXPECT(crc32 == Crc32Patch(crc32, p, p, cases[i].len, 100));
+	}
+	return TEST_OK;
+}
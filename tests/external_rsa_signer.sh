@@ -4,10 +4,42 @@
 # Use of this source code is governed by a BSD-style license that can be
 # found in the LICENSE file.
 
+persistent=
+if [ "$1" = "--persistent" ]; then
+  persistent=1
+  shift
+fi
+
 if [ $# -ne 1 ]; then
-  echo "Usage: $0 <private_key_pem_file>"
+  echo "Usage: $0 [--persistent] <private_key_pem_file>"
   echo "Reads data to sign from stdin, encrypted data is output to stdout"
+  echo "With --persistent, each input and output is a 4-byte big-endian"
+  echo "length followed by the data, until stdin is closed"
   exit 1
 fi
 
-openssl rsautl -sign -inkey "$1"
+if [ -z "${persistent}" ]; then
+  openssl rsautl -sign -inkey "$1"
+  exit
+fi
+
+pem="$1"
+sig="$(mktemp)"
+trap 'rm -f "${sig}"' EXIT
+
+read_bytes() {
+  dd bs="$1" count=1 iflag=fullblock 2>/dev/null
+}
+
+while true; do
+  set -- $(read_bytes 4 | od -An -tu1)
+  [ $# -eq 4 ] || exit 0
+  size=$(( ($1 << 24) | ($2 << 16) | ($3 << 8) | $4 ))
+  [ "${size}" -gt 0 ] || exit 1
+  read_bytes "${size}" | openssl rsautl -sign -inkey "${pem}" >"${sig}" ||
+    exit 1
+  size=$(stat -c %s "${sig}")
+  printf "$(printf '\\%03o' $(( (size >> 24) & 255 )) \
+    $(( (size >> 16) & 255 )) $(( (size >> 8) & 255 )) $(( size & 255 )))"
+  cat "${sig}"
+done
@@ -0,0 +1,50 @@
+// Copyright 2026 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "2struct.h"
+#include "file_type.h"
+#include "fmap.h"
+#include "futility.h"
+
+// The parsers take a non-const buffer, so inputs are copied here. It only
+// ever grows, so most inputs don't need an allocation.
+static uint8_t *buf;
+static size_t buf_size;
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	if (size > UINT32_MAX)
+		return 0;
+
+	if (size > buf_size) {
+		uint8_t *new_buf = realloc(buf, size);
+		if (!new_buf)
+			return 0;
+		buf = new_buf;
+		buf_size = size;
+	}
+	memcpy(buf, data, size);
+
+	// Runs every recognizer, which covers the FMAP, GBB, keyblock and
+	// preamble parsers among others.
+	futil_file_type_buf(buf, size);
+
+	// Also look into the GBB area of an image, as "show" and "sign" do.
+	FmapHeader *fmap = fmap_find(buf, size);
+	FmapAreaHeader *ah;
+	uint8_t *gbb = fmap_find_by_name(buf, size, fmap, "GBB", &ah);
+	if (gbb && ah->area_offset <= size &&
+	    ah->area_size <= size - ah->area_offset) {
+		uint32_t maxlen;
+		futil_valid_gbb_header((struct vb2_gbb_header *)gbb,
+				       ah->area_size, &maxlen);
+	}
+
+	return 0;
+}
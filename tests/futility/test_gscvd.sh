@@ -97,6 +97,28 @@ main() {
     exit 1
   fi
 
+  # Any of several root key hashes may match.
+  if ! "${FUTILITY}" gscvd "${bios_blob}" "${pubkhash//?/0}" "${pubkhash}" \
+       2>/dev/null ; then
+    echo "Unexpected mismatch with several root key hashes!" >&2
+    exit 1
+  fi
+
+  # Validate a batch of images, reporting each one.
+  printf '%s\n' "${bios_blob} ${pubkhash}" \
+    "${bios_blob} ${pubkhash//?/0}" \
+    "# comment" \
+    "${bios_blob}" \
+    "${TMPD}/missing.bin" > "${TMPD}/batch.txt"
+  printf '%s\n' "${bios_blob}: OK" "${bios_blob}: FAILED" \
+    "${bios_blob}: OK" "${TMPD}/missing.bin: FAILED" > "${TMPD}/expected.txt"
+  if "${FUTILITY}" gscvd --batch "${TMPD}/batch.txt" > "${TMPD}/actual.txt" \
+       2>/dev/null ; then
+    echo "Unexpected success of a batch with failures!" >&2
+    exit 1
+  fi
+  cmp "${TMPD}/expected.txt" "${TMPD}/actual.txt"
+
   # Change HWID and see that signature still matches.
   hwid="$("${FUTILITY}" gbb --hwid "${bios_blob}" | sed 's/.*: //')"
   "${FUTILITY}" gbb  --set --hwid="${hwid}xx" "${bios_blob}"
@@ -50,6 +50,46 @@ echo 'Verifying test kernel'
 
 echo 'Test kernel blob looks good'
 
+# Repack it, verifying the result in the same pass
+"${FUTILITY}" vbutil_kernel \
+    --repack "${TMP}.kernel.repacked" \
+    --oldblob "${TMP}.kernel.test" \
+    --signprivate "${TESTKEYS}/key_rsa2048.sha256.vbprivk" \
+    --sign-and-verify \
+    --signpubkey "${DEVKEYS}/kernel_subkey.vbpubk" \
+  | grep -E 'Body verification succeeded'
+cmp "${TMP}.kernel.test" "${TMP}.kernel.repacked"
+
+echo 'Repacked kernel blob verifies'
+
+# Packing in memory (to verify it) matches the streamed pack above
+"${FUTILITY}" vbutil_kernel \
+    --pack "${TMP}.kernel.inmem" \
+    --keyblock "${TMP}.keyblock.test" \
+    --signprivate "${TESTKEYS}/key_rsa2048.sha256.vbprivk" \
+    --version 1 \
+    --arch arm \
+    --vmlinuz "${TMP}.kernel.bin" \
+    --bootloader "${TMP}.bootloader.bin" \
+    --config "${TMP}.config.txt" \
+    --sign-and-verify \
+  | grep -E 'Body verification succeeded'
+cmp "${TMP}.kernel.test" "${TMP}.kernel.inmem"
+"${FUTILITY}" vbutil_kernel \
+    --pack "${TMP}.kernel.vblock" \
+    --keyblock "${TMP}.keyblock.test" \
+    --signprivate "${TESTKEYS}/key_rsa2048.sha256.vbprivk" \
+    --version 1 \
+    --arch arm \
+    --vmlinuz "${TMP}.kernel.bin" \
+    --bootloader "${TMP}.bootloader.bin" \
+    --config "${TMP}.config.txt" \
+    --vblockonly
+cmp -n 65536 "${TMP}.kernel.test" "${TMP}.kernel.vblock"
+[ "$(stat -c %s "${TMP}.kernel.vblock")" -eq 65536 ]
+
+echo 'Streamed and in-memory packs match'
+
 # Mess up the padding, make sure it fails.
 rc=0
 "${FUTILITY}" show "${TMP}.kernel.test" \
@@ -72,6 +112,26 @@ rc=0
 
 echo 'Really invalid args are still invalid'
 
+# Look at a directory of them at once, in parallel.
+mkdir -p "${TMP}.dir/sub"
+cp "${TMP}.kernel.test" "${TMP}.dir/a"
+cp "${TMP}.kernel.test" "${TMP}.dir/sub/b"
+cp "${TMP}.kernel.bin" "${TMP}.dir/sub/c"
+for f in a sub/b sub/c; do
+  "${FUTILITY}" verify "${TMP}.dir/${f}" \
+    --publickey "${DEVKEYS}/kernel_subkey.vbpubk" \
+    >> "${TMP}.expected" 2>/dev/null || true
+done
+echo "3 files, 1 failed" >> "${TMP}.expected"
+rc=0
+"${FUTILITY}" verify --jobs 2 --recursive "${TMP}.dir" \
+    --publickey "${DEVKEYS}/kernel_subkey.vbpubk" \
+    > "${TMP}.actual" 2>/dev/null || rc=$?
+[ $rc -eq 1 ]
+cmp "${TMP}.expected" "${TMP}.actual"
+
+echo 'Parallel verification works'
+
 # cleanup
 rm -rf "${TMP}"*
 exit 0
@@ -39,6 +39,22 @@ dd bs=1024 count=16 if=/dev/urandom of="${TMP}.fw_main"
 # They should match
 cmp "${TMP}.vblock.old" "${TMP}.vblock.new"
 
+# and with the keys loaded just once
+printf "%s\n" \
+  "fwblob ${TMP}.fw_main ${TMP}.vblock.server1" \
+  "fwblob ${TMP}.fw_main.missing ${TMP}.vblock.missing" \
+  "" \
+  "fwblob ${TMP}.fw_main ${TMP}.vblock.server2" \
+  > "${TMP}.requests"
+if "${FUTILITY}" --debug sign_server \
+  --keyset "${KEYDIR}" \
+  --version 12 \
+  --flags 42 \
+  < "${TMP}.requests" > "${TMP}.replies"; then false; fi
+printf "OK\nERROR\nOK\n" | cmp - "${TMP}.replies"
+cmp "${TMP}.vblock.old" "${TMP}.vblock.server1"
+cmp "${TMP}.vblock.old" "${TMP}.vblock.server2"
+
 # cleanup
 rm -rf "${TMP}"*
 exit 0
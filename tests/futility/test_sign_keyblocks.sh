@@ -104,6 +104,20 @@ cmp "${TMP}.keyblock2" "${TMP}.keyblock3"
 
 cmp "${TMP}.keyblock4" "${TMP}.keyblock5"
 
+# same thing twice from sign_server, which keeps the signer running
+printf "pubkey %s %s\n" \
+  "${DEVKEYS}/firmware_data_key.vbpubk" "${TMP}.keyblock6" \
+  "${DEVKEYS}/firmware_data_key.vbpubk" "${TMP}.keyblock7" |
+  "${FUTILITY}" --debug sign_server \
+  --pem_signpriv "${TESTKEYS}/key_rsa4096.pem" \
+  --pem_algo 8 \
+  --pem_external "${SIGNER}" \
+  --flags 19 > "${TMP}.replies"
+
+printf "OK\nOK\n" | cmp - "${TMP}.replies"
+cmp "${TMP}.keyblock4" "${TMP}.keyblock6"
+cmp "${TMP}.keyblock4" "${TMP}.keyblock7"
+
 
 # cleanup
 rm -rf "${TMP}"*
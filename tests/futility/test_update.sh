@@ -198,6 +198,33 @@ test_update "Full update" \
 	"${FROM_IMAGE}" "${TMP}.expected.full" \
 	-i "${TO_IMAGE}" --wp=0 --sys_props 0,0x10001
 
+test_update "Full update (--timing)" \
+	"${FROM_IMAGE}" "${TMP}.expected.full" \
+	-i "${TO_IMAGE}" --wp=0 --sys_props 0,0x10001 --timing=json \
+	2>"${TMP}.timing.json"
+grep -qF '"name": "write dummy:' "${TMP}.timing.json"
+grep -qF '"total_seconds": ' "${TMP}.timing.json"
+
+# The emulated flash is probed once for reading, writing and verifying, and
+# is only saved to its file when that session is closed.
+test_update "Full update (one flash session)" \
+	"${FROM_IMAGE}" "${TMP}.expected.full" \
+	-i "${TO_IMAGE}" --wp=0 --sys_props 0,0x10001 -v \
+	>"${TMP}.session.log" 2>&1
+[ "$(grep -c 'Probed dummy:' "${TMP}.session.log")" = 1 ]
+grep -qE 'Closed dummy:.* after [2-9][0-9]* operation' "${TMP}.session.log"
+! cmp -s "${TMP}.emu" "${FROM_IMAGE}"
+
+# The EC is written by another process, to its own emulated flash.
+cp -f "${FROM_IMAGE}" "${TMP}.emu.ec"
+test_update "Full update (--quirks parallel_ec_write)" \
+	"${FROM_IMAGE}" "${TMP}.expected.full" \
+	-i "${TO_IMAGE}" -e "${TO_IMAGE}" --emulate_ec "${TMP}.emu.ec" \
+	--quirks parallel_ec_write --wp=0 --sys_props 0,0x10001 \
+	>"${TMP}.parallel.log" 2>&1
+grep -q 'Updating EC firmware in process' "${TMP}.parallel.log"
+cmp "${TMP}.emu.ec" "${TO_IMAGE}"
+
 test_update "Full update (incompatible platform)" \
 	"${FROM_IMAGE}" "!platform is not compatible" \
 	-i "${LINK_BIOS}" --wp=0 --sys_props 0,0x10001
@@ -506,6 +533,24 @@ echo "*** Test Item: Detect model (--archive, --detect-model-only)"
 	--emulate "${FROM_IMAGE}.ap" --detect-model-only >"${TMP}.model.out"
 cmp "${TMP}.model.out" <(echo peppy)
 
+echo "TEST: Manifest index (--manifest --write-index)"
+"${FUTILITY}" update -a "${A}" --manifest >"${TMP}.json.scan"
+"${FUTILITY}" update -a "${A}" --manifest --write-index >"${TMP}.json.out"
+cmp "${TMP}.json.scan" "${TMP}.json.out"
+mv "${A}/models" "${A}/models.moved"
+"${FUTILITY}" update -a "${A}" --manifest >"${TMP}.json.out"
+cmp "${TMP}.json.scan" "${TMP}.json.out"
+test_update "Full update (--archive, manifest index, model=peppy)" \
+	"${FROM_IMAGE}.ap" "${PEPPY_BIOS}" \
+	-a "${A}" --wp=0 --sys_props 0,0x10001,3 --model=peppy
+cp -f "${VOXEL_BIOS}" "${A}/images/bios_peppy.bin"
+test_update "Full update (--archive, outdated manifest index)" \
+	"${FROM_IMAGE}.ap" "!does not match the manifest index" \
+	-a "${A}" --wp=0 --sys_props 0,0x10001,3 --model=peppy
+cp -f "${PEPPY_BIOS}" "${A}/images/bios_peppy.bin"
+mv "${A}/models.moved" "${A}/models"
+rm -f "${A}/manifest.index"
+
 CL_TAG="cl" PATH="${A}/bin:${PATH}" \
 	test_update "Full update (-a, model=customtip, fake VPD)" \
 	"${FROM_IMAGE}.al" "${LINK_BIOS}" \
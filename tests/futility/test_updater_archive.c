@@ -0,0 +1,221 @@
+/* Copyright 2026 The ChromiumOS Authors
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Tests for reading firmware updater archives with libarchive.
+ */
+
+#include <archive.h>
+#include <archive_entry.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common/tests.h"
+#include "updater.h"
+
+/* Larger than ARCHIVE_CACHE_MAX_BYTES, so never kept in the cache. */
+#define BIG_SIZE (64 * 1024 * 1024 + 1)
+
+/*
+ * The mocked libarchive reads this list of entries in order, and counts how
+ * often the archive is opened and how much is decompressed.
+ */
+static const struct {
+	const char *name;
+	unsigned int type;
+	const char *data;  /* NULL for BIG_SIZE bytes of 'x'. */
+} mock_entries[] = {
+	{"dir/", AE_IFDIR, ""},
+	{"a.txt", AE_IFREG, "alpha"},
+	{"big.bin", AE_IFREG, NULL},
+	{"b.txt", AE_IFREG, "bravo"},
+	{"a.txt", AE_IFREG, "alpha2"},
+	{"c.txt", AE_IFREG, "charlie"},
+};
+
+struct archive {
+	int position;
+};
+struct archive_entry {
+	int index;
+};
+
+static struct archive_entry mock_entry;
+static int mock_opens;
+static size_t mock_bytes_read;
+
+static size_t mock_entry_size(int i)
+{
+	return mock_entries[i].data ? strlen(mock_entries[i].data) : BIG_SIZE;
+}
+
+struct archive *archive_read_new(void)
+{
+	return calloc(1, sizeof(struct archive));
+}
+
+int archive_read_support_filter_all(struct archive *a)
+{
+	return ARCHIVE_OK;
+}
+
+int archive_read_support_format_all(struct archive *a)
+{
+	return ARCHIVE_OK;
+}
+
+int archive_read_open_filename(struct archive *a, const char *filename,
+			       size_t block_size)
+{
+	mock_opens++;
+	a->position = -1;
+	return ARCHIVE_OK;
+}
+
+int archive_read_free(struct archive *a)
+{
+	free(a);
+	return ARCHIVE_OK;
+}
+
+int archive_read_next_header(struct archive *a, struct archive_entry **entry)
+{
+	if (++a->position >= (int)ARRAY_SIZE(mock_entries))
+		return ARCHIVE_EOF;
+	mock_entry.index = a->position;
+	*entry = &mock_entry;
+	return ARCHIVE_OK;
+}
+
+la_ssize_t archive_read_data(struct archive *a, void *buf, size_t size)
+{
+	size_t entry_size = mock_entry_size(a->position);
+
+	if (size > entry_size)
+		size = entry_size;
+	if (mock_entries[a->position].data)
+		memcpy(buf, mock_entries[a->position].data, size);
+	else
+		memset(buf, 'x', size);
+	mock_bytes_read += size;
+	return size;
+}
+
+__LA_MODE_T archive_entry_filetype(struct archive_entry *entry)
+{
+	return mock_entries[entry->index].type;
+}
+
+const char *archive_entry_pathname(struct archive_entry *entry)
+{
+	return mock_entries[entry->index].name;
+}
+
+la_int64_t archive_entry_size(struct archive_entry *entry)
+{
+	return mock_entry_size(entry->index);
+}
+
+time_t archive_entry_mtime(struct archive_entry *entry)
+{
+	return 100 + entry->index;
+}
+
+static int count_entries(const char *name, void *arg)
+{
+	(*(int *)arg)++;
+	return 0;
+}
+
+static void test_read_on_demand(struct u_archive *ar)
+{
+	uint8_t *data;
+	uint32_t size;
+	int64_t mtime;
+	size_t bytes_read;
+	int entries = 0;
+
+	TEST_EQ(mock_opens, 1, "Archive indexed");
+	TEST_EQ(mock_bytes_read, 0, "  nothing decompressed");
+	TEST_TRUE(archive_has_entry(ar, "c.txt"), "  has file");
+	TEST_FALSE(archive_has_entry(ar, "dir/"), "  no directories");
+	TEST_FALSE(archive_has_entry(ar, "missing"), "  no missing file");
+	archive_walk(ar, &entries, count_entries);
+	TEST_EQ(entries, 5, "  walked all files");
+
+	TEST_SUCC(archive_read_file(ar, "b.txt", &data, &size, &mtime),
+		  "Read file");
+	TEST_STR_EQ((char *)data, "bravo", "  data");
+	TEST_EQ(size, 5, "  size");
+	TEST_EQ(mtime, 103, "  mtime");
+	TEST_EQ(mock_opens, 2, "  archive opened to read");
+	TEST_EQ(mock_bytes_read, 5,
+		"  older duplicate and large file passed over");
+	free(data);
+
+	bytes_read = mock_bytes_read;
+	TEST_SUCC(archive_read_file(ar, "b.txt", &data, &size, NULL),
+		  "Read file again");
+	TEST_STR_EQ((char *)data, "bravo", "  data");
+	TEST_EQ(mock_opens, 2, "  from the cache");
+	TEST_EQ(mock_bytes_read, bytes_read, "  nothing decompressed");
+	free(data);
+
+	TEST_SUCC(archive_read_file(ar, "a.txt", &data, &size, &mtime),
+		  "Read duplicated file");
+	TEST_STR_EQ((char *)data, "alpha2", "  latest data");
+	TEST_EQ(mtime, 104, "  latest mtime");
+	TEST_EQ(mock_opens, 2, "  read forward");
+	free(data);
+
+	TEST_SUCC(archive_read_file(ar, "big.bin", &data, &size, NULL),
+		  "Read file larger than the cache");
+	TEST_EQ(size, BIG_SIZE, "  size");
+	TEST_TRUE(data[0] == 'x' && data[BIG_SIZE - 1] == 'x', "  data");
+	TEST_EQ(data[BIG_SIZE], 0, "  terminated");
+	TEST_EQ(mock_opens, 3, "  archive reopened");
+	free(data);
+
+	bytes_read = mock_bytes_read;
+	TEST_SUCC(archive_read_file(ar, "big.bin", &data, &size, NULL),
+		  "Read large file again");
+	TEST_EQ(size, BIG_SIZE, "  size");
+	TEST_EQ(mock_opens, 4, "  not cached");
+	TEST_EQ(mock_bytes_read, bytes_read + BIG_SIZE, "  decompressed again");
+	free(data);
+
+	bytes_read = mock_bytes_read;
+	TEST_SUCC(archive_read_file(ar, "b.txt", &data, &size, NULL),
+		  "Read cached file after rewinding");
+	TEST_STR_EQ((char *)data, "bravo", "  data");
+	TEST_EQ(mock_bytes_read, bytes_read, "  nothing decompressed");
+	free(data);
+
+	TEST_NEQ(archive_read_file(ar, "missing", &data, &size, NULL), 0,
+		 "Read missing file");
+}
+
+int main(int argc, char *argv[])
+{
+	char path[] = "/tmp/test_updater_archive.XXXXXX";
+	int fd = mkstemp(path);
+	struct u_archive *ar;
+
+	/* Not a ZIP file, so only libarchive can open it. */
+	TEST_TRUE(fd >= 0 && write(fd, "mock", 4) == 4, "Create archive file");
+	ar = archive_open(path);
+	TEST_PTR_NEQ(ar, NULL, "Open archive");
+	if (ar) {
+		test_read_on_demand(ar);
+		archive_close(ar);
+	}
+	if (fd >= 0) {
+		close(fd);
+		unlink(path);
+	}
+
+	return gTestSuccess ? 0 : 255;
+}
@@ -0,0 +1,303 @@
+/* Copyright 2026 The ChromiumOS Authors
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Tests for the firmware updater utilities.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common/tests.h"
+#include "fmap.h"
+#include "updater.h"
+
+#define BLOCK FLASH_ERASE_BLOCK_SIZE
+/* Not a multiple of the erase block size. */
+#define IMAGE_SIZE (4 * BLOCK + BLOCK / 2)
+#define SECTION_OFFSET (BLOCK + BLOCK / 2)
+#define SECTION_SIZE BLOCK
+#define TAIL_OFFSET (4 * BLOCK)
+#define TAIL_SIZE (BLOCK / 2)
+#define FMAP_SIZE 0x200
+#define FWID_SIZE 0x40
+
+static uint8_t image_data[IMAGE_SIZE];
+static uint8_t current_data[IMAGE_SIZE];
+
+static void add_area(FmapHeader *fmap, const char *name, uint32_t offset,
+		     uint32_t size)
+{
+	FmapAreaHeader *area = (FmapAreaHeader *)(fmap + 1) +
+			       fmap->fmap_nareas++;
+
+	area->area_offset = offset;
+	area->area_size = size;
+	strcpy(area->area_name, name);
+}
+
+/*
+ * Sets up two identical images with an FMAP, the version sections, a section
+ * that does not start or end on an erase block, and a tail shorter than an
+ * erase block.
+ */
+static void setup_images(struct firmware_image *image,
+			 struct firmware_image *current)
+{
+	FmapHeader *fmap = (FmapHeader *)image_data;
+	uint32_t i;
+
+	for (i = 0; i < IMAGE_SIZE; i++)
+		image_data[i] = i * 7;
+	memset(fmap, 0, sizeof(*fmap));
+	memcpy(fmap->fmap_signature, FMAP_SIGNATURE, FMAP_SIGNATURE_SIZE);
+	fmap->fmap_ver_major = FMAP_VER_MAJOR;
+	fmap->fmap_size = IMAGE_SIZE;
+	add_area(fmap, "FMAP", 0, FMAP_SIZE);
+	add_area(fmap, "RO_FRID", FMAP_SIZE, FWID_SIZE);
+	add_area(fmap, "RW_FWID_A", FMAP_SIZE + FWID_SIZE, FWID_SIZE);
+	add_area(fmap, "RW_FWID_B", FMAP_SIZE + 2 * FWID_SIZE, FWID_SIZE);
+	add_area(fmap, "SECTION", SECTION_OFFSET, SECTION_SIZE);
+	add_area(fmap, "TAIL", TAIL_OFFSET, TAIL_SIZE);
+	memcpy(current_data, image_data, sizeof(current_data));
+
+	memset(image, 0, sizeof(*image));
+	image->data = image_data;
+	image->size = IMAGE_SIZE;
+	image->fmap_header = fmap;
+	memset(current, 0, sizeof(*current));
+	current->data = current_data;
+	current->size = IMAGE_SIZE;
+}
+
+static void test_plan_firmware_write(void)
+{
+	struct firmware_image image, current;
+	struct write_plan plan;
+	const char * const section[] = {"SECTION", NULL};
+	const char * const tail[] = {"TAIL", NULL};
+	const char * const missing[] = {"MISSING", NULL};
+
+	setup_images(&image, &current);
+	TEST_SUCC(plan_firmware_write(&plan, &image, &current, NULL, BLOCK),
+		  "Identical images");
+	TEST_EQ(plan.count, 0, "  no ranges");
+	TEST_EQ(plan.bytes, 0, "  no bytes");
+	free_write_plan(&plan);
+
+	current_data[2 * BLOCK] ^= 1;
+	TEST_SUCC(plan_firmware_write(&plan, &image, &current, NULL, BLOCK),
+		  "First byte of a block changed");
+	TEST_EQ(plan.count, 1, "  one range");
+	TEST_EQ(plan.ranges[0].offset, 2 * BLOCK, "  offset");
+	TEST_EQ(plan.ranges[0].size, BLOCK, "  size");
+	TEST_EQ(plan.bytes, BLOCK, "  bytes");
+	free_write_plan(&plan);
+
+	setup_images(&image, &current);
+	current_data[2 * BLOCK - 1] ^= 1;
+	TEST_SUCC(plan_firmware_write(&plan, &image, &current, NULL, BLOCK),
+		  "Last byte of a block changed");
+	TEST_EQ(plan.count, 1, "  one range");
+	TEST_EQ(plan.ranges[0].offset, BLOCK, "  offset");
+	TEST_EQ(plan.ranges[0].size, BLOCK, "  size");
+	free_write_plan(&plan);
+
+	current_data[2 * BLOCK] ^= 1;
+	TEST_SUCC(plan_firmware_write(&plan, &image, &current, NULL, BLOCK),
+		  "Adjacent blocks changed");
+	TEST_EQ(plan.count, 1, "  merged into one range");
+	TEST_EQ(plan.ranges[0].offset, BLOCK, "  offset");
+	TEST_EQ(plan.ranges[0].size, 2 * BLOCK, "  size");
+	TEST_EQ(plan.bytes, 2 * BLOCK, "  bytes");
+	free_write_plan(&plan);
+
+	current_data[0x200] ^= 1;
+	current_data[3 * BLOCK + 1] ^= 1;
+	TEST_SUCC(plan_firmware_write(&plan, &image, &current, NULL, BLOCK),
+		  "All but the last block changed");
+	TEST_EQ(plan.count, 1, "  one range");
+	TEST_EQ(plan.ranges[0].offset, 0, "  offset");
+	TEST_EQ(plan.ranges[0].size, 4 * BLOCK, "  size");
+	free_write_plan(&plan);
+
+	setup_images(&image, &current);
+	current_data[0x200] ^= 1;
+	current_data[2 * BLOCK] ^= 1;
+	TEST_SUCC(plan_firmware_write(&plan, &image, &current, NULL, BLOCK),
+		  "Separate blocks changed");
+	TEST_EQ(plan.count, 2, "  two ranges");
+	TEST_EQ(plan.ranges[0].offset, 0, "  first offset");
+	TEST_EQ(plan.ranges[1].offset, 2 * BLOCK, "  second offset");
+	TEST_EQ(plan.bytes, 2 * BLOCK, "  bytes");
+	free_write_plan(&plan);
+
+	setup_images(&image, &current);
+	current_data[IMAGE_SIZE - 1] ^= 1;
+	TEST_SUCC(plan_firmware_write(&plan, &image, &current, NULL, BLOCK),
+		  "Partial last block changed");
+	TEST_EQ(plan.count, 1, "  one range");
+	TEST_EQ(plan.ranges[0].offset, TAIL_OFFSET, "  offset");
+	TEST_EQ(plan.ranges[0].size, TAIL_SIZE, "  ends with the image");
+	TEST_EQ(plan.bytes, TAIL_SIZE, "  bytes");
+	free_write_plan(&plan);
+
+	TEST_SUCC(plan_firmware_write(&plan, &image, &current, tail, BLOCK),
+		  "Partial last block in a section");
+	TEST_EQ(plan.count, 1, "  one range");
+	TEST_EQ(plan.ranges[0].size, TAIL_SIZE, "  size");
+	free_write_plan(&plan);
+
+	TEST_SUCC(plan_firmware_write(&plan, &image, &current, section,
+				      BLOCK),
+		  "Change outside of the section");
+	TEST_EQ(plan.count, 0, "  no ranges");
+	free_write_plan(&plan);
+
+	setup_images(&image, &current);
+	current_data[SECTION_OFFSET - 1] ^= 1;
+	current_data[SECTION_OFFSET + SECTION_SIZE] ^= 1;
+	TEST_SUCC(plan_firmware_write(&plan, &image, &current, section,
+				      BLOCK),
+		  "Changes next to an unaligned section");
+	TEST_EQ(plan.count, 0, "  no ranges");
+	free_write_plan(&plan);
+
+	current_data[SECTION_OFFSET + SECTION_SIZE - 1] ^= 1;
+	TEST_SUCC(plan_firmware_write(&plan, &image, &current, section,
+				      BLOCK),
+		  "Last byte of an unaligned section changed");
+	TEST_EQ(plan.count, 1, "  one range");
+	TEST_EQ(plan.ranges[0].offset, 2 * BLOCK, "  offset");
+	TEST_EQ(plan.ranges[0].size, BLOCK, "  whole erase block");
+	free_write_plan(&plan);
+
+	TEST_NEQ(plan_firmware_write(&plan, &image, &current, missing, BLOCK),
+		 0, "Missing section");
+	current.size--;
+	TEST_NEQ(plan_firmware_write(&plan, &image, &current, NULL, BLOCK),
+		 0, "Different sizes");
+	current.size++;
+	TEST_NEQ(plan_firmware_write(&plan, &image, &current, NULL, 0), 0,
+		 "No block size");
+}
+
+static void test_lazy_read(void)
+{
+	char path[] = "/tmp/test_updater_utils.XXXXXX";
+	char programmer[128], other_programmer[128];
+	struct updater_config *cfg = updater_new_config();
+	struct firmware_image image, full;
+	struct firmware_section section;
+	const uint32_t gap = SECTION_OFFSET + SECTION_SIZE;
+	int fd;
+
+	setup_images(&image, &full);
+	fd = mkstemp(path);
+	TEST_TRUE(fd >= 0 && write(fd, image_data, IMAGE_SIZE) == IMAGE_SIZE,
+		  "Create emulated flash");
+	snprintf(programmer, sizeof(programmer),
+		 "dummy:emulate=VARIABLE_SIZE,size=%d,image=%s", IMAGE_SIZE,
+		 path);
+
+	memset(&image, 0, sizeof(image));
+	image.programmer = programmer;
+	TEST_SUCC(load_system_firmware_lazily(cfg, &image), "Read lazily");
+	TEST_EQ(image.size, IMAGE_SIZE, "  size");
+	TEST_SUCC(memcmp(image.data, image_data, FMAP_SIZE + 3 * FWID_SIZE),
+		  "  FMAP and versions read");
+	TEST_NEQ(memcmp(image.data + SECTION_OFFSET,
+			image_data + SECTION_OFFSET, SECTION_SIZE), 0,
+		 "  section not read yet");
+
+	TEST_SUCC(find_firmware_section(&section, &image, "SECTION"),
+		  "Find section");
+	TEST_PTR_EQ(section.data, image.data + SECTION_OFFSET, "  data");
+	TEST_SUCC(memcmp(section.data, image_data + SECTION_OFFSET,
+			 SECTION_SIZE), "  read from flash");
+	TEST_NEQ(memcmp(image.data + gap, image_data + gap, TAIL_OFFSET - gap),
+		 0, "  range after the section not read");
+	TEST_NEQ(memcmp(image.data + TAIL_OFFSET, image_data + TAIL_OFFSET,
+			TAIL_SIZE), 0, "  tail not read");
+
+	/* A flash of another size can't be read into the image. */
+	snprintf(other_programmer, sizeof(other_programmer),
+		 "dummy:emulate=VARIABLE_SIZE,size=%d,image=%s",
+		 IMAGE_SIZE + BLOCK, path);
+	image.programmer = other_programmer;
+	TEST_EQ(find_firmware_section(&section, &image, "TAIL"),
+		SECTION_READ_FAILURE, "Read failure");
+	TEST_PTR_EQ(section.data, NULL, "  no data");
+	TEST_TRUE(firmware_section_exists(&image, "TAIL"), "  section exists");
+	TEST_EQ(preserve_firmware_section(&image, &image, "TAIL"),
+		SECTION_READ_FAILURE, "  not preserved");
+	TEST_EQ(find_firmware_section(&section, &image, "MISSING"),
+		SECTION_NOT_FOUND, "Missing section");
+	image.programmer = programmer;
+
+	memset(&full, 0, sizeof(full));
+	full.programmer = programmer;
+	TEST_SUCC(load_system_firmware(cfg, &full), "Read whole flash");
+	image.data[SECTION_OFFSET] ^= 0xff;
+	TEST_SUCC(complete_firmware_image(&image), "Complete lazy image");
+	TEST_EQ(image.size, full.size, "  size");
+	TEST_EQ(image.data[SECTION_OFFSET], full.data[SECTION_OFFSET] ^ 0xff,
+		"  changed data kept");
+	image.data[SECTION_OFFSET] ^= 0xff;
+	TEST_SUCC(memcmp(image.data, full.data, full.size),
+		  "  same as the whole flash");
+	TEST_SUCC(complete_firmware_image(&image), "Complete again");
+
+	free_firmware_image(&image);
+	free_firmware_image(&full);
+	TEST_SUCC(updater_delete_config(cfg), "Close flash session");
+	if (fd >= 0) {
+		close(fd);
+		unlink(path);
+	}
+}
+
+static void test_print_update_timing(void)
+{
+	char path[] = "/tmp/test_updater_utils.XXXXXX";
+	struct updater_config *cfg = updater_new_config();
+	char output[256] = {0};
+	int fd, saved;
+
+	cfg->timing = TIMING_JSON;
+	end_update_stage(cfg, begin_update_stage(cfg, "read \"a\\b\"\t"), 4);
+
+	fd = mkstemp(path);
+	fflush(stderr);
+	saved = dup(STDERR_FILENO);
+	TEST_TRUE(fd >= 0 && dup2(fd, STDERR_FILENO) == STDERR_FILENO,
+		  "Redirect stderr");
+	print_update_timing(cfg);
+	fflush(stderr);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+	TEST_TRUE(pread(fd, output, sizeof(output) - 1, 0) > 0,
+		  "Print timing in JSON");
+	TEST_PTR_NEQ(strstr(output,
+			    "{ \"name\": \"read \\\"a\\\\b\\\"\\u0009\", "),
+		     NULL, "  name escaped");
+	TEST_PTR_NEQ(strstr(output, "\"bytes\": 4 }"), NULL, "  bytes");
+
+	updater_delete_config(cfg);
+	if (fd >= 0) {
+		close(fd);
+		unlink(path);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	test_plan_firmware_write();
+	test_lazy_read();
+	test_print_update_timing();
+
+	return gTestSuccess ? 0 : 255;
+}
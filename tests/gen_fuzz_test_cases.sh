@@ -65,6 +65,98 @@ function generate_fuzzing_images {
     "${TESTCASE_DIR}/firmware_key.vbpubk"
 }
 
+# Print $2 as a little-endian integer of $1 bytes.
+function le_bytes {
+  local i
+  for ((i = 0; i < $1; i++)); do
+    printf "\\x$(printf %02x $(( ($2 >> (8 * i)) & 0xff )))"
+  done
+}
+
+# Print $1 padded with zeros to $2 bytes.
+function zero_pad {
+  printf "%s" "$1"
+  head -c $(( $2 - ${#1} )) /dev/zero
+}
+
+# Print an FMAP area entry: offset, size, name.
+function fmap_area {
+  le_bytes 4 "$1"
+  le_bytes 4 "$2"
+  zero_pad "$3" 32
+  le_bytes 2 0
+}
+
+# Print file $1 padded with zeros to $2 bytes.
+function pad_file {
+  cat "$1"
+  head -c $(( $2 - $(stat -c %s "$1") )) /dev/zero
+}
+
+# Seed inputs for the fuzzers in tests/*_fuzzer.c, laid out the way each
+# fuzzer splits its input. Use together with tests/vboot_fuzzer.dict.
+function generate_fuzzing_corpora {
+  local corpus="${TESTCASE_DIR}/corpus"
+  local keyblock_size
+  local disk="${TESTCASE_DIR}/gpt_disk"
+  local image="${TESTCASE_DIR}/fmap_image"
+  local sectors=256
+
+  echo "Generating fuzzer corpora..."
+  mkdir -p "${corpus}/cgpt_fuzzer" "${corpus}/futil_file_type_fuzzer" \
+    "${corpus}/vb2_keyblock_fuzzer" "${corpus}/vb2_preamble_fuzzer"
+
+  # vb2_keyblock_fuzzer: 4096-byte GBB root key, then the keyblock.
+  { pad_file "${TESTCASE_DIR}/root_key.vbpubk" 4096
+    cat "${TESTCASE_DIR}/firmware.keyblock"
+  } > "${corpus}/vb2_keyblock_fuzzer/firmware"
+  { pad_file "${TESTKEY_DIR}/key_rsa4096.sha1.vbpubk" 4096
+    cat "${TESTCASE_DIR}/kernel.keyblock"
+  } > "${corpus}/vb2_keyblock_fuzzer/kernel"
+
+  # vb2_preamble_fuzzer: 4096-byte data key, then the preamble that follows
+  # the keyblock in the vblock.
+  keyblock_size=$(stat -c %s "${TESTCASE_DIR}/firmware.keyblock")
+  { pad_file "${TESTKEY_DIR}/key_rsa4096.sha256.vbpubk" 4096
+    tail -c +$(( keyblock_size + 1 )) "${TESTCASE_DIR}/firmware.vblock"
+  } > "${corpus}/vb2_preamble_fuzzer/firmware"
+
+  # cgpt_fuzzer: GptDataParams (512-byte sectors, no flags, drive sizes),
+  # then the disk.
+  rm -f "${disk}"
+  truncate -s $(( sectors * 512 )) "${disk}"
+  "${BIN_DIR}/cgpt" create "${disk}"
+  "${BIN_DIR}/cgpt" add -b 64 -s 64 -t kernel -l KERN-A -S 1 -P 2 "${disk}"
+  "${BIN_DIR}/cgpt" add -b 128 -s 64 -t kernel -l KERN-B -P 1 -T 15 "${disk}"
+  { le_bytes 4 9; le_bytes 4 0; le_bytes 8 "${sectors}"
+    le_bytes 8 "${sectors}"; cat "${disk}"
+  } > "${corpus}/cgpt_fuzzer/gpt"
+  "${BIN_DIR}/cgpt" legacy -p "${disk}"
+  { le_bytes 4 9; le_bytes 4 0; le_bytes 8 "${sectors}"
+    le_bytes 8 "${sectors}"; cat "${disk}"
+  } > "${corpus}/cgpt_fuzzer/gpt_ignoreme"
+
+  # futil_file_type_fuzzer: the structures above, and a small image with an
+  # FMAP, a GBB and an A slot.
+  cp "${TESTCASE_DIR}/firmware.keyblock" "${TESTCASE_DIR}/firmware.vblock" \
+    "${TESTCASE_DIR}/root_key.vbpubk" "${corpus}/futil_file_type_fuzzer/"
+  "${FUTILITY}" gbb -c 0x100,0x1000,0x100,0x1000 "${TESTCASE_DIR}/gbb"
+  rm -f "${image}"
+  truncate -s $(( 0x8000 )) "${image}"
+  { printf "__FMAP__"; le_bytes 1 1; le_bytes 1 1; le_bytes 8 0
+    le_bytes 4 0x8000; zero_pad "FMAP" 32; le_bytes 2 4
+    fmap_area 0x0 0x1000 "FMAP"
+    fmap_area 0x1000 0x3000 "GBB"
+    fmap_area 0x4000 0x2000 "VBLOCK_A"
+    fmap_area 0x6000 0x2000 "FW_MAIN_A"
+  } | dd of="${image}" conv=notrunc status=none
+  dd if="${TESTCASE_DIR}/gbb" of="${image}" bs=4096 seek=1 conv=notrunc \
+    status=none
+  dd if="${TESTCASE_DIR}/firmware.vblock" of="${image}" bs=4096 seek=4 \
+    conv=notrunc status=none
+  cp "${image}" "${corpus}/futil_file_type_fuzzer/bios"
+}
+
 function pre_work {
   # Generate a file to serve as random bytes for firmware/kernel contents.
   # NOTE: The kernel and config file can't really be random, but the bootloader
@@ -84,3 +176,4 @@ mkdir -p "${TESTCASE_DIR}"
 pre_work
 check_test_keys
 generate_fuzzing_images "${TEST_IMAGE_FILE}"
+generate_fuzzing_corpora
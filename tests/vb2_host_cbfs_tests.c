@@ -0,0 +1,207 @@
+/* Copyright 2026 The ChromiumOS Authors
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Tests for reading CBFS without cbfstool.
+ */
+
+#include <string.h>
+
+#include "2sha.h"
+#include "cbfstool.h"
+#include "common/tests.h"
+
+#define CBFS_SIZE 0x1000
+#define TAG_COMPRESSION 0x42435a4c
+#define TAG_HASH 0x68736148
+#define COMPRESS_LZMA 1
+
+static uint8_t cbfs[CBFS_SIZE];
+static size_t cbfs_used;
+
+/* Metadata of the files a CBFS walk should see, for the metadata hash. */
+static uint8_t metadata[CBFS_SIZE];
+static size_t metadata_size;
+
+/* Headers of the files added to the CBFS, in order. */
+static uint8_t *headers[8];
+static int num_headers;
+
+static uint8_t *put_be32(uint8_t *p, uint32_t value)
+{
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+	return p + 4;
+}
+
+/*
+ * Appends a file to the CBFS, with an optional compression attribute and a
+ * hash attribute unless hash_algo is VB2_HASH_INVALID. Returns its data.
+ */
+static uint8_t *add_file(const char *name, uint32_t type, const char *data,
+			 uint32_t compression, enum vb2_hash_algorithm hash_algo)
+{
+	uint8_t *header = cbfs + cbfs_used;
+	uint32_t len = strlen(data);
+	uint32_t attr_offset = 24 + ((strlen(name) + 1 + 3) & ~3);
+	uint8_t *p = header + attr_offset;
+	struct vb2_hash hash;
+
+	headers[num_headers++] = header;
+
+	if (compression != CBFS_COMPRESS_NONE) {
+		p = put_be32(p, TAG_COMPRESSION);
+		p = put_be32(p, 16);
+		p = put_be32(p, compression);
+		p = put_be32(p, len);
+	}
+	if (hash_algo != VB2_HASH_INVALID) {
+		uint32_t hash_size = offsetof(struct vb2_hash, raw) +
+				     vb2_digest_size(hash_algo);
+
+		vb2_hash_calculate(false, data, len, hash_algo, &hash);
+		p = put_be32(p, TAG_HASH);
+		p = put_be32(p, 8 + hash_size);
+		memcpy(p, &hash, hash_size);
+		p += hash_size;
+	}
+
+	memcpy(header, "LARCHIVE", 8);
+	put_be32(header + 8, len);
+	put_be32(header + 12, type);
+	put_be32(header + 16, p == header + attr_offset ? 0 : attr_offset);
+	put_be32(header + 20, p - header);
+	strcpy((char *)header + 24, name);
+	memcpy(p, data, len);
+
+	if (type != 0) {
+		memcpy(metadata + metadata_size, header, p - header);
+		metadata_size += p - header;
+	}
+	cbfs_used = (p + len - cbfs + 63) & ~63;
+	return p;
+}
+
+/* Lays out a CBFS and returns the data of its last file. */
+static uint8_t *setup_cbfs(enum vb2_hash_algorithm hash_algo)
+{
+	memset(cbfs, 0xff, sizeof(cbfs));
+	cbfs_used = 0;
+	metadata_size = 0;
+	num_headers = 0;
+
+	add_file("config", CBFS_TYPE_RAW, "CONFIG_X=y\n", CBFS_COMPRESS_NONE,
+		 hash_algo);
+	add_file("ecro", 0, "deleted", CBFS_COMPRESS_NONE, hash_algo);
+	add_file("ecrw", CBFS_TYPE_RAW, "packed", COMPRESS_LZMA, hash_algo);
+	return add_file("ecro", CBFS_TYPE_RAW, "ec ro", CBFS_COMPRESS_NONE,
+			hash_algo);
+}
+
+static void cbfs_find_file_tests(void)
+{
+	struct cbfs_file_info file;
+
+	setup_cbfs(VB2_HASH_SHA256);
+
+	TEST_SUCC(cbfs_find_file(cbfs, sizeof(cbfs), "config", &file),
+		  "Find config");
+	TEST_EQ(file.type, CBFS_TYPE_RAW, "  type");
+	TEST_EQ(file.compression, CBFS_COMPRESS_NONE, "  not compressed");
+	TEST_EQ(file.size, strlen("CONFIG_X=y\n"), "  size");
+	TEST_SUCC(memcmp(file.data, "CONFIG_X=y\n", file.size), "  data");
+
+	TEST_SUCC(cbfs_find_file(cbfs, sizeof(cbfs), "ecro", &file),
+		  "Find file after a deleted one");
+	TEST_SUCC(memcmp(file.data, "ec ro", file.size), "  data");
+
+	TEST_SUCC(cbfs_find_file(cbfs, sizeof(cbfs), "ecrw", &file),
+		  "Find compressed file");
+	TEST_EQ(file.compression, COMPRESS_LZMA, "  compression");
+
+	TEST_EQ(cbfs_find_file(cbfs, sizeof(cbfs), "ec", &file),
+		VB2_ERROR_CBFS_FILE_NOT_FOUND, "Name prefix not found");
+	TEST_EQ(cbfs_find_file(cbfs, sizeof(cbfs), "missing", &file),
+		VB2_ERROR_CBFS_FILE_NOT_FOUND, "Missing file");
+	TEST_EQ(cbfs_find_file(cbfs, 16, "config", &file),
+		VB2_ERROR_CBFSTOOL, "Truncated header");
+}
+
+static void cbfs_malformed_tests(void)
+{
+	struct cbfs_file_info file;
+	struct vb2_hash hash = { .algo = VB2_HASH_SHA256 };
+
+	/* A file header cut off by the end of the CBFS. */
+	setup_cbfs(VB2_HASH_SHA256);
+	memcpy(cbfs + cbfs_used, "LARCHIVE", 8);
+	TEST_SUCC(cbfs_find_file(cbfs, cbfs_used + 16, "ecro", &file),
+		  "Truncated trailing header: file before it found");
+	TEST_SUCC(memcmp(file.data, "ec ro", file.size), "  data");
+	TEST_EQ(cbfs_find_file(cbfs, cbfs_used + 16, "missing", &file),
+		VB2_ERROR_CBFSTOOL, "  missing file is an error");
+	TEST_EQ(cbfs_get_metadata_hash(cbfs, cbfs_used + 16, &hash),
+		VB2_ERROR_CBFSTOOL, "  no metadata hash");
+
+	/* Metadata larger than coreboot allows, even for a deleted file. */
+	setup_cbfs(VB2_HASH_SHA256);
+	put_be32(headers[1] + 20, 0x200);
+	TEST_SUCC(cbfs_find_file(cbfs, sizeof(cbfs), "config", &file),
+		  "Oversized metadata: file before it found");
+	TEST_EQ(cbfs_find_file(cbfs, sizeof(cbfs), "ecrw", &file),
+		VB2_ERROR_CBFSTOOL, "  file after it is an error");
+	TEST_EQ(cbfs_get_metadata_hash(cbfs, sizeof(cbfs), &hash),
+		VB2_ERROR_CBFSTOOL, "  no metadata hash");
+
+	/* File data running past the end of the CBFS. */
+	setup_cbfs(VB2_HASH_SHA256);
+	put_be32(headers[3] + 8, CBFS_SIZE - 0x40);
+	TEST_EQ(cbfs_find_file(cbfs, sizeof(cbfs), "ecro", &file),
+		VB2_ERROR_CBFSTOOL, "Data past the end");
+	TEST_EQ(cbfs_get_metadata_hash(cbfs, sizeof(cbfs), &hash),
+		VB2_ERROR_CBFSTOOL, "  no metadata hash");
+
+	/* A length that is larger than the whole CBFS. */
+	setup_cbfs(VB2_HASH_SHA256);
+	put_be32(headers[2] + 8, 0xffffffc0);
+	TEST_EQ(cbfs_find_file(cbfs, sizeof(cbfs), "ecro", &file),
+		VB2_ERROR_CBFSTOOL, "Length larger than the CBFS");
+}
+
+static void cbfs_get_metadata_hash_tests(void)
+{
+	struct vb2_hash hash = { .algo = VB2_HASH_SHA256 };
+	struct vb2_hash expected;
+	uint8_t *data;
+
+	data = setup_cbfs(VB2_HASH_SHA256);
+	vb2_hash_calculate(false, metadata, metadata_size, VB2_HASH_SHA256,
+			   &expected);
+	TEST_SUCC(cbfs_get_metadata_hash(cbfs, sizeof(cbfs), &hash),
+		  "Metadata hash");
+	TEST_SUCC(memcmp(hash.sha256, expected.sha256, sizeof(hash.sha256)),
+		  "  skips deleted files");
+
+	data[0] ^= 1;
+	TEST_EQ(cbfs_get_metadata_hash(cbfs, sizeof(cbfs), &hash),
+		VB2_ERROR_CBFSTOOL, "Bad file hash");
+
+	setup_cbfs(VB2_HASH_INVALID);
+	vb2_hash_calculate(false, metadata, metadata_size, VB2_HASH_SHA256,
+			   &expected);
+	TEST_SUCC(cbfs_get_metadata_hash(cbfs, sizeof(cbfs), &hash),
+		  "Files without hashes");
+	TEST_SUCC(memcmp(hash.sha256, expected.sha256, sizeof(hash.sha256)),
+		  "  hash");
+}
+
+int main(int argc, char *argv[])
+{
+	cbfs_find_file_tests();
+	cbfs_get_metadata_hash_tests();
+	cbfs_malformed_tests();
+
+	return gTestSuccess ? 0 : 255;
+}
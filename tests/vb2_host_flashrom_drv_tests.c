@@ -0,0 +1,370 @@
+/* Copyright 2026 The ChromiumOS Authors
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Tests for libflashrom sessions in the host flashrom driver.
+ */
+
+#include <libflashrom.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "2common.h"
+#include "common/tests.h"
+#include "flashrom.h"
+
+#define MOCK_FLASH_SIZE 0x1000
+#define PROG_AP "dummy:emulate=VARIABLE_SIZE,size=4096,image=ap.bin"
+#define PROG_EC "dummy:emulate=VARIABLE_SIZE,size=4096,image=ec.bin"
+
+/*
+ * The mocked libflashrom behaves like the dummy programmer with emulation:
+ * the flash contents are only saved to the image file on shutdown.
+ */
+struct flashrom_programmer {
+	char name[64];
+};
+struct flashrom_flashctx {
+	struct flashrom_programmer *prog;
+};
+struct flashrom_layout {
+	int regions;
+};
+struct flashrom_wp_cfg {
+	enum flashrom_wp_mode mode;
+};
+
+static struct flashrom_programmer mock_prog;
+static struct flashrom_flashctx mock_flashctx;
+static bool mock_prog_active;
+static int mock_inits, mock_probes, mock_shutdowns;
+static int mock_shutdown_result;
+static bool mock_verify;
+static bool mock_modified;
+static uint8_t mock_flash[MOCK_FLASH_SIZE];
+static uint8_t mock_saved[MOCK_FLASH_SIZE];
+
+static void reset_mock(void)
+{
+	memset(&mock_prog, 0, sizeof(mock_prog));
+	mock_prog_active = false;
+	mock_inits = mock_probes = mock_shutdowns = 0;
+	mock_shutdown_result = 0;
+	mock_verify = false;
+	mock_modified = false;
+	memset(mock_flash, 0xff, sizeof(mock_flash));
+	memset(mock_saved, 0xff, sizeof(mock_saved));
+}
+
+void flashrom_set_log_callback(flashrom_log_callback *log_callback)
+{
+}
+
+int flashrom_init(int perform_selfcheck)
+{
+	return 0;
+}
+
+int flashrom_programmer_init(struct flashrom_programmer **flashprog,
+			     const char *prog_name, const char *prog_params)
+{
+	/* libflashrom cannot drive two programmers at once. */
+	if (mock_prog_active)
+		return 1;
+	mock_prog_active = true;
+	mock_inits++;
+	snprintf(mock_prog.name, sizeof(mock_prog.name), "%s:%s", prog_name,
+		 prog_params);
+	*flashprog = &mock_prog;
+	return 0;
+}
+
+int flashrom_programmer_shutdown(struct flashrom_programmer *flashprog)
+{
+	TEST_PTR_EQ(flashprog, &mock_prog, "  shutdown started programmer");
+	mock_prog_active = false;
+	mock_shutdowns++;
+	if (mock_shutdown_result)
+		return mock_shutdown_result;
+	if (mock_modified)
+		memcpy(mock_saved, mock_flash, sizeof(mock_saved));
+	mock_modified = false;
+	return 0;
+}
+
+int flashrom_flash_probe(struct flashrom_flashctx **flashctx,
+			 const struct flashrom_programmer *flashprog,
+			 const char *chip_name)
+{
+	mock_probes++;
+	mock_flashctx.prog = &mock_prog;
+	*flashctx = &mock_flashctx;
+	return 0;
+}
+
+size_t flashrom_flash_getsize(const struct flashrom_flashctx *flashctx)
+{
+	return MOCK_FLASH_SIZE;
+}
+
+void flashrom_flash_release(struct flashrom_flashctx *flashctx)
+{
+}
+
+void flashrom_flag_set(struct flashrom_flashctx *flashctx,
+		       enum flashrom_flag flag, bool value)
+{
+	if (flag == FLASHROM_FLAG_VERIFY_AFTER_WRITE)
+		mock_verify = value;
+}
+
+int flashrom_image_read(struct flashrom_flashctx *flashctx, void *buffer,
+			size_t buffer_len)
+{
+	if (!mock_prog_active || buffer_len != MOCK_FLASH_SIZE)
+		return 1;
+	memcpy(buffer, mock_flash, buffer_len);
+	return 0;
+}
+
+int flashrom_image_write(struct flashrom_flashctx *flashctx, void *buffer,
+			 size_t buffer_len, const void *refbuffer)
+{
+	if (!mock_prog_active || buffer_len != MOCK_FLASH_SIZE)
+		return 1;
+	memcpy(mock_flash, buffer, buffer_len);
+	mock_modified = true;
+	return 0;
+}
+
+int flashrom_layout_read_fmap_from_rom(struct flashrom_layout **layout,
+				       struct flashrom_flashctx *flashctx,
+				       size_t offset, size_t len)
+{
+	return 1;
+}
+
+int flashrom_layout_read_fmap_from_buffer(struct flashrom_layout **layout,
+					  struct flashrom_flashctx *flashctx,
+					  const uint8_t *buf, size_t len)
+{
+	return 1;
+}
+
+int flashrom_layout_include_region(struct flashrom_layout *layout,
+				   const char *name)
+{
+	return 1;
+}
+
+int flashrom_layout_get_region_range(struct flashrom_layout *layout,
+				     const char *name, unsigned int *start,
+				     unsigned int *len)
+{
+	return 1;
+}
+
+void flashrom_layout_release(struct flashrom_layout *layout)
+{
+}
+
+void flashrom_layout_set(struct flashrom_flashctx *flashctx,
+			 const struct flashrom_layout *layout)
+{
+}
+
+enum flashrom_wp_result flashrom_wp_cfg_new(struct flashrom_wp_cfg **cfg)
+{
+	*cfg = calloc(1, sizeof(**cfg));
+	return *cfg ? FLASHROM_WP_OK : FLASHROM_WP_ERR_OTHER;
+}
+
+void flashrom_wp_cfg_release(struct flashrom_wp_cfg *cfg)
+{
+	free(cfg);
+}
+
+void flashrom_wp_set_mode(struct flashrom_wp_cfg *cfg,
+			  enum flashrom_wp_mode mode)
+{
+	cfg->mode = mode;
+}
+
+enum flashrom_wp_mode flashrom_wp_get_mode(const struct flashrom_wp_cfg *cfg)
+{
+	return cfg->mode;
+}
+
+void flashrom_wp_set_range(struct flashrom_wp_cfg *cfg, size_t start,
+			   size_t len)
+{
+}
+
+void flashrom_wp_get_range(size_t *start, size_t *len,
+			   const struct flashrom_wp_cfg *cfg)
+{
+	*start = 0;
+	*len = 0;
+}
+
+enum flashrom_wp_result flashrom_wp_read_cfg(struct flashrom_wp_cfg *cfg,
+					     struct flashrom_flashctx *flashctx)
+{
+	cfg->mode = FLASHROM_WP_MODE_DISABLED;
+	return mock_prog_active ? FLASHROM_WP_OK : FLASHROM_WP_ERR_OTHER;
+}
+
+enum flashrom_wp_result flashrom_wp_write_cfg(
+		struct flashrom_flashctx *flashctx,
+		const struct flashrom_wp_cfg *cfg)
+{
+	return mock_prog_active ? FLASHROM_WP_OK : FLASHROM_WP_ERR_OTHER;
+}
+
+static void test_session_reuse(void)
+{
+	struct flashrom_session *session = NULL;
+	struct firmware_image image = { .programmer = PROG_AP };
+	struct firmware_image written = { .programmer = PROG_AP };
+	uint8_t data[MOCK_FLASH_SIZE];
+	bool wp_mode = true;
+
+	reset_mock();
+	TEST_SUCC(flashrom_session_open(&session, PROG_AP, 0), "Open session");
+	TEST_PTR_NEQ(session, NULL, "  session");
+	TEST_EQ(mock_probes, 1, "  probed");
+	TEST_SUCC(flashrom_session_open(&session, PROG_AP, 0),
+		  "Open session again");
+	TEST_EQ(mock_probes, 1, "  not probed again");
+
+	TEST_SUCC(flashrom_read_image(&image, NULL, 0), "Read");
+	TEST_EQ(image.size, MOCK_FLASH_SIZE, "  size");
+	TEST_TRUE(mock_prog_active, "  programmer still active");
+
+	memset(data, 0x5a, sizeof(data));
+	written.data = data;
+	written.size = sizeof(data);
+	TEST_SUCC(flashrom_write_image(&written, NULL, &image, 1, 0),
+		  "Write and verify");
+	TEST_TRUE(mock_verify, "  verified");
+	TEST_TRUE(mock_prog_active, "  programmer still active");
+	free(image.data);
+	free(image.file_name);
+
+	memset(&image, 0, sizeof(image));
+	image.programmer = PROG_AP;
+	TEST_SUCC(flashrom_read_image(&image, NULL, 0), "Read back");
+	TEST_SUCC(memcmp(image.data, data, sizeof(data)), "  written data");
+	TEST_SUCC(flashrom_get_wp(PROG_AP, &wp_mode, NULL, NULL, 0),
+		  "Get WP");
+	TEST_FALSE(wp_mode, "  WP disabled");
+	free(image.data);
+	free(image.file_name);
+
+	TEST_EQ(mock_inits, 1, "Programmer started once");
+	TEST_EQ(mock_probes, 1, "Flash probed once");
+	TEST_EQ(mock_shutdowns, 0, "Programmer not shut down yet");
+	TEST_NEQ(memcmp(mock_saved, data, sizeof(data)), 0,
+		 "Emulated flash not saved yet");
+
+	TEST_SUCC(flashrom_session_close(&session), "Close session");
+	TEST_PTR_EQ(session, NULL, "  session");
+	TEST_EQ(mock_shutdowns, 1, "  programmer shut down");
+	TEST_SUCC(memcmp(mock_saved, data, sizeof(data)),
+		  "  emulated flash saved");
+	TEST_SUCC(flashrom_session_close(&session), "Close closed session");
+	TEST_EQ(mock_shutdowns, 1, "  nothing shut down");
+}
+
+static void test_session_save_failure(void)
+{
+	struct flashrom_session *session = NULL;
+	struct firmware_image image = { .programmer = PROG_AP };
+	uint8_t data[MOCK_FLASH_SIZE];
+
+	reset_mock();
+	memset(data, 0xa5, sizeof(data));
+	image.data = data;
+	image.size = sizeof(data);
+	TEST_SUCC(flashrom_session_open(&session, PROG_AP, 0), "Open session");
+	TEST_SUCC(flashrom_write_image(&image, NULL, NULL, 0, 0), "Write");
+
+	mock_shutdown_result = 1;
+	TEST_NEQ(flashrom_session_close(&session), 0,
+		 "Close fails when the emulated flash is not saved");
+	TEST_PTR_EQ(session, NULL, "  session released");
+	TEST_FALSE(mock_prog_active, "  programmer shut down");
+	TEST_NEQ(memcmp(mock_saved, data, sizeof(data)), 0,
+		 "  emulated flash not saved");
+}
+
+static void test_read_in_place(void)
+{
+	struct firmware_image image = { .programmer = PROG_AP };
+	uint8_t data[MOCK_FLASH_SIZE];
+
+	reset_mock();
+	memset(mock_flash, 0x3c, sizeof(mock_flash));
+	memset(data, 0, sizeof(data));
+	image.data = data;
+	image.size = sizeof(data);
+	TEST_SUCC(flashrom_read_image_in_place(&image, NULL, 0),
+		  "Read in place");
+	TEST_PTR_EQ(image.data, data, "  same buffer");
+	TEST_PTR_EQ(image.file_name, NULL, "  no file name");
+	TEST_SUCC(memcmp(data, mock_flash, sizeof(data)), "  data");
+
+	image.size--;
+	TEST_NEQ(flashrom_read_image_in_place(&image, NULL, 0), 0,
+		 "Buffer smaller than the flash");
+	TEST_PTR_EQ(image.data, data, "  same buffer");
+	TEST_FALSE(mock_prog_active, "  programmer shut down");
+}
+
+static void test_programmer_switch(void)
+{
+	struct flashrom_session *session = NULL, *other = NULL;
+	struct firmware_image image = { .programmer = PROG_EC };
+
+	reset_mock();
+	TEST_SUCC(flashrom_session_open(&session, PROG_AP, 0), "Open session");
+	TEST_NEQ(flashrom_read_image(&image, NULL, 0), 0,
+		 "Other programmer fails while the session is open");
+	TEST_EQ(mock_inits, 1, "  not started");
+	TEST_NEQ(flashrom_session_open(&other, PROG_EC, 0), 0,
+		 "Second session fails");
+	TEST_PTR_EQ(other, NULL, "  not opened");
+
+	TEST_SUCC(flashrom_session_open(&session, PROG_EC, 0),
+		  "Switch session to another programmer");
+	TEST_EQ(mock_shutdowns, 1, "  old programmer shut down");
+	TEST_EQ(mock_inits, 2, "  new programmer started");
+	TEST_STR_EQ(mock_prog.name, PROG_EC, "  new programmer");
+	TEST_SUCC(flashrom_read_image(&image, NULL, 0), "Read");
+	TEST_EQ(mock_probes, 2, "  with the probed flash");
+	free(image.data);
+	free(image.file_name);
+	TEST_SUCC(flashrom_session_close(&session), "Close session");
+
+	memset(&image, 0, sizeof(image));
+	image.programmer = PROG_AP;
+	TEST_SUCC(flashrom_read_image(&image, NULL, 0),
+		  "Read without a session");
+	TEST_EQ(mock_probes, 3, "  probed");
+	TEST_FALSE(mock_prog_active, "  programmer shut down");
+	free(image.data);
+	free(image.file_name);
+}
+
+int main(int argc, char *argv[])
+{
+	test_session_reuse();
+	test_session_save_failure();
+	test_read_in_place();
+	test_programmer_switch();
+
+	return gTestSuccess ? 0 : 255;
+}
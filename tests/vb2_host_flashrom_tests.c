@@ -24,6 +24,8 @@
 #include "subprocess.h"
 
 #define MOCK_TMPFILE_NAME "/tmp/vb2_unittest"
+#define MEMFD_PATH_PREFIX "/proc/self/fd/"
+#define REGION_PARAM_PREFIX "SOME_REGION:"
 #define MOCK_ROM_CONTENTS "bloop123"
 
 static bool flashrom_mock_success = true;
@@ -38,6 +40,22 @@ static const char *captured_programmer;
 static uint8_t *captured_rom_contents;
 static uint32_t captured_rom_size;
 
+/* Temporary files are in memory if possible, otherwise from mkstemp(). */
+static bool is_temp_file(const char *path)
+{
+	return path && (!strcmp(path, MOCK_TMPFILE_NAME) ||
+			!strncmp(path, MEMFD_PATH_PREFIX,
+				 strlen(MEMFD_PATH_PREFIX)));
+}
+
+/* Checks a region parameter names the region and a temporary file. */
+static bool is_region_temp_file(const char *param)
+{
+	return param && !strncmp(param, REGION_PARAM_PREFIX,
+				 strlen(REGION_PARAM_PREFIX)) &&
+		is_temp_file(param + strlen(REGION_PARAM_PREFIX));
+}
+
 /* Mocked mkstemp for tests. */
 int mkstemp(char *template_name)
 {
@@ -56,6 +74,7 @@ int subprocess_run(const char *const argv[],
 	int rv;
 	/* getopt_long wants an int instead of an enum, bummer... */
 	int captured_verify_int = FLASHROM_VERIFY_UNSPECIFIED;
+	const char *tmpfile;
 	struct option long_opts[] = {
 		{
 			.name = "noverify-all",
@@ -130,13 +149,19 @@ int subprocess_run(const char *const argv[],
 	rv = !flashrom_mock_success;
 	captured_verify = captured_verify_int;
 
+	tmpfile = captured_op_filename;
+	if (!tmpfile && captured_region_param)
+		tmpfile = strchr(captured_region_param, ':') + 1;
+	if (!is_temp_file(tmpfile))
+		return 1;
+
 	if (captured_operation == FLASHROM_READ) {
 		/* Write the mocked string we read from the ROM. */
-		rv |= vb2_write_file(MOCK_TMPFILE_NAME, MOCK_ROM_CONTENTS,
+		rv |= vb2_write_file(tmpfile, MOCK_ROM_CONTENTS,
 				     strlen(MOCK_ROM_CONTENTS));
 	} else if (captured_operation == FLASHROM_WRITE) {
 		/* Capture the buffer contents we wrote to the ROM. */
-		rv |= vb2_read_file(MOCK_TMPFILE_NAME, &captured_rom_contents,
+		rv |= vb2_read_file(tmpfile, &captured_rom_contents,
 				    &captured_rom_size);
 	}
 
@@ -156,8 +181,8 @@ static void test_read_whole_chip(void)
 	TEST_EQ(captured_operation, FLASHROM_READ, "Doing a read operation");
 	TEST_EQ(captured_verify, FLASHROM_VERIFY_UNSPECIFIED,
 		"Verification not enabled");
-	TEST_STR_EQ(captured_op_filename, MOCK_TMPFILE_NAME,
-		    "Reading to correct file");
+	TEST_TRUE(is_temp_file(captured_op_filename),
+		  "Reading to correct file");
 	TEST_PTR_EQ(captured_region_param, NULL, "Not operating on a region");
 	TEST_EQ(image.size, strlen(MOCK_ROM_CONTENTS), "Contents correct size");
 	TEST_SUCC(memcmp(image.data, MOCK_ROM_CONTENTS, image.size),
@@ -181,8 +206,8 @@ static void test_read_region(void)
 		"Verification not enabled");
 	TEST_PTR_EQ(captured_op_filename, NULL,
 		    "Not doing a read of the whole ROM");
-	TEST_STR_EQ(captured_region_param, "SOME_REGION:" MOCK_TMPFILE_NAME,
-		    "Reading to correct file and from correct region");
+	TEST_TRUE(is_region_temp_file(captured_region_param),
+		  "Reading to correct file and from correct region");
 	TEST_EQ(image.size, strlen(MOCK_ROM_CONTENTS), "Contents correct size");
 	TEST_SUCC(memcmp(image.data, MOCK_ROM_CONTENTS, image.size),
 		  "Buffer has correct contents");
@@ -220,8 +245,8 @@ static void test_write_whole_chip(void)
 	TEST_EQ(captured_operation, FLASHROM_WRITE, "Doing a write operation");
 	TEST_EQ(captured_verify, FLASHROM_VERIFY_FAST,
 		"Fast verification enabled");
-	TEST_STR_EQ(captured_op_filename, MOCK_TMPFILE_NAME,
-		    "Writing to correct file");
+	TEST_TRUE(is_temp_file(captured_op_filename),
+		  "Writing to correct file");
 	TEST_PTR_EQ(captured_region_param, NULL, "Not operating on a region");
 	TEST_EQ(captured_rom_size, strlen(MOCK_ROM_CONTENTS),
 		"Contents correct size");
@@ -249,8 +274,8 @@ static void test_write_region(void)
 		"Fast verification enabled");
 	TEST_PTR_EQ(captured_op_filename, NULL,
 		    "Not doing a write of the whole ROM");
-	TEST_STR_EQ(captured_region_param, "SOME_REGION:" MOCK_TMPFILE_NAME,
-		    "Writing to correct file and from correct region");
+	TEST_TRUE(is_region_temp_file(captured_region_param),
+		  "Writing to correct file and from correct region");
 	TEST_EQ(captured_rom_size, strlen(MOCK_ROM_CONTENTS),
 		"Contents correct size");
 	TEST_SUCC(memcmp(captured_rom_contents, MOCK_ROM_CONTENTS,
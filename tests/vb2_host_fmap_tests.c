@@ -0,0 +1,95 @@
+/* Copyright 2026 The ChromiumOS Authors
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Tests for host FMAP utilities.
+ */
+
+#include <string.h>
+
+#include "common/tests.h"
+#include "fmap.h"
+
+#define FMAP_OFFSET 0x100
+#define NUM_AREAS 40
+
+static uint8_t image[0x10000];
+
+/* Lay out an FMAP at FMAP_OFFSET, with areas AREA0..AREA38 and one
+ * duplicated name at the end. */
+static FmapHeader *setup_image(void)
+{
+	FmapHeader *fmap = (FmapHeader *)(image + FMAP_OFFSET);
+	FmapAreaHeader *ah = (FmapAreaHeader *)(fmap + 1);
+	int i;
+
+	memset(image, 0, sizeof(image));
+	memcpy(fmap->fmap_signature, FMAP_SIGNATURE, FMAP_SIGNATURE_SIZE);
+	fmap->fmap_ver_major = FMAP_VER_MAJOR;
+	fmap->fmap_size = sizeof(image);
+	fmap->fmap_nareas = NUM_AREAS;
+	for (i = 0; i < NUM_AREAS - 1; i++) {
+		snprintf(ah[i].area_name, FMAP_NAMELEN, "AREA%d", i);
+		ah[i].area_offset = 0x1000 + i * 0x100;
+		ah[i].area_size = 0x100;
+	}
+	/* A name that fills the field, with no trailing NUL. */
+	memset(ah[7].area_name, 'X', FMAP_NAMELEN);
+	/* Only the first of two areas with the same name is found. */
+	strcpy(ah[NUM_AREAS - 1].area_name, "AREA3");
+	ah[NUM_AREAS - 1].area_offset = 0x8000;
+
+	return fmap;
+}
+
+static void fmap_index_tests(void)
+{
+	FmapHeader *fmap = setup_image();
+	FmapAreaHeader *ah = NULL;
+	struct fmap_index *index;
+	char long_name[FMAP_NAMELEN + 2];
+	char name[FMAP_NAMELEN];
+	int i;
+
+	index = fmap_index_create(image, sizeof(image), NULL);
+	TEST_PTR_NEQ(index, NULL, "Index created");
+	TEST_PTR_EQ(index->fmap, fmap, "  finds the FMAP");
+
+	for (i = 0; i < NUM_AREAS - 1; i++) {
+		if (i == 7)
+			continue;
+		snprintf(name, sizeof(name), "AREA%d", i);
+		if (fmap_index_find(index, name, &ah) !=
+		    fmap_find_by_name(image, sizeof(image), fmap, name, NULL))
+			break;
+	}
+	TEST_EQ(i, NUM_AREAS - 1, "  matches fmap_find_by_name()");
+
+	TEST_PTR_EQ(fmap_index_find(index, "AREA3", &ah), image + 0x1300,
+		    "  first of duplicate names");
+	TEST_PTR_EQ(ah, (FmapAreaHeader *)(fmap + 1) + 3, "  area header");
+
+	memset(long_name, 'X', sizeof(long_name) - 1);
+	long_name[sizeof(long_name) - 1] = '\0';
+	TEST_PTR_EQ(fmap_index_find(index, long_name, NULL), image + 0x1700,
+		    "  unterminated name");
+
+	ah = NULL;
+	TEST_PTR_EQ(fmap_index_find(index, "AREA", &ah), NULL, "  missing name");
+	TEST_PTR_EQ(ah, NULL, "  leaves area header alone");
+	TEST_PTR_EQ(fmap_index_find(index, "", NULL), NULL, "  empty name");
+	fmap_index_free(index);
+
+	TEST_PTR_EQ(fmap_index_find(NULL, "AREA1", NULL), NULL, "NULL index");
+
+	memset(image + FMAP_OFFSET, 0, FMAP_SIGNATURE_SIZE);
+	TEST_PTR_EQ(fmap_index_create(image, sizeof(image), NULL), NULL,
+		    "No FMAP, no index");
+}
+
+int main(int argc, char *argv[])
+{
+	fmap_index_tests();
+
+	return gTestSuccess ? 0 : 255;
+}
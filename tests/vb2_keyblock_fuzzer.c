@@ -13,6 +13,9 @@
 static struct vb2_context *ctx;
 static uint8_t workbuf[VB2_FIRMWARE_WORKBUF_RECOMMENDED_SIZE]
 	__attribute__((aligned(VB2_WORKBUF_ALIGN)));
+/* Contents of workbuf right after setup, restored for each input. */
+static uint8_t workbuf_init[VB2_FIRMWARE_WORKBUF_RECOMMENDED_SIZE];
+static uint32_t workbuf_init_used;
 static struct {
 	struct vb2_gbb_header h;
 	uint8_t rootkey[4096];
@@ -71,28 +74,51 @@ vb2_error_t vb2_safe_memcmp(const void *s1, const void *s2, size_t size)
 	return VB2_SUCCESS;
 }
 
+/*
+ * The signature is never valid anyway, so skip the RSA math. This is reached
+ * because setup allows hwcrypto.
+ */
+vb2_error_t vb2ex_hwcrypto_modexp(const struct vb2_public_key *key,
+				  uint8_t *inout, uint32_t *workbuf32, int exp)
+{
+	return VB2_SUCCESS;
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+	/* Set up data structures needed by the tested function, once. */
+	if (vb2api_init(workbuf, sizeof(workbuf), &ctx))
+		abort();
+	vb2_nv_init(ctx);
+	vb2api_secdata_firmware_create(ctx);
+	vb2api_secdata_kernel_create(ctx);
+	if (vb2_secdata_firmware_init(ctx) || vb2_secdata_kernel_init(ctx))
+		abort();
+	vb2_secdata_kernel_set(ctx, VB2_SECDATA_KERNEL_FLAGS,
+			       VB2_SECDATA_KERNEL_FLAG_HWCRYPTO_ALLOWED);
+
+	memset(&gbb.h, 0, sizeof(gbb.h));
+	gbb.h.rootkey_offset = gbb.rootkey - (uint8_t *)&gbb;
+	gbb.h.rootkey_size = sizeof(gbb.rootkey);
+
+	workbuf_init_used = vb2_get_sd(ctx)->workbuf_used;
+	memcpy(workbuf_init, workbuf, workbuf_init_used);
+	return 0;
+}
+
 int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
 int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
 	/* Initialize fuzzing inputs. */
 	if (size < sizeof(gbb.rootkey))
 		return 0;
 
-	memset(&gbb.h, 0, sizeof(gbb.h));
-	gbb.h.rootkey_offset = gbb.rootkey - (uint8_t *)&gbb;
-	gbb.h.rootkey_size = sizeof(gbb.rootkey);
-
 	memcpy(gbb.rootkey, data, sizeof(gbb.rootkey));
 	mock_keyblock = data + sizeof(gbb.rootkey);
 	mock_keyblock_size = size - sizeof(gbb.rootkey);
 
-	/* Set up data structures needed by the tested function. */
-	if (vb2api_init(workbuf, sizeof(workbuf), &ctx))
-		abort();
-	vb2_nv_init(ctx);
-	vb2api_secdata_firmware_create(ctx);
-	vb2api_secdata_kernel_create(ctx);
-	if (vb2_secdata_firmware_init(ctx) || vb2_secdata_kernel_init(ctx))
-		abort();
+	/* Undo whatever the previous input did to the workbuf. */
+	memcpy(workbuf, workbuf_init, workbuf_init_used);
 
 	/* Run function to test. */
 	vb2_load_fw_keyblock(ctx);
@@ -13,6 +13,11 @@
 static struct vb2_context *ctx;
 static uint8_t workbuf[VB2_FIRMWARE_WORKBUF_RECOMMENDED_SIZE]
 	__attribute__((aligned(VB2_WORKBUF_ALIGN)));
+/* Contents of workbuf right after setup, restored for each input. */
+static uint8_t workbuf_init[VB2_FIRMWARE_WORKBUF_RECOMMENDED_SIZE];
+static uint32_t workbuf_init_used;
+
+static struct vb2_gbb_header gbb;
 
 static const uint8_t *mock_preamble;
 static size_t mock_preamble_size;
@@ -23,6 +28,11 @@ void vb2api_fail(struct vb2_context *c, uint8_t reason, uint8_t subcode)
 	return;
 }
 
+struct vb2_gbb_header *vb2_get_gbb(struct vb2_context *c)
+{
+	return &gbb;
+}
+
 vb2_error_t vb2ex_read_resource(struct vb2_context *c,
 				enum vb2_resource_index index, uint32_t offset,
 				void *buf, uint32_t size)
@@ -51,13 +61,20 @@ vb2_error_t vb2_safe_memcmp(const void *s1, const void *s2, size_t size)
 	return VB2_SUCCESS;
 }
 
-int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
-int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
-	const size_t datakey_size = 4096;	// enough for all our signatures
-
-	if (size < datakey_size)
-		return 0;
+/*
+ * The signature is never valid anyway, so skip the RSA math. This is reached
+ * because setup allows hwcrypto.
+ */
+vb2_error_t vb2ex_hwcrypto_modexp(const struct vb2_public_key *key,
+				  uint8_t *inout, uint32_t *workbuf32, int exp)
+{
+	return VB2_SUCCESS;
+}
 
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+	/* Set up data structures needed by the tested function, once. */
 	if (vb2api_init(workbuf, sizeof(workbuf), &ctx))
 		abort();
 	vb2_nv_init(ctx);
@@ -65,6 +82,23 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
 	vb2api_secdata_kernel_create(ctx);
 	if (vb2_secdata_firmware_init(ctx) || vb2_secdata_kernel_init(ctx))
 		abort();
+	vb2_secdata_kernel_set(ctx, VB2_SECDATA_KERNEL_FLAGS,
+			       VB2_SECDATA_KERNEL_FLAG_HWCRYPTO_ALLOWED);
+
+	workbuf_init_used = vb2_get_sd(ctx)->workbuf_used;
+	memcpy(workbuf_init, workbuf, workbuf_init_used);
+	return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	const size_t datakey_size = 4096;	// enough for all our signatures
+
+	if (size < datakey_size)
+		return 0;
+
+	/* Undo whatever the previous input did to the workbuf. */
+	memcpy(workbuf, workbuf_init, workbuf_init_used);
 
 	struct vb2_workbuf wb;
 	vb2_workbuf_from_ctx(ctx, &wb);